@@ -0,0 +1,869 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+#include "loon_binary.h"
+
+#include <cstring>
+#include <clocale>
+#include <cstdlib>
+
+
+namespace loon {
+namespace binary {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+const char magic[] = "LoonBin1";
+const char end_magic[] = "LoonEnd1";
+const size_t magic_len = 8;
+const size_t trailer_len = 8 + 8 + magic_len;
+
+// return the number of bytes in the LEB128 encoding of 'n'
+inline size_t varint_size(uint64_t n)
+{
+    size_t size = 1;
+    while (n >= 0x80) {
+        n >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+inline bool is_digit(char c)
+{
+    return '0' <= c && c <= '9';
+}
+
+// return true iff [p, end) is a decimal integer written exactly as the
+// writer would write it (no '+', no leading zeros, no "-0") that fits an
+// int64_t; return its value in 'n'
+bool canonical_dec(const char * p, const char * end, int64_t & n)
+{
+    const bool negative = p != end && *p == '-';
+    if (negative)
+        ++p;
+    const size_t digits = end - p;
+    if (digits == 0 || digits > 19 || (*p == '0' && (digits > 1 || negative)))
+        return false;
+    uint64_t u = 0;
+    for (; p != end; ++p) {
+        if (!is_digit(*p))
+            return false;
+        u = u * 10 + (*p - '0');
+    }
+    if (u > (negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX)))
+        return false; // (19 digits can't overflow u, but may overflow int64_t)
+    n = negative ? static_cast<int64_t>(0 - u) : static_cast<int64_t>(u);
+    return true;
+}
+
+// return true iff [p, end) is a hexadecimal integer with upper case digits
+// that fits a uint64_t; return its value in 'n'
+bool canonical_hex(const char * p, const char * end, uint64_t & n)
+{
+    if (end - p < 3 || p[0] != '0' || p[1] != 'x' || end - p > 2 + 16)
+        return false;
+    n = 0;
+    for (p += 2; p != end; ++p) {
+        const char c = *p;
+        if (is_digit(c))
+            n = n * 16 + (c - '0');
+        else if ('A' <= c && c <= 'F')
+            n = n * 16 + (c - 'A' + 10);
+        else
+            return false;
+    }
+    return true;
+}
+
+// return the decimal text of 'n'
+std::string dec_text(int64_t n)
+{
+    char buf[21];
+    char * const end = buf + sizeof(buf);
+    char * p = end;
+    uint64_t u = n < 0 ? 0 - static_cast<uint64_t>(n) : static_cast<uint64_t>(n);
+    do {
+        *--p = static_cast<char>('0' + u % 10);
+        u /= 10;
+    }
+    while (u);
+    if (n < 0)
+        *--p = '-';
+    return std::string(p, end);
+}
+
+// return the hexadecimal text of 'n', with 'digits' digits
+std::string hex_text(uint64_t n, int digits)
+{
+    std::string s(2 + digits, '0');
+    s[1] = 'x';
+    for (int i = 0; i < digits; ++i, n >>= 4)
+        s[s.size() - 1 - i] = "0123456789ABCDEF"[n & 0xF];
+    return s;
+}
+
+// return the value of the given Loon number text
+double text_to_double(const std::string & text, loon::reader::num_type ntype)
+{
+    if (ntype == loon::reader::num_hex_int) {
+        double d = 0;
+        for (size_t i = 2; i < text.size(); ++i) {
+            const char c = text[i];
+            d = d * 16 + (is_digit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+        }
+        return d;
+    }
+
+    // strtod() uses the decimal point of the current C locale, which may not be '.'
+    std::string s(text);
+    const char point = *std::localeconv()->decimal_point;
+    const std::string::size_type i = s.find('.');
+    if (point != '.' && i != std::string::npos)
+        s[i] = point;
+    return std::strtod(s.c_str(), 0);
+}
+
+
+// return true iff the Loon float text [p, p + len) is exactly what
+// loon::writer would write for its value, so it can be stored as a double
+// without changing the text; return the value in 'd'
+bool canonical_float(const char * p, size_t len, double & d)
+{
+    const std::string text(p, len);
+    d = text_to_double(text, loon::reader::num_float);
+    return loon::writer::detail::double_to_string(d) == text;
+}
+
+
+// throw the writer misuse error 'id'
+void fail(loon::writer::error_id id)
+{
+    const char * msg = "Loon binary writer error.";
+    switch (id) {
+    case loon::writer::key_not_allowed:         msg = "Loon binary writer error: a dict key is not allowed here."; break;
+    case loon::writer::key_required:            msg = "Loon binary writer error: a dict key is required before the value."; break;
+    case loon::writer::missing_dict_value:      msg = "Loon binary writer error: the dict ended with a key that has no value."; break;
+    case loon::writer::unbalanced_end:          msg = "Loon binary writer error: there is no open list of that type to end."; break;
+    case loon::writer::extra_top_level_value:   msg = "Loon binary writer error: a binary document may contain just one top-level value."; break;
+    }
+    throw loon::writer::exception(id, msg);
+}
+
+
+} // anonymous namespace
+
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+// writer
+
+void writer::put(const char * data, size_t len)
+{
+    write(data, len);
+    offset_ += len;
+}
+
+void writer::put_byte(uint8_t b)
+{
+    const char c = static_cast<char>(b);
+    put(&c, 1);
+}
+
+void writer::put_varint(uint64_t n)
+{
+    char buf[10];
+    size_t len = 0;
+    for (; n >= 0x80; n >>= 7)
+        buf[len++] = static_cast<char>(0x80 | (n & 0x7F));
+    buf[len++] = static_cast<char>(n);
+    put(buf, len);
+}
+
+void writer::put_u64(uint64_t n)
+{
+    char buf[8];
+    for (int i = 0; i < 8; ++i, n >>= 8)
+        buf[i] = static_cast<char>(n & 0xFF);
+    put(buf, 8);
+}
+
+// a value is about to be written: check it is allowed here and start the
+// document, if not already started
+void writer::begin()
+{
+    if (depth_ == 0) {
+        if (finished_)
+            fail(loon::writer::extra_top_level_value); // (a document holds only one)
+    }
+    else if (stack_[depth_ - 1].is_dict && !stack_[depth_ - 1].keyed)
+        fail(loon::writer::key_required);
+    if (!started_) {
+        put(magic, magic_len);
+        started_ = true;
+    }
+}
+
+// a value starting at 'offset' has been written
+void writer::value_ends(uint64_t offset)
+{
+    if (depth_ == 0) {
+        finish(offset);
+        return;
+    }
+    frame & f = stack_[depth_ - 1];
+    f.offsets.push_back(offset);
+    if (f.is_dict) {
+        f.key_ids.push_back(f.key_id);
+        f.key_id = 0;
+        f.keyed = false; // (the next value needs a key of its own)
+    }
+}
+
+// write the key table and trailer for the document whose root value is at 'root'
+void writer::finish(uint64_t root)
+{
+    const uint64_t keys_offset = offset_;
+    put_varint(keys_.size());
+    uint64_t key_offset = offset_ + 8 * keys_.size();
+    for (size_t i = 0; i < keys_.size(); ++i) {
+        put_u64(key_offset);
+        key_offset += varint_size(keys_[i].size()) + keys_[i].size();
+    }
+    for (size_t i = 0; i < keys_.size(); ++i) {
+        put_varint(keys_[i].size());
+        put(keys_[i].data(), keys_[i].size());
+    }
+    put_u64(keys_offset);
+    put_u64(root);
+    put(end_magic, magic_len);
+
+    // the document is complete; reset() starts another
+    finished_ = true;
+    started_ = false;
+    offset_ = 0;
+    key_ids_.clear();
+    keys_.clear();
+}
+
+void writer::list_begin(bool is_dict)
+{
+    begin();
+    if (depth_ == stack_.size())
+        stack_.push_back(frame());
+    frame & f = stack_[depth_++];
+    f.is_dict = is_dict;
+    f.keyed = false;
+    f.key_id = 0;
+    f.offsets.clear();
+    f.key_ids.clear();
+}
+
+void writer::list_end(bool is_dict)
+{
+    if (depth_ == 0 || stack_[depth_ - 1].is_dict != is_dict)
+        fail(loon::writer::unbalanced_end);
+    if (stack_[depth_ - 1].keyed)
+        fail(loon::writer::missing_dict_value);
+    const frame & f = stack_[--depth_];
+    const uint64_t at = offset_;
+    put_byte(f.is_dict ? tag_dict : tag_arry);
+    put_varint(f.offsets.size());
+    for (size_t i = 0; i < f.offsets.size(); ++i) {
+        if (f.is_dict) {
+            uint32_t id = f.key_ids[i];
+            char buf[4];
+            for (int j = 0; j < 4; ++j, id >>= 8)
+                buf[j] = static_cast<char>(id & 0xFF);
+            put(buf, 4);
+        }
+        put_u64(f.offsets[i]);
+    }
+    value_ends(at);
+}
+
+void writer::loon_arry_begin()
+{
+    list_begin(false);
+}
+
+void writer::loon_arry_end()
+{
+    list_end(false);
+}
+
+void writer::loon_dict_begin()
+{
+    list_begin(true);
+}
+
+void writer::loon_dict_end()
+{
+    list_end(true);
+}
+
+void writer::loon_dict_key(const std::string & key_name)
+{
+    if (depth_ == 0 || !stack_[depth_ - 1].is_dict || stack_[depth_ - 1].keyed)
+        fail(loon::writer::key_not_allowed);
+    std::map<std::string, uint32_t>::iterator i = key_ids_.find(key_name);
+    if (i == key_ids_.end()) {
+        i = key_ids_.insert(std::make_pair(key_name, static_cast<uint32_t>(keys_.size()))).first;
+        keys_.push_back(key_name);
+    }
+    stack_[depth_ - 1].key_id = i->second;
+    stack_[depth_ - 1].keyed = true;
+}
+
+void writer::loon_dict_key(const char * utf8, size_t len)
+{
+    buf_.assign(utf8, len);
+    loon_dict_key(buf_);
+}
+
+void writer::loon_null()
+{
+    begin();
+    const uint64_t at = offset_;
+    put_byte(tag_null);
+    value_ends(at);
+}
+
+void writer::loon_bool(bool value)
+{
+    begin();
+    const uint64_t at = offset_;
+    put_byte(value ? tag_true : tag_false);
+    value_ends(at);
+}
+
+void writer::loon_dec_u32(uint32_t n)
+{
+    begin();
+    const uint64_t at = offset_;
+    put_byte(tag_int);
+    put_u64(n);
+    value_ends(at);
+}
+
+void writer::loon_dec_s32(int32_t n)
+{
+    begin();
+    const uint64_t at = offset_;
+    put_byte(tag_int);
+    put_u64(static_cast<uint64_t>(static_cast<int64_t>(n)));
+    value_ends(at);
+}
+
+void writer::loon_hex_u32(uint32_t n)
+{
+    begin();
+    const uint64_t at = offset_;
+    put_byte(tag_hex);
+    put_byte(8);
+    put_u64(n);
+    value_ends(at);
+}
+
+void writer::loon_double(double n)
+{
+    static_assert(sizeof(double) == sizeof(uint64_t), "code assumes double is 64-bits");
+    uint64_t bits;
+    std::memcpy(&bits, &n, sizeof(bits));
+    begin();
+    const uint64_t at = offset_;
+    put_byte(tag_f64);
+    put_u64(bits);
+    value_ends(at);
+}
+
+void writer::loon_string(const std::string & value)
+{
+    loon_string(value.data(), value.size());
+}
+
+void writer::loon_string(const char * utf8, size_t len)
+{
+    begin();
+    const uint64_t at = offset_;
+    put_byte(tag_string);
+    put_varint(len);
+    put(utf8, len);
+    value_ends(at);
+}
+
+void writer::loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+{
+    begin();
+    const uint64_t at = offset_;
+    int64_t n;
+    uint64_t u;
+    double d;
+    if (ntype == loon::reader::num_dec_int && canonical_dec(utf8, utf8 + len, n)) {
+        put_byte(tag_int);
+        put_u64(static_cast<uint64_t>(n));
+    }
+    else if (ntype == loon::reader::num_hex_int && canonical_hex(utf8, utf8 + len, u)) {
+        put_byte(tag_hex);
+        put_byte(static_cast<uint8_t>(len - 2));
+        put_u64(u);
+    }
+    else if (ntype == loon::reader::num_float && canonical_float(utf8, len, d)) {
+        std::memcpy(&u, &d, sizeof(u));
+        put_byte(tag_f64);
+        put_u64(u);
+    }
+    else { // keep the text, so nothing is lost
+        put_byte(tag_number);
+        put_byte(static_cast<uint8_t>(ntype));
+        put_varint(len);
+        put(utf8, len);
+    }
+    value_ends(at);
+}
+
+void writer::reset()
+{
+    depth_ = 0;
+    offset_ = 0;
+    started_ = false;
+    finished_ = false;
+    key_ids_.clear();
+    keys_.clear();
+}
+
+writer::writer()
+{
+    reset();
+}
+
+writer::~writer()
+{
+}
+
+
+
+// document
+
+void document::fail() const
+{
+    const int line = 0; // (there are no lines in a binary document)
+    throw loon::reader::exception(loon::reader::bad_binary, line,
+        loon::reader::exception_message(loon::reader::bad_binary, line).c_str());
+}
+
+const char * document::bytes_at(uint64_t offset, uint64_t len) const
+{
+    if (offset > len_ || len > len_ - offset)
+        fail();
+    return reinterpret_cast<const char *>(data_ + offset);
+}
+
+uint8_t document::byte_at(uint64_t offset) const
+{
+    if (offset >= len_)
+        fail();
+    return data_[offset];
+}
+
+uint64_t document::u64_at(uint64_t offset) const
+{
+    const uint8_t * p = reinterpret_cast<const uint8_t *>(bytes_at(offset, 8));
+    uint64_t n = 0;
+    for (int i = 8; i--; )
+        n = (n << 8) | p[i];
+    return n;
+}
+
+uint32_t document::u32_at(uint64_t offset) const
+{
+    const uint8_t * p = reinterpret_cast<const uint8_t *>(bytes_at(offset, 4));
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+// return the varint at 'offset' and advance 'offset' past it
+uint64_t document::varint_at(uint64_t & offset) const
+{
+    uint64_t n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const uint8_t b = byte_at(offset++);
+        n |= uint64_t(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+            return n;
+    }
+    fail();
+    return 0;
+}
+
+document::document(const char * data, size_t len)
+: data_(reinterpret_cast<const uint8_t *>(data)), len_(len)
+{
+    if (len < magic_len + trailer_len
+        || std::memcmp(data, magic, magic_len) != 0
+        || std::memcmp(data + len - magic_len, end_magic, magic_len) != 0)
+        fail();
+    keys_ = u64_at(len - trailer_len);
+    root_ = u64_at(len - trailer_len + 8);
+    if (keys_ >= len - trailer_len || root_ >= keys_ || root_ < magic_len)
+        fail();
+    num_keys_ = varint_at(keys_);
+    bytes_at(keys_, num_keys_ * 8); // the table must be in range
+    if (num_keys_ > (len_ - keys_) / 8)
+        fail();
+}
+
+void document::key(uint32_t id, const char *& utf8, size_t & len) const
+{
+    if (id >= num_keys_)
+        fail();
+    uint64_t offset = u64_at(keys_ + 8 * uint64_t(id));
+    const uint64_t n = varint_at(offset);
+    utf8 = bytes_at(offset, n);
+    len = static_cast<size_t>(n);
+}
+
+
+
+// value
+
+value::type_t value::type() const
+{
+    switch (doc_->byte_at(offset_)) {
+    case tag_null:      return type_null;
+    case tag_false:
+    case tag_true:      return type_bool;
+    case tag_int:
+    case tag_hex:
+    case tag_f64:
+    case tag_number:    return type_number;
+    case tag_string:    return type_string;
+    case tag_arry:      return type_arry;
+    case tag_dict:      return type_dict;
+    }
+    doc_->fail();
+    return type_null;
+}
+
+bool value::as_bool() const
+{
+    const uint8_t t = doc_->byte_at(offset_);
+    if (t != tag_true && t != tag_false)
+        doc_->fail();
+    return t == tag_true;
+}
+
+std::string value::number_text(loon::reader::num_type & ntype) const
+{
+    switch (doc_->byte_at(offset_)) {
+    case tag_int:
+        ntype = loon::reader::num_dec_int;
+        return dec_text(static_cast<int64_t>(doc_->u64_at(offset_ + 1)));
+
+    case tag_hex:
+        {
+            ntype = loon::reader::num_hex_int;
+            const int digits = doc_->byte_at(offset_ + 1);
+            if (digits < 1 || digits > 16)
+                doc_->fail();
+            return hex_text(doc_->u64_at(offset_ + 2), digits);
+        }
+
+    case tag_f64:
+        {
+            ntype = loon::reader::num_float;
+            const uint64_t bits = doc_->u64_at(offset_ + 1);
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return loon::writer::detail::double_to_string(d);
+        }
+
+    case tag_number:
+        {
+            const uint8_t t = doc_->byte_at(offset_ + 1);
+            if (t > loon::reader::num_float)
+                doc_->fail();
+            ntype = static_cast<loon::reader::num_type>(t);
+            uint64_t offset = offset_ + 2;
+            const uint64_t len = doc_->varint_at(offset);
+            return std::string(doc_->bytes_at(offset, len), static_cast<size_t>(len));
+        }
+    }
+    doc_->fail();
+    return std::string();
+}
+
+double value::as_double() const
+{
+    switch (doc_->byte_at(offset_)) {
+    case tag_int:
+        return static_cast<double>(static_cast<int64_t>(doc_->u64_at(offset_ + 1)));
+
+    case tag_hex:
+        return static_cast<double>(doc_->u64_at(offset_ + 2));
+
+    case tag_f64:
+        {
+            const uint64_t bits = doc_->u64_at(offset_ + 1);
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return d;
+        }
+    }
+    loon::reader::num_type ntype;
+    const std::string text(number_text(ntype));
+    return text_to_double(text, ntype);
+}
+
+void value::as_string(const char *& utf8, size_t & len) const
+{
+    if (doc_->byte_at(offset_) != tag_string)
+        doc_->fail();
+    uint64_t offset = offset_ + 1;
+    const uint64_t n = doc_->varint_at(offset);
+    utf8 = doc_->bytes_at(offset, n);
+    len = static_cast<size_t>(n);
+}
+
+std::string value::as_string() const
+{
+    const char * utf8;
+    size_t len;
+    as_string(utf8, len);
+    return std::string(utf8, len);
+}
+
+// return the offset of the element table of this arry or dict; set 'n' to
+// the number of elements
+uint64_t value::elements(size_t & n) const
+{
+    const uint8_t t = doc_->byte_at(offset_);
+    if (t != tag_arry && t != tag_dict)
+        doc_->fail();
+    uint64_t offset = offset_ + 1;
+    const uint64_t count = doc_->varint_at(offset);
+    const uint64_t entry_size = t == tag_dict ? 12 : 8;
+    if (count > (doc_->len_ - offset) / entry_size)
+        doc_->fail();
+    n = static_cast<size_t>(count);
+    return offset;
+}
+
+size_t value::size() const
+{
+    size_t n;
+    elements(n);
+    return n;
+}
+
+value value::at(size_t i) const
+{
+    size_t n;
+    const uint64_t table = elements(n);
+    if (i >= n)
+        doc_->fail();
+    const bool is_dict = doc_->byte_at(offset_) == tag_dict;
+    const uint64_t offset = is_dict
+        ? doc_->u64_at(table + 12 * uint64_t(i) + 4)
+        : doc_->u64_at(table + 8 * uint64_t(i));
+    // elements are always written before their container; this also
+    // guarantees a malformed document can't contain a cycle
+    if (offset >= offset_ || offset < magic_len)
+        doc_->fail();
+    return value(doc_, offset);
+}
+
+void value::key(size_t i, const char *& utf8, size_t & len) const
+{
+    size_t n;
+    const uint64_t table = elements(n);
+    if (i >= n || doc_->byte_at(offset_) != tag_dict)
+        doc_->fail();
+    doc_->key(doc_->u32_at(table + 12 * uint64_t(i)), utf8, len);
+}
+
+bool value::find(const std::string & k, value & v) const
+{
+    const size_t n = size();
+    for (size_t i = 0; i < n; ++i) {
+        const char * utf8;
+        size_t len;
+        key(i, utf8, len);
+        if (len == k.size() && std::memcmp(utf8, k.data(), len) == 0) {
+            v = at(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+// reader
+
+reader::~reader()
+{
+}
+
+void reader::process(const document & doc)
+{
+    process(doc.root());
+}
+
+void reader::process(const value & root)
+{
+    // an explicit stack rather than recursion, so deep nesting can't overflow the call stack
+    struct list {
+        value v;
+        size_t i, n;
+        bool is_dict;
+    };
+    std::vector<list> stack;
+    std::string text;
+
+    value v(root);
+    for (;;) {
+        switch (v.type()) {
+        case value::type_null:
+            loon_null();
+            break;
+
+        case value::type_bool:
+            loon_bool(v.as_bool());
+            break;
+
+        case value::type_number:
+            {
+                loon::reader::num_type ntype;
+                text = v.number_text(ntype);
+                loon_number(text.data(), text.size(), ntype);
+            }
+            break;
+
+        case value::type_string:
+            {
+                const char * utf8;
+                size_t len;
+                v.as_string(utf8, len);
+                loon_string(utf8, len);
+            }
+            break;
+
+        case value::type_arry:
+        case value::type_dict:
+            {
+                const bool is_dict = v.type() == value::type_dict;
+                if (is_dict)
+                    loon_dict_begin();
+                else
+                    loon_arry_begin();
+                const list l = { v, 0, v.size(), is_dict };
+                stack.push_back(l);
+            }
+            break;
+        }
+
+        // close finished lists, then move to the next element, if any
+        for (;;) {
+            if (stack.empty())
+                return;
+            list & l = stack.back();
+            if (l.i < l.n) {
+                if (l.is_dict) {
+                    const char * utf8;
+                    size_t len;
+                    l.v.key(l.i, utf8, len);
+                    loon_dict_key(utf8, len);
+                }
+                v = l.v.at(l.i++);
+                break;
+            }
+            if (l.is_dict)
+                loon_dict_end();
+            else
+                loon_arry_end();
+            stack.pop_back();
+        }
+    }
+}
+
+
+
+// text to binary
+
+from_text::from_text(writer & out)
+: out_(out)
+{
+}
+
+from_text::~from_text()
+{
+}
+
+void from_text::loon_arry_begin() { out_.loon_arry_begin(); }
+void from_text::loon_arry_end() { out_.loon_arry_end(); }
+void from_text::loon_dict_begin() { out_.loon_dict_begin(); }
+void from_text::loon_dict_end() { out_.loon_dict_end(); }
+void from_text::loon_null() { out_.loon_null(); }
+void from_text::loon_bool(bool value) { out_.loon_bool(value); }
+
+void from_text::loon_dict_key(const char * utf8, size_t len)
+{
+    out_.loon_dict_key(utf8, len);
+}
+
+void from_text::loon_string(const char * utf8, size_t len)
+{
+    out_.loon_string(utf8, len);
+}
+
+void from_text::loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+{
+    out_.loon_number(utf8, len, ntype);
+}
+
+
+
+}} // end of namespace loon::binary
@@ -0,0 +1,306 @@
+#ifndef LOON_BINARY_H_INCLUDED
+#define LOON_BINARY_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  A binary encoding of the Loon data model.
+
+    A binary Loon document can be memory-mapped and navigated directly with
+    loon::binary::document; nothing has to be parsed. It can be converted to
+    and from Loon text without loss: reading the text, or reading the binary
+    document with loon::binary::reader, produces the same events.
+
+    The layout is (all fixed width integers are little-endian, "varint" is
+    an unsigned LEB128 integer and "offset" is a u64 byte offset from the
+    start of the document):
+
+        document = "LoonBin1" value* keys trailer
+        value    = 0x00                                   null
+                 | 0x01 | 0x02                            false | true
+                 | 0x03 i64                               decimal integer
+                 | 0x04 u8:digits u64                     hexadecimal integer, 'digits' wide
+                 | 0x05 f64                               IEEE 754 double
+                 | 0x06 u8:num_type varint:len byte*len   any other number, as Loon text
+                 | 0x07 varint:len byte*len               UTF-8 string (no escapes)
+                 | 0x08 varint:n offset*n                 arry of n values
+                 | 0x09 varint:n (u32:key_id offset)*n    dict of n key/value pairs
+        keys     = varint:n offset*n                      n UTF-8 strings, each varint:len byte*len
+        trailer  = offset:keys offset:root "LoonEnd1"
+
+    The elements of an arry or dict are written before the arry or dict that
+    contains them, so the writer can stream its output; the root value is
+    found through the trailer. Each distinct dict key is stored once.
+*/
+
+
+#include "loon_reader.h"
+#include "loon_writer.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+
+namespace loon {
+namespace binary {
+
+
+enum tag {
+    tag_null = 0x00, tag_false = 0x01, tag_true = 0x02, tag_int = 0x03,
+    tag_hex = 0x04, tag_f64 = 0x05, tag_number = 0x06, tag_string = 0x07,
+    tag_arry = 0x08, tag_dict = 0x09
+};
+
+
+// Output a binary Loon document. Use it exactly as you would loon::writer::base:
+// derive your own class and override write(). The document is complete (the
+// key table and trailer are written) when the single top-level value ends;
+// call reset() to start another document. Calls that would not make a well
+// formed document (a second top-level value, a dict value with no key, a key
+// outside a dict, an unbalanced end) throw a loon::writer::exception, as the
+// validating loon::writer::base does.
+class writer {
+public:
+    writer();
+    virtual ~writer();
+
+    // Reset the writer to it's initial pristine state.
+    virtual void reset();
+
+    // The output of this class is written through this function.
+    virtual void write(const char * data, size_t len) = 0;
+
+    // These functions behave as their namesakes in loon::writer::base.
+    void loon_arry_begin();
+    void loon_arry_end();
+    void loon_dict_begin();
+    void loon_dict_end();
+    void loon_dict_key(const std::string & key_name);
+    void loon_dict_key(const char * utf8, size_t len);
+    void loon_null();
+    void loon_bool(bool value);
+    void loon_dec_u32(uint32_t n);
+    void loon_dec_s32(int32_t n);
+    void loon_hex_u32(uint32_t n);
+    void loon_double(double n);
+    void loon_string(const std::string & value);
+    void loon_string(const char * utf8, size_t len);
+
+    // Output the given Loon number text, as reported by loon::reader::base.
+    void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype);
+
+private:
+    struct frame {
+        bool is_dict;
+        bool keyed;                         // dict only: the next value's key has been given
+        uint32_t key_id;                    // dict only: the key of the next value
+        std::vector<uint64_t> offsets;      // offset of each element
+        std::vector<uint32_t> key_ids;      // dict only: key of each element
+    };
+    std::vector<frame> stack_;  // frames are reused, so they keep their capacity
+    size_t depth_;              // number of frames in use
+    uint64_t offset_;           // number of bytes written so far
+    bool started_;
+    bool finished_;             // the top-level value has been written
+    std::map<std::string, uint32_t> key_ids_;
+    std::vector<std::string> keys_;
+    std::string buf_;           // scratch
+
+    void begin();
+    void value_ends(uint64_t offset);
+    void put(const char * data, size_t len);
+    void put_byte(uint8_t b);
+    void put_varint(uint64_t n);
+    void put_u64(uint64_t n);
+    void list_begin(bool is_dict);
+    void list_end(bool is_dict);
+    void finish(uint64_t root);
+};
+
+
+// A read-only view of a binary Loon document held in memory (e.g. mapped
+// from a file). The memory must remain valid while the document and any
+// values obtained from it are in use. A loon::reader::exception with id
+// bad_binary is thrown if the data is found to be malformed.
+class document;
+
+class value {
+public:
+    enum type_t { type_null, type_bool, type_number, type_string, type_arry, type_dict };
+
+    type_t type() const;
+
+    // the value of a bool
+    bool as_bool() const;
+
+    // the value of a number, as the Loon text reader would report it
+    std::string number_text(loon::reader::num_type & ntype) const;
+    // the value of a number converted to a double
+    double as_double() const;
+
+    // the value of a string
+    std::string as_string() const;
+    void as_string(const char *& utf8, size_t & len) const;
+
+    // the number of elements in an arry or dict
+    size_t size() const;
+    // the i'th element of an arry or dict
+    value at(size_t i) const;
+    // the key of the i'th element of a dict
+    void key(size_t i, const char *& utf8, size_t & len) const;
+    // return true iff the dict has the given key; set 'v' to the associated value
+    bool find(const std::string & key, value & v) const;
+
+private:
+    friend class document;
+    const document * doc_;
+    uint64_t offset_;
+    value(const document * doc, uint64_t offset) : doc_(doc), offset_(offset) {}
+
+    uint64_t elements(size_t & n) const;
+};
+
+class document {
+public:
+    // view the 'len' bytes at 'data'
+    document(const char * data, size_t len);
+
+    // the top-level value
+    value root() const { return value(this, root_); }
+
+    // the number of distinct dict keys and the text of key 'id'
+    size_t num_keys() const { return num_keys_; }
+    void key(uint32_t id, const char *& utf8, size_t & len) const;
+
+private:
+    friend class value;
+    const uint8_t * data_;
+    uint64_t len_;
+    uint64_t keys_;     // offset of the key offsets table
+    uint64_t num_keys_;
+    uint64_t root_;
+
+    void fail() const;
+    uint8_t byte_at(uint64_t offset) const;
+    uint64_t u64_at(uint64_t offset) const;
+    uint32_t u32_at(uint64_t offset) const;
+    uint64_t varint_at(uint64_t & offset) const;
+    const char * bytes_at(uint64_t offset, uint64_t len) const;
+};
+
+
+// Produce the same virtual function calls loon::reader::base would make when
+// reading the Loon text equivalent of a binary Loon document. Derive your
+// own reader from this class, just as you would from loon::reader::base.
+class reader {
+public:
+    virtual ~reader();
+
+    // read the whole binary Loon 'doc'
+    void process(const document & doc);
+    // read just the value 'v' (and everything it contains)
+    void process(const value & v);
+
+    // see loon::reader::base
+    virtual void loon_arry_begin() = 0;
+    virtual void loon_arry_end() = 0;
+    virtual void loon_dict_begin() = 0;
+    virtual void loon_dict_end() = 0;
+    virtual void loon_dict_key(const char * utf8, size_t len) = 0;
+    virtual void loon_null() = 0;
+    virtual void loon_bool(bool value) = 0;
+    virtual void loon_string(const char * utf8, size_t len) = 0;
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype) = 0;
+};
+
+
+// a Loon text reader that writes everything it reads to the given binary writer
+class from_text : private loon::reader::base {
+public:
+    explicit from_text(writer & out);
+    virtual ~from_text();
+
+    using base::process_chunk;
+    using base::current_line;
+    using base::reset;
+
+private:
+    writer & out_;
+
+    virtual void loon_arry_begin();
+    virtual void loon_arry_end();
+    virtual void loon_dict_begin();
+    virtual void loon_dict_end();
+    virtual void loon_dict_key(const char * utf8, size_t len);
+    virtual void loon_null();
+    virtual void loon_bool(bool value);
+    virtual void loon_string(const char * utf8, size_t len);
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype);
+};
+
+
+// a binary reader that writes everything it reads to the given Loon text
+// writer (Writer may be loon::writer::base or loon::writer::basic<>)
+template <typename Writer>
+class to_text : private reader {
+public:
+    explicit to_text(Writer & out) : out_(out) {}
+
+    using reader::process;
+
+private:
+    Writer & out_;
+
+    virtual void loon_arry_begin() { out_.loon_arry_begin(); }
+    virtual void loon_arry_end() { out_.loon_arry_end(); }
+    virtual void loon_dict_begin() { out_.loon_dict_begin(); }
+    virtual void loon_dict_end() { out_.loon_dict_end(); }
+    virtual void loon_null() { out_.loon_null(); }
+    virtual void loon_bool(bool value) { out_.loon_bool(value); }
+
+    virtual void loon_dict_key(const char * utf8, size_t len)
+    {
+        out_.loon_dict_key(std::string(utf8, len));
+    }
+
+    virtual void loon_string(const char * utf8, size_t len)
+    {
+        out_.loon_string(std::string(utf8, len));
+    }
+
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type)
+    {
+        out_.loon_preformatted_value(utf8, len);
+    }
+};
+
+
+}} // end of namespace loon::binary
+#endif
@@ -0,0 +1,520 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+#include "loon_canonical.h"
+#include "loon_writer.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace loon {
+namespace canonical {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return c - 'A' + 10;
+}
+
+// return the decimal digits of the hexadecimal number in [p, end)
+std::string hex_to_decimal(const char * p, const char * end)
+{
+    // the number in base 10^9, least significant limb first
+    std::vector<uint32_t> limbs;
+    for (; p != end; ++p) {
+        uint64_t carry = hex_value(*p);
+        for (size_t i = 0; i < limbs.size(); ++i) {
+            const uint64_t n = uint64_t(limbs[i]) * 16 + carry;
+            limbs[i] = static_cast<uint32_t>(n % 1000000000);
+            carry = n / 1000000000;
+        }
+        if (carry)
+            limbs.push_back(static_cast<uint32_t>(carry));
+    }
+
+    std::string result;
+    for (size_t i = limbs.size(); i--; ) {
+        char buf[10];
+        uint32_t n = limbs[i];
+        for (int j = 8; j >= 0; --j, n /= 10)
+            buf[j] = static_cast<char>('0' + n % 10);
+        result.append(buf, 9);
+    }
+    return result;
+}
+
+inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+inline uint64_t load64(const uint8_t * p)
+{
+    uint64_t n = 0;
+    for (int i = 7; i >= 0; --i)
+        n = (n << 8) | p[i];
+    return n;
+}
+
+const uint64_t c1 = 0x87c37b91114253d5ULL;
+const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+// dict entries are ordered by the bytes of their keys
+struct key_less {
+    template <typename Entry>
+    bool operator()(const Entry & a, const Entry & b) const { return a.key < b.key; }
+};
+
+
+} // anonymous namespace
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+std::string number(const char * utf8, size_t len, loon::reader::num_type ntype)
+{
+    const char * p = utf8;
+    const char * const end = utf8 + len;
+    bool negative = false;
+    if (p != end && (*p == '+' || *p == '-'))
+        negative = *p++ == '-';
+
+    // the value is digits * 10^exponent
+    std::string digits;
+    int64_t exponent = 0;
+    if (ntype == loon::reader::num_hex_int)
+        digits = hex_to_decimal(p + 2, end);
+    else {
+        for (; p != end && is_digit(*p); ++p)
+            digits += *p;
+        if (p != end && *p == '.') {
+            for (++p; p != end && is_digit(*p); ++p) {
+                digits += *p;
+                --exponent;
+            }
+        }
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool negative_exponent = false;
+            if (p != end && (*p == '+' || *p == '-'))
+                negative_exponent = *p++ == '-';
+            int64_t e = 0;
+            for (; p != end && is_digit(*p); ++p) {
+                if (e < 1000000000000000LL) // (beyond this the exponent is no longer exact)
+                    e = e * 10 + (*p - '0');
+            }
+            exponent += negative_exponent ? -e : e;
+        }
+    }
+
+    // remove the redundant zeros
+    const size_t first = digits.find_first_not_of('0');
+    if (first == std::string::npos)
+        return "0";
+    const size_t last = digits.find_last_not_of('0');
+    exponent += digits.size() - 1 - last;
+    digits = digits.substr(first, last + 1 - first);
+
+    std::string result(negative ? "-" : "");
+    const int64_t n = digits.size();
+    const int64_t point = n + exponent; // the position of the decimal point in digits
+    if (exponent >= 0 && point <= 21) {
+        result += digits;
+        result.append(static_cast<size_t>(exponent), '0');
+    }
+    else if (point > 0 && point <= 21) {
+        result.append(digits, 0, static_cast<size_t>(point));
+        result += '.';
+        result.append(digits, static_cast<size_t>(point), std::string::npos);
+    }
+    else if (point <= 0 && point > -6) {
+        result += "0.";
+        result.append(static_cast<size_t>(-point), '0');
+        result += digits;
+    }
+    else {
+        result += digits[0];
+        if (n > 1) {
+            result += '.';
+            result.append(digits, 1, std::string::npos);
+        }
+        result += 'e';
+        result += std::to_string(static_cast<long long>(point - 1));
+    }
+    return result;
+}
+
+
+
+// hash128
+
+void hash128::reset()
+{
+    h1_ = h2_ = 0;
+    len_ = 0;
+    tail_len_ = 0;
+}
+
+void hash128::block(const uint8_t * p)
+{
+    uint64_t k1 = load64(p);
+    uint64_t k2 = load64(p + 8);
+
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1_ ^= k1;
+    h1_ = rotl64(h1_, 27); h1_ += h2_; h1_ = h1_ * 5 + 0x52dce729;
+
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2_ ^= k2;
+    h2_ = rotl64(h2_, 31); h2_ += h1_; h2_ = h2_ * 5 + 0x38495ab5;
+}
+
+void hash128::update(const void * data, size_t len)
+{
+    if (len == 0)
+        return;
+    const uint8_t * p = static_cast<const uint8_t *>(data);
+    len_ += len;
+    if (tail_len_) {
+        const size_t n = std::min(len, 16 - tail_len_);
+        std::memcpy(tail_ + tail_len_, p, n);
+        tail_len_ += n;
+        p += n;
+        len -= n;
+        if (tail_len_ < 16)
+            return;
+        block(tail_);
+        tail_len_ = 0;
+    }
+    for (; len >= 16; p += 16, len -= 16)
+        block(p);
+    std::memcpy(tail_, p, len);
+    tail_len_ = len;
+}
+
+digest hash128::result() const
+{
+    uint64_t h1 = h1_;
+    uint64_t h2 = h2_;
+
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for (size_t i = tail_len_; i > 8; --i)
+        k2 = (k2 << 8) | tail_[i - 1];
+    for (size_t i = std::min<size_t>(tail_len_, 8); i > 0; --i)
+        k1 = (k1 << 8) | tail_[i - 1];
+    if (tail_len_ > 8) {
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    if (tail_len_) {
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len_;
+    h2 ^= len_;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    const digest d = { h1, h2 };
+    return d;
+}
+
+
+
+// writer
+
+writer::writer()
+{
+    reset();
+}
+
+writer::~writer()
+{
+}
+
+void writer::reset()
+{
+    depth_ = 0;
+    need_space_ = false;
+}
+
+// append to the text being produced: the last entry of the innermost open
+// dict, or the output if there are none
+void writer::put(const char * utf8, size_t len)
+{
+    if (depth_)
+        dicts_[depth_ - 1].entries.back().text.append(utf8, len);
+    else
+        write(utf8, len);
+}
+
+void writer::token(const char * utf8, size_t len)
+{
+    if (need_space_)
+        put(" ", 1);
+    put(utf8, len);
+    need_space_ = true;
+}
+
+void writer::loon_arry_begin()
+{
+    token("(arry", 5);
+}
+
+void writer::loon_arry_end()
+{
+    put(")", 1);
+    need_space_ = true;
+}
+
+void writer::loon_dict_begin()
+{
+    if (depth_ == dicts_.size())
+        dicts_.push_back(dict());
+    dict & d = dicts_[depth_++];
+    d.entries.clear();
+    d.need_space = need_space_;
+}
+
+void writer::loon_dict_end()
+{
+    dict & d = dicts_[--depth_];
+    std::stable_sort(d.entries.begin(), d.entries.end(), key_less());
+    need_space_ = d.need_space;
+    token("(dict", 5);
+    for (size_t i = 0; i < d.entries.size(); ++i) {
+        put(" ", 1);
+        put(d.entries[i].text.data(), d.entries[i].text.size());
+    }
+    put(")", 1);
+    need_space_ = true;
+}
+
+void writer::loon_dict_key(const char * utf8, size_t len)
+{
+    dict & d = dicts_[depth_ - 1];
+    d.entries.push_back(entry());
+    d.entries.back().key.assign(utf8, len);
+    loon::writer::detail::escape(buf_, d.entries.back().key);
+    need_space_ = false;
+    token(reinterpret_cast<const char *>(&buf_[0]), buf_.size());
+}
+
+void writer::loon_null()
+{
+    token("null", 4);
+}
+
+void writer::loon_bool(bool value)
+{
+    if (value)
+        token("true", 4);
+    else
+        token("false", 5);
+}
+
+void writer::loon_string(const char * utf8, size_t len)
+{
+    loon::writer::detail::escape(buf_, std::string(utf8, len));
+    token(reinterpret_cast<const char *>(&buf_[0]), buf_.size());
+}
+
+void writer::loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+{
+    const std::string n(number(utf8, len, ntype));
+    token(n.data(), n.size());
+}
+
+
+
+// hasher
+
+/*  The hash is of a sequence of tagged items: a scalar is its tag, its length
+    (8 bytes, little-endian) and its bytes; an arry is '[', its elements and
+    ']'; a dict is '{', the 16-byte hash of each of its entries in order of
+    key, and '}', where the hash of an entry is the hash of its key (tag 'k')
+    and its value. Equal canonical texts give equal sequences, and as each
+    item says where it ends, different canonical texts give different ones. */
+
+hasher::hasher()
+{
+    reset();
+}
+
+void hasher::reset()
+{
+    root_.reset();
+    depth_ = 0;
+}
+
+void hasher::put(char tag, const char * data, size_t len)
+{
+    uint8_t header[9] = { static_cast<uint8_t>(tag) };
+    for (int i = 0; i < 8; ++i)
+        header[1 + i] = static_cast<uint8_t>(uint64_t(len) >> (8 * i));
+    hash128 & h = out();
+    h.update(header, sizeof(header));
+    h.update(data, len);
+}
+
+// the last entry of the innermost dict is complete
+void hasher::finish_entry()
+{
+    dict & d = dicts_[depth_ - 1];
+    if (!d.entries.empty())
+        d.entries.back().hash = d.current.result();
+}
+
+void hasher::loon_arry_begin()
+{
+    out().update("[", 1);
+}
+
+void hasher::loon_arry_end()
+{
+    out().update("]", 1);
+}
+
+void hasher::loon_dict_begin()
+{
+    if (depth_ == dicts_.size())
+        dicts_.push_back(dict());
+    dicts_[depth_++].entries.clear();
+}
+
+void hasher::loon_dict_end()
+{
+    finish_entry();
+    dict & d = dicts_[--depth_];
+    std::stable_sort(d.entries.begin(), d.entries.end(), key_less());
+    hash128 & h = out();
+    h.update("{", 1);
+    for (size_t i = 0; i < d.entries.size(); ++i) {
+        uint8_t bytes[16];
+        for (int j = 0; j < 8; ++j) {
+            bytes[j] = static_cast<uint8_t>(d.entries[i].hash.lo >> (8 * j));
+            bytes[8 + j] = static_cast<uint8_t>(d.entries[i].hash.hi >> (8 * j));
+        }
+        h.update(bytes, sizeof(bytes));
+    }
+    h.update("}", 1);
+}
+
+void hasher::loon_dict_key(const char * utf8, size_t len)
+{
+    finish_entry();
+    dict & d = dicts_[depth_ - 1];
+    d.entries.push_back(entry());
+    d.entries.back().key.assign(utf8, len);
+    d.current.reset();
+    put('k', utf8, len);
+}
+
+void hasher::loon_null()
+{
+    put('n', 0, 0);
+}
+
+void hasher::loon_bool(bool value)
+{
+    put(value ? 't' : 'f', 0, 0);
+}
+
+void hasher::loon_string(const char * utf8, size_t len)
+{
+    put('s', utf8, len);
+}
+
+void hasher::loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+{
+    const std::string n(number(utf8, len, ntype));
+    put('#', n.data(), n.size());
+}
+
+
+
+std::string canonical_text(const char * utf8, size_t len)
+{
+    struct string_writer : public writer {
+        std::string str;
+        virtual void write(const char * utf8, size_t len) { str.append(utf8, len); }
+    } out;
+    from_text<writer> in(out);
+    in.process_chunk(utf8, len, /*is_last_chunk=*/true);
+    return out.str;
+}
+
+digest hash_text(const char * utf8, size_t len)
+{
+    hasher out;
+    from_text<hasher> in(out);
+    in.process_chunk(utf8, len, /*is_last_chunk=*/true);
+    return out.result();
+}
+
+
+}} // end of namespace loon::canonical
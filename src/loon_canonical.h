@@ -0,0 +1,224 @@
+#ifndef LOON_CANONICAL_H_INCLUDED
+#define LOON_CANONICAL_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  The canonical form of a Loon value, and a hash of it.
+
+    Loon texts that mean the same thing have the same canonical text:
+
+    - tokens are separated by a single space and there are no comments
+    - the entries of each dict are sorted by key, comparing the UTF-8 bytes
+      of the keys (entries with the same key keep their order)
+    - strings and keys are escaped as loon::writer::base escapes them
+    - numbers that are equal have the same text, whatever their type: the
+      exact decimal value with no redundant sign or zeros, as an integer or
+      decimal fraction, or in exponent form if that would need more than 21
+      digits or 6 leading zeros; e.g. 0x1F, +31 and 3.1e1 are all 31 and
+      -.50 and -5e-1 are -0.5
+
+    loon::canonical::writer outputs the canonical text of the value whose
+    reader events it is given. loon::canonical::hasher computes a 128-bit
+    hash of the canonical form from the same events without producing the
+    text: two values have the same hash iff (barring collisions) they have
+    the same canonical text. Both hold the entries of each open dict until
+    it ends, so they can be sorted; the hasher holds just the key and the
+    16-byte hash of each entry. Feed them Loon text with from_text<>.
+*/
+
+
+#include "loon_reader.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace loon {
+namespace canonical {
+
+
+// return the canonical text of the given Loon number, e.g. "0x10" => "16"
+std::string number(const char * utf8, size_t len, loon::reader::num_type ntype);
+
+
+struct digest {
+    uint64_t lo, hi;
+};
+
+inline bool operator==(const digest & a, const digest & b) { return a.lo == b.lo && a.hi == b.hi; }
+inline bool operator!=(const digest & a, const digest & b) { return !(a == b); }
+
+
+// A streaming 128-bit hash of a sequence of bytes (MurmurHash3 x64-128,
+// seed 0): the bytes may be given in any number of pieces.
+class hash128 {
+public:
+    hash128() { reset(); }
+
+    void reset();
+    void update(const void * data, size_t len);
+
+    // the hash of all the bytes given since construction or reset()
+    digest result() const;
+
+private:
+    uint64_t h1_, h2_;
+    uint64_t len_;          // the number of bytes given
+    uint8_t tail_[16];      // the bytes of an incomplete 16-byte block
+    size_t tail_len_;
+
+    void block(const uint8_t * p);
+};
+
+
+// Output canonical Loon text. Derive your own class from this and override
+// write(), exactly as you would for loon::writer::base. Give it the events
+// of a single Loon value, as loon::reader::base reports them (with strings
+// unescaped, not raw).
+class writer {
+public:
+    writer();
+    virtual ~writer();
+
+    // Reset the writer to it's initial pristine state.
+    virtual void reset();
+
+    // The output of this class is written through this function.
+    virtual void write(const char * utf8, size_t len) = 0;
+
+    void loon_arry_begin();
+    void loon_arry_end();
+    void loon_dict_begin();
+    void loon_dict_end();
+    void loon_dict_key(const char * utf8, size_t len);
+    void loon_null();
+    void loon_bool(bool value);
+    void loon_string(const char * utf8, size_t len);
+    void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype);
+
+private:
+    struct entry {
+        std::string key;    // unescaped, for sorting
+        std::string text;   // the quoted key and value
+    };
+    struct dict {
+        std::vector<entry> entries;
+        bool need_space;    // need_space_ of the text the dict is in
+    };
+    std::vector<dict> dicts_;   // the open dicts; reused, so they keep their capacity
+    size_t depth_;              // number of dicts_ in use
+    bool need_space_;           // the next token follows another
+    std::vector<uint8_t> buf_;  // scratch
+
+    void put(const char * utf8, size_t len);
+    void token(const char * utf8, size_t len);
+};
+
+
+// Compute the hash of the canonical form of a Loon value from its events,
+// given as for canonical::writer.
+class hasher {
+public:
+    hasher();
+
+    // Reset the hasher to it's initial pristine state.
+    void reset();
+
+    // the hash of the value; complete once the value has ended
+    digest result() const { return root_.result(); }
+
+    void loon_arry_begin();
+    void loon_arry_end();
+    void loon_dict_begin();
+    void loon_dict_end();
+    void loon_dict_key(const char * utf8, size_t len);
+    void loon_null();
+    void loon_bool(bool value);
+    void loon_string(const char * utf8, size_t len);
+    void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype);
+
+private:
+    struct entry {
+        std::string key;
+        digest hash;        // of the key and value
+    };
+    struct dict {
+        std::vector<entry> entries;
+        hash128 current;    // of the last entry, until the next key or the dict end
+    };
+    hash128 root_;
+    std::vector<dict> dicts_;   // the open dicts; reused, so they keep their capacity
+    size_t depth_;              // number of dicts_ in use
+
+    hash128 & out() { return depth_ ? dicts_[depth_ - 1].current : root_; }
+    void put(char tag, const char * data, size_t len);
+    void finish_entry();
+};
+
+
+// a Loon reader that gives everything it reads to the given canonical::writer
+// or canonical::hasher (or anything else with the same loon_XXXX functions)
+template <typename Target>
+class from_text : private loon::reader::base {
+public:
+    explicit from_text(Target & out) : out_(out) {}
+
+    using base::process_chunk;
+    using base::current_line;
+    using base::reset;
+
+private:
+    Target & out_;
+
+    virtual void loon_arry_begin() { out_.loon_arry_begin(); }
+    virtual void loon_arry_end() { out_.loon_arry_end(); }
+    virtual void loon_dict_begin() { out_.loon_dict_begin(); }
+    virtual void loon_dict_end() { out_.loon_dict_end(); }
+    virtual void loon_dict_key(const char * utf8, size_t len) { out_.loon_dict_key(utf8, len); }
+    virtual void loon_null() { out_.loon_null(); }
+    virtual void loon_bool(bool value) { out_.loon_bool(value); }
+    virtual void loon_string(const char * utf8, size_t len) { out_.loon_string(utf8, len); }
+
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+    {
+        out_.loon_number(utf8, len, ntype);
+    }
+};
+
+
+// return the canonical text of the given Loon text
+std::string canonical_text(const char * utf8, size_t len);
+
+// return the hash of the canonical form of the given Loon text
+digest hash_text(const char * utf8, size_t len);
+
+
+}} // end of namespace loon::canonical
+#endif
@@ -0,0 +1,539 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+#include "loon_diff.h"
+#include "loon_canonical.h"
+#include "loon_reader.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+
+namespace loon {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+void fail()
+{
+    const int line = 0; // (the problem is with the document as a whole)
+    throw loon::reader::exception(loon::reader::bad_diff, line,
+        loon::reader::exception_message(loon::reader::bad_diff, line).c_str());
+}
+
+// a value read from Loon text
+struct node {
+    enum kind_t { null_kind, bool_kind, number_kind, string_kind, arry_kind, dict_kind };
+
+    kind_t kind;
+    loon::reader::num_type ntype;   // number_kind only
+    std::string value;              // the text of a number, the value of a string,
+                                    // or "true" or "false"
+    std::vector<std::string> keys;  // dict only: the key of each child
+    std::vector<node> children;     // lists: the elements
+    canonical::digest hash;         // structural digest of the value (see set_hash)
+
+    node() : kind(null_kind), ntype(loon::reader::num_dec_int)
+    {
+        hash.lo = hash.hi = 0;
+    }
+
+    void swap(node & other)
+    {
+        std::swap(kind, other.kind);
+        std::swap(ntype, other.ntype);
+        value.swap(other.value);
+        keys.swap(other.keys);
+        children.swap(other.children);
+        std::swap(hash, other.hash);
+    }
+
+    bool is_list() const { return kind == arry_kind || kind == dict_kind; }
+};
+
+// add a tagged item to 'h'
+void hash_item(canonical::hash128 & h, char tag, const char * data, size_t len)
+{
+    uint8_t header[9] = { static_cast<uint8_t>(tag) };
+    for (int i = 0; i < 8; ++i)
+        header[1 + i] = static_cast<uint8_t>(uint64_t(len) >> (8 * i));
+    h.update(header, sizeof(header));
+    h.update(data, len);
+}
+
+void hash_digest(canonical::hash128 & h, const canonical::digest & d)
+{
+    uint8_t bytes[16];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<uint8_t>(d.lo >> (8 * i));
+        bytes[8 + i] = static_cast<uint8_t>(d.hi >> (8 * i));
+    }
+    h.update(bytes, sizeof(bytes));
+}
+
+// set the hash of 'n' from its value and the hashes of its children; this
+// is diff's own digest, not the one canonical::hash_text() gives
+void set_hash(node & n)
+{
+    canonical::hash128 h;
+    switch (n.kind) {
+    case node::null_kind:
+        hash_item(h, 'n', 0, 0);
+        break;
+    case node::bool_kind:
+        hash_item(h, n.value == "true" ? 't' : 'f', 0, 0);
+        break;
+    case node::number_kind:
+        {
+            const std::string canonical(canonical::number(n.value.data(), n.value.size(), n.ntype));
+            hash_item(h, '#', canonical.data(), canonical.size());
+        }
+        break;
+    case node::string_kind:
+        hash_item(h, 's', n.value.data(), n.value.size());
+        break;
+    case node::arry_kind:
+        h.update("[", 1);
+        for (size_t i = 0; i < n.children.size(); ++i)
+            hash_digest(h, n.children[i].hash);
+        h.update("]", 1);
+        break;
+    case node::dict_kind:
+        {
+            // the entries in order of key
+            std::vector<std::pair<std::string, size_t> > order;
+            for (size_t i = 0; i < n.keys.size(); ++i)
+                order.push_back(std::make_pair(n.keys[i], i));
+            std::sort(order.begin(), order.end());
+            h.update("{", 1);
+            for (size_t i = 0; i < order.size(); ++i) {
+                canonical::hash128 entry;
+                hash_item(entry, 'k', order[i].first.data(), order[i].first.size());
+                hash_digest(entry, n.children[order[i].second].hash);
+                hash_digest(h, entry.result());
+            }
+            h.update("}", 1);
+        }
+        break;
+    }
+    n.hash = h.result();
+}
+
+// read Loon text into a tree of nodes
+class tree_reader : private loon::reader::base {
+public:
+    // return the single value in the given Loon 'text'; if 'hashes', with
+    // the hash of each value set
+    static node read(const std::string & text, bool hashes)
+    {
+        tree_reader r(hashes);
+        r.process_chunk(text.data(), text.size(), /*is_last_chunk=*/true);
+        if (r.values_.size() != 1)
+            fail();
+        node result;
+        result.swap(r.values_[0]);
+        return result;
+    }
+
+private:
+    const bool hashes_;
+    std::vector<node> stack_;   // the open lists
+    std::vector<node> values_;  // the top-level values
+
+    explicit tree_reader(bool hashes) : hashes_(hashes) {}
+
+    void add(node & n)
+    {
+        if (hashes_)
+            set_hash(n);
+        std::vector<node> & siblings(stack_.empty() ? values_ : stack_.back().children);
+        siblings.push_back(node());
+        siblings.back().swap(n);
+    }
+
+    void add(node::kind_t kind, const char * utf8 = "", size_t len = 0)
+    {
+        node n;
+        n.kind = kind;
+        n.value.assign(utf8, len);
+        add(n);
+    }
+
+    void begin(node::kind_t kind)
+    {
+        stack_.push_back(node());
+        stack_.back().kind = kind;
+    }
+
+    void end()
+    {
+        node n;
+        n.swap(stack_.back());
+        stack_.pop_back();
+        add(n);
+    }
+
+    virtual void loon_arry_begin() { begin(node::arry_kind); }
+    virtual void loon_arry_end() { end(); }
+    virtual void loon_dict_begin() { begin(node::dict_kind); }
+    virtual void loon_dict_end() { end(); }
+    virtual void loon_dict_key(const char * utf8, size_t len) { stack_.back().keys.push_back(std::string(utf8, len)); }
+    virtual void loon_null() { add(node::null_kind); }
+    virtual void loon_bool(bool value) { add(node::bool_kind, value ? "true" : "false", value ? 4 : 5); }
+    virtual void loon_string(const char * utf8, size_t len) { add(node::string_kind, utf8, len); }
+
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+    {
+        node n;
+        n.kind = node::number_kind;
+        n.ntype = ntype;
+        n.value.assign(utf8, len);
+        add(n);
+    }
+};
+
+// write the value 'n' to 'out'
+void write_node(const node & n, writer::base & out)
+{
+    switch (n.kind) {
+    case node::null_kind:   out.loon_null();                                            break;
+    case node::bool_kind:   out.loon_bool(n.value == "true");                           break;
+    case node::number_kind: out.loon_preformatted_value(n.value.data(), n.value.size()); break;
+    case node::string_kind: out.loon_string(n.value);                                   break;
+    case node::arry_kind:
+        out.loon_arry_begin();
+        for (size_t i = 0; i < n.children.size(); ++i)
+            write_node(n.children[i], out);
+        out.loon_arry_end();
+        break;
+    case node::dict_kind:
+        out.loon_dict_begin();
+        for (size_t i = 0; i < n.children.size(); ++i) {
+            out.loon_dict_key(n.keys[i]);
+            write_node(n.children[i], out);
+        }
+        out.loon_dict_end();
+        break;
+    }
+}
+
+// a step along a path: a dict key, or an arry index if 'key' is null
+struct step {
+    const std::string * key;
+    size_t index;
+};
+typedef std::vector<step> path;
+
+// writes the changes found by the comparison to the delta
+class delta_writer {
+public:
+    explicit delta_writer(writer::base & out) : out_(out) {}
+
+    void change(const char * op, const path & p, const node * value)
+    {
+        out_.loon_dict_begin();
+        out_.loon_dict_key(op_key());
+        out_.loon_string(op);
+        out_.loon_dict_key(path_key());
+        out_.loon_arry_begin();
+        for (size_t i = 0; i < p.size(); ++i) {
+            if (p[i].key)
+                out_.loon_string(*p[i].key);
+            else {
+                const std::string index(std::to_string(static_cast<unsigned long long>(p[i].index)));
+                out_.loon_preformatted_value(index.data(), index.size());
+            }
+        }
+        out_.loon_arry_end();
+        if (value) {
+            out_.loon_dict_key(value_key());
+            write_node(*value, out_);
+        }
+        out_.loon_dict_end();
+    }
+
+    static const writer::key & op_key() { static const writer::key k("op"); return k; }
+    static const writer::key & path_key() { static const writer::key k("path"); return k; }
+    static const writer::key & value_key() { static const writer::key k("value"); return k; }
+
+private:
+    writer::base & out_;
+};
+
+bool unique_keys(const node & n)
+{
+    std::vector<std::string> keys(n.keys);
+    std::sort(keys.begin(), keys.end());
+    return std::adjacent_find(keys.begin(), keys.end()) == keys.end();
+}
+
+void compare(const node & a, const node & b, path & p, delta_writer & delta);
+
+void compare_dicts(const node & a, const node & b, path & p, delta_writer & delta)
+{
+    std::map<std::string, size_t> b_index;
+    for (size_t i = 0; i < b.keys.size(); ++i)
+        b_index[b.keys[i]] = i;
+
+    step s = { 0, 0 };
+    for (size_t i = 0; i < a.keys.size(); ++i) {
+        s.key = &a.keys[i];
+        p.push_back(s);
+        const std::map<std::string, size_t>::const_iterator found(b_index.find(a.keys[i]));
+        if (found == b_index.end())
+            delta.change("remove", p, 0);
+        else {
+            compare(a.children[i], b.children[found->second], p, delta);
+            b_index.erase(found);
+        }
+        p.pop_back();
+    }
+
+    // the entries only b has, in b's order
+    for (size_t i = 0; i < b.keys.size(); ++i) {
+        if (b_index.count(b.keys[i])) {
+            s.key = &b.keys[i];
+            p.push_back(s);
+            delta.change("set", p, &b.children[i]);
+            p.pop_back();
+        }
+    }
+}
+
+// elements the same at the start and end of the arrys are skipped; the
+// elements between are compared in pairs, then the extra elements of a
+// are removed or those of b inserted
+void compare_arrys(const node & a, const node & b, path & p, delta_writer & delta)
+{
+    const size_t na = a.children.size();
+    const size_t nb = b.children.size();
+    size_t first = 0;
+    while (first < na && first < nb && a.children[first].hash == b.children[first].hash)
+        ++first;
+    size_t same_end = 0;
+    while (same_end < na - first && same_end < nb - first
+            && a.children[na - 1 - same_end].hash == b.children[nb - 1 - same_end].hash)
+        ++same_end;
+    const size_t ma = na - first - same_end; // the elements between
+    const size_t mb = nb - first - same_end;
+    const size_t pairs = std::min(ma, mb);
+
+    step s = { 0, 0 };
+    p.push_back(s);
+    for (size_t i = first; i < first + pairs; ++i) {
+        p.back().index = i;
+        compare(a.children[i], b.children[i], p, delta);
+    }
+    for (size_t i = first + ma; i-- > first + pairs; ) {
+        p.back().index = i;
+        delta.change("remove", p, 0);
+    }
+    for (size_t i = first + pairs; i < first + mb; ++i) {
+        p.back().index = i;
+        delta.change("insert", p, &b.children[i]);
+    }
+    p.pop_back();
+}
+
+void compare(const node & a, const node & b, path & p, delta_writer & delta)
+{
+    if (a.hash == b.hash)
+        return;
+    if (a.kind == node::arry_kind && b.kind == node::arry_kind)
+        compare_arrys(a, b, p, delta);
+    else if (a.kind == node::dict_kind && b.kind == node::dict_kind && unique_keys(a) && unique_keys(b))
+        compare_dicts(a, b, p, delta);
+    else
+        delta.change("set", p, &b);
+}
+
+// return the arry index given by the path 'step'
+size_t index_of(const node & step)
+{
+    if (step.kind != node::number_kind || step.ntype != loon::reader::num_dec_int)
+        fail();
+    size_t index = 0;
+    for (size_t i = 0; i < step.value.size(); ++i) {
+        const char c = step.value[i];
+        if (c < '0' || c > '9' || index > (size_t(-1) - 9) / 10)
+            fail();
+        index = index * 10 + (c - '0');
+    }
+    return index;
+}
+
+// return the element of the list 'n' that the path 'step' leads to; if 'n'
+// is a dict without the key and 'add', a new entry is added for it
+node & child(node & n, const node & step, bool add)
+{
+    if (n.kind == node::dict_kind) {
+        if (step.kind != node::string_kind)
+            fail();
+        for (size_t i = 0; i < n.keys.size(); ++i) {
+            if (n.keys[i] == step.value)
+                return n.children[i];
+        }
+        if (!add)
+            fail();
+        n.keys.push_back(step.value);
+        n.children.push_back(node());
+        return n.children.back();
+    }
+    if (n.kind != node::arry_kind)
+        fail();
+    const size_t i = index_of(step);
+    if (i >= n.children.size())
+        fail();
+    return n.children[i];
+}
+
+// return the value of the given 'key' in the dict 'n', or 0 if none
+const node * field(const node & n, const char * key)
+{
+    for (size_t i = 0; i < n.keys.size(); ++i) {
+        if (n.keys[i] == key)
+            return &n.children[i];
+    }
+    return 0;
+}
+
+// make the changes in 'delta' to 'doc'
+void apply(node & doc, const node & delta)
+{
+    if (delta.kind != node::arry_kind)
+        fail();
+    for (size_t c = 0; c < delta.children.size(); ++c) {
+        const node & change = delta.children[c];
+        if (change.kind != node::dict_kind)
+            fail();
+        const node * const op = field(change, "op");
+        const node * const path = field(change, "path");
+        const node * const value = field(change, "value");
+        if (!op || op->kind != node::string_kind || !path || path->kind != node::arry_kind)
+            fail();
+        const std::vector<node> & steps = path->children;
+
+        if (op->value == "set") {
+            if (!value)
+                fail();
+            node * target = &doc;
+            for (size_t i = 0; i < steps.size(); ++i)
+                target = &child(*target, steps[i], i + 1 == steps.size());
+            node copy(*value);
+            target->swap(copy);
+            continue;
+        }
+
+        if (steps.empty())
+            fail();
+        node * parent = &doc;
+        for (size_t i = 0; i + 1 < steps.size(); ++i)
+            parent = &child(*parent, steps[i], false);
+        const node & last = steps.back();
+
+        if (op->value == "insert") {
+            const size_t i = index_of(last);
+            if (!value || parent->kind != node::arry_kind || i > parent->children.size())
+                fail();
+            parent->children.insert(parent->children.begin() + i, *value);
+        }
+        else if (op->value == "remove") {
+            node & element = child(*parent, last, false);
+            const size_t i = &element - &parent->children[0];
+            parent->children.erase(parent->children.begin() + i);
+            if (parent->kind == node::dict_kind)
+                parent->keys.erase(parent->keys.begin() + i);
+        }
+        else
+            fail();
+    }
+}
+
+struct string_writer : public writer::base {
+    std::string str;
+    string_writer() { set_pretty(false); }
+private:
+    virtual void write(const char * utf8, size_t len) { str.append(utf8, len); }
+};
+
+
+} // anonymous namespace
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+void diff(const std::string & a, const std::string & b, writer::base & delta)
+{
+    const node old_value(tree_reader::read(a, true));
+    const node new_value(tree_reader::read(b, true));
+    delta_writer out(delta);
+    path p;
+    delta.loon_arry_begin();
+    compare(old_value, new_value, p, out);
+    delta.loon_arry_end();
+}
+
+std::string diff(const std::string & a, const std::string & b)
+{
+    string_writer out;
+    diff(a, b, out);
+    return out.str;
+}
+
+void patch(const std::string & doc, const std::string & delta, writer::base & out)
+{
+    node value(tree_reader::read(doc, false));
+    apply(value, tree_reader::read(delta, false));
+    write_node(value, out);
+}
+
+std::string patch(const std::string & doc, const std::string & delta)
+{
+    string_writer out;
+    patch(doc, delta, out);
+    return out.str;
+}
+
+
+} // end of namespace loon
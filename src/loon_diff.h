@@ -0,0 +1,90 @@
+#ifndef LOON_DIFF_H_INCLUDED
+#define LOON_DIFF_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  The differences between two Loon values, as Loon.
+
+    loon::diff() compares the values of two Loon texts and writes a delta:
+    an arry of the changes that loon::patch() makes to the first value to
+    give the second. Each change is a dict:
+
+        (dict "op" "set"    "path" (arry "servers" 2 "port") "value" 9090)
+        (dict "op" "insert" "path" (arry "servers" 3) "value" (dict ...))
+        (dict "op" "remove" "path" (arry "old"))
+
+    A path leads from the top-level value through dict keys (strings) and
+    arry indices (numbers); the changes are made in order. "set" replaces a
+    value or adds a dict entry, "insert" puts a value into an arry before the
+    given index and "remove" takes out a dict entry or arry element.
+
+    Each text is read into a tree that holds a structural digest of every
+    value. The digest is diff's own: it is built with the hash128 of
+    loon_canonical.h from the canonical numbers and sorted dict entries, but
+    it is not the digest canonical::hash_text() gives for the same value.
+    Values with the same digest are not compared further, so once the texts
+    are read the comparison costs time in proportion to the changes, not the
+    size of the values. Differences of form alone, such as layout, comments,
+    dict entry order or the way a number is written, are not changes. So the
+    text patch() gives has the value of the second text, but is written by
+    the given writer.
+
+    A dict in which a key appears more than once is replaced as a whole if
+    it has changed.
+*/
+
+
+#include "loon_writer.h"
+
+#include <string>
+
+
+namespace loon {
+
+
+// Write to 'delta' the changes that turn the value of the Loon text 'a'
+// into the value of 'b'. Throws a loon::reader::exception if either text
+// is not valid Loon, or with id bad_diff if it doesn't hold exactly one value.
+void diff(const std::string & a, const std::string & b, writer::base & delta);
+
+// as above, returning the delta as compact Loon text; "(arry)" if the values
+// are the same
+std::string diff(const std::string & a, const std::string & b);
+
+// Write to 'out' the value of the Loon text 'doc' with the changes in the
+// given 'delta' made to it. Throws a loon::reader::exception with id
+// bad_diff if 'delta' is not a delta or doesn't fit the value of 'doc'.
+void patch(const std::string & doc, const std::string & delta, writer::base & out);
+
+// as above, returning the result as compact Loon text
+std::string patch(const std::string & doc, const std::string & delta);
+
+
+} // end of namespace loon
+#endif
@@ -0,0 +1,425 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+#include "loon_incremental.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+
+namespace loon {
+namespace incremental {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+// build the nodes for a slice of Loon text; offsets are from the start of the text
+class tree_builder : public loon::reader::base {
+public:
+    std::vector<node> values; // the top-level values in the slice
+
+    explicit tree_builder(uint64_t start) : prev_end_(start) {}
+
+private:
+    struct open_list {
+        node list;
+        uint64_t prev_end; // end of the list's last element so far
+    };
+    std::vector<open_list> stack_;
+    uint64_t prev_end_; // end of the last top-level value so far
+
+    // add a node of the given 'kind' ending at 'end' to the current list
+    node & add(node::kind_t kind, uint64_t end)
+    {
+        std::vector<node> & siblings(stack_.empty() ? values : stack_.back().list.children);
+        uint64_t & prev_end(stack_.empty() ? prev_end_ : stack_.back().prev_end);
+        siblings.push_back(node());
+        node & n(siblings.back());
+        n.kind = kind;
+        n.begin = prev_end;
+        n.end = end;
+        prev_end = end;
+        return n;
+    }
+
+    void list_begin(node::kind_t kind)
+    {
+        open_list o;
+        o.list.kind = kind;
+        o.list.begin = stack_.empty() ? prev_end_ : stack_.back().prev_end;
+        o.list.head = current_offset() - o.list.begin; // (current byte follows the symbol)
+        o.prev_end = current_offset();
+        stack_.push_back(std::move(o));
+    }
+
+    void list_end()
+    {
+        node list(std::move(stack_.back().list));
+        stack_.pop_back();
+        for (size_t i = 0; i < list.children.size(); ++i) {
+            list.children[i].begin -= list.begin;
+            list.children[i].end -= list.begin;
+        }
+        const uint64_t begin = list.begin;
+        node & n(add(list.kind, current_offset() + 1)); // (current byte is the closing ')')
+        n = std::move(list);
+        n.begin = begin;
+        n.end = current_offset() + 1;
+    }
+
+    virtual void loon_arry_begin() { list_begin(node::arry_kind); }
+    virtual void loon_arry_end() { list_end(); }
+    virtual void loon_dict_begin() { list_begin(node::dict_kind); }
+    virtual void loon_dict_end() { list_end(); }
+
+    // numbers and symbols end at the byte that follows them; strings end at
+    // their closing quote
+
+    virtual void loon_dict_key(const char * utf8, size_t len)
+    {
+        add(node::string_kind, current_offset() + 1).value.assign(utf8, len);
+    }
+
+    virtual void loon_string(const char * utf8, size_t len)
+    {
+        add(node::string_kind, current_offset() + 1).value.assign(utf8, len);
+    }
+
+    virtual void loon_null()
+    {
+        add(node::null_kind, current_offset());
+    }
+
+    virtual void loon_bool(bool value)
+    {
+        add(node::bool_kind, current_offset()).value = value ? "true" : "false";
+    }
+
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+    {
+        node & n(add(node::number_kind, current_offset()));
+        n.value.assign(utf8, len);
+        n.ntype = ntype;
+    }
+};
+
+// return true iff 'a' and 'b' hold the same values, wherever they are
+bool same(const node & a, const node & b)
+{
+    std::vector<std::pair<const node *, const node *> > todo(1, std::make_pair(&a, &b));
+    while (!todo.empty()) {
+        const node & x(*todo.back().first);
+        const node & y(*todo.back().second);
+        todo.pop_back();
+        if (x.kind != y.kind || x.value != y.value || x.children.size() != y.children.size())
+            return false;
+        for (size_t i = 0; i < x.children.size(); ++i)
+            todo.push_back(std::make_pair(&x.children[i], &y.children[i]));
+    }
+    return true;
+}
+
+// the path of element 'i' of the given 'list', whose path is 'list_path'
+path child_path(const node & list, bool is_top, const path & list_path, size_t i)
+{
+    path p(list_path);
+    if (!is_top) {
+        if (list.kind == node::dict_kind)
+            p.push_back(list.children[i - 1].value);
+        else
+            p.push_back(std::to_string(static_cast<unsigned long long>(i)));
+    }
+    return p;
+}
+
+// add the path of each key whose value differs between the dict entries in
+// 'before' and 'after' to 'changed'
+void changed_keys(
+    const node * before, size_t before_size,
+    const node * after, size_t after_size,
+    const path & dict_path, std::vector<path> & changed)
+{
+    typedef std::map<std::string, const node *> entries;
+    entries old_entries, new_entries;
+    for (size_t i = 0; i + 1 < before_size; i += 2)
+        old_entries.insert(std::make_pair(before[i].value, &before[i + 1]));
+    for (size_t i = 0; i + 1 < after_size; i += 2)
+        new_entries.insert(std::make_pair(after[i].value, &after[i + 1]));
+
+    for (size_t i = 0; i + 1 < before_size; i += 2) {
+        entries::const_iterator n = new_entries.find(before[i].value);
+        if ((n == new_entries.end() || !same(*n->second, before[i + 1]))
+            && old_entries[before[i].value] == &before[i + 1]) { // (report each key once)
+            path p(dict_path);
+            p.push_back(before[i].value);
+            changed.push_back(p);
+        }
+    }
+    for (size_t i = 0; i + 1 < after_size; i += 2) {
+        if (old_entries.find(after[i].value) == old_entries.end()
+            && new_entries[after[i].value] == &after[i + 1]) {
+            path p(dict_path);
+            p.push_back(after[i].value);
+            changed.push_back(p);
+        }
+    }
+}
+
+// return true iff 'text' starts with the UTF-8 BOM, which the reader ignores
+bool starts_with_bom(const std::string & text)
+{
+    return text.compare(0, 3, "\xEF\xBB\xBF") == 0;
+}
+
+// return true iff replacing [offset, offset + len) of 'text' with 'replacement'
+// may make, break or move a line splice ({\} followed by a newline) or split
+// a {CR} {LF} newline; a splice moves where the tokens either side of it end
+bool splice_edit(const std::string & text, uint64_t offset, uint64_t len, const std::string & replacement)
+{
+    const size_t from = static_cast<size_t>(offset < 2 ? 0 : offset - 2); // (e.g. {\} {CR} | {LF})
+    return text.find('\\', from) <= offset + len // (or just after the edit)
+        || replacement.find('\\') != std::string::npos
+        || (offset > 0 && text[static_cast<size_t>(offset - 1)] == '\r');
+}
+
+bool end_less(const node & n, uint64_t offset) { return n.end < offset; }
+bool begin_greater(uint64_t offset, const node & n) { return offset < n.begin; }
+
+
+} // anonymous namespace
+
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+document::document()
+: valid_(false), bytes_read_(0)
+{
+    top_.kind = node::arry_kind;
+    top_.end = 1;
+}
+
+void document::parse(const std::string & text)
+{
+    if (&text != &text_)
+        text_ = text;
+    valid_ = false;
+    bytes_read_ = text_.size();
+
+    tree_builder b(0);
+    b.process_chunk(text_.data(), text_.size(), /*is_last_chunk=*/true);
+
+    top_ = node();
+    top_.kind = node::arry_kind;
+    top_.children.swap(b.values); // (top_ begins at 0, so the offsets are already relative)
+    top_.end = text_.size() + 1; // (as if there were a closing ')' after the text)
+    valid_ = true;
+}
+
+/*  Read the slots of the elements of 'list' touched by the edit of the old
+    text [b, e) again, from the new text; 'delta' is the change in the
+    length of the text. 'list_begin' is the offset of 'list' in the text.
+    The edit must lie between the list's arry/dict symbol and its ')'.
+    Return false if the slots can't be read in isolation; otherwise update
+    'list' and add what changed to 'changed'.
+*/
+bool document::reparse(node & list, uint64_t list_begin, const path & list_path,
+    uint64_t b, uint64_t e, int64_t delta, std::vector<path> & changed)
+{
+    const bool is_top = &list == &top_;
+    const uint64_t head = list_begin + list.head;
+    const uint64_t close = list_begin - list.begin + list.end - 1; // (list.end is from the parent's begin)
+
+    // the elements whose slots touch the edit are [i, j)
+    std::vector<node> & children(list.children);
+    const size_t n = children.size();
+    size_t i = std::lower_bound(children.begin(), children.end(), b - list_begin, end_less) - children.begin();
+    size_t j = std::upper_bound(children.begin(), children.end(), e - list_begin, begin_greater) - children.begin();
+    if (i == n)
+        j = n;
+    if (list.kind == node::dict_kind) { // keep keys with their values
+        i &= ~size_t(1);
+        j += j & 1;
+    }
+    const uint64_t from = i < n ? list_begin + children[i].begin : (n ? list_begin + children[n - 1].end : head);
+    uint64_t to = j > i ? list_begin + children[j - 1].end : from;
+    if (e > to)
+        to = close; // the edit touches the space after the last element
+    const uint64_t new_to = to + delta;
+    if (new_to < from || new_to > text_.size())
+        return false;
+
+    tree_builder builder(from);
+    try {
+        if (from == 0)
+            builder.reset(); // (so a BOM is recognised)
+        else
+            builder.reset_at(from, 1);
+        builder.process_chunk(text_.data() + from, static_cast<size_t>(new_to - from), false);
+        if (new_to < text_.size() && !builder.can_end_slice(static_cast<uint8_t>(text_[new_to])))
+            return false; // e.g. the edit opened a string or comment
+        builder.process_chunk(0, 0, /*is_last_chunk=*/true);
+    }
+    catch (const loon::reader::exception &) {
+        return false;
+    }
+    bytes_read_ += new_to - from;
+
+    std::vector<node> & values(builder.values);
+    if (list.kind == node::dict_kind) {
+        if (values.size() % 2 != 0)
+            return false;
+        for (size_t k = 0; k < values.size(); k += 2)
+            if (values[k].kind != node::string_kind)
+                return false;
+    }
+
+    // what changed?
+    if (list.kind == node::dict_kind && !is_top)
+        changed_keys(j > i ? &children[i] : 0, j - i, values.empty() ? 0 : &values[0], values.size(), list_path, changed);
+    else {
+        bool same_elements = j - i == values.size();
+        for (size_t k = 0; same_elements && k < values.size(); ++k)
+            same_elements = same(children[i + k], values[k]);
+        if (!same_elements)
+            changed.push_back(list_path);
+    }
+
+    // replace the old elements with the new
+    for (size_t k = 0; k < values.size(); ++k) {
+        values[k].begin -= list_begin;
+        values[k].end -= list_begin;
+    }
+    children.erase(children.begin() + i, children.begin() + j);
+    children.insert(children.begin() + i,
+        std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+    for (size_t k = i + values.size(); k < children.size(); ++k) {
+        children[k].begin += delta;
+        children[k].end += delta;
+    }
+    list.end += delta;
+    return true;
+}
+
+std::vector<path> document::edit(uint64_t offset, uint64_t len, const std::string & replacement)
+{
+    if (offset > text_.size() || len > text_.size() - offset)
+        throw std::out_of_range("loon::incremental::document::edit");
+
+    // an edit that moves a BOM from the start of the text, or puts one there,
+    // changes how the text after the BOM is read; so may an edit near a line
+    // splice
+    const bool bom_edit = offset < 3 && starts_with_bom(text_);
+    const bool splice = splice_edit(text_, offset, len, replacement);
+    text_.replace(static_cast<size_t>(offset), static_cast<size_t>(len), replacement);
+    const int64_t delta = static_cast<int64_t>(replacement.size()) - static_cast<int64_t>(len);
+    std::vector<path> changed;
+    if (!valid_ || bom_edit || splice || (offset < 3 && starts_with_bom(text_))) {
+        parse(text_);
+        changed.push_back(path());
+        return changed;
+    }
+    bytes_read_ = 0;
+
+    // find the lists that enclose the edit, from the outermost inwards
+    struct level {
+        node * list;
+        uint64_t begin;     // offset of the list in the text
+        size_t index;       // position of the list in its parent
+        path list_path;
+    };
+    std::vector<level> chain;
+    const level top = { &top_, 0, 0, path() };
+    chain.push_back(top);
+    uint64_t b = offset, e = offset + len;
+    for (;;) {
+        const level & l(chain.back());
+        std::vector<node> & children(l.list->children);
+        const size_t i = std::upper_bound(children.begin(), children.end(), b - l.begin,
+            begin_greater) - children.begin();
+        if (i == 0)
+            break;
+        node & child(children[i - 1]);
+        const uint64_t child_begin = l.begin + child.begin;
+        const bool is_list = child.kind == node::arry_kind || child.kind == node::dict_kind;
+        if (!is_list || b <= child_begin + child.head || e > l.begin + child.end - 1)
+            break;
+        const level inner = { &child, child_begin, i - 1,
+            child_path(*l.list, l.list == &top_, l.list_path, i - 1) };
+        chain.push_back(inner);
+    }
+
+    // read again the smallest part of the text we can
+    for (size_t k = chain.size(); k--; ) {
+        if (reparse(*chain[k].list, chain[k].begin, chain[k].list_path, b, e, delta, changed)) {
+            // move everything that follows the edited list
+            for (size_t m = k; m--; ) {
+                std::vector<node> & children(chain[m].list->children);
+                for (size_t c = chain[m + 1].index + 1; c < children.size(); ++c) {
+                    children[c].begin += delta;
+                    children[c].end += delta;
+                }
+                chain[m].list->end += delta;
+            }
+            return changed;
+        }
+        changed.clear();
+        if (k) { // try again with the whole slot of the list in its parent
+            b = chain[k].begin;
+            e = chain[k - 1].begin + chain[k].list->end;
+        }
+    }
+
+    // the edited text can't be read in parts; read it all
+    parse(text_);
+    changed.push_back(path());
+    return changed;
+}
+
+
+
+}} // end of namespace loon::incremental
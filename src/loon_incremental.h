@@ -0,0 +1,114 @@
+#ifndef LOON_INCREMENTAL_H_INCLUDED
+#define LOON_INCREMENTAL_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  Incremental re-parsing of Loon text after small edits.
+
+    loon::incremental::document holds Loon text and a tree of the values in
+    it. Each value in the tree knows the extent of its "slot": the bytes from
+    the end of the previous value in the same list (or the end of the list's
+    arry/dict symbol) to the end of the value itself, so the slots of a list's
+    elements tile the inside of the list. When the text is edited only the
+    slots touched by the edit are read again, in the smallest list that
+    encloses the edit. If that fails, because the edit changed where the list
+    begins or ends or opened a string or comment that runs past the slots, the
+    enclosing list is read again, and so on out to the whole text.
+
+    Extents are relative to the start of the parent's slot, so an edit only
+    moves the values that follow it in the same lists, never their contents.
+*/
+
+
+#include "loon_reader.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace loon {
+namespace incremental {
+
+
+struct node {
+    enum kind_t { null_kind, bool_kind, number_kind, string_kind, arry_kind, dict_kind };
+
+    kind_t kind;
+    loon::reader::num_type ntype;   // number_kind only
+    std::string value;              // the text of a number, the value of a string,
+                                    // or "true" or "false"
+    uint64_t begin, end;            // the slot, relative to the parent's begin
+    uint64_t head;                  // lists: end of the arry/dict symbol, relative to begin
+    std::vector<node> children;     // lists: the elements; for a dict, key, value, key, value...
+
+    node() : kind(null_kind), ntype(loon::reader::num_dec_int), begin(0), end(0), head(0) {}
+};
+
+// the location of a value: the keys of the dicts and the indices (in
+// decimal) of the arrys that lead to it from the top-level values
+typedef std::vector<std::string> path;
+
+class document {
+public:
+    document();
+
+    // Parse the whole of the given Loon 'text'. Throws a loon::reader::exception
+    // if the text is not valid Loon.
+    void parse(const std::string & text);
+
+    // Replace the 'len' bytes at 'offset' in the text with 'replacement' and
+    // bring the tree up to date. Return the path of each dict key whose value
+    // was added, removed or changed; for a change in an arry the path of the
+    // arry is returned. (The top-level values have the empty path.) Throws a
+    // loon::reader::exception if the edited text is not valid Loon; the edit
+    // is kept and the next edit will parse the whole text again.
+    std::vector<path> edit(uint64_t offset, uint64_t len, const std::string & replacement);
+
+    const std::string & text() const { return text_; }
+
+    // a list whose children are the top-level values in the text
+    const node & top() const { return top_; }
+
+    // the number of bytes read by the last call to parse() or edit()
+    uint64_t bytes_read() const { return bytes_read_; }
+
+private:
+    std::string text_;
+    node top_;
+    bool valid_;        // the tree matches text_
+    uint64_t bytes_read_;
+
+    bool reparse(node & list, uint64_t list_begin, const path & list_path,
+        uint64_t b, uint64_t e, int64_t delta, std::vector<path> & changed);
+};
+
+
+}} // end of namespace loon::incremental
+#endif
@@ -0,0 +1,385 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+#include "loon_index.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+
+namespace loon {
+namespace index {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+void fail(loon::reader::error_id id, int line)
+{
+    throw loon::reader::exception(id, line, loon::reader::exception_message(id, line).c_str());
+}
+
+// return given 'n' as a decimal string
+std::string to_decimal(uint64_t n)
+{
+    char buf[20]; // 0 .. 18446744073709551615
+    char * const end = buf + sizeof(buf);
+    char * p = end;
+    do {
+        *--p = static_cast<char>('0' + n % 10);
+        n /= 10;
+    }
+    while (n);
+    return std::string(p, end);
+}
+
+// read the sidecar written by write_index()
+class index_reader : public loon::reader::base {
+public:
+    arry_index result;
+
+    index_reader() : depth_(0), key_(key_none), have_offset_(false), offset_(0), seen_(0) {}
+
+    // check the index is complete and consistent and number its entries
+    void finish()
+    {
+        const uint64_t every = result.every;
+        if (seen_ != 7 || depth_ != 0 || have_offset_ || every == 0)
+            bad();
+        const size_t n = result.entries.size();
+        if (n != result.size / every + 1 + (result.size % every != 0 ? 1 : 0))
+            bad();
+        for (size_t i = 0; i < n; ++i) {
+            result.entries[i].element = std::min<uint64_t>(i * every, result.size);
+            if (i && result.entries[i].offset < result.entries[i - 1].offset)
+                bad();
+        }
+    }
+
+private:
+    int depth_;
+    enum { key_none, key_every, key_size, key_entries } key_;
+    bool have_offset_;
+    uint64_t offset_;
+    unsigned seen_; // a bit for each of every, size and entries
+
+    void bad() const { fail(loon::reader::bad_index, current_line()); }
+
+    virtual void loon_dict_begin()
+    {
+        if (depth_++ != 0)
+            bad();
+    }
+
+    virtual void loon_dict_end()
+    {
+        --depth_;
+    }
+
+    virtual void loon_arry_begin()
+    {
+        if (depth_++ != 1 || key_ != key_entries)
+            bad();
+        seen_ |= 4;
+    }
+
+    virtual void loon_arry_end()
+    {
+        --depth_;
+    }
+
+    virtual void loon_dict_key(const char * utf8, size_t len)
+    {
+        const std::string k(utf8, len);
+        if (k == "every")
+            key_ = key_every;
+        else if (k == "size")
+            key_ = key_size;
+        else if (k == "entries")
+            key_ = key_entries;
+        else
+            bad();
+    }
+
+    virtual void loon_null() { bad(); }
+    virtual void loon_bool(bool) { bad(); }
+    virtual void loon_string(const char *, size_t) { bad(); }
+
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+    {
+        if (ntype != loon::reader::num_dec_int || *utf8 == '-' || len > 20)
+            bad();
+        const uint64_t n = std::strtoull(std::string(utf8, len).c_str(), 0, 10);
+
+        if (depth_ == 1 && key_ == key_every) {
+            result.every = n;
+            seen_ |= 1;
+        }
+        else if (depth_ == 1 && key_ == key_size) {
+            result.size = n;
+            seen_ |= 2;
+        }
+        else if (depth_ == 2 && !have_offset_) {
+            offset_ = n;
+            have_offset_ = true;
+        }
+        else if (depth_ == 2) {
+            const entry e = { 0, offset_, static_cast<int>(n) };
+            result.entries.push_back(e);
+            have_offset_ = false;
+        }
+        else
+            bad();
+    }
+};
+
+
+} // anonymous namespace
+
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+size_t arry_index::entry_for(uint64_t i) const
+{
+    if (entries.empty())
+        return 0;
+    const uint64_t n = every ? i / every : 0;
+    return static_cast<size_t>(std::min<uint64_t>(n, entries.size() - 1));
+}
+
+
+
+// builder
+
+builder::builder(uint64_t every)
+{
+    reset();
+    index_.every = every ? every : 1;
+    set_raw_strings(true); // (we don't need the string values)
+}
+
+void builder::reset()
+{
+    base::reset();
+    const uint64_t every = index_.every;
+    index_ = arry_index();
+    index_.every = every;
+    depth_ = 0;
+    count_ = 0;
+    done_ = false;
+}
+
+// a value is starting at the top level; it must be the one and only arry
+void builder::top_level_value()
+{
+    fail(loon::reader::index_requires_arry, current_line());
+}
+
+// an element of the top-level arry ended; the next element may start at 'boundary'
+void builder::element_ends(uint64_t boundary)
+{
+    if (++count_ % index_.every == 0) {
+        const entry e = { count_, boundary, current_line() };
+        index_.entries.push_back(e);
+    }
+}
+
+void builder::list_ends()
+{
+    if (--depth_ == 1)
+        element_ends(current_offset() + 1); // (current byte is the closing ')')
+    else if (depth_ == 0) {
+        // the top-level arry ended: record where it ends, if not already recorded
+        index_.size = count_;
+        if (index_.entries.back().element != count_) {
+            const entry e = { count_, current_offset(), current_line() };
+            index_.entries.push_back(e);
+        }
+        done_ = true;
+    }
+}
+
+void builder::loon_arry_begin()
+{
+    if (depth_ == 0) {
+        if (done_)
+            top_level_value();
+        const entry e = { 0, current_offset(), current_line() };
+        index_.entries.push_back(e);
+    }
+    ++depth_;
+}
+
+void builder::loon_dict_begin()
+{
+    if (depth_ == 0)
+        top_level_value();
+    ++depth_;
+}
+
+void builder::loon_arry_end()
+{
+    list_ends();
+}
+
+void builder::loon_dict_end()
+{
+    list_ends();
+}
+
+void builder::loon_dict_key(const char *, size_t)
+{
+}
+
+// numbers and symbols end at the byte that follows them, which is the
+// boundary; strings end at their closing quote, which is not
+
+void builder::loon_null()
+{
+    if (depth_ == 0)
+        top_level_value();
+    if (depth_ == 1)
+        element_ends(current_offset());
+}
+
+void builder::loon_bool(bool)
+{
+    if (depth_ == 0)
+        top_level_value();
+    if (depth_ == 1)
+        element_ends(current_offset());
+}
+
+void builder::loon_number(const char *, size_t, loon::reader::num_type)
+{
+    if (depth_ == 0)
+        top_level_value();
+    if (depth_ == 1)
+        element_ends(current_offset());
+}
+
+void builder::loon_string(const char *, size_t)
+{
+    if (depth_ == 0)
+        top_level_value();
+    if (depth_ == 1)
+        element_ends(current_offset() + 1);
+}
+
+
+
+arry_index build_index(std::istream & in, uint64_t every, size_t chunk_size)
+{
+    builder b(every);
+    std::vector<char> buf(chunk_size ? chunk_size : 1);
+    while (in) {
+        in.read(&buf[0], buf.size());
+        b.process_chunk(&buf[0], static_cast<size_t>(in.gcount()), /*is_last_chunk=*/false);
+    }
+    b.process_chunk(0, 0, /*is_last_chunk=*/true);
+    if (b.index().entries.empty()) // there was no Loon value at all
+        fail(loon::reader::index_requires_arry, b.current_line());
+    return b.index();
+}
+
+void write_index(const arry_index & index, loon::writer::base & out)
+{
+    std::string n;
+    out.loon_dict_begin();
+    out.loon_dict_key("every");
+    n = to_decimal(index.every);
+    out.loon_preformatted_value(n.c_str(), n.size());
+    out.loon_dict_key("size");
+    n = to_decimal(index.size);
+    out.loon_preformatted_value(n.c_str(), n.size());
+    out.loon_dict_key("entries");
+    out.loon_arry_begin();
+    for (size_t i = 0; i < index.entries.size(); ++i) {
+        n = to_decimal(index.entries[i].offset);
+        out.loon_preformatted_value(n.c_str(), n.size());
+        out.loon_dec_s32(index.entries[i].line);
+    }
+    out.loon_arry_end();
+    out.loon_dict_end();
+}
+
+arry_index read_index(std::istream & in)
+{
+    index_reader r;
+    std::vector<char> buf(4096);
+    while (in) {
+        in.read(&buf[0], buf.size());
+        r.process_chunk(&buf[0], static_cast<size_t>(in.gcount()), /*is_last_chunk=*/false);
+    }
+    r.process_chunk(0, 0, /*is_last_chunk=*/true);
+    r.finish();
+    return r.result;
+}
+
+void read_slice(std::istream & in, const arry_index & index, size_t first, size_t last,
+    loon::reader::base & reader, size_t chunk_size)
+{
+    if (first > last || last >= index.entries.size())
+        fail(loon::reader::bad_index, 0);
+    const entry & from = index.entries[first];
+    uint64_t remaining = index.entries[last].offset - from.offset;
+
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(from.offset));
+    reader.reset_at(from.offset, from.line);
+    std::vector<char> buf(chunk_size ? chunk_size : 1);
+    while (remaining) {
+        in.read(&buf[0], static_cast<std::streamsize>(std::min<uint64_t>(buf.size(), remaining)));
+        const size_t n = static_cast<size_t>(in.gcount());
+        if (n == 0) // the text is shorter than the index says it is
+            fail(loon::reader::bad_index, reader.current_line());
+        reader.process_chunk(&buf[0], n, /*is_last_chunk=*/false);
+        remaining -= n;
+    }
+    reader.process_chunk(0, 0, /*is_last_chunk=*/true);
+}
+
+
+
+}} // end of namespace loon::index
@@ -0,0 +1,137 @@
+#ifndef LOON_INDEX_H_INCLUDED
+#define LOON_INDEX_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  A random-access index of the elements of a large top-level arry.
+
+    Building the index reads the whole Loon text once and records the byte
+    offset and line number of the boundary before every Kth element of the
+    top-level arry. Each boundary lies between tokens, so the text from one
+    recorded boundary to the next can be read on its own by a fresh
+    loon::reader::base as a sequence of top-level values: the elements of
+    that part of the arry. This lets separate workers read separate slices
+    of a huge arry without each lexing the text that precedes its slice.
+
+    The index may be saved as a small Loon "sidecar" file:
+
+        (dict "every" K "size" N "entries" (arry offset line offset line ...))
+
+    with one offset/line pair for elements 0, K, 2K, ... and a final pair for
+    the end of the arry (element N).
+*/
+
+
+#include "loon_reader.h"
+#include "loon_writer.h"
+
+#include <istream>
+#include <vector>
+#include <cstdint>
+
+
+namespace loon {
+namespace index {
+
+
+struct entry {
+    uint64_t element;   // the number of elements that precede this boundary
+    uint64_t offset;    // the byte offset of the boundary in the Loon text
+    int line;           // the line number of the boundary
+};
+
+struct arry_index {
+    uint64_t every;     // there is an entry for every 'every'th element
+    uint64_t size;      // the number of elements in the arry
+    std::vector<entry> entries; // for elements 0, every, 2*every, ... and size
+
+    arry_index() : every(0), size(0) {}
+
+    // return the position in 'entries' of the last entry at or before element 'i'
+    size_t entry_for(uint64_t i) const;
+};
+
+
+// Build an arry_index from Loon text fed to process_chunk(). The text is fully
+// validated, just as loon::reader::base would, and must consist of a single
+// top-level arry (or a loon::reader::exception with id index_requires_arry is
+// thrown).
+class builder : private loon::reader::base {
+public:
+    explicit builder(uint64_t every);
+
+    using base::process_chunk;
+    using base::current_line;
+
+    virtual void reset();
+
+    // the index; complete once the last chunk has been processed
+    const arry_index & index() const { return index_; }
+
+private:
+    arry_index index_;
+    int depth_;
+    uint64_t count_;    // number of elements seen so far
+    bool done_;         // the top-level arry has ended
+
+    void top_level_value();
+    void element_ends(uint64_t boundary);
+    void list_ends();
+
+    virtual void loon_arry_begin();
+    virtual void loon_arry_end();
+    virtual void loon_dict_begin();
+    virtual void loon_dict_end();
+    virtual void loon_dict_key(const char * utf8, size_t len);
+    virtual void loon_null();
+    virtual void loon_bool(bool value);
+    virtual void loon_string(const char * utf8, size_t len);
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype);
+};
+
+// read all the Loon text from 'in' and return an index of every 'every'th element
+arry_index build_index(std::istream & in, uint64_t every, size_t chunk_size = 64 * 1024);
+
+// write the given 'index' as a Loon sidecar to 'out'
+void write_index(const arry_index & index, loon::writer::base & out);
+
+// read an index written by write_index() from 'in'; throws a
+// loon::reader::exception with id bad_index if 'in' does not hold an index
+arry_index read_index(std::istream & in);
+
+// Feed the slice of the Loon text in 'in' from index entry 'first' up to
+// index entry 'last' to the given 'reader', which receives the elements
+// [entries[first].element, entries[last].element) as top-level values. The
+// 'reader' is reset before the slice is read. 'in' must be seekable.
+void read_slice(std::istream & in, const arry_index & index, size_t first, size_t last,
+    loon::reader::base & reader, size_t chunk_size = 64 * 1024);
+
+
+}} // end of namespace loon::index
+#endif
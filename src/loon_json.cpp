@@ -0,0 +1,624 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+#include "loon_json.h"
+
+#include <cassert>
+#include <climits>
+
+
+namespace loon {
+namespace json {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+inline bool is_digit(uint8_t ch)
+{
+    return unsigned(ch) - '0' < 10;
+}
+
+// return true iff 'ch' may be part of a JSON number
+inline bool is_number_char(uint8_t ch)
+{
+    return is_digit(ch) || ch == '-' || ch == '+' || ch == '.' || ch == 'e' || ch == 'E';
+}
+
+// return true iff 'v' is exactly the given null-terminated 's'
+inline bool equal(const loon::reader::vector_uint8 & v, const char * s)
+{
+    const size_t len = std::strlen(s);
+    return v.size() == len && std::memcmp(&v[0], s, len) == 0;
+}
+
+// return true iff 'v' is a JSON number; set 'ntype' to the type of number
+//    number = [ minus ] int [ frac ] [ exp ]
+//    int    = zero / ( digit1-9 *DIGIT )
+//    frac   = decimal-point 1*DIGIT
+//    exp    = e [ minus / plus ] 1*DIGIT
+bool json_number(const loon::reader::vector_uint8 & v, loon::reader::num_type & ntype)
+{
+    const uint8_t * p = &v[0];
+    const uint8_t * const end = p + v.size();
+
+    ntype = loon::reader::num_dec_int;
+    if (*p == '-')
+        ++p;
+    if (p == end || !is_digit(*p))
+        return false;
+    if (*p++ == '0') {
+        if (p != end && is_digit(*p))
+            return false; // no leading zeros
+    }
+    else {
+        while (p != end && is_digit(*p))
+            ++p;
+    }
+
+    if (p != end && *p == '.') {
+        ntype = loon::reader::num_float;
+        if (++p == end || !is_digit(*p))
+            return false;
+        while (p != end && is_digit(*p))
+            ++p;
+    }
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ntype = loon::reader::num_float;
+        if (++p != end && (*p == '-' || *p == '+'))
+            ++p;
+        if (p == end || !is_digit(*p))
+            return false;
+        while (p != end && is_digit(*p))
+            ++p;
+    }
+
+    return p == end;
+}
+
+// append the decimal representation of the hexadecimal digits [p, end) to 's'
+void hex_to_decimal(std::string & s, const char * p, const char * end)
+{
+    std::vector<uint8_t> digits(1, 0); // decimal digits, least significant first
+    for (; p != end; ++p) {
+        const char c = *p;
+        unsigned carry = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+        for (size_t i = 0; i < digits.size(); ++i) {
+            const unsigned d = digits[i] * 16 + carry;
+            digits[i] = static_cast<uint8_t>(d % 10);
+            carry = d / 10;
+        }
+        for (; carry; carry /= 10)
+            digits.push_back(static_cast<uint8_t>(carry % 10));
+    }
+    while (digits.size() > 1 && digits.back() == 0)
+        digits.pop_back();
+    for (size_t i = digits.size(); i--; )
+        s += static_cast<char>('0' + digits[i]);
+}
+
+// append the decimal digits [p, end) to 's' without leading zeros; if there are
+// no digits append 'if_empty'
+void append_digits(std::string & s, const char * p, const char * end, const char * if_empty)
+{
+    while (end - p > 1 && *p == '0')
+        ++p;
+    if (p == end)
+        s += if_empty;
+    else
+        s.append(p, end);
+}
+
+
+} // anonymous namespace
+
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+// JSON reader
+
+void reader::fail() const
+{
+    throw loon::reader::exception(loon::reader::bad_json, current_line_,
+        loon::reader::exception_message(loon::reader::bad_json, current_line_, value_).c_str());
+}
+
+// a value is about to start: check one is allowed here
+void reader::begin_value()
+{
+    if (expect_ != ex_value && expect_ != ex_value_or_end)
+        fail();
+}
+
+// a value has ended: decide what may follow it
+void reader::end_value()
+{
+    expect_ = in_object_.empty() ? ex_nothing : ex_comma_or_end;
+}
+
+void reader::end_string()
+{
+    const loon::reader::error_id id = raw_strings_
+        ? loon::reader::check_string_escapes(value_)
+        : loon::reader::expand_string_escapes(value_);
+    if (id != loon::reader::no_error)
+        throw loon::reader::exception(id, current_line_,
+            loon::reader::exception_message(id, current_line_, value_).c_str());
+
+    const char * const p = value_.empty() ? "" : reinterpret_cast<const char *>(&value_[0]);
+    if (string_is_key_) {
+        loon_dict_key(p, value_.size());
+        expect_ = ex_colon;
+    }
+    else {
+        loon_string(p, value_.size());
+        end_value();
+    }
+}
+
+void reader::end_number()
+{
+    loon::reader::num_type ntype;
+    if (!json_number(value_, ntype))
+        fail();
+    loon_number(reinterpret_cast<const char *>(&value_[0]), value_.size(), ntype);
+    end_value();
+}
+
+void reader::end_literal()
+{
+    if (equal(value_, "true"))
+        loon_bool(true);
+    else if (equal(value_, "false"))
+        loon_bool(false);
+    else if (equal(value_, "null"))
+        loon_null();
+    else
+        fail();
+    end_value();
+}
+
+void reader::process(uint8_t ch)
+{
+    switch (token_) {
+    case in_string:
+        if (ch == '"') {
+            token_ = in_none;
+            end_string();
+        }
+        else if (ch < 0x20) // JSON allows DEL in a string, but no other control codes
+            fail();
+        else {
+            value_.push_back(ch);
+            if (ch == '\\')
+                token_ = in_string_escape;
+        }
+        return;
+
+    case in_string_escape:
+        // accumulate the char following the '\', whatever it is
+        value_.push_back(ch);
+        token_ = in_string;
+        return;
+
+    case in_number:
+        if (is_number_char(ch)) {
+            value_.push_back(ch);
+            return;
+        }
+        token_ = in_none;
+        end_number();
+        break; // ch is unprocessed
+
+    case in_literal:
+        if ('a' <= ch && ch <= 'z') {
+            value_.push_back(ch);
+            return;
+        }
+        token_ = in_none;
+        end_literal();
+        break; // ch is unprocessed
+
+    case in_none:
+        break;
+    }
+
+    switch (ch) {
+    case ' ': case '\t': case '\n': case '\r':
+        break;
+
+    case '[':
+        begin_value();
+        in_object_.push_back(false);
+        loon_arry_begin();
+        expect_ = ex_value_or_end;
+        break;
+
+    case '{':
+        begin_value();
+        in_object_.push_back(true);
+        loon_dict_begin();
+        expect_ = ex_key_or_end;
+        break;
+
+    case ']':
+        if (in_object_.empty() || in_object_.back()
+            || (expect_ != ex_value_or_end && expect_ != ex_comma_or_end))
+            fail();
+        in_object_.pop_back();
+        loon_arry_end();
+        end_value();
+        break;
+
+    case '}':
+        if (in_object_.empty() || !in_object_.back()
+            || (expect_ != ex_key_or_end && expect_ != ex_comma_or_end))
+            fail();
+        in_object_.pop_back();
+        loon_dict_end();
+        end_value();
+        break;
+
+    case ',':
+        if (expect_ != ex_comma_or_end)
+            fail();
+        expect_ = in_object_.back() ? ex_key : ex_value;
+        break;
+
+    case ':':
+        if (expect_ != ex_colon)
+            fail();
+        expect_ = ex_value;
+        break;
+
+    case '"':
+        string_is_key_ = expect_ == ex_key || expect_ == ex_key_or_end;
+        if (!string_is_key_)
+            begin_value();
+        value_.clear();
+        token_ = in_string;
+        break;
+
+    default:
+        value_.clear();
+        value_.push_back(ch);
+        if (is_digit(ch) || ch == '-') {
+            begin_value();
+            token_ = in_number;
+        }
+        else if ('a' <= ch && ch <= 'z') {
+            begin_value();
+            token_ = in_literal;
+        }
+        else
+            fail();
+        break;
+    }
+}
+
+void reader::process_chunk(const char * utf8, size_t len, bool is_last_chunk)
+{
+    static_assert(CHAR_BIT == 8, "char is not 8 bits; code assumes it is");
+    const uint8_t * p = reinterpret_cast<const uint8_t *>(utf8);
+    const uint8_t * const end = p + len;
+
+    for (; p != end; ++p) {
+        process(*p);
+
+        // update line counter if this is a newline
+        if (*p == '\r') {
+            ++current_line_;
+            cr_ = true;
+        }
+        else {
+            if (*p == '\n' && !cr_)
+                ++current_line_;
+            cr_ = false;
+        }
+    }
+
+    if (is_last_chunk) {
+        if (token_ == in_number) {
+            token_ = in_none;
+            end_number();
+        }
+        else if (token_ == in_literal) {
+            token_ = in_none;
+            end_literal();
+        }
+        if (token_ != in_none || expect_ != ex_nothing)
+            fail(); // unclosed string, array or object, or no value at all
+    }
+}
+
+void reader::reset()
+{
+    expect_ = ex_value;
+    token_ = in_none;
+    in_object_.clear();
+    value_.clear();
+    current_line_ = 1;
+    cr_ = false;
+    string_is_key_ = false;
+}
+
+reader::reader()
+: raw_strings_(false)
+{
+    reset();
+}
+
+reader::~reader()
+{
+}
+
+
+
+// JSON writer
+
+// a value or key is about to be written: write the comma that precedes it, if any
+void writer::separate()
+{
+    if (depth_ == 0 && complete_) {
+        throw loon::writer::exception(loon::writer::extra_top_level_value,
+            "JSON writer error: a JSON text may contain just one top-level value.");
+    }
+    if (need_comma_)
+        write(",", 1);
+}
+
+// a value has been written
+void writer::value_written()
+{
+    need_comma_ = true;
+    if (depth_ == 0)
+        complete_ = true;
+}
+
+void writer::loon_arry_begin()
+{
+    separate();
+    write("[", 1);
+    need_comma_ = false;
+    ++depth_;
+}
+
+void writer::loon_arry_end()
+{
+    write("]", 1);
+    if (depth_)
+        --depth_;
+    value_written();
+}
+
+void writer::loon_dict_begin()
+{
+    separate();
+    write("{", 1);
+    need_comma_ = false;
+    ++depth_;
+}
+
+void writer::loon_dict_end()
+{
+    write("}", 1);
+    if (depth_)
+        --depth_;
+    value_written();
+}
+
+void writer::loon_dict_key(const std::string & key_name)
+{
+    loon::writer::detail::escape(buf_, key_name);
+    loon_preformatted_key(reinterpret_cast<const char *>(&buf_[0]), buf_.size());
+}
+
+void writer::loon_preformatted_key(const char * utf8, size_t len)
+{
+    separate();
+    write(utf8, len);
+    write(":", 1);
+    need_comma_ = false;
+}
+
+void writer::loon_preformatted_value(const char * utf8, size_t len)
+{
+    separate();
+    write(utf8, len);
+    value_written();
+}
+
+void writer::loon_null()
+{
+    loon_preformatted_value("null", 4);
+}
+
+void writer::loon_bool(bool value)
+{
+    if (value)
+        loon_preformatted_value("true", 4);
+    else
+        loon_preformatted_value("false", 5);
+}
+
+void writer::loon_dec_u32(uint32_t n)
+{
+    char buf[11];
+    char * const end = buf + sizeof(buf);
+    const char * const p = loon::writer::detail::dec_u32(end, n);
+    loon_preformatted_value(p, end - p);
+}
+
+void writer::loon_dec_s32(int32_t n)
+{
+    char buf[11];
+    char * const end = buf + sizeof(buf);
+    const char * const p = loon::writer::detail::dec_s32(end, n);
+    loon_preformatted_value(p, end - p);
+}
+
+void writer::loon_hex_u32(uint32_t n)
+{
+    loon_dec_u32(n);
+}
+
+void writer::loon_double(double n)
+{
+    const std::string s(loon::writer::detail::double_to_string(n));
+    loon_preformatted_value(s.c_str(), s.length());
+}
+
+void writer::loon_string(const std::string & value)
+{
+    loon::writer::detail::escape(buf_, value);
+    loon_preformatted_value(reinterpret_cast<const char *>(&buf_[0]), buf_.size());
+}
+
+void writer::loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+{
+    const char * p = utf8;
+    const char * const end = utf8 + len;
+    num_.clear();
+
+    if (ntype == loon::reader::num_hex_int)
+        hex_to_decimal(num_, p + 2, end); // skip the {0x}
+    else {
+        if (p != end && (*p == '-' || *p == '+')) {
+            if (*p == '-')
+                num_ += '-';
+            ++p;
+        }
+        const char * q = p;
+        while (q != end && is_digit(*q))
+            ++q;
+        append_digits(num_, p, q, "0"); // integer part
+        if (q != end && *q == '.') {
+            num_ += '.';
+            p = ++q;
+            while (q != end && is_digit(*q))
+                ++q;
+            if (p == q)
+                num_ += '0'; // Loon allows 1. but JSON requires 1.0
+            else
+                num_.append(p, q);
+        }
+        num_.append(q, end); // the exponent, if any
+    }
+
+    loon_preformatted_value(num_.c_str(), num_.size());
+}
+
+void writer::reset()
+{
+    need_comma_ = false;
+    depth_ = 0;
+    complete_ = false;
+}
+
+writer::writer()
+{
+    reset();
+}
+
+writer::~writer()
+{
+}
+
+
+
+// Loon to JSON
+
+from_loon::from_loon(writer & out)
+: out_(out)
+{
+    set_raw_strings(true); // Loon string escapes are also valid in JSON
+}
+
+from_loon::~from_loon()
+{
+}
+
+void from_loon::loon_arry_begin() { out_.loon_arry_begin(); }
+void from_loon::loon_arry_end() { out_.loon_arry_end(); }
+void from_loon::loon_dict_begin() { out_.loon_dict_begin(); }
+void from_loon::loon_dict_end() { out_.loon_dict_end(); }
+void from_loon::loon_null() { out_.loon_null(); }
+void from_loon::loon_bool(bool value) { out_.loon_bool(value); }
+
+void from_loon::loon_dict_key(const char * utf8, size_t len)
+{
+    buf_.assign(1, '"');
+    buf_.append(utf8, len);
+    buf_ += '"';
+    out_.loon_preformatted_key(buf_.c_str(), buf_.size());
+}
+
+void from_loon::loon_string(const char * utf8, size_t len)
+{
+    buf_.assign(1, '"');
+    buf_.append(utf8, len);
+    buf_ += '"';
+    out_.loon_preformatted_value(buf_.c_str(), buf_.size());
+}
+
+void from_loon::loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+{
+    out_.loon_number(utf8, len, ntype);
+}
+
+void convert_from_loon(std::istream & in, writer & out, size_t chunk_size)
+{
+    from_loon f(out);
+    std::vector<char> buf(chunk_size ? chunk_size : 1);
+    while (in) {
+        in.read(&buf[0], buf.size());
+        f.process_chunk(&buf[0], static_cast<size_t>(in.gcount()), /*is_last_chunk=*/false);
+    }
+    f.process_chunk(0, 0, /*is_last_chunk=*/true);
+}
+
+
+
+}} // end of namespace loon::json
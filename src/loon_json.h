@@ -0,0 +1,268 @@
+#ifndef LOON_JSON_H_INCLUDED
+#define LOON_JSON_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  Read and write JSON with the same interface as the Loon reader and writer.
+
+    Loon and JSON have the same data model: arry is a JSON array, dict is a
+    JSON object, and strings, numbers, true, false and null are the same in
+    both. (They even share the same string escape sequences.)
+
+    - loon::json::reader is a streaming JSON parser that calls the same nine
+      loon_XXXX virtual functions as loon::reader::base.
+    - loon::json::writer has the same loon_XXXX functions as
+      loon::writer::base but outputs compact JSON.
+    - loon::json::from_loon and loon::json::to_loon<Writer> connect the two
+      formats directly, so conversion needs no in-memory document.
+*/
+
+
+#include "loon_reader.h"
+#include "loon_writer.h"
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <cstring>
+
+
+namespace loon {
+namespace json {
+
+
+// process JSON text into a virtual function call for each JSON value found;
+// the events are those loon::reader::base produces for the equivalent Loon
+// text, so a JSON array produces loon_arry_begin() ... loon_arry_end()
+class reader {
+public:
+    reader();
+    virtual ~reader();
+
+    // Reset the reader to it's initial pristine state ready to start
+    // processing a new JSON text.
+    virtual void reset();
+
+    // Feed JSON text to the reader, as for loon::reader::base::process_chunk().
+    // A loon::reader::exception with id bad_json (or one of the string escape
+    // ids) is thrown if the text is not well formed.
+    void process_chunk(const char * utf8, size_t len, bool is_last_chunk);
+
+    // return the line number of the JSON text being processed
+    int current_line() const { return current_line_; }
+
+    // see loon::reader::base::set_raw_strings()
+    bool set_raw_strings(bool on) { std::swap(raw_strings_, on); return on; }
+
+    // see loon::reader::base
+    virtual void loon_arry_begin() = 0;
+    virtual void loon_arry_end() = 0;
+    virtual void loon_dict_begin() = 0;
+    virtual void loon_dict_end() = 0;
+    virtual void loon_dict_key(const char * utf8, size_t len) = 0;
+    virtual void loon_null() = 0;
+    virtual void loon_bool(bool value) = 0;
+    virtual void loon_string(const char * utf8, size_t len) = 0;
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype) = 0;
+
+private:
+    enum { ex_value, ex_value_or_end, ex_key, ex_key_or_end, ex_colon,
+        ex_comma_or_end, ex_nothing } expect_;
+    enum { in_none, in_string, in_string_escape, in_number, in_literal } token_;
+    std::vector<bool> in_object_; // one entry per open array (false) or object (true)
+    loon::reader::vector_uint8 value_;
+    int current_line_;
+    bool cr_;
+    bool raw_strings_;
+    bool string_is_key_;
+
+    void process(uint8_t ch);
+    void begin_value();
+    void end_value();
+    void end_string();
+    void end_number();
+    void end_literal();
+    void fail() const;
+};
+
+
+// Output JSON text. Derive your own class from this and override write(),
+// exactly as you would for loon::writer::base. A JSON text holds one value:
+// a second top-level value throws a loon::writer::exception with id
+// extra_top_level_value (call reset() to start another text).
+class writer {
+public:
+    writer();
+    virtual ~writer();
+
+    // Reset the writer to it's initial pristine state.
+    virtual void reset();
+
+    // The output of this class is written through this function.
+    // You must override it to collect the JSON text produced.
+    virtual void write(const char * utf8, size_t len) = 0;
+
+    // These functions behave as their namesakes in loon::writer::base.
+    void loon_arry_begin();
+    void loon_arry_end();
+    void loon_dict_begin();
+    void loon_dict_end();
+    void loon_dict_key(const std::string & key_name);
+    void loon_preformatted_key(const char * utf8, size_t len);
+    void loon_null();
+    void loon_bool(bool value);
+    void loon_dec_u32(uint32_t n);
+    void loon_dec_s32(int32_t n);
+    void loon_hex_u32(uint32_t n); // JSON has no hex numbers; output in decimal
+    void loon_double(double n);
+    void loon_string(const std::string & value);
+    void loon_preformatted_value(const char * utf8, size_t len);
+
+    // Output the given Loon number text, of the given type, as a JSON
+    // number; e.g. 0x1F => 31, +.5 => 0.5, 1. => 1.0, 007 => 7
+    void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype);
+
+private:
+    bool need_comma_;
+    size_t depth_;              // number of open arrays and objects
+    bool complete_;             // the top-level value has been written
+    std::vector<uint8_t> buf_;  // scratch (is a member to minimise memory allocations)
+    std::string num_;           // scratch
+
+    void separate();
+    void value_written();
+};
+
+
+// a Loon reader that writes everything it reads to the given JSON writer
+class from_loon : private loon::reader::base {
+public:
+    explicit from_loon(writer & out);
+    virtual ~from_loon();
+
+    using base::process_chunk;
+    using base::current_line;
+    using base::reset;
+
+private:
+    writer & out_;
+    std::string buf_; // scratch
+
+    virtual void loon_arry_begin();
+    virtual void loon_arry_end();
+    virtual void loon_dict_begin();
+    virtual void loon_dict_end();
+    virtual void loon_dict_key(const char * utf8, size_t len);
+    virtual void loon_null();
+    virtual void loon_bool(bool value);
+    virtual void loon_string(const char * utf8, size_t len);
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype);
+};
+
+
+// a JSON reader that writes everything it reads to the given Loon writer
+// (Writer may be loon::writer::base or loon::writer::basic<>)
+template <typename Writer>
+class to_loon : private reader {
+public:
+    explicit to_loon(Writer & out)
+    : out_(out)
+    {
+        set_raw_strings(true);
+    }
+
+    using reader::process_chunk;
+    using reader::current_line;
+    using reader::reset;
+
+private:
+    Writer & out_;
+    std::string buf_; // scratch
+
+    // return the given raw JSON string as a Loon string: JSON allows an
+    // unescaped DEL (U+007F) in a string, Loon does not
+    const std::string & quote(const char * utf8, size_t len)
+    {
+        buf_.assign(1, '"');
+        const char * const end = utf8 + len;
+        for (const char * del; (del = static_cast<const char *>(std::memchr(utf8, 0x7F, end - utf8))) != 0; utf8 = del + 1) {
+            buf_.append(utf8, del);
+            buf_ += "\\u007F";
+        }
+        buf_.append(utf8, end);
+        buf_ += '"';
+        return buf_;
+    }
+
+    virtual void loon_arry_begin() { out_.loon_arry_begin(); }
+    virtual void loon_arry_end() { out_.loon_arry_end(); }
+    virtual void loon_dict_begin() { out_.loon_dict_begin(); }
+    virtual void loon_dict_end() { out_.loon_dict_end(); }
+    virtual void loon_null() { out_.loon_null(); }
+    virtual void loon_bool(bool value) { out_.loon_bool(value); }
+
+    virtual void loon_dict_key(const char * utf8, size_t len)
+    {
+        const std::string & q(quote(utf8, len));
+        out_.loon_preformatted_key(q.c_str(), q.size());
+    }
+
+    virtual void loon_string(const char * utf8, size_t len)
+    {
+        const std::string & q(quote(utf8, len));
+        out_.loon_preformatted_value(q.c_str(), q.size());
+    }
+
+    // every JSON number is also a valid Loon number
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type)
+    {
+        out_.loon_preformatted_value(utf8, len);
+    }
+};
+
+
+// read all the Loon text from 'in' and write it as JSON to 'out'
+void convert_from_loon(std::istream & in, writer & out, size_t chunk_size = 64 * 1024);
+
+// read all the JSON text from 'in' and write it as Loon to 'out'
+template <typename Writer>
+void convert_to_loon(std::istream & in, Writer & out, size_t chunk_size = 64 * 1024)
+{
+    to_loon<Writer> t(out);
+    std::vector<char> buf(chunk_size ? chunk_size : 1);
+    while (in) {
+        in.read(&buf[0], buf.size());
+        t.process_chunk(&buf[0], static_cast<size_t>(in.gcount()), /*is_last_chunk=*/false);
+    }
+    t.process_chunk(0, 0, /*is_last_chunk=*/true);
+}
+
+
+}} // end of namespace loon::json
+#endif
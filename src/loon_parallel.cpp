@@ -0,0 +1,198 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+#include "loon_parallel.h"
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace loon {
+namespace detail {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+// the state shared by the threads of one format_in_parallel() call
+class schedule {
+public:
+    schedule(block_formatter & f, size_t num_blocks, size_t window)
+    : f_(f), num_blocks_(num_blocks), next_(0), emitted_(0),
+      texts_(window), done_(window, false), stop_(false)
+    {
+    }
+
+    // format blocks until there are none left (runs on each worker thread)
+    void work()
+    {
+        std::string text;
+        for (;;) {
+            size_t block;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                // don't get more than a window's worth of blocks ahead of emit()
+                while (!stop_ && next_ < num_blocks_ && next_ >= emitted_ + texts_.size())
+                    changed_.wait(lock);
+                if (stop_ || next_ == num_blocks_)
+                    return;
+                block = next_++;
+            }
+
+            text.clear();
+            try {
+                f_.format(block, text);
+            }
+            catch (...) {
+                fail();
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            const size_t slot = block % texts_.size();
+            texts_[slot].swap(text);
+            done_[slot] = true;
+            changed_.notify_all();
+        }
+    }
+
+    // emit the blocks in order as they are formatted (runs on the calling thread)
+    void emit()
+    {
+        std::string text;
+        for (size_t block = 0; block < num_blocks_; ++block) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                const size_t slot = block % texts_.size();
+                while (!stop_ && !done_[slot])
+                    changed_.wait(lock);
+                if (stop_)
+                    return;
+                text.swap(texts_[slot]);
+                done_[slot] = false;
+                emitted_ = block + 1;
+                changed_.notify_all();
+            }
+
+            try {
+                f_.emit(text);
+            }
+            catch (...) {
+                fail();
+                return;
+            }
+        }
+    }
+
+    // record the current exception and stop all the threads
+    void fail()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+            error_ = std::current_exception();
+        stop_ = true;
+        changed_.notify_all();
+    }
+
+    // rethrow the first exception recorded by fail(), if any
+    void rethrow() const
+    {
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+
+private:
+    block_formatter & f_;
+    const size_t num_blocks_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    size_t next_;                   // the next block to be formatted
+    size_t emitted_;                // the number of blocks emitted
+    std::vector<std::string> texts_;// formatted blocks waiting to be emitted
+    std::vector<bool> done_;        // texts_[i] holds a formatted block
+    bool stop_;                     // something threw: give up
+    std::exception_ptr error_;
+};
+
+
+} // anonymous namespace
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+void format_in_parallel(block_formatter & f, size_t num_blocks, unsigned threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, num_blocks));
+
+    if (threads <= 1) {
+        std::string text;
+        for (size_t block = 0; block < num_blocks; ++block) {
+            text.clear();
+            f.format(block, text);
+            f.emit(text);
+        }
+        return;
+    }
+
+    schedule s(f, num_blocks, 4 * threads);
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    try {
+        for (unsigned i = 0; i < threads; ++i)
+            workers.push_back(std::thread(&schedule::work, &s));
+        s.emit();
+    }
+    catch (...) {
+        s.fail(); // couldn't start a thread
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    s.rethrow();
+}
+
+
+}} // end of namespace loon::detail
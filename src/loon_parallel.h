@@ -0,0 +1,192 @@
+#ifndef LOON_PARALLEL_H_INCLUDED
+#define LOON_PARALLEL_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  Write a large document using several threads.
+
+    The text of an element of a top-level arry or dict depends only on the
+    element and the output style, not on what comes before it: in compact
+    style it is a space followed by the element, in pretty style a newline,
+    one indent and the element. So blocks of consecutive elements can be
+    formatted at the same time, each by its own writer into its own buffer,
+    and the buffers written to the sink in order. The output is exactly what
+    loon::writer::basic<Sink, Style> gives when writing the whole document.
+
+    Only the top-level list is split up; a document whose top-level list has
+    a few huge elements gains little.
+*/
+
+
+#include "loon_binary.h"
+#include "loon_sink.h"
+#include "loon_writer.h"
+
+#include <algorithm>
+#include <string>
+
+
+namespace loon {
+
+
+// ignore this namespace: it is a Loon implementation detail
+namespace detail {
+
+class block_formatter {
+public:
+    virtual ~block_formatter() {}
+
+    // set 'text' to the output for block number 'block' (called concurrently)
+    virtual void format(size_t block, std::string & text) = 0;
+    // output the 'text' of the next block (called in block order, one at a time)
+    virtual void emit(const std::string & text) = 0;
+};
+
+// Call f.format() for each of the 'num_blocks' blocks on up to 'threads'
+// threads (0 means one per hardware thread) and f.emit() for each block, in
+// order, on the calling thread. Only a few blocks more than there are threads
+// are held in memory at once. An exception thrown by f is rethrown here once
+// all the threads have finished.
+void format_in_parallel(block_formatter & f, size_t num_blocks, unsigned threads);
+
+// formats blocks of the elements of a List (see write_parallel())
+template <typename List, typename Sink, typename Style>
+class list_formatter : public block_formatter {
+public:
+    list_formatter(const List & list, Sink & sink, size_t per_block, size_t num_blocks)
+    : list_(list), sink_(sink), per_block_(per_block), num_blocks_(num_blocks)
+    {
+    }
+
+    virtual void format(size_t block, std::string & text)
+    {
+        // a writer of our own opens the list, so our elements are formatted
+        // at the right depth; emit() drops the 5 chars "(arry" or "(dict"
+        writer::basic<writer::string_sink, Style> w((writer::string_sink(text)));
+        if (list_.is_dict())
+            w.loon_dict_begin();
+        else
+            w.loon_arry_begin();
+        const size_t end = std::min(list_.size(), (block + 1) * per_block_);
+        for (size_t i = block * per_block_; i < end; ++i)
+            list_.write(i, w);
+        if (block + 1 == num_blocks_) {
+            if (list_.is_dict())
+                w.loon_dict_end();
+            else
+                w.loon_arry_end();
+        }
+    }
+
+    virtual void emit(const std::string & text)
+    {
+        sink_.write(text.data() + 5, text.size() - 5);
+    }
+
+private:
+    const List & list_;
+    Sink & sink_;
+    const size_t per_block_;
+    const size_t num_blocks_;
+};
+
+// the top-level list of a binary Loon document, as write_parallel() requires
+class binary_list {
+public:
+    explicit binary_list(const binary::value & v) : v_(v) {}
+
+    bool is_dict() const { return v_.type() == binary::value::type_dict; }
+    size_t size() const { return v_.size(); }
+
+    template <typename Writer>
+    void write(size_t i, Writer & w) const
+    {
+        if (is_dict()) {
+            const char * utf8;
+            size_t len;
+            v_.key(i, utf8, len);
+            w.loon_dict_key(std::string(utf8, len));
+        }
+        binary::to_text<Writer>(w).process(v_.at(i));
+    }
+
+private:
+    binary::value v_;
+};
+
+} // end of namespace detail
+
+
+// Write the Loon text of the arry or dict 'list' to 'sink', formatting the
+// elements on up to 'threads' threads (0 means one per hardware thread). The
+// output is the same as loon::writer::basic<Sink, Style> would give. List is
+// a view of your own document's top-level list with the member functions
+//    bool is_dict() const;   // true for a dict, false for an arry
+//    size_t size() const;    // the number of elements
+//    template <typename Writer>
+//    void write(size_t i, Writer & w) const;
+// where write() outputs element 'i' (for a dict its key then its value) to
+// the loon::writer::basic<> 'w'. write() is called concurrently for
+// different elements. Sink is as for loon::writer::basic<>; its write() is
+// only called from the calling thread. For example,
+//    loon::write_parallel<loon::writer::pretty<> >(my_list, my_sink, 8);
+template <typename Style = writer::compact, typename List, typename Sink>
+void write_parallel(const List & list, Sink & sink, unsigned threads = 0)
+{
+    // enough blocks to keep the threads busy when elements vary in size,
+    // few enough that the cost of handing them out doesn't matter
+    const size_t n = list.size();
+    const size_t per_block = std::max<size_t>(1, n / 1024);
+    const size_t num_blocks = n ? (n + per_block - 1) / per_block : 1;
+
+    detail::list_formatter<List, Sink, Style> f(list, sink, per_block, num_blocks);
+    sink.write(list.is_dict() ? "(dict" : "(arry", 5);
+    detail::format_in_parallel(f, num_blocks, threads);
+}
+
+// As above, for a binary Loon document. A top-level value that is not an arry
+// or dict is just written.
+template <typename Style = writer::compact, typename Sink>
+void write_parallel(const binary::document & doc, Sink & sink, unsigned threads = 0)
+{
+    const binary::value root(doc.root());
+    if (root.type() == binary::value::type_arry || root.type() == binary::value::type_dict) {
+        write_parallel<Style>(detail::binary_list(root), sink, threads);
+    }
+    else {
+        std::string text;
+        writer::basic<writer::string_sink, Style> w((writer::string_sink(text)));
+        binary::to_text<writer::basic<writer::string_sink, Style> >(w).process(root);
+        sink.write(text.data(), text.size());
+    }
+}
+
+
+} // end of namespace loon
+#endif
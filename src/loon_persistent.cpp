@@ -0,0 +1,417 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+#include "loon_persistent.h"
+
+#include <stdexcept>
+
+
+namespace loon {
+namespace persistent {
+
+
+// the shared, never modified, representation of a value other than null
+struct value::node {
+    type_t type;
+    bool b;                                 // bool only
+    loon::reader::num_type ntype;           // number only
+    std::string text;                       // the text of a number or the value of a string
+    std::shared_ptr<const std::vector<std::string> > keys;  // dict only: the key of each element
+    std::vector<value> elements;            // arry and dict only
+
+    explicit node(type_t t) : type(t), b(false), ntype(loon::reader::num_dec_int) {}
+};
+
+
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+void out_of_range()
+{
+    throw std::out_of_range("loon::persistent::value: the path leads to nothing");
+}
+
+void wrong_type()
+{
+    throw std::invalid_argument("loon::persistent::value: the value is not of that type");
+}
+
+// return the arry index in the given path 'step'
+size_t index_of(const std::string & step)
+{
+    if (step.empty())
+        out_of_range();
+    size_t index = 0;
+    for (size_t i = 0; i < step.size(); ++i) {
+        const char c = step[i];
+        if (c < '0' || c > '9' || index > (size_t(-1) - 9) / 10)
+            out_of_range();
+        index = index * 10 + (c - '0');
+    }
+    return index;
+}
+
+// return the position of the first 'key' in 'keys', or keys.size() if none
+size_t key_index(const std::vector<std::string> & keys, const std::string & key)
+{
+    size_t i = 0;
+    while (i < keys.size() && keys[i] != key)
+        ++i;
+    return i;
+}
+
+
+} // anonymous namespace
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+value::value()
+{
+}
+
+value value::make_bool(bool b)
+{
+    std::shared_ptr<node> n(new node(type_bool));
+    n->b = b;
+    return value(n);
+}
+
+value value::make_number(const std::string & text, loon::reader::num_type ntype)
+{
+    std::shared_ptr<node> n(new node(type_number));
+    n->ntype = ntype;
+    n->text = text;
+    return value(n);
+}
+
+value value::make_string(const std::string & s)
+{
+    std::shared_ptr<node> n(new node(type_string));
+    n->text = s;
+    return value(n);
+}
+
+value value::make_arry(const std::vector<value> & elements)
+{
+    std::shared_ptr<node> n(new node(type_arry));
+    n->elements = elements;
+    return value(n);
+}
+
+value value::make_dict(const std::vector<std::pair<std::string, value> > & entries)
+{
+    std::shared_ptr<node> n(new node(type_dict));
+    std::shared_ptr<std::vector<std::string> > keys(new std::vector<std::string>);
+    keys->reserve(entries.size());
+    n->elements.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        keys->push_back(entries[i].first);
+        n->elements.push_back(entries[i].second);
+    }
+    n->keys = keys;
+    return value(n);
+}
+
+value::type_t value::type() const
+{
+    return node_ ? node_->type : type_null;
+}
+
+bool value::as_bool() const
+{
+    if (type() != type_bool)
+        wrong_type();
+    return node_->b;
+}
+
+const std::string & value::number_text(loon::reader::num_type & ntype) const
+{
+    if (type() != type_number)
+        wrong_type();
+    ntype = node_->ntype;
+    return node_->text;
+}
+
+const std::string & value::as_string() const
+{
+    if (type() != type_string)
+        wrong_type();
+    return node_->text;
+}
+
+size_t value::size() const
+{
+    if (type() != type_arry && type() != type_dict)
+        wrong_type();
+    return node_->elements.size();
+}
+
+const value & value::at(size_t i) const
+{
+    if (i >= size())
+        throw std::out_of_range("loon::persistent::value::at");
+    return node_->elements[i];
+}
+
+const std::string & value::key(size_t i) const
+{
+    if (type() != type_dict)
+        wrong_type();
+    if (i >= size())
+        throw std::out_of_range("loon::persistent::value::key");
+    return (*node_->keys)[i];
+}
+
+bool value::find(const std::string & key, value & v) const
+{
+    if (type() != type_dict)
+        wrong_type();
+    const size_t i = key_index(*node_->keys, key);
+    if (i == node_->elements.size())
+        return false;
+    v = node_->elements[i];
+    return true;
+}
+
+bool value::find(const path & p, value & v) const
+{
+    const value * at = this;
+    for (size_t step = 0; step < p.size(); ++step) {
+        const type_t t = at->type();
+        size_t i;
+        if (t == type_dict)
+            i = key_index(*at->node_->keys, p[step]);
+        else if (t == type_arry) {
+            i = 0;
+            for (size_t j = 0; j < p[step].size(); ++j) {
+                const char c = p[step][j];
+                if (c < '0' || c > '9' || i > (size_t(-1) - 9) / 10)
+                    return false;
+                i = i * 10 + (c - '0');
+            }
+            if (p[step].empty())
+                return false;
+        }
+        else
+            return false;
+        if (i >= at->node_->elements.size())
+            return false;
+        at = &at->node_->elements[i];
+    }
+    v = *at;
+    return true;
+}
+
+// return a copy of this value with the given edit made at the end of path
+// 'p', which leads from this value from 'step' onwards; only the lists on
+// the path are copied, and of those only the vectors of references to their
+// elements (and a dict's keys, if they change)
+value value::edit(const path & p, size_t step, edit_kind kind, const value & v) const
+{
+    if (step == p.size()) {
+        if (kind != edit_set)
+            out_of_range();
+        return v;
+    }
+
+    const type_t t = type();
+    if (t != type_arry && t != type_dict)
+        out_of_range();
+    std::shared_ptr<node> copy(new node(*node_));
+    std::vector<value> & elements = copy->elements;
+    const bool last = step + 1 == p.size();
+
+    size_t i;
+    if (t == type_dict) {
+        i = key_index(*node_->keys, p[step]);
+        if (last && kind == edit_insert)
+            out_of_range(); // (insert is for arrys)
+        if (last && kind == edit_set && i == elements.size()) {
+            std::shared_ptr<std::vector<std::string> > keys(new std::vector<std::string>(*node_->keys));
+            keys->push_back(p[step]);
+            copy->keys = keys;
+            elements.push_back(v);
+            return value(copy);
+        }
+        if (i == elements.size())
+            out_of_range();
+        if (last && kind == edit_erase) {
+            std::shared_ptr<std::vector<std::string> > keys(new std::vector<std::string>(*node_->keys));
+            keys->erase(keys->begin() + i);
+            copy->keys = keys;
+            elements.erase(elements.begin() + i);
+            return value(copy);
+        }
+    }
+    else {
+        i = index_of(p[step]);
+        if (last && kind == edit_insert) {
+            if (i > elements.size())
+                out_of_range();
+            elements.insert(elements.begin() + i, v);
+            return value(copy);
+        }
+        if (i >= elements.size())
+            out_of_range();
+        if (last && kind == edit_erase) {
+            elements.erase(elements.begin() + i);
+            return value(copy);
+        }
+    }
+
+    elements[i] = elements[i].edit(p, step + 1, kind, v);
+    return value(copy);
+}
+
+value value::set(const path & p, const value & v) const
+{
+    return edit(p, 0, edit_set, v);
+}
+
+value value::insert(const path & p, const value & v) const
+{
+    return edit(p, 0, edit_insert, v);
+}
+
+value value::erase(const path & p) const
+{
+    return edit(p, 0, edit_erase, value());
+}
+
+
+
+// from_text
+
+from_text::from_text()
+{
+}
+
+from_text::~from_text()
+{
+}
+
+void from_text::reset()
+{
+    base::reset();
+    stack_.clear();
+    values_.clear();
+}
+
+void from_text::add(const value & v)
+{
+    if (stack_.empty())
+        values_.push_back(v);
+    else
+        stack_.back().elements.push_back(v);
+}
+
+void from_text::loon_arry_begin()
+{
+    stack_.push_back(list());
+    stack_.back().is_dict = false;
+}
+
+void from_text::loon_dict_begin()
+{
+    stack_.push_back(list());
+    stack_.back().is_dict = true;
+}
+
+void from_text::loon_arry_end()
+{
+    std::shared_ptr<value::node> n(new value::node(value::type_arry));
+    n->elements.swap(stack_.back().elements);
+    stack_.pop_back();
+    add(value(n));
+}
+
+void from_text::loon_dict_end()
+{
+    std::shared_ptr<value::node> n(new value::node(value::type_dict));
+    std::shared_ptr<std::vector<std::string> > keys(new std::vector<std::string>);
+    keys->swap(stack_.back().keys);
+    n->keys = keys;
+    n->elements.swap(stack_.back().elements);
+    stack_.pop_back();
+    add(value(n));
+}
+
+void from_text::loon_dict_key(const char * utf8, size_t len)
+{
+    stack_.back().keys.push_back(std::string(utf8, len));
+}
+
+void from_text::loon_null()
+{
+    add(value());
+}
+
+void from_text::loon_bool(bool b)
+{
+    add(value::make_bool(b));
+}
+
+void from_text::loon_string(const char * utf8, size_t len)
+{
+    add(value::make_string(std::string(utf8, len)));
+}
+
+void from_text::loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+{
+    add(value::make_number(std::string(utf8, len), ntype));
+}
+
+
+value read(const std::string & text)
+{
+    from_text in;
+    in.process_chunk(text.data(), text.size(), /*is_last_chunk=*/true);
+    if (in.values().size() != 1)
+        throw std::invalid_argument("loon::persistent::read: the text must hold exactly one value");
+    return in.values()[0];
+}
+
+
+}} // end of namespace loon::persistent
@@ -0,0 +1,200 @@
+#ifndef LOON_PERSISTENT_H_INCLUDED
+#define LOON_PERSISTENT_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  An immutable Loon document whose versions share their unchanged parts.
+
+    A loon::persistent::value is a Loon value: null, a bool, a number, a
+    string, or an arry or dict of values. It never changes once made. The
+    functions that "modify" a value return a new value that shares with the
+    old one every subtree not on the path to the change (path copying), so
+    keeping many versions of a large document costs memory in proportion to
+    the changes between them. Copying a value copies one reference-counted
+    pointer.
+
+    As no value is ever modified, values may be read concurrently from any
+    number of threads without locks, and a thread may make new versions while
+    others read the old ones.
+*/
+
+
+#include "loon_reader.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace loon {
+namespace persistent {
+
+
+// the location of a value: the keys of the dicts and the indices (in decimal)
+// of the arrys that lead to it from the top-level value (as loon::incremental)
+typedef std::vector<std::string> path;
+
+class value {
+public:
+    enum type_t { type_null, type_bool, type_number, type_string, type_arry, type_dict };
+
+    // null
+    value();
+
+    static value make_bool(bool b);
+    // a number, given as Loon number text
+    static value make_number(const std::string & text, loon::reader::num_type ntype);
+    static value make_string(const std::string & s);
+    static value make_arry(const std::vector<value> & elements);
+    static value make_dict(const std::vector<std::pair<std::string, value> > & entries);
+
+    type_t type() const;
+
+    // the value of a bool
+    bool as_bool() const;
+    // the Loon text of a number
+    const std::string & number_text(loon::reader::num_type & ntype) const;
+    // the value of a string
+    const std::string & as_string() const;
+
+    // the number of elements in an arry or dict
+    size_t size() const;
+    // the i'th element of an arry or dict
+    const value & at(size_t i) const;
+    // the key of the i'th element of a dict
+    const std::string & key(size_t i) const;
+    // return true iff the dict has the given key; set 'v' to the (first) associated value
+    bool find(const std::string & key, value & v) const;
+    // return true iff there is a value at the given path; set 'v' to it
+    bool find(const path & p, value & v) const;
+
+    // Return a copy of this value with the value at the given path replaced
+    // by 'v'. If the last step of the path is a key the dict doesn't have,
+    // 'v' is added to the dict with that key. The empty path gives 'v'.
+    value set(const path & p, const value & v) const;
+    // return a copy of this value with 'v' inserted into the arry at the
+    // given path, before the index that ends the path
+    value insert(const path & p, const value & v) const;
+    // return a copy of this value without the dict entry or arry element at
+    // the given path
+    value erase(const path & p) const;
+    // (These throw a std::out_of_range if the path leads to nothing.)
+
+    // return true iff this value and 'other' are the same, shared, value
+    // (so are certainly equal without looking further)
+    bool shares(const value & other) const { return node_ == other.node_; }
+
+private:
+    friend class from_text;
+    struct node;
+    std::shared_ptr<const node> node_;  // null for the value null
+
+    explicit value(const std::shared_ptr<const node> & n) : node_(n) {}
+
+    enum edit_kind { edit_set, edit_insert, edit_erase };
+    value edit(const path & p, size_t step, edit_kind kind, const value & v) const;
+};
+
+
+// A Loon reader that makes a persistent value of each top-level value it reads.
+class from_text : private loon::reader::base {
+public:
+    from_text();
+    virtual ~from_text();
+
+    using base::process_chunk;
+    using base::current_line;
+
+    virtual void reset();
+
+    // the top-level values read so far
+    const std::vector<value> & values() const { return values_; }
+
+private:
+    struct list {
+        bool is_dict;
+        std::vector<std::string> keys;
+        std::vector<value> elements;
+    };
+    std::vector<list> stack_;   // the open lists
+    std::vector<value> values_;
+
+    void add(const value & v);
+
+    virtual void loon_arry_begin();
+    virtual void loon_arry_end();
+    virtual void loon_dict_begin();
+    virtual void loon_dict_end();
+    virtual void loon_dict_key(const char * utf8, size_t len);
+    virtual void loon_null();
+    virtual void loon_bool(bool value);
+    virtual void loon_string(const char * utf8, size_t len);
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype);
+};
+
+// return the value of the given Loon 'text', which must hold exactly one
+// value (or a std::invalid_argument is thrown)
+value read(const std::string & text);
+
+// output the given value 'v' to 'out' (loon::writer::base or loon::writer::basic<>)
+template <typename Writer>
+void write(const value & v, Writer & out)
+{
+    loon::reader::num_type ntype;
+    switch (v.type()) {
+    case value::type_null:      out.loon_null();                break;
+    case value::type_bool:      out.loon_bool(v.as_bool());     break;
+    case value::type_string:    out.loon_string(v.as_string()); break;
+    case value::type_number:
+        {
+            const std::string & text(v.number_text(ntype));
+            out.loon_preformatted_value(text.data(), text.size());
+        }
+        break;
+    case value::type_arry:
+        out.loon_arry_begin();
+        for (size_t i = 0; i < v.size(); ++i)
+            write(v.at(i), out);
+        out.loon_arry_end();
+        break;
+    case value::type_dict:
+        out.loon_dict_begin();
+        for (size_t i = 0; i < v.size(); ++i) {
+            out.loon_dict_key(v.key(i));
+            write(v.at(i), out);
+        }
+        out.loon_dict_end();
+        break;
+    }
+}
+
+
+}} // end of namespace loon::persistent
+#endif
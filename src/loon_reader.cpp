@@ -30,8 +30,14 @@
 
 #include <cstdint>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
 #include <cstdio>
 #include <limits>
+#if LOON_READER_STATE_SAMPLING
+#include <chrono>
+#endif
 
 
 namespace loon {
@@ -172,6 +178,51 @@ std::string exception_msg(error_id id, std::string & description)
             " by a valid UTF-16 surrogate lead value.";
         return "Orphan UTF-16 surrogate trail.";
 
+    case bound_value_mismatch:
+        description =
+            "The value's type does not match the C++ type of the object it is"
+            " bound to, or the value is out of range for that type.";
+        return "Bound value mismatch.";
+
+    case bad_json:
+        description =
+            "For example, [1,2] is valid JSON but [1,] and [1 2] are not.";
+        return "Bad JSON.";
+
+    case bad_binary:
+        description =
+            "The data is truncated, an offset or length is out of range,"
+            " or an unknown tag was found.";
+        return "Bad binary Loon.";
+
+    case index_requires_arry:
+        description =
+            "An arry index can only be built for Loon text consisting of"
+            " a single top-level arry, e.g. (arry 1 2 3).";
+        return "Index requires a top-level arry.";
+
+    case bad_index:
+        description =
+            "The text is not an arry index written by loon::index::write_index().";
+        return "Bad arry index.";
+
+    case bad_checkpoint:
+        description =
+            "The text is not a reader checkpoint made by loon::reader::base::checkpoint().";
+        return "Bad checkpoint.";
+
+    case invalid_utf8:
+        description =
+            "The text contains a byte sequence that is not valid UTF-8.";
+        return "Invalid UTF-8.";
+
+    case bad_diff:
+        description =
+            "A document does not hold exactly one value, or the delta is not"
+            " a delta written by loon::diff() or a path in it leads to a value"
+            " the document doesn't have.";
+        return "Bad diff or patch.";
+
     case internal_error_unknown_state:
         description = "";
         return "Internal Loon error: Unknown state.";
@@ -222,6 +273,16 @@ inline const char * char_ptr(const vector_uint8 & s)
     return s.empty() ? "" : reinterpret_cast<const char *>(&s[0]);
 }
 
+// return the FNV-1a hash of the given 'len' bytes at 'p'; used to look up
+// dict keys registered with base::intern_key()
+inline uint32_t key_hash(const uint8_t * p, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (const uint8_t * const end = p + len; p != end; ++p)
+        h = (h ^ *p) * 16777619u;
+    return h;
+}
+
 // return true iff 'a' matches 'b' exactly (excluding 'b's null-terminator)
 inline bool operator==(const vector_uint8 & a, const char * b)
 {
@@ -251,6 +312,96 @@ inline uint32_t utf16_combine_surrogate_pair(uint32_t lead, uint32_t trail)
     return 0x00010000 + ((lead & 0x000003FF) << 10) + (trail & 0x000003FF);
 }
 
+// UTF-8 validation states: the continuation bytes still expected in the
+// current sequence; the after_XX states restrict the range of the next byte
+// to exclude overlong encodings, surrogates and code points above U+10FFFF
+enum {
+    utf8_start, utf8_need_1, utf8_need_2, utf8_need_3,
+    utf8_after_E0, utf8_after_ED, utf8_after_F0, utf8_after_F4
+};
+
+// return the UTF-8 validation state after the given first byte 'ch' of a
+// sequence; utf8_start if 'ch' is ASCII or cannot start a sequence
+inline uint8_t utf8_lead_state(uint8_t ch)
+{
+    if (ch < 0xC2)
+        return utf8_start; // (0xC0 and 0xC1 could only start overlong sequences)
+    if (ch < 0xE0)
+        return utf8_need_1;
+    if (ch < 0xF0)
+        return ch == 0xE0 ? utf8_after_E0 : ch == 0xED ? utf8_after_ED : utf8_need_2;
+    if (ch < 0xF5)
+        return ch == 0xF0 ? utf8_after_F0 : ch == 0xF4 ? utf8_after_F4 : utf8_need_3;
+    return utf8_start;
+}
+
+// Return a pointer to the first byte in [p, end) that is not valid UTF-8
+// given the validation 'state' at 'p', or 'end' if there is none. 'state'
+// is updated to the state after the returned byte. (A byte that cuts a
+// sequence short is itself taken as the start of the next sequence.)
+const uint8_t * find_bad_utf8(const uint8_t * p, const uint8_t * const end, uint8_t & state)
+{
+    static const uint8_t lo[] = { 0, 0x80, 0x80, 0x80, 0xA0, 0x80, 0x90, 0x80 };
+    static const uint8_t hi[] = { 0, 0xBF, 0xBF, 0xBF, 0xBF, 0x9F, 0xBF, 0x8F };
+    static const uint8_t next[] = {
+        utf8_start, utf8_start, utf8_need_1, utf8_need_2,
+        utf8_need_1, utf8_need_1, utf8_need_2, utf8_need_2
+    };
+
+    for (; p != end; ++p) {
+        if (state == utf8_start) {
+            // skip ASCII eight bytes at a time
+            for (; end - p >= 8; p += 8) {
+                uint64_t word;
+                std::memcpy(&word, p, 8);
+                if (word & 0x8080808080808080ull)
+                    break;
+            }
+            if (p == end)
+                break;
+            if (*p < 0x80)
+                continue;
+            state = utf8_lead_state(*p);
+            if (state == utf8_start)
+                return p; // a continuation byte or a byte that never appears in UTF-8
+        }
+        else if (lo[state] <= *p && *p <= hi[state])
+            state = next[state];
+        else {
+            state = utf8_lead_state(*p);
+            return p; // the sequence was cut short
+        }
+    }
+    return end;
+}
+
+// return true iff 's' is valid UTF-8
+bool is_utf8(const vector_uint8 & s)
+{
+    if (s.empty())
+        return true;
+    uint8_t state = utf8_start;
+    const uint8_t * const end = &s[0] + s.size();
+    return find_bad_utf8(&s[0], end, state) == end && state == utf8_start;
+}
+
+// return the bytes of the given symbol 's' packed into a word, first byte lowest
+constexpr uint64_t packed_symbol(const char * s, int i = 0)
+{
+    return s[i]
+        ? static_cast<uint64_t>(static_cast<uint8_t>(s[i])) << (8 * i) | packed_symbol(s, i + 1)
+        : 0;
+}
+
+// return the text of a symbol of the given 'kind'; 'other' if it's not a keyword
+vector_uint8 symbol_name(lexer::symbol_kind kind, const vector_uint8 & other)
+{
+    static const char * const names[] = { "arry", "dict", "true", "false", "null" };
+    if (kind == lexer::symbol_other)
+        return other;
+    return vector_uint8(names[kind], names[kind] + std::strlen(names[kind]));
+}
+
 inline bool is_digit(uint8_t ch)
 {
     return unsigned(ch) - '0' < 10;
@@ -269,6 +420,9 @@ inline bool is_ctrl(uint8_t ch)
     return ch < 0x20 || ch == 0x7F;
 }
 
+// process_chunk() takes chunks of up to this many bytes the short way
+const size_t small_chunk_size = 64;
+
 inline bool is_whitespace(uint8_t ch)
 {
     return ch <= 0x20 || ch == 0x7F;
@@ -289,39 +443,36 @@ inline bool non_symbol(uint8_t ch)
     return ch == '(' || ch == ')' || ch == '"' || ch == ';' || is_whitespace(ch);
 }
 
-// return true iff given 'c' is ASCII hex digit; return binary value of digit in 'n'
-inline bool hex2bin(uint8_t c, uint32_t & n)
-{
-    // if this isn't ASCII, n = c - 'A' + 10 might not work
-    static_assert(
-        'A'==0x41 && 'B'==0x42 && 'C'==0x43 && 'D'==0x44 && 'E'==0x45 && 'F'==0x46
-     && 'a'==0x61 && 'b'==0x62 && 'c'==0x63 && 'd'==0x64 && 'e'==0x65 && 'f'==0x66,
-        "code assumes ASCII");
-
-    if ('0' <= c && c <= '9')
-        n = c - '0';
-    else if ('A' <= c && c <= 'F')
-        n = c - 'A' + 10;
-    else if ('a' <= c && c <= 'f')
-        n = c - 'a' + 10;
-    else
-        return false;
-
-    return true;
-}
+// the binary value of each ASCII hex digit; 0xFF for every other byte
+const uint8_t hex_digit_value[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+       0,    1,    2,    3,    4,    5,    6,    7,    8,    9, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF,   10,   11,   12,   13,   14,   15, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF,   10,   11,   12,   13,   14,   15, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
 
 // return true iff successfully read a 4 digit hex number [src, src+4) into 'n'
-bool read4hex(const uint8_t * src, uint32_t & n)
+inline bool read4hex(const uint8_t * src, uint32_t & n)
 {
-    n = 0;
-    for (int i = 0; i < 4; ++i) {
-        uint32_t d;
-        if (!hex2bin(src[i], d))
-            return false;
-        n <<= 4;
-        n += d;
-    }
-    return true;
+    static_assert('A' == 0x41 && 'a' == 0x61, "code assumes ASCII");
+    const uint32_t a = hex_digit_value[src[0]];
+    const uint32_t b = hex_digit_value[src[1]];
+    const uint32_t c = hex_digit_value[src[2]];
+    const uint32_t d = hex_digit_value[src[3]];
+    n = a << 12 | b << 8 | c << 4 | d;
+    return (a | b | c | d) <= 0xF; // (one test for all four digits)
 }
 
 // write given UTF-32 'n' to given 'dst' as UTF-8; return number of bytes written
@@ -350,6 +501,13 @@ int write_utf32_as_utf8(uint8_t * dst, uint32_t n)
     return p - dst;
 }
 
+// return a pointer to the first \ in [p, end), or 'end' if there is none
+inline uint8_t * find_escape(uint8_t * p, const uint8_t * end)
+{
+    void * const q = std::memchr(p, '\\', end - p);
+    return q ? static_cast<uint8_t *>(q) : const_cast<uint8_t *>(end);
+}
+
 // replace all Loon string escapes with their UTF-8 values in the given 's'
 error_id expand_loon_string_escapes(vector_uint8 & s)
 {
@@ -359,12 +517,9 @@ error_id expand_loon_string_escapes(vector_uint8 & s)
     const uint8_t esc_char = '\\';
 
     // skip straight to first escape, if any
-    s.push_back(esc_char);  // add sentinal (may cause reallocation)
     uint8_t * src = &s[0];
-    const uint8_t * const end = src + s.size() - 1;
-    while (*src != esc_char)
-        ++src;
-    s.pop_back();           // remove sentinal (cannot cause reallocation)
+    const uint8_t * const end = src + s.size();
+    src = find_escape(src, end);
     if (src == end)
         return no_error;    // string contains no escapes
 
@@ -393,10 +548,77 @@ error_id expand_loon_string_escapes(vector_uint8 & s)
         // UTF-16 \uXXXX (or \uXXXX\uYYYY UTF-16 surrogate pair)
         case 'u':
             {
-                if (end - src < 4)
+                uint32_t x, y;
+                if (end - src < 4 || !read4hex(src, x))
                     return bad_utf16_string_escape;
+                src += 4;
+                if (x < 0x80) // (the common case of an escaped ASCII character)
+                    *dst++ = static_cast<uint8_t>(x);
+                else {
+                    if (utf16_is_surrogate_lead(x)) { // => need \uYYYY trail value
+                        if (end - src < 6
+                            || src[0] != esc_char || src[1] != 'u'
+                            || !read4hex(src+2, y)
+                            || !utf16_is_surrogate_trail(y))
+                            return bad_or_missing_utf16_trail;
+                        x = utf16_combine_surrogate_pair(x, y);
+                        src += 6;
+                    }
+                    else if (utf16_is_surrogate_trail(x))
+                        return orphan_utf16_surrogate_trail;
+                    dst += write_utf32_as_utf8(dst, x);
+                }
+            }
+            break;
+
+        default:
+            // an unknown escape; if it's ASCII make it the only thing
+            // in s so it can be used in the exception message
+            const uint8_t c = *--src;
+            s.clear();
+            if (c < 0x80 && !is_ctrl(c)) {
+                s.push_back(esc_char);
+                s.push_back(c);
+            }
+            return string_escape_unknown;
+        }
+
+        // copy upto next escape in one go
+        uint8_t * const next = find_escape(src, end);
+        const size_t run = next - src;
+        if (run) {
+            std::memmove(dst, src, run); // (dst < src; the ranges may overlap)
+            dst += run;
+            src = next;
+        }
+    }
+    s.resize(dst - &s[0]); // shrink to fit
+
+    return no_error;
+}
+
+// return no_error iff all the Loon string escapes in the given 's' are valid;
+// this is expand_loon_string_escapes() without the expansion
+error_id check_loon_string_escapes(vector_uint8 & s)
+{
+    const uint8_t esc_char = '\\';
+    uint8_t * src = s.empty() ? 0 : &s[0];
+    const uint8_t * const end = src + s.size();
+    while (src != end) {
+        src = find_escape(src, end);
+        if (src == end)
+            break;
+        if (++src == end)
+            return string_escape_incomplete;
+
+        switch (*src++) {
+        case '\\': case '"': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+            break;
+
+        case 'u':
+            {
                 uint32_t x, y;
-                if (!read4hex(src, x))
+                if (end - src < 4 || !read4hex(src, x))
                     return bad_utf16_string_escape;
                 src += 4;
                 if (utf16_is_surrogate_lead(x)) { // => need \uYYYY trail value
@@ -405,12 +627,10 @@ error_id expand_loon_string_escapes(vector_uint8 & s)
                         || !read4hex(src+2, y)
                         || !utf16_is_surrogate_trail(y))
                         return bad_or_missing_utf16_trail;
-                    x = utf16_combine_surrogate_pair(x, y);
                     src += 6;
                 }
                 else if (utf16_is_surrogate_trail(x))
                     return orphan_utf16_surrogate_trail;
-                dst += write_utf32_as_utf8(dst, x);
             }
             break;
 
@@ -425,13 +645,7 @@ error_id expand_loon_string_escapes(vector_uint8 & s)
             }
             return string_escape_unknown;
         }
-
-        // copy upto next escape
-        while (src < end && *src != esc_char)
-            *dst++ = *src++;
     }
-    s.resize(dst - &s[0]); // shrink to fit
-
     return no_error;
 }
 
@@ -439,6 +653,23 @@ error_id expand_loon_string_escapes(vector_uint8 & s)
 
 
 
+std::string exception_message(error_id id, int line, const vector_uint8 & v)
+{
+    return throw_msg(id, line, v);
+}
+
+error_id expand_string_escapes(vector_uint8 & s)
+{
+    return expand_loon_string_escapes(s);
+}
+
+error_id check_string_escapes(vector_uint8 & s)
+{
+    return check_loon_string_escapes(s);
+}
+
+
+
 //       //////// //     // //////// ////////  
 //       //        //   //  //       //     // 
 //       //         // //   //       //     // 
@@ -451,10 +682,75 @@ error_id expand_loon_string_escapes(vector_uint8 & s)
 // notification of the parsed tokens
 void lexer::begin_list() {}
 void lexer::end_list() {}
-void lexer::atom_symbol(const vector_uint8 &) {}
+void lexer::atom_symbol(symbol_kind, const vector_uint8 &) {}
 void lexer::atom_string(const vector_uint8 &) {}
 void lexer::atom_number(const vector_uint8 &, num_type) {}
 
+// the text contains the given error, at or near 'v'
+void lexer::syntax_error(error_id id, const vector_uint8 & v)
+{
+    throw exception(id, token_, throw_msg(id, token_.line, v).c_str());
+}
+
+// note that the byte being processed is the first of a token
+inline void lexer::start_token()
+{
+    token_.offset = current_offset();
+    token_.line = current_line_;
+    token_.column = static_cast<int>(token_.offset - line_start_) + 1;
+}
+
+// the symbol being read is the first 'symbol_len_' bytes in value_;
+// pack them into symbol_word_, if they fit
+void lexer::load_symbol()
+{
+    symbol_len_ = value_.size();
+    symbol_word_ = 0;
+    if (symbol_len_ <= 8) {
+        for (size_t i = 0; i < symbol_len_; ++i)
+            symbol_word_ |= static_cast<uint64_t>(value_[i]) << (8 * i);
+    }
+}
+
+// return the text of the symbol being read
+vector_uint8 lexer::symbol_text() const
+{
+    if (symbol_len_ > 8)
+        return value_;
+    vector_uint8 text(symbol_len_);
+    for (size_t i = 0; i < symbol_len_; ++i)
+        text[i] = static_cast<uint8_t>(symbol_word_ >> (8 * i));
+    return text;
+}
+
+// the symbol being read is complete; the keywords are recognised here, with
+// one comparison of the packed bytes, so that they never touch value_
+void lexer::end_symbol()
+{
+    if (symbol_len_ <= 8) {
+        switch (symbol_word_) {
+        case packed_symbol("arry"):     atom_symbol(symbol_arry, value_);     return;
+        case packed_symbol("dict"):     atom_symbol(symbol_dict, value_);     return;
+        case packed_symbol("true"):     atom_symbol(symbol_true, value_);     return;
+        case packed_symbol("false"):    atom_symbol(symbol_false, value_);    return;
+        case packed_symbol("null"):     atom_symbol(symbol_null, value_);     return;
+        default:
+            value_ = symbol_text();
+            break;
+        }
+    }
+    atom_symbol(symbol_other, value_);
+}
+
+// report that the byte being processed is not valid UTF-8
+void lexer::bad_utf8()
+{
+    const location token(token_);
+    start_token(); // (the error is located at the byte, not the token)
+    syntax_error(invalid_utf8, vector_uint8());
+    token_ = token;
+}
+
 
 
 /*  process() assembles the next token from the bytes it is given. As each
@@ -474,8 +770,33 @@ void lexer::atom_number(const vector_uint8 &, num_type) {}
     finally in the start state (second recurse).)
 */
 
+// Report a bad number given in value_, which ends with 'ch', then, when
+// recovering from errors, skip the rest of it
+void lexer::bad_token(error_id id, uint8_t ch)
+{
+    syntax_error(id, value_);
+    state_ = in_bad_token;
+    process(ch);
+}
+
 void lexer::process(uint8_t ch)
 {
+#if LOON_READER_STATE_SAMPLING
+    if (!sampling_ && --sample_countdown_ == 0) {
+        // time this byte (in the nested call) by the state it starts in
+        sample_countdown_ = statistics::state_sample_interval;
+        sampling_ = true;
+        const int state = state_;
+        const std::chrono::steady_clock::time_point t0(std::chrono::steady_clock::now());
+        process(ch);
+        const std::chrono::steady_clock::duration t(std::chrono::steady_clock::now() - t0);
+        stats_.state_nanoseconds[state] += std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+        ++stats_.state_samples[state];
+        sampling_ = false;
+        return;
+    }
+#endif
+
     switch (state_) {
     case start:
         if (is_whitespace(ch)) {
@@ -485,59 +806,72 @@ void lexer::process(uint8_t ch)
         else if (ch == ';') { // the start of a comment
             state_ = in_coment;
         }
-        else if (ch == '(') { // the start of a list
-            ++nest_level_;
-            begin_list();
-            // remain in start state
-        }
-        else if (ch == ')') { // the end of a list
-            if (nest_level_ == 0)
-                throw exception(unbalanced_close_bracket, current_line_,
-                    throw_msg(unbalanced_close_bracket, current_line_).c_str());
-            --nest_level_;
-            end_list();
-            // remain in start state
-        }
-        else if (ch == '"') { // {"} => start of string
-            value_.clear();
-            state_ = in_string;
-        }
-        else if (is_digit(ch)) { // {0-9} => start of number
-            value_.clear();
-            value_.push_back(ch);
-            state_ = num_second_digit;
-        }
-        else if (ch == '-' || ch == '+') { // {+-} => start of number (possibly)
-            value_.clear();
-            value_.push_back(ch);
-            state_ = num_sign;
-        }
-        else if (ch == '.') { // {.} => start of number (possibly)
-            value_.clear();
-            value_.push_back(ch);
-            state_ = num_leading_dot;
-        }
-        else { // must be in symbol
-            value_.clear();
-            value_.push_back(ch);
-            state_ = in_symbol;
+        else {
+            start_token();
+            if (ch == '(') { // the start of a list
+                ++nest_level_;
+                begin_list();
+                // remain in start state
+            }
+            else if (ch == ')') { // the end of a list
+                if (nest_level_ == 0) {
+                    syntax_error(unbalanced_close_bracket, vector_uint8());
+                    break; // (recovering from errors: ignore the bracket)
+                }
+                --nest_level_;
+                end_list();
+                // remain in start state
+            }
+            else if (ch == '"') { // {"} => start of string
+                value_.clear();
+                string_escaped_ = false;
+                state_ = in_string;
+            }
+            else if (is_digit(ch)) { // {0-9} => start of number
+                value_.clear();
+                value_.push_back(ch);
+                state_ = num_second_digit;
+            }
+            else if (ch == '-' || ch == '+') { // {+-} => start of number (possibly)
+                value_.clear();
+                value_.push_back(ch);
+                state_ = num_sign;
+            }
+            else if (ch == '.') { // {.} => start of number (possibly)
+                value_.clear();
+                value_.push_back(ch);
+                state_ = num_leading_dot;
+            }
+            else { // must be in symbol
+                symbol_word_ = ch;
+                symbol_len_ = 1;
+                state_ = in_symbol;
+            }
         }
         break;
 
     case in_string:
         if (is_ctrl(ch)) {
-            throw exception(unescaped_ctrl_char_in_string, current_line_,
-                throw_msg(unescaped_ctrl_char_in_string, current_line_).c_str());
+            syntax_error(unescaped_ctrl_char_in_string, vector_uint8());
+            // (recovering from errors: ignore the character)
         }
         else if (ch == '"') { // the end of the string atom
-            const error_id id = expand_loon_string_escapes(value_);
-            if (id != no_error)
-                throw exception(id, current_line_, throw_msg(id, current_line_, value_).c_str());
-            atom_string(value_);
+            error_id id = utf8_ == utf8_strings && !is_utf8(value_) ? invalid_utf8 : no_error;
+            if (id == no_error) {
+                id = raw_strings_
+                    ? check_loon_string_escapes(value_)
+                    : expand_loon_string_escapes(value_);
+            }
             state_ = start;
+            stats_.escaped_strings += string_escaped_;
+            if (id != no_error)
+                syntax_error(id, value_); // (recovering from errors: ignore the string)
+            else
+                atom_string(value_);
         }
         else if (ch == '\\') {
             value_.push_back(ch);
+            string_escaped_ = true;
             state_ = in_string_escape;
         }
         else {
@@ -554,12 +888,19 @@ void lexer::process(uint8_t ch)
 
     case in_symbol:
         if (non_symbol(ch)) {
-            atom_symbol(value_);
+            end_symbol();
             state_ = start;
             process(ch);
         }
+        else if (symbol_len_ < 8) {
+            symbol_word_ |= static_cast<uint64_t>(ch) << (8 * symbol_len_++);
+            // remain in in_symbol state
+        }
         else {
+            if (symbol_len_ == 8) // too long to be a keyword: continue in value_
+                value_ = symbol_text();
             value_.push_back(ch);
+            ++symbol_len_;
             // remain in in_symbol state
         }
         break;
@@ -581,6 +922,7 @@ void lexer::process(uint8_t ch)
         }
         else { // {+-} {ch: any character that isn't 0-9 or .} => this was never a number
             // value_[0] is either '+' or '-' and is the start of a symbol
+            load_symbol();
             state_ = in_symbol;
             process(ch);
         }
@@ -593,6 +935,7 @@ void lexer::process(uint8_t ch)
         }
         else { // [{+-}] {.} {ch: any character that isn't 0-9} => this was never a number
             // value_[0] is either '+', '-' or '.' and is the start of a symbol
+            load_symbol();
             state_ = in_symbol;
             process(ch);
         }
@@ -606,8 +949,8 @@ void lexer::process(uint8_t ch)
                 break;
             }
             else { // {1-9} {xX} => syntax error
-                throw exception(bad_number, current_line_,
-                    throw_msg(bad_number, current_line_, value_).c_str());
+                bad_token(bad_number, ch);
+                break;
             }
         }
         state_ = num_digits;
@@ -634,8 +977,7 @@ void lexer::process(uint8_t ch)
         }
         else { // number merges into symbol, e.g. 99a = > bad number
             value_.push_back(ch);
-            throw exception(bad_number, current_line_,
-                throw_msg(bad_number, current_line_, value_).c_str());
+            bad_token(bad_number, ch);
         }
         break;
 
@@ -656,8 +998,7 @@ void lexer::process(uint8_t ch)
         }
         else {// got something like 9.X => bad number
             value_.push_back(ch);
-            throw exception(bad_number, current_line_,
-                throw_msg(bad_number, current_line_, value_).c_str());
+            bad_token(bad_number, ch);
         }
         break;
 
@@ -672,8 +1013,7 @@ void lexer::process(uint8_t ch)
         }
         else { // {0-9} {eE} {ch: any char except + - or 0-9} => syntax error
             value_.push_back(ch);
-            throw exception(bad_number, current_line_,
-                throw_msg(bad_number, current_line_, value_).c_str());
+            bad_token(bad_number, ch);
         }
         break;
 
@@ -684,8 +1024,7 @@ void lexer::process(uint8_t ch)
         }
         else { // {0-9} {eE} {+-} {ch: any char except 0-9} => syntax error
             value_.push_back(ch);
-            throw exception(bad_number, current_line_,
-                throw_msg(bad_number, current_line_, value_).c_str());
+            bad_token(bad_number, ch);
         }
         break;
 
@@ -702,11 +1041,18 @@ void lexer::process(uint8_t ch)
         }
         else { // got something like 9e9e => bad number
             value_.push_back(ch);
-            throw exception(bad_number, current_line_,
-                throw_msg(bad_number, current_line_, value_).c_str());
+            bad_token(bad_number, ch);
         }
         break;
 
+    case in_bad_token:
+        if (non_symbol(ch)) { // the end of the bad token
+            state_ = start;
+            process(ch);
+        }
+        // else remain in in_bad_token state
+        break;
+
     case num_hex:
         if (is_hexdigit(ch)) { // {0} {xX} {0-0a-fA-F} => more hex number
             value_.push_back(ch);
@@ -720,27 +1066,25 @@ void lexer::process(uint8_t ch)
                 process(ch);
             }
             else // no hex digits following the {0} {xX} => an incomplete hex number
-                throw exception(incomplete_hex_number, current_line_,
-                    throw_msg(incomplete_hex_number, current_line_, value_).c_str());
+                bad_token(incomplete_hex_number, ch);
         }
         else { // got something like 0xAX => bad hex number
             value_.push_back(ch);
-            throw exception(bad_hex_number, current_line_,
-                throw_msg(bad_hex_number, current_line_, value_).c_str());
+            bad_token(bad_hex_number, ch);
         }
         break;
     }
 }
 
 
-void lexer::process_chunk(const char * utf8, size_t len, bool is_last_chunk)
+// pre-process the bytes [p, end) and pass them to process()
+void lexer::scan(const uint8_t * p, const uint8_t * const end)
 {
-    static_assert(CHAR_BIT == 8, "char is not 8 bits; code assumes it is");
-    const uint8_t * p = reinterpret_cast<const uint8_t *>(utf8);
-    const uint8_t * const end = p + len;
+    chunk_ = p;
 
-    // loop once for every byte in [utf8, utf8 + len)
+    // loop once for every byte in [p, end)
     for (; p != end; ++p) {
+        pos_ = p;
         switch (pp_state_) { // "pre-processor" state
         case pp_in_bom_1:
             if (*p == 0xBB) // {0xEF} {0xBB} => pp_in_bom_2
@@ -757,6 +1101,7 @@ void lexer::process_chunk(const char * utf8, size_t len, bool is_last_chunk)
             if (*p == 0xBF) { // {0xEF} {0xBB} {0xBF} => pp_start
                 // we have silently consumed the complete UTF-8 BOM
                 pp_state_ = pp_start;
+                line_start_ = current_offset() + 1; // (the BOM is not in column 1)
             }
             else {
                 // {0xEF} {0xBB} {anything but 0xBF} => pp_start
@@ -839,29 +1184,101 @@ void lexer::process_chunk(const char * utf8, size_t len, bool is_last_chunk)
         // update line counter if this is a newline
         if (*p == '\r') { // {CR} => newline
             ++current_line_;
+            line_start_ = current_offset() + 1;
             cr_ = true;
         }
         else {
-            if (*p == '\v' || *p == '\f') // {VT} or {FF} => newline
+            if (*p == '\v' || *p == '\f') { // {VT} or {FF} => newline
                 ++current_line_;
-            else if (*p == '\n' && !cr_) {
+                line_start_ = current_offset() + 1;
+            }
+            else if (*p == '\n') {
                 // {LF} => {newline} (don't count {LF} if preceeded by {CR}
                 // because we already counted it when we saw the {CR})
-                ++current_line_;
+                if (!cr_)
+                    ++current_line_;
+                line_start_ = current_offset() + 1;
             }
             cr_ = false;
         }
     }
-    // we've processed all the source text we were given
     assert(p == end);
+    chunk_offset_ += end - chunk_;
+    chunk_ = pos_ = end;
+}
+
+// as scan(), for the few bytes of a small chunk in the pp_start state: the
+// bytes other than {\} and newlines need only process()
+void lexer::scan_small(const uint8_t * p, const uint8_t * const end)
+{
+    chunk_ = p;
+    for (; p != end; ++p) {
+        if (*p == '\\' || is_newline(*p)) {
+            // scan() splices lines and counts them
+            chunk_offset_ += p - chunk_;
+            scan(p, end);
+            return;
+        }
+        pos_ = p;
+        cr_ = false;
+        process(*p);
+    }
+    chunk_offset_ += end - chunk_;
+    chunk_ = pos_ = end;
+}
+
+void lexer::process_chunk(const char * utf8, size_t len, bool is_last_chunk)
+{
+    static_assert(CHAR_BIT == 8, "char is not 8 bits; code assumes it is");
+    const uint8_t * p = reinterpret_cast<const uint8_t *>(utf8);
+    const uint8_t * const end = p + len;
+    stats_.bytes += len;
+    ++stats_.chunks;
+
+    if (len <= small_chunk_size && !is_last_chunk && pp_state_ == pp_start && utf8_ != utf8_all && fast_paths_) {
+        // chunks of a few bytes, as from a network read, take the short way
+        scan_small(p, end);
+        // (the next chunk continues the token; branch free because which
+        // state a tiny chunk ends in is anyone's guess)
+        stats_.split_tokens += (state_ != start) & (state_ != in_coment) & (state_ != in_bad_token);
+        return;
+    }
+
+    if (utf8_ == utf8_all) {
+        // scan up to each byte that is not valid UTF-8 and report it there
+        const uint8_t * from = p;
+        for (;;) {
+            const uint8_t * const bad = find_bad_utf8(from, end, utf8_state_);
+            if (bad == end)
+                break;
+            scan(p, bad);
+            bad_utf8();
+            // (recovering from errors: the byte is then processed as given)
+            p = bad;
+            from = bad + 1;
+        }
+    }
+    scan(p, end);
+    // we've processed all the source text we were given
+
+    if (!is_last_chunk && state_ != start && state_ != in_coment && state_ != in_bad_token)
+        ++stats_.split_tokens; // (the next chunk continues the token)
 
     if (is_last_chunk) {
         // we won't receive any further source text
+        if (utf8_state_ != utf8_start) {
+            // the text ended part way through a UTF-8 sequence
+            utf8_state_ = utf8_start;
+            bad_utf8();
+        }
+
         switch (state_) {
         case in_string:
         case in_string_escape:
-            throw exception(unclosed_string, current_line_,
-                throw_msg(unclosed_string, current_line_).c_str());
+            state_ = start;
+            start_token(); // (the error is at the end of the text)
+            syntax_error(unclosed_string, vector_uint8());
+            break;
 
         case num_second_digit:
         case num_digits:
@@ -869,39 +1286,50 @@ void lexer::process_chunk(const char * utf8, size_t len, bool is_last_chunk)
             break;
 
         case num_frac_digits:
-        case num_exp_start:
         case num_exp:
             atom_number(value_, num_float);
             break;
 
+        case num_exp_start:
         case num_exp_start_digits:
-            throw exception(bad_number, current_line_,
-                throw_msg(bad_number, current_line_, value_).c_str());
+            state_ = start;
+            syntax_error(bad_number, value_);
+            break;
 
         case num_hex:
             if (value_.size() > 2)
                 atom_number(value_, num_hex_int);
-            else
-                throw exception(incomplete_hex_number, current_line_,
-                    throw_msg(incomplete_hex_number, current_line_, value_).c_str());
+            else {
+                state_ = start;
+                syntax_error(incomplete_hex_number, value_);
+            }
             break;
 
         case num_sign:
         case num_leading_dot:
+            atom_symbol(symbol_other, value_);
+            break;
+
         case in_symbol:
-            atom_symbol(value_);
+            end_symbol();
             break;
 
         case start:
         case in_coment:
+        case in_bad_token:
             break;
         }
-
-        if (nest_level_)
-            throw exception(unclosed_list, current_line_,
-                throw_msg(unclosed_list, current_line_).c_str());
-
         state_ = start;
+
+        if (nest_level_) {
+            start_token(); // (the error is at the end of the text)
+            syntax_error(unclosed_list, vector_uint8());
+            // recovering from errors: close the lists that are still open
+            while (nest_level_) {
+                --nest_level_;
+                end_list();
+            }
+        }
     }
 }
 
@@ -915,9 +1343,54 @@ void lexer::reset()
     cr_ = false;
     current_line_ = 1;
     nest_level_ = 0;
+    chunk_ = pos_ = 0;
+    chunk_offset_ = 0;
+    utf8_state_ = utf8_start;
+    string_escaped_ = false;
+    static_assert(statistics::num_states == in_bad_token + 1, "statistics::num_states is wrong");
+    stats_ = statistics();
+    value_capacity_ = value_.capacity();
+    sampling_ = false;
+    sample_countdown_ = statistics::state_sample_interval;
+    line_start_ = 0;
+    token_.offset = 0;
+    token_.line = 1;
+    token_.column = 1;
+}
+
+// continue as if the next byte given were at 'offset' in 'column' on 'line'
+// of a larger text
+void lexer::start_at(uint64_t offset, int line, int column)
+{
+    pp_state_ = pp_start; // (a BOM is only recognised at the start of the text)
+    current_line_ = line;
+    chunk_offset_ = offset;
+    line_start_ = offset - (column - 1);
+    token_.offset = offset;
+    token_.line = line;
+    token_.column = column;
+}
+
+bool lexer::can_end_slice(uint8_t next) const
+{
+    if (pp_state_ != pp_start && pp_state_ != pp_bom_test)
+        return false; // e.g. the text ended with a {\}
+    switch (state_) {
+    case start:
+        return true;
+
+    case in_string:
+    case in_string_escape:
+    case in_coment:
+        return false;
+
+    default: // a number or symbol, which 'next' must complete
+        return non_symbol(next);
+    }
 }
 
 lexer::lexer()
+: raw_strings_(false), fast_paths_(true), utf8_(utf8_unchecked)
 {
     reset();
 }
@@ -938,17 +1411,44 @@ lexer::~lexer()
 
 
 // for non-strings update list_state_ if necessary; key -> value -> key -> value -> ...
-void base::toggle_dict_state()
+// return false if the value is in error (and we are recovering from errors)
+bool base::toggle_dict_state()
 {
     if (!list_state_.empty()) {
         if (list_state_.back() == dict_allow_key) {
             // keys must be strings
-            throw exception(dict_key_is_not_string, current_line_,
-                throw_msg(dict_key_is_not_string, current_line_).c_str());
+            syntax_error(dict_key_is_not_string, vector_uint8());
+            return false;
         }
         else if (list_state_.back() == dict_require_value)
             list_state_.back() = dict_allow_key;
     }
+    return true;
+}
+
+// report the error; throw, or arrange to skip the rest of the list it is in
+void base::syntax_error(error_id id, const vector_uint8 & near)
+{
+    if (recovery_ == no_recovery)
+        lexer::syntax_error(id, near); // (throws)
+
+    if (discarding_) {
+        if (id != unclosed_list)
+            return; // (ignore errors in text we are already skipping)
+    }
+    else {
+        // the innermost list we know about, including one missing its symbol
+        const int level = static_cast<int>(list_state_.size()) + (at_list_start_ ? 1 : 0);
+        at_list_start_ = false;
+        if (level > 0) {
+            discarding_ = true;
+            discard_until_ = recovery_ == skip_list ? level - 1 : 0;
+        }
+    }
+    if (id == unclosed_list)
+        discard_until_ = 0; // (all the open lists are about to be closed)
+
+    loon_error(exception(id, token_, throw_msg(id, token_.line, near).c_str()));
 }
 
 
@@ -983,28 +1483,56 @@ void base::loon_number(const char *, size_t, num_type) {}
 
 void base::begin_list()
 {
-    if (at_list_start_)
-        throw exception(missing_arry_or_dict_symbol, current_line_,
-            throw_msg(missing_arry_or_dict_symbol, current_line_).c_str());
+    ++stats_.lists;
+    if (discarding_)
+        return;
+    if (at_list_start_) {
+        syntax_error(missing_arry_or_dict_symbol, vector_uint8());
+        return;
+    }
     at_list_start_ = true;
+    list_start_ = token_;
 }
 
 void base::end_list()
 {
-    if (at_list_start_)
-        throw exception(missing_arry_or_dict_symbol, current_line_,
-            throw_msg(missing_arry_or_dict_symbol, current_line_).c_str());
+    if (discarding_) {
+        if (static_cast<size_t>(nest_level_) < list_state_.size()) {
+            // close a list that was open before the error
+            report_location(token_);
+            if (list_state_.back() == arry_allow_value)
+                loon_arry_end();
+            else
+                loon_dict_end();
+            list_state_.pop_back();
+        }
+        if (nest_level_ <= discard_until_)
+            discarding_ = false; // we're back in step
+        return;
+    }
+
+    if (at_list_start_) {
+        syntax_error(missing_arry_or_dict_symbol, vector_uint8());
+        end_list();
+        return;
+    }
     if (list_state_.empty())
         throw exception(internal_error_inconsistent, current_line_,
             throw_msg(internal_error_inconsistent, current_line_).c_str());
 
-    if (list_state_.back() == arry_allow_value)
+    if (list_state_.back() == arry_allow_value) {
+        report_location(token_);
         loon_arry_end();
-    else if (list_state_.back() == dict_allow_key)
+    }
+    else if (list_state_.back() == dict_allow_key) {
+        report_location(token_);
         loon_dict_end();
-    else if (list_state_.back() == dict_require_value)
-        throw exception(missing_dict_value, current_line_,
-            throw_msg(missing_dict_value, current_line_).c_str());
+    }
+    else if (list_state_.back() == dict_require_value) {
+        syntax_error(missing_dict_value, vector_uint8());
+        end_list();
+        return;
+    }
     else
         throw exception(internal_error_inconsistent, current_line_,
             throw_msg(internal_error_inconsistent, current_line_).c_str());
@@ -1012,48 +1540,69 @@ void base::end_list()
     list_state_.pop_back();
 }
 
-void base::atom_symbol(const vector_uint8 & value)
+void base::atom_symbol(symbol_kind kind, const vector_uint8 & other)
 {
-    toggle_dict_state();
+    ++stats_.symbols;
+    if (kind == symbol_other)
+        note_buffer(other);
+    if (discarding_ || !toggle_dict_state())
+        return;
 
     if (at_list_start_) {
-        if (value == "arry") {
+        if (kind == symbol_arry) {
             list_state_.push_back(arry_allow_value);
+            stats_.max_depth = std::max(stats_.max_depth, static_cast<int>(list_state_.size()));
+            token_ = list_start_; // (the list is located at its '(')
+            report_location(token_);
             loon_arry_begin();
         }
-        else if (value == "dict") {
+        else if (kind == symbol_dict) {
             list_state_.push_back(dict_allow_key);
+            stats_.max_depth = std::max(stats_.max_depth, static_cast<int>(list_state_.size()));
+            token_ = list_start_;
+            report_location(token_);
             loon_dict_begin();
         }
-        else
-            throw exception(missing_arry_or_dict_symbol, current_line_,
-                throw_msg(missing_arry_or_dict_symbol, current_line_, value).c_str());
+        else {
+            syntax_error(missing_arry_or_dict_symbol, symbol_name(kind, other));
+            return;
+        }
         at_list_start_ = false;
     }
     else {
-        if (value == "true")
-            loon_bool(true);
-        else if (value == "false")
-            loon_bool(false);
-        else if (value == "null")
-            loon_null();
-        else
-            throw exception(unexpected_or_unknown_symbol, current_line_,
-                throw_msg(unexpected_or_unknown_symbol, current_line_, value).c_str());
+        report_location(token_);
+        switch (kind) {
+        case symbol_true:   loon_bool(true);    break;
+        case symbol_false:  loon_bool(false);   break;
+        case symbol_null:   loon_null();        break;
+        default:
+            syntax_error(unexpected_or_unknown_symbol, symbol_name(kind, other));
+            break;
+        }
     }
 }
 
 void base::atom_string(const vector_uint8 & value)
 {
-    if (at_list_start_)
-        throw exception(missing_arry_or_dict_symbol, current_line_,
-            throw_msg(missing_arry_or_dict_symbol, current_line_, value).c_str());
+    ++stats_.strings;
+    note_buffer(value);
+    if (discarding_)
+        return;
+    if (at_list_start_) {
+        syntax_error(missing_arry_or_dict_symbol, value);
+        return;
+    }
 
+    report_location(token_);
     if (list_state_.empty())
         loon_string(char_ptr(value), value.size());
     else {
         if (list_state_.back() == dict_allow_key) {
-            loon_dict_key(char_ptr(value), value.size());
+            const int id = find_key(reinterpret_cast<const uint8_t *>(char_ptr(value)), value.size());
+            if (id < 0)
+                loon_dict_key(char_ptr(value), value.size());
+            else
+                loon_dict_key_id(id);
             list_state_.back() = dict_require_value;
         }
         else {
@@ -1064,14 +1613,126 @@ void base::atom_string(const vector_uint8 & value)
     }
 }
 
+void base::throw_exception(error_id id) const
+{
+    throw exception(id, token_, throw_msg(id, token_.line).c_str());
+}
+
 void base::atom_number(const vector_uint8 & value, num_type ntype)
 {
-    if (at_list_start_)
-        throw exception(missing_arry_or_dict_symbol, current_line_,
-            throw_msg(missing_arry_or_dict_symbol, current_line_, value).c_str());
+    ++stats_.numbers;
+    note_buffer(value);
+    if (discarding_)
+        return;
+    if (at_list_start_) {
+        syntax_error(missing_arry_or_dict_symbol, value);
+        return;
+    }
+
+    if (toggle_dict_state()) {
+        report_location(token_);
+        loon_number(char_ptr(value), value.size(), ntype);
+    }
+}
+
+// the default is to throw the exception, as if not recovering from errors
+void base::loon_error(const exception & e)
+{
+    throw e;
+}
+
+base::recovery base::set_recovery(recovery r)
+{
+    std::swap(recovery_, r);
+    return r;
+}
+
+// count a growth of the token buffer 'value' (which is value_) since last time
+inline void base::note_buffer(const vector_uint8 & value)
+{
+    if (value.capacity() != value_capacity_) {
+        ++stats_.buffer_growths;
+        value_capacity_ = value.capacity();
+    }
+}
+
+const statistics & base::stats() const
+{
+    return stats_;
+}
+
+// the default ignores token locations
+void base::loon_token_location(const location &) {}
+
+bool base::set_token_locations(bool on)
+{
+    std::swap(token_locations_, on);
+    return on;
+}
+
+void base::loon_dict_key_id(int id)
+{
+    loon_dict_key(keys_[id].data(), keys_[id].size());
+}
+
+int base::intern_key(const char * utf8, size_t len)
+{
+    const uint8_t * const p = reinterpret_cast<const uint8_t *>(utf8);
+    const int found = find_key(p, len);
+    if (found >= 0)
+        return found;
+
+    const uint32_t id = static_cast<uint32_t>(keys_.size());
+    keys_.push_back(std::string(utf8, len));
+    key_hashes_.push_back(key_hash(p, len));
+
+    // (re)build the hash table so that it is at most half full
+    if (key_index_.size() < keys_.size() * 2) {
+        size_t size = 16;
+        while (size < keys_.size() * 2)
+            size *= 2;
+        key_index_.assign(size, 0);
+        for (uint32_t i = 0; i < id; ++i) {
+            size_t slot = key_hashes_[i] & (size - 1);
+            while (key_index_[slot])
+                slot = (slot + 1) & (size - 1);
+            key_index_[slot] = i + 1;
+        }
+    }
+    const size_t mask = key_index_.size() - 1;
+    size_t slot = key_hashes_[id] & mask;
+    while (key_index_[slot])
+        slot = (slot + 1) & mask;
+    key_index_[slot] = id + 1;
+    return static_cast<int>(id);
+}
+
+int base::intern_key(const std::string & key)
+{
+    return intern_key(key.data(), key.size());
+}
 
-    toggle_dict_state();
-    loon_number(char_ptr(value), value.size(), ntype);
+void base::clear_interned_keys()
+{
+    keys_.clear();
+    key_hashes_.clear();
+    key_index_.clear();
+}
+
+// return the id of the registered key [p, p + len), or -1 if there is none
+int base::find_key(const uint8_t * p, size_t len) const
+{
+    if (keys_.empty())
+        return -1;
+    const uint32_t h = key_hash(p, len);
+    const size_t mask = key_index_.size() - 1;
+    for (size_t slot = h & mask; key_index_[slot]; slot = (slot + 1) & mask) {
+        const uint32_t id = key_index_[slot] - 1;
+        if (key_hashes_[id] == h && keys_[id].size() == len
+                && (len == 0 || std::memcmp(keys_[id].data(), p, len) == 0))
+            return static_cast<int>(id);
+    }
+    return -1;
 }
 
 void base::reset()
@@ -1079,9 +1740,19 @@ void base::reset()
     lexer::reset();
     at_list_start_ = false;
     list_state_.clear();
+    discarding_ = false;
+    discard_until_ = 0;
+    list_start_ = token_location();
+}
+
+void base::reset_at(uint64_t offset, int line, int column)
+{
+    reset();
+    start_at(offset, line, column);
 }
 
 base::base()
+: recovery_(no_recovery), token_locations_(false)
 {
     reset();
 }
@@ -1092,4 +1763,192 @@ base::~base()
 
 
 
+namespace {
+
+// read the Loon text made by base::checkpoint()
+class checkpoint_reader : public base {
+public:
+    std::vector<std::string> items; // the elements of the top-level arry
+    std::vector<bool> is_number;
+
+    checkpoint_reader() : depth_(0) {}
+
+private:
+    int depth_;
+
+    void bad() const { throw_exception(bad_checkpoint); }
+    void item(const char * utf8, size_t len, bool number)
+    {
+        if (depth_ != 1)
+            bad();
+        items.push_back(std::string(utf8, len));
+        is_number.push_back(number);
+    }
+
+    virtual void loon_arry_begin() { if (depth_++ != 0) bad(); }
+    virtual void loon_arry_end() { --depth_; }
+    virtual void loon_dict_begin() { bad(); }
+    virtual void loon_dict_end() { bad(); }
+    virtual void loon_dict_key(const char *, size_t) { bad(); }
+    virtual void loon_null() { bad(); }
+    virtual void loon_bool(bool) { bad(); }
+    virtual void loon_string(const char * utf8, size_t len) { item(utf8, len, false); }
+    virtual void loon_number(const char * utf8, size_t len, num_type ntype)
+    {
+        if (ntype != num_dec_int || *utf8 == '-')
+            bad();
+        item(utf8, len, true);
+    }
+};
+
+const char checkpoint_tag[] = "loon reader checkpoint";
+const char list_state_chars[] = "akv"; // arry_allow_value, dict_allow_key, dict_require_value
+
+// append 'v' to 'out' as a quoted Loon string
+void append_quoted(std::string & out, const vector_uint8 & v)
+{
+    out += '"';
+    for (size_t i = 0; i < v.size(); ++i) {
+        const uint8_t ch = v[i];
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += static_cast<char>(ch);
+        }
+        else if (is_ctrl(ch)) {
+            out += "\\u00";
+            out += "0123456789ABCDEF"[ch >> 4];
+            out += "0123456789ABCDEF"[ch & 0xF];
+        }
+        else
+            out += static_cast<char>(ch);
+    }
+    out += '"';
+}
+
+// append 'n' to 'out' in decimal
+void append_decimal(std::string & out, uint64_t n)
+{
+    char buf[20];
+    char * const end = buf + sizeof(buf);
+    char * p = end;
+    do {
+        *--p = static_cast<char>('0' + n % 10);
+        n /= 10;
+    }
+    while (n);
+    out += ' ';
+    out.append(p, end);
+}
+
+} // anonymous namespace
+
+
+/*  The checkpoint is the Loon text
+
+        (arry "loon reader checkpoint" 4 offset line state pp_state cr
+            nest_level at_list_start discarding discard_until column
+            token_offset token_line token_column list_offset list_line list_column
+            utf8_state "value" "list_state")
+
+    where 4 is the version of this layout, which must change if the lexer
+    states are changed, and list_state has one character per open list.
+*/
+std::string base::checkpoint() const
+{
+    std::string out("(arry \"");
+    out += checkpoint_tag;
+    out += "\" 4";
+    append_decimal(out, current_offset());
+    append_decimal(out, static_cast<uint64_t>(current_line_));
+    append_decimal(out, static_cast<uint64_t>(state_));
+    append_decimal(out, static_cast<uint64_t>(pp_state_));
+    append_decimal(out, cr_ ? 1 : 0);
+    append_decimal(out, static_cast<uint64_t>(nest_level_));
+    append_decimal(out, at_list_start_ ? 1 : 0);
+    append_decimal(out, discarding_ ? 1 : 0);
+    append_decimal(out, static_cast<uint64_t>(discard_until_));
+    append_decimal(out, static_cast<uint64_t>(current_column()));
+    const location * const locations[] = { &token_, &list_start_ };
+    for (int i = 0; i < 2; ++i) {
+        append_decimal(out, locations[i]->offset);
+        append_decimal(out, static_cast<uint64_t>(locations[i]->line));
+        append_decimal(out, static_cast<uint64_t>(locations[i]->column));
+    }
+    append_decimal(out, utf8_state_);
+    out += ' ';
+    append_quoted(out, state_ == in_symbol ? symbol_text() : value_);
+    out += " \"";
+    for (size_t i = 0; i < list_state_.size(); ++i)
+        out += list_state_chars[list_state_[i]];
+    out += "\")";
+    return out;
+}
+
+void base::restore(const std::string & saved)
+{
+    checkpoint_reader r;
+    r.set_raw_strings(false);
+    r.process_chunk(saved.data(), saved.size(), /*is_last_chunk=*/true);
+
+    enum {
+        tag, version, offset, line, state, pp_state, cr, nest_level, at_list_start,
+        discarding, discard_until, column, token_offset, token_line, token_column,
+        list_offset, list_line, list_column, utf8_state, value, list_state, num_items
+    };
+    const std::vector<std::string> & items(r.items);
+    bool ok = items.size() == num_items && items[tag] == checkpoint_tag;
+    uint64_t n[num_items] = { 0 };
+    for (int i = version; ok && i <= utf8_state; ++i) {
+        ok = r.is_number[i] && items[i].size() <= 19;
+        if (ok)
+            n[i] = std::strtoull(items[i].c_str(), 0, 10);
+    }
+    ok = ok && !r.is_number[value] && !r.is_number[list_state]
+        && n[version] == 4 && n[line] >= 1 && n[line] <= INT_MAX
+        && n[column] >= 1 && n[column] - 1 <= n[offset]
+        && n[token_offset] <= n[offset] && n[list_offset] <= n[offset]
+        && n[token_line] >= 1 && n[token_line] <= INT_MAX && n[list_line] >= 1 && n[list_line] <= INT_MAX
+        && n[column] <= INT_MAX && n[token_column] <= INT_MAX && n[list_column] <= INT_MAX
+        && n[utf8_state] <= utf8_after_F4
+        && n[state] <= in_bad_token && n[pp_state] <= pp_ignore_lf && n[cr] <= 1
+        && n[at_list_start] <= 1 && n[discarding] <= 1;
+    if (ok && n[discarding] == 0) // each open list is known to the reader
+        ok = n[nest_level] == items[list_state].size() + n[at_list_start];
+    else if (ok) // lists opened after the error are known only to the lexer
+        ok = n[at_list_start] == 0 && n[nest_level] >= items[list_state].size()
+            && n[nest_level] <= INT_MAX && n[discard_until] <= items[list_state].size();
+    std::vector<list_info> lists;
+    for (size_t i = 0; ok && i < items[list_state].size(); ++i) {
+        const char * const c = std::strchr(list_state_chars, items[list_state][i]);
+        ok = c && *c;
+        if (ok)
+            lists.push_back(static_cast<list_info>(c - list_state_chars));
+    }
+    if (!ok)
+        throw_exception(bad_checkpoint);
+
+    chunk_ = pos_ = 0;
+    chunk_offset_ = n[offset];
+    line_start_ = n[offset] - (n[column] - 1);
+    token_.offset = n[token_offset];
+    token_.line = static_cast<int>(n[token_line]);
+    token_.column = static_cast<int>(n[token_column]);
+    list_start_.offset = n[list_offset];
+    list_start_.line = static_cast<int>(n[list_line]);
+    list_start_.column = static_cast<int>(n[list_column]);
+    utf8_state_ = static_cast<uint8_t>(n[utf8_state]);
+    current_line_ = static_cast<int>(n[line]);
+    state_ = static_cast<decltype(state_)>(n[state]);
+    pp_state_ = static_cast<decltype(pp_state_)>(n[pp_state]);
+    cr_ = n[cr] != 0;
+    nest_level_ = static_cast<int>(n[nest_level]);
+    at_list_start_ = n[at_list_start] != 0;
+    discarding_ = n[discarding] != 0;
+    discard_until_ = static_cast<int>(n[discard_until]);
+    value_.assign(items[value].begin(), items[value].end());
+    load_symbol(); // (in case state_ is in_symbol)
+    list_state_.swap(lists);
+}
+
+
 }} // end of namespace loon::reader
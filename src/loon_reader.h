@@ -32,6 +32,7 @@
 #include <string>
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
 #include <cstdint>
 
 
@@ -112,27 +113,94 @@ enum error_id {
     // lead value. (A surrogate lead is in the range \uD800...\uDBFF, a surrogate trail is
     // in the range \uDC00...\uDFFF.)
 
+    bound_value_mismatch                    = 116,
+    // A value could not be stored in the C++ object it is bound to (see loon_struct.h);
+    // either the Loon value type does not match the C++ type, or the value is out of range.
+    // For example, "abc" cannot be stored in an int32_t and 1e99 cannot be stored in a uint32_t.
+
+    bad_json                                = 117,
+    // The JSON text being read by loon::json::reader (see loon_json.h) is not well formed.
+    // For example, [1,] and {"key" 1} are not valid JSON.
+
+    bad_binary                              = 118,
+    // The data given to loon::binary::document (see loon_binary.h) is not a well formed
+    // binary Loon document. For example, it is truncated or an offset is out of range.
+
+    index_requires_arry                     = 119,
+    // An index of a top-level arry (see loon_index.h) was requested for Loon text whose
+    // top-level value is not an arry, or that has more than one top-level value.
+
+    bad_index                               = 120,
+    // The text given to loon::index::read_index() is not an arry index written by
+    // loon::index::write_index().
+
+    bad_checkpoint                          = 121,
+    // The text given to loon::reader::base::restore() is not a checkpoint made by
+    // loon::reader::base::checkpoint().
+
+    invalid_utf8                            = 122,
+    // The Loon text contains a byte sequence that is not valid UTF-8, found because
+    // UTF-8 validation was requested (see loon::reader::base::set_utf8_validation()).
+    // E.g. a stray continuation byte, an overlong encoding or an encoded surrogate.
+
+    bad_diff                                = 123,
+    // A text given to loon::diff() or loon::patch() (see loon_diff.h) does not hold
+    // exactly one value, or the delta given to loon::patch() is not a delta written
+    // by loon::diff() or doesn't fit the document: a path leads to a value that
+    // isn't there.
+
 
     // the following should never occur... the code is broken... please report to author...
     internal_error_unknown_state            = 998,
     internal_error_inconsistent             = 999,
 };
 
+// a place in a Loon text
+struct location {
+    uint64_t offset;    // bytes from the start of the text
+    int line;           // 1 for the first line
+    int column;         // 1 for the first byte on the line (counts bytes, not characters)
+};
+
 class exception : public std::runtime_error {
 public:
     exception(error_id id, int line, const char * msg)
-    : std::runtime_error(msg), id_(id), line_(line)
+    : std::runtime_error(msg), id_(id), line_(line), offset_(0), column_(0)
+    {}
+
+    exception(error_id id, const location & where, const char * msg)
+    : std::runtime_error(msg), id_(id), line_(where.line),
+      offset_(where.offset), column_(where.column)
     {}
 
     virtual error_id id() const { return id_; }
     virtual int line() const { return line_; }
 
+    // the offset and column of the start of the token in error, or 0 if not known
+    uint64_t offset() const { return offset_; }
+    int column() const { return column_; }
+
 protected:
     error_id id_;
     int line_; // Loon text line number being processed at point of exception
+    uint64_t offset_;
+    int column_;
 };
 
 
+// return the message carried by a loon::reader::exception with the given
+// 'id' found on the given 'line', at or near the text 'v' (if not empty)
+std::string exception_message(error_id id, int line, const vector_uint8 & v = vector_uint8());
+
+// Replace all string escape sequences in the given 's' with the UTF-8 they
+// represent. (Loon and JSON have the same string escapes.) Return no_error,
+// or the error_id describing the first invalid escape found.
+error_id expand_string_escapes(vector_uint8 & s);
+
+// As expand_string_escapes() but the escapes are only checked, not expanded.
+error_id check_string_escapes(vector_uint8 & s);
+
+
 // number types for loon::reader::base::loon_number()
 enum num_type {
     num_dec_int,    // -123456  decimal integer
@@ -140,6 +208,34 @@ enum num_type {
     num_float       // +9.3e-3  decimal fraction
 };
 
+// UTF-8 validation modes for loon::reader::base::set_utf8_validation()
+enum utf8_validation {
+    utf8_unchecked, // the text is assumed to be valid UTF-8
+    utf8_strings,   // each string is checked
+    utf8_all        // all the text is checked, including comments
+};
+
+// counts kept by the reader of what it has read; see loon::reader::base::stats()
+struct statistics {
+    uint64_t bytes;             // bytes given to process_chunk()
+    uint64_t chunks;            // calls to process_chunk()
+    uint64_t lists;             // lists read, i.e. each '('
+    uint64_t strings;           // strings read, including dict keys
+    uint64_t escaped_strings;   // strings containing at least one \ escape
+    uint64_t numbers;           // numbers read
+    uint64_t symbols;           // symbols read, including the arry or dict of each list
+    uint64_t split_tokens;      // chunk boundaries that fell part way through a token
+    uint64_t buffer_growths;    // times the reader found its token buffer had grown
+    int max_depth;              // deepest nesting of lists reported
+
+    // Only if compiled with LOON_READER_STATE_SAMPLING defined non-zero: the
+    // lexer times the processing of one byte in every state_sample_interval
+    // and adds it to the totals for the lexer state it was processed in.
+    enum { num_states = 15, state_sample_interval = 1024 };
+    uint64_t state_samples[num_states];
+    uint64_t state_nanoseconds[num_states];
+};
+
 // ignore this class: it is a Loon reader implementation detail
 class lexer {
 
@@ -151,27 +247,75 @@ public:
 
     virtual void process_chunk(const char * utf8, size_t len, bool is_last_chunk);
 
+    // the symbols the lexer recognises itself; the text of any other is given
+    enum symbol_kind { symbol_arry, symbol_dict, symbol_true, symbol_false, symbol_null, symbol_other };
+
     virtual void begin_list() = 0;
     virtual void end_list() = 0;
-    virtual void atom_symbol(const vector_uint8 &) = 0;
+    virtual void atom_symbol(symbol_kind kind, const vector_uint8 & other) = 0;
     virtual void atom_string(const vector_uint8 &) = 0;
 
     virtual void atom_number(const vector_uint8 &, num_type) = 0;
+    virtual void syntax_error(error_id id, const vector_uint8 & near);
 
     virtual int current_line() const { return current_line_; }
 
+    uint64_t current_offset() const { return chunk_offset_ + (pos_ - chunk_); }
+
+    int current_column() const { return static_cast<int>(current_offset() - line_start_) + 1; }
+
+    const location & token_location() const { return token_; }
+
+    void start_at(uint64_t offset, int line, int column);
+
+    bool can_end_slice(uint8_t next) const;
+
+    bool set_raw_strings(bool on) { std::swap(raw_strings_, on); return on; }
+
+    utf8_validation set_utf8_validation(utf8_validation v) { std::swap(utf8_, v); return v; }
+
+    bool set_fast_paths(bool on) { std::swap(fast_paths_, on); return on; }
+
 protected:
     int current_line_;
 
 private:
+    friend class base; // for checkpoint() and restore()
     enum { pp_bom_test, pp_in_bom_1, pp_in_bom_2, pp_start, pp_escape, pp_ignore_lf } pp_state_;
     enum { start, in_symbol, in_string, in_string_escape, in_coment,
         num_second_digit, num_sign, num_leading_dot, num_digits, num_hex,
-        num_exp_start, num_frac_digits, num_exp_start_digits, num_exp } state_;
+        num_exp_start, num_frac_digits, num_exp_start_digits, num_exp,
+        in_bad_token } state_;
     bool cr_;
+    bool raw_strings_;
+    bool fast_paths_;
+    utf8_validation utf8_;
+    uint8_t utf8_state_;        // progress through a UTF-8 sequence (utf8_all only)
     int nest_level_;
+    bool string_escaped_;       // the string being read contains a \ escape
+    statistics stats_;
+    size_t value_capacity_;     // capacity of value_ when last looked at
+    // (declared whatever LOON_READER_STATE_SAMPLING is, so that the class
+    // layout doesn't depend on it; only lexer::process() uses them)
+    bool sampling_;             // a byte is being timed
+    unsigned sample_countdown_; // bytes until the next one is timed
     vector_uint8 value_;
+    uint64_t symbol_word_;      // the first 8 bytes of the symbol being read, packed
+    size_t symbol_len_;         // length of the symbol; if over 8 all of it is in value_
+    const uint8_t * chunk_;     // the chunk being processed
+    const uint8_t * pos_;       // the byte being processed
+    uint64_t chunk_offset_;     // offset of chunk_ from the start of the Loon text
+    uint64_t line_start_;       // offset of the first byte on the current line
+    location token_;            // where the current token starts
+    void start_token();
+    void bad_utf8();
+    void load_symbol();
+    void end_symbol();
+    vector_uint8 symbol_text() const;
+    void scan(const uint8_t * p, const uint8_t * end);
+    void scan_small(const uint8_t * p, const uint8_t * end);
     void process(uint8_t ch);
+    void bad_token(error_id id, uint8_t ch);
 };
 
 
@@ -196,7 +340,8 @@ public:
 
         Notes about UTF-8 encoding
         - The Loon reader assumes the given text is in valid UTF-8 encoding.
-        - The reader does no general UTF-8 validation of the given source text.
+        - The reader does no general UTF-8 validation of the given source text
+          unless asked to with set_utf8_validation().
         - If the UTF-8 BOM forms the first three bytes (0xEF 0xBB 0xBF) of the
           given Loon source text it is ignored.
         - If the UTF-8 BOM appears anywhere other than the first three bytes
@@ -209,6 +354,116 @@ public:
     // This function returns the current value of that count.
     using lexer::current_line; // just republish the lexer function
 
+    // uint64_t current_offset()
+    // The offset, in bytes from the start of the Loon text, of the byte the
+    // reader is processing. (During a loon_XXXX event this is the byte that
+    // completed the token; between calls to process_chunk() it is the number
+    // of bytes processed so far.)
+    using lexer::current_offset; // just republish the lexer function
+
+    // int current_column()
+    // The column of the byte current_offset() on line current_line(). The
+    // first byte on a line is column 1; columns count bytes, not characters.
+    using lexer::current_column; // just republish the lexer function
+
+    // const location & token_location()
+    // The offset, line and column of the first byte of the token that raised
+    // the current loon_XXXX event (for loon_arry_begin and loon_dict_begin the
+    // '(' that opened the list; for loon_arry_end and loon_dict_end the ')').
+    // A loon::reader::exception carries the location of the token in error.
+    using lexer::token_location; // just republish the lexer function
+
+    // Reset the reader, as reset() does, ready to process a slice of a larger
+    // Loon text that starts at the given 'offset' and 'line' (and 'column',
+    // if the slice doesn't start at the beginning of a line). The slice must
+    // start between tokens. The slice is read as a sequence of top-level values.
+    void reset_at(uint64_t offset, int line, int column = 1);
+
+    // Return the complete state of the reader as a short Loon text, so that
+    // reading can later be resumed from this point with restore(), e.g. in
+    // another process. Call it only between calls to process_chunk(), not
+    // from a loon_XXXX function. The state of your derived class is not
+    // included: save that alongside. The offset of the next byte the reader
+    // expects is current_offset().
+    std::string checkpoint() const;
+
+    // Restore the state saved by checkpoint(); continue by giving process_chunk()
+    // the Loon text that starts at current_offset(). Throws a loon::reader::exception
+    // with id bad_checkpoint if 'saved' is not a checkpoint.
+    void restore(const std::string & saved);
+
+    // bool can_end_slice(uint8_t next)
+    // Return true iff the text processed so far may be followed by the byte
+    // 'next' without any token, comment or line splice spanning the two. Use
+    // this to check that a slice read after reset_at() ends between tokens.
+    using lexer::can_end_slice; // just republish the lexer function
+
+    // bool set_raw_strings(bool on)
+    // Normally the reader replaces the escape sequences in each string with
+    // the characters they represent before passing the string to loon_string()
+    // or loon_dict_key(). If raw strings are on the reader still checks the
+    // escape sequences are valid but passes the string exactly as it appears
+    // in the Loon text, less the enclosing quotes. Returns the previous
+    // setting. (Default is off. The setting is not changed by reset().)
+    using lexer::set_raw_strings; // just republish the lexer function
+
+    // utf8_validation set_utf8_validation(utf8_validation v)
+    // Check that the Loon text is valid UTF-8: either all of it (utf8_all), as
+    // it is given to process_chunk(), or just the strings (utf8_strings). The
+    // reader reports invalid UTF-8 as an error with id invalid_utf8; with
+    // utf8_all the error is located at the offending byte, with utf8_strings
+    // at the string containing it. Returns the previous setting. (Default is
+    // utf8_unchecked. The setting is not changed by reset().)
+    using lexer::set_utf8_validation; // just republish the lexer function
+
+    // bool set_fast_paths(bool on)
+    // The reader takes short cuts where it safely can, e.g. for chunks of only
+    // a few bytes. With fast paths off every byte takes the general, byte at a
+    // time, path: the reference the short cuts are fuzzed against (see
+    // test/fuzz.cpp). Returns the previous setting. (Default is on. The setting
+    // is not changed by reset().)
+    using lexer::set_fast_paths; // just republish the lexer function
+
+    // Return counts of what the reader has read since it was constructed or
+    // last reset(), e.g. to tell whether slow reading is due to the shape of
+    // the input (tiny chunks, deep nesting, escapes) or to your loon_XXXX
+    // functions. (restore() doesn't restore the counts.)
+    const statistics & stats() const;
+
+    // What the reader does when it finds an error in the Loon text:
+    //  no_recovery - throw a loon::reader::exception (the default)
+    //  skip_list   - call loon_error(), then ignore the rest of the innermost
+    //                list containing the error and carry on after its ')'
+    //  skip_record - call loon_error(), then ignore the rest of the top-level
+    //                value containing the error and carry on with the next
+    // When recovering, every list the reader reported opening is still closed
+    // with a loon_arry_end or loon_dict_end event. A dict may be left with a
+    // key but no value.
+    enum recovery { no_recovery, skip_list, skip_record };
+
+    // Set the error recovery mode; return the previous mode. (The setting is
+    // not changed by reset().)
+    recovery set_recovery(recovery r);
+
+    // If on, the reader calls loon_token_location() before each of the
+    // events 1 to 9 below. Returns the previous setting. (Default is off.
+    // The setting is not changed by reset().)
+    bool set_token_locations(bool on);
+
+    // Register 'key' as a dict key you expect and return its id: the first
+    // key registered gets id 0, the next 1 and so on; registering a key again
+    // returns the id it already has. Thereafter the reader reports that key
+    // with loon_dict_key_id() instead of loon_dict_key(), so you can switch
+    // on the id rather than compare strings. Keys are matched, through a hash
+    // of the key bytes in the reader's token buffer, against the key as it
+    // would be given to loon_dict_key(), i.e. unescaped unless raw strings
+    // are on. (The registered keys are not changed by reset().)
+    int intern_key(const char * utf8, size_t len);
+    int intern_key(const std::string & key);
+
+    // Forget all the keys registered with intern_key().
+    void clear_interned_keys();
+
 
     // You must override these nine virtual functions to collect the Loon data.
 
@@ -252,16 +507,58 @@ public:
     // integer or a decimal floating point number, as indicated by 'ntype'.
     virtual void loon_number(const char * utf8, size_t len, num_type ntype) = 0;
 
+    // 10. Optional. The reader found the error described by 'e' and is
+    // recovering from it (see set_recovery()). The default throws 'e'. You
+    // may throw from here to stop reading.
+    virtual void loon_error(const exception & e);
+
+    // 11. Optional. If set_token_locations(true) was called, this gives the
+    // location of the token raising the event that immediately follows; see
+    // token_location(). The default does nothing.
+    virtual void loon_token_location(const location & where);
+
+    // 12. Optional. The reader encountered a dict key registered with
+    // intern_key(); 'id' is the id intern_key() returned for it. This event
+    // replaces loon_dict_key() for that key. The default calls loon_dict_key()
+    // with the registered key, so a reader that doesn't override this sees
+    // every key as before.
+    virtual void loon_dict_key_id(int id);
+
+protected:
+    // Throw a loon::reader::exception with the given 'id' for the current line.
+    // A derived reader may use this to report errors it detects in the Loon data.
+    void throw_exception(error_id id) const;
+
 private:
     bool at_list_start_;
 
     enum list_info { arry_allow_value, dict_allow_key, dict_require_value };
     std::vector<list_info> list_state_;
-    void toggle_dict_state();
+    bool toggle_dict_state();
+    void note_buffer(const vector_uint8 & value);
+
+    recovery recovery_;
+    bool token_locations_;
+    location list_start_;   // where the list now missing its arry/dict symbol started
+    void report_location(const location & where)
+    {
+        if (token_locations_)
+            loon_token_location(where);
+    }
+
+    std::vector<std::string> keys_;     // the keys registered with intern_key(), by id
+    std::vector<uint32_t> key_hashes_;  // the hash of each registered key, by id
+    std::vector<uint32_t> key_index_;   // open addressed hash table: key id + 1, or 0 if empty slot
+    int find_key(const uint8_t * p, size_t len) const;
+
+    bool discarding_;       // true => ignore tokens until back at discard_until_
+    int discard_until_;     // nest level at which discarding ends
+
+    virtual void syntax_error(error_id id, const vector_uint8 & near);
 
     virtual void begin_list();
     virtual void end_list();
-    virtual void atom_symbol(const vector_uint8 &);
+    virtual void atom_symbol(symbol_kind, const vector_uint8 &);
     virtual void atom_string(const vector_uint8 &);
     virtual void atom_number(const vector_uint8 &, num_type);
 };
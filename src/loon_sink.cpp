@@ -0,0 +1,214 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+#include "loon_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+
+namespace loon {
+namespace writer {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+void fail(const char * what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+#ifdef _WIN32
+
+// write all of the given pieces to 'fd'; return the number of calls made
+uint64_t write_all(int fd, const char * a, size_t a_len, const char * b, size_t b_len)
+{
+    uint64_t calls = 0;
+    const char * data[2] = { a, b };
+    size_t len[2] = { a_len, b_len };
+    for (int i = 0; i < 2; ++i) {
+        while (len[i]) {
+            const unsigned n = static_cast<unsigned>(std::min<size_t>(len[i], 1 << 30));
+            const int written = _write(fd, data[i], n);
+            ++calls;
+            if (written < 0)
+                fail("loon::writer::fd_sink");
+            data[i] += written;
+            len[i] -= written;
+        }
+    }
+    return calls;
+}
+
+#else
+
+// write all of the given pieces to 'fd', both at once if possible; return
+// the number of calls made
+uint64_t write_all(int fd, const char * a, size_t a_len, const char * b, size_t b_len)
+{
+    uint64_t calls = 0;
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char *>(a);
+    iov[0].iov_len = a_len;
+    iov[1].iov_base = const_cast<char *>(b);
+    iov[1].iov_len = b_len;
+    iovec * v = iov;
+    int n = 2;
+    while (n && v->iov_len == 0) // (skip empty pieces)
+        ++v, --n;
+    while (n) {
+        const ssize_t written = ::writev(fd, v, n);
+        ++calls;
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            fail("loon::writer::fd_sink");
+        }
+        // move past what was written (a pipe or socket may take only part)
+        size_t done = static_cast<size_t>(written);
+        while (n && done >= v->iov_len) {
+            done -= v->iov_len;
+            ++v, --n;
+        }
+        if (n) {
+            v->iov_base = static_cast<char *>(v->iov_base) + done;
+            v->iov_len -= done;
+        }
+    }
+    return calls;
+}
+
+#endif
+
+} // anonymous namespace
+
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+void file_sink::write(const char * utf8, size_t len)
+{
+    if (std::fwrite(utf8, 1, len, file_) != len)
+        fail("loon::writer::file_sink");
+}
+
+void file_sink::flush()
+{
+    if (std::fflush(file_) != 0)
+        fail("loon::writer::file_sink");
+}
+
+
+fd_sink::fd_sink(int fd, size_t buffer_size)
+: fd_(fd), buf_(std::max<size_t>(buffer_size, 1)), used_(0), syscalls_(0)
+{
+}
+
+fd_sink::fd_sink(fd_sink && other)
+: fd_(other.fd_), buf_(std::move(other.buf_)), used_(other.used_), syscalls_(other.syscalls_)
+{
+    other.used_ = 0; // (so only this sink writes the buffered text)
+}
+
+fd_sink & fd_sink::operator=(fd_sink && other)
+{
+    if (this != &other) {
+        flush();
+        fd_ = other.fd_;
+        buf_ = std::move(other.buf_);
+        used_ = other.used_;
+        syscalls_ = other.syscalls_;
+        other.used_ = 0;
+    }
+    return *this;
+}
+
+fd_sink::~fd_sink()
+{
+    try {
+        flush();
+    }
+    catch (const std::system_error &) {
+    }
+}
+
+void fd_sink::write(const char * utf8, size_t len)
+{
+    if (len <= buf_.size() - used_) {
+        // the common case: a token, or a few spaces
+        std::memcpy(buf_.data() + used_, utf8, len);
+        used_ += len;
+    }
+    else {
+        // the buffer is full: write it and this piece in one call
+        write_out(utf8, len);
+    }
+}
+
+void fd_sink::flush()
+{
+    write_out(0, 0);
+}
+
+void fd_sink::write_out(const char * data, size_t len)
+{
+    if (used_ == 0 && len == 0)
+        return;
+    const size_t used = used_;
+    used_ = 0; // (if the write fails the buffered text is dropped, not repeated)
+    syscalls_ += write_all(fd_, buf_.data(), used, data, len);
+}
+
+
+}} // end of namespace loon::writer
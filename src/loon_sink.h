@@ -0,0 +1,149 @@
+#ifndef LOON_SINK_H_INCLUDED
+#define LOON_SINK_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  Ready-made destinations for Loon writer output.
+
+    Each sink has the member function write(const char * utf8, size_t len)
+    that loon::writer::basic<Sink, Style> requires, and loon::writer::to<Sink>
+    is a loon::writer::base that writes to a sink, so neither kind of writer
+    needs a class of your own just to collect its output:
+
+    string_sink - appends the text to a std::string
+    file_sink   - writes the text to a C stdio FILE
+    fd_sink     - writes the text to a file descriptor, gathering the small
+                  pieces the writer produces into a buffer and sending the
+                  full buffer and the piece that didn't fit in one writev()
+                  call, so a large document costs a few system calls per MB
+                  rather than one per token
+
+    The sinks that write to a file throw a std::system_error if it fails.
+*/
+
+
+#include "loon_writer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace loon {
+namespace writer {
+
+
+// appends the text to the given string, which must outlive the sink
+class string_sink {
+public:
+    explicit string_sink(std::string & str) : str_(&str) {}
+
+    void write(const char * utf8, size_t len) { str_->append(utf8, len); }
+
+    std::string & str() const { return *str_; }
+
+private:
+    std::string * str_;
+};
+
+
+// writes the text to the given FILE, which stdio buffers; the sink doesn't
+// close the FILE
+class file_sink {
+public:
+    explicit file_sink(FILE * file) : file_(file) {}
+
+    void write(const char * utf8, size_t len);
+
+    // write out what stdio has buffered
+    void flush();
+
+private:
+    FILE * file_;
+};
+
+
+// writes the text to the given file descriptor, which the sink doesn't
+// close; call flush() when the writer is done. (The destructor flushes, but
+// cannot report an error.) An fd_sink can be moved but not copied, so its
+// buffered text is written once.
+class fd_sink {
+public:
+    explicit fd_sink(int fd, size_t buffer_size = 64 * 1024);
+    ~fd_sink();
+
+    fd_sink(fd_sink && other);
+    fd_sink & operator=(fd_sink && other);
+
+    void write(const char * utf8, size_t len);
+
+    // write out everything buffered
+    void flush();
+
+    // the number of system calls made to write the text
+    uint64_t syscalls() const { return syscalls_; }
+
+private:
+    int fd_;
+    std::vector<char> buf_;
+    size_t used_;       // bytes of buf_ waiting to be written
+    uint64_t syscalls_;
+
+    // write out buf_, followed by 'len' bytes at 'data'
+    void write_out(const char * data, size_t len);
+
+    fd_sink(const fd_sink &) = delete;
+    fd_sink & operator=(const fd_sink &) = delete;
+};
+
+
+// a loon::writer::base that writes to a sink, e.g.
+//    loon::writer::to<loon::writer::fd_sink> w(STDOUT_FILENO);
+//    w.loon_arry_begin(); ... w.loon_arry_end();
+//    w.sink().flush();
+template <typename Sink>
+class to : public base {
+public:
+    // construct the sink from 'arg' (e.g. an fd, or a sink to move from)
+    template <typename Arg>
+    explicit to(Arg && arg) : sink_(std::forward<Arg>(arg)) {}
+
+    Sink & sink() { return sink_; }
+
+private:
+    Sink sink_;
+
+    virtual void write(const char * utf8, size_t len) { sink_.write(utf8, len); }
+};
+
+
+}} // end of namespace loon::writer
+#endif
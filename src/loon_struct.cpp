@@ -0,0 +1,399 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+#include "loon_struct.h"
+
+#include <cstring>
+#include <clocale>
+#include <cstdlib>
+
+
+namespace loon {
+namespace binding {
+namespace {
+
+
+//        ///////   //////     ///    //       
+//       //     // //    //   // //   //       
+//       //     // //        //   //  //       
+//       //     // //       //     // //       
+//       //     // //       ///////// //       
+//       //     // //    // //     // //       
+////////  ///////   //////  //     // //////// 
+
+
+// return the hash table slot for the key [utf8, utf8 + len) in a table of 'mask' + 1 slots;
+// the hash is made from the key length and its first and last bytes only
+inline size_t key_slot(const char * utf8, size_t len, size_t mask)
+{
+    if (len == 0)
+        return 0;
+    const size_t first = static_cast<uint8_t>(utf8[0]);
+    const size_t last = static_cast<uint8_t>(utf8[len - 1]);
+    return (len * 31 + first * 7 + last) & mask;
+}
+
+// return true iff [utf8, utf8 + len) is a Loon integer with a magnitude
+// that fits in 32 bits; return its value in 'n'
+bool parse_integer(const char * utf8, size_t len, reader::num_type ntype, int64_t & n)
+{
+    const char * p = utf8;
+    const char * const end = utf8 + len;
+    bool negative = false;
+    uint64_t u = 0;
+
+    if (ntype == reader::num_hex_int) {
+        for (p += 2; p != end; ++p) { // skip the {0x}
+            const char c = *p;
+            const unsigned d = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+            u = u * 16 + d;
+            if (u > 0xFFFFFFFF)
+                return false;
+        }
+    }
+    else if (ntype == reader::num_dec_int) {
+        if (p != end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        for (; p != end; ++p) {
+            u = u * 10 + (*p - '0');
+            if (u > 0xFFFFFFFF)
+                return false;
+        }
+    }
+    else
+        return false;
+
+    n = negative ? -static_cast<int64_t>(u) : static_cast<int64_t>(u);
+    return true;
+}
+
+// return true iff [utf8, utf8 + len) is a Loon number; return its value in 'd'
+bool parse_double(const char * utf8, size_t len, reader::num_type ntype, double & d)
+{
+    if (ntype == reader::num_hex_int) {
+        // any width: the digits are converted straight to a double
+        d = 0;
+        for (const char * p = utf8 + 2; p != utf8 + len; ++p) { // skip the {0x}
+            const char c = *p;
+            d = d * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+        }
+        return true;
+    }
+
+    // strtod() needs a null-terminated string and uses the decimal point of
+    // the current C locale, which may not be '.'
+    std::string s(utf8, len);
+    const char point = *std::localeconv()->decimal_point;
+    if (point != '.') {
+        const std::string::size_type i = s.find('.');
+        if (i != std::string::npos)
+            s[i] = point;
+    }
+    d = std::strtod(s.c_str(), 0);
+    return true;
+}
+
+
+// bool
+
+void write_bool(const type_info &, writer::base & w, const void * obj)
+{
+    w.loon_bool(*static_cast<const bool *>(obj));
+}
+
+bool bool_from_bool(void * obj, bool value)
+{
+    *static_cast<bool *>(obj) = value;
+    return true;
+}
+
+
+// int32_t
+
+void write_int32(const type_info &, writer::base & w, const void * obj)
+{
+    w.loon_dec_s32(*static_cast<const int32_t *>(obj));
+}
+
+bool int32_from_number(void * obj, const char * utf8, size_t len, reader::num_type ntype)
+{
+    int64_t n;
+    if (!parse_integer(utf8, len, ntype, n) || n < INT32_MIN || n > INT32_MAX)
+        return false;
+    *static_cast<int32_t *>(obj) = static_cast<int32_t>(n);
+    return true;
+}
+
+
+// uint32_t
+
+void write_uint32(const type_info &, writer::base & w, const void * obj)
+{
+    w.loon_dec_u32(*static_cast<const uint32_t *>(obj));
+}
+
+bool uint32_from_number(void * obj, const char * utf8, size_t len, reader::num_type ntype)
+{
+    int64_t n;
+    if (!parse_integer(utf8, len, ntype, n) || n < 0 || n > UINT32_MAX)
+        return false;
+    *static_cast<uint32_t *>(obj) = static_cast<uint32_t>(n);
+    return true;
+}
+
+
+// double
+
+void write_double(const type_info &, writer::base & w, const void * obj)
+{
+    w.loon_double(*static_cast<const double *>(obj));
+}
+
+bool double_from_number(void * obj, const char * utf8, size_t len, reader::num_type ntype)
+{
+    return parse_double(utf8, len, ntype, *static_cast<double *>(obj));
+}
+
+
+// std::string
+
+void write_string(const type_info &, writer::base & w, const void * obj)
+{
+    w.loon_string(*static_cast<const std::string *>(obj));
+}
+
+bool string_from_string(void * obj, const char * utf8, size_t len)
+{
+    static_cast<std::string *>(obj)->assign(utf8, len);
+    return true;
+}
+
+
+} // anonymous namespace
+
+
+
+
+////////  //     // ////////  //       ////  //////  
+//     // //     // //     // //        //  //    // 
+//     // //     // //     // //        //  //       
+////////  //     // ////////  //        //  //       
+//        //     // //     // //        //  //       
+//        //     // //     // //        //  //    // 
+//         ///////  ////////  //////// ////  //////  
+
+
+const type_info & type_of<bool>::get()
+{
+    static const type_info info(write_bool, bool_from_bool, 0, 0);
+    return info;
+}
+
+const type_info & type_of<int32_t>::get()
+{
+    static const type_info info(write_int32, 0, int32_from_number, 0);
+    return info;
+}
+
+const type_info & type_of<uint32_t>::get()
+{
+    static const type_info info(write_uint32, 0, uint32_from_number, 0);
+    return info;
+}
+
+const type_info & type_of<double>::get()
+{
+    static const type_info info(write_double, 0, double_from_number, 0);
+    return info;
+}
+
+const type_info & type_of<std::string>::get()
+{
+    static const type_info info(write_string, 0, 0, string_from_string);
+    return info;
+}
+
+
+
+type_info::type_info(write_fn * w, from_bool_fn * b, from_number_fn * n, from_string_fn * s)
+: kind_(scalar), write_(w), from_bool_(b), from_number_(n), from_string_(s),
+  append_(0), element_(0), fields_(0), num_fields_(0)
+{
+}
+
+type_info::type_info(write_fn * w, append_fn * a, const type_info & (*element)())
+: kind_(sequence), write_(w), from_bool_(0), from_number_(0), from_string_(0),
+  append_(a), element_(element), fields_(0), num_fields_(0)
+{
+}
+
+type_info::type_info(const field * fields, size_t num_fields)
+: kind_(object), write_(write_object), from_bool_(0), from_number_(0), from_string_(0),
+  append_(0), element_(0), fields_(fields), num_fields_(num_fields)
+{
+    // build the key -> field hash table, at most half full
+    size_t size = 8;
+    while (size < num_fields * 2)
+        size *= 2;
+    index_.resize(size);
+    for (size_t i = 0; i < num_fields; ++i) {
+        size_t slot = key_slot(fields[i].name, fields[i].name_len, size - 1);
+        while (index_[slot])
+            slot = (slot + 1) & (size - 1);
+        index_[slot] = static_cast<uint16_t>(i + 1);
+    }
+}
+
+const field * type_info::find(const char * utf8, size_t len) const
+{
+    const size_t mask = index_.size() - 1;
+    for (size_t slot = key_slot(utf8, len, mask); index_[slot]; slot = (slot + 1) & mask) {
+        const field & f = fields_[index_[slot] - 1];
+        if (f.name_len == len && std::memcmp(f.name, utf8, len) == 0)
+            return &f;
+    }
+    return 0;
+}
+
+void type_info::write_object(const type_info & t, writer::base & w, const void * obj)
+{
+    w.loon_dict_begin();
+    for (const field * f = t.fields_; f != t.fields_ + t.num_fields_; ++f) {
+        w.loon_preformatted_key(f->quoted, f->quoted_len);
+        f->type().write(w, f->member(const_cast<void *>(obj)));
+    }
+    w.loon_dict_end();
+}
+
+
+
+// return the type of the object that is to receive the next value and set
+// 'obj' to its address; return 0 if the value is to be ignored
+const type_info * struct_reader::next_value(void *& obj)
+{
+    if (stack_.empty()) {
+        obj = root_;
+        return root_type_;
+    }
+
+    frame & f = stack_.back();
+    if (f.type == 0)
+        return 0;
+    if (f.type->kind() == type_info::sequence) {
+        obj = f.type->append(f.obj);
+        return &f.type->element();
+    }
+    obj = f.value;
+    return f.value_type;
+}
+
+void struct_reader::begin(type_info::kind_t kind)
+{
+    frame f = { 0, 0, 0, 0 };
+    f.type = next_value(f.obj);
+    if (f.type && f.type->kind() != kind)
+        throw_exception(reader::bound_value_mismatch);
+    stack_.push_back(f);
+}
+
+void struct_reader::loon_arry_begin()
+{
+    begin(type_info::sequence);
+}
+
+void struct_reader::loon_arry_end()
+{
+    stack_.pop_back();
+}
+
+void struct_reader::loon_dict_begin()
+{
+    begin(type_info::object);
+}
+
+void struct_reader::loon_dict_end()
+{
+    stack_.pop_back();
+}
+
+void struct_reader::loon_dict_key(const char * utf8, size_t len)
+{
+    frame & f = stack_.back();
+    f.value_type = 0;
+    if (f.type) {
+        const field * member = f.type->find(utf8, len);
+        if (member) {
+            f.value_type = &member->type();
+            f.value = member->member(f.obj);
+        }
+    }
+}
+
+void struct_reader::loon_null()
+{
+    void * obj;
+    next_value(obj); // null leaves the object unchanged
+}
+
+void struct_reader::loon_bool(bool value)
+{
+    void * obj;
+    const type_info * type = next_value(obj);
+    if (type && !type->from_bool(obj, value))
+        throw_exception(reader::bound_value_mismatch);
+}
+
+void struct_reader::loon_string(const char * utf8, size_t len)
+{
+    void * obj;
+    const type_info * type = next_value(obj);
+    if (type && !type->from_string(obj, utf8, len))
+        throw_exception(reader::bound_value_mismatch);
+}
+
+void struct_reader::loon_number(const char * utf8, size_t len, reader::num_type ntype)
+{
+    void * obj;
+    const type_info * type = next_value(obj);
+    if (type && !type->from_number(obj, utf8, len, ntype))
+        throw_exception(reader::bound_value_mismatch);
+}
+
+void struct_reader::reset()
+{
+    base::reset();
+    stack_.clear();
+}
+
+struct_reader::~struct_reader()
+{
+}
+
+
+
+}} // end of namespace loon::binding
@@ -0,0 +1,329 @@
+#ifndef LOON_STRUCT_H_INCLUDED
+#define LOON_STRUCT_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  Bind the members of a C++ struct to the entries of a Loon dict.
+
+    Given
+
+        struct point { int32_t x; int32_t y; };
+        LOON_STRUCT(point, x, y)
+
+    loon::binding::write_struct(writer, p) outputs (dict "x" 1 "y" 2) and
+    loon::binding::struct_reader reads such a dict back into a point.
+
+    - LOON_STRUCT must appear at namespace scope in the same namespace as
+      the struct (it defines a function that is found by argument dependent
+      lookup). Up to 32 members may be listed.
+    - The dict keys are the member names. They are stored as constant,
+      already quoted byte strings so the writer never has to escape them,
+      and the reader dispatches on them through a small hash table indexed
+      by key length, first byte and last byte, so no std::string is ever
+      constructed for a key.
+    - A member may be bool, int32_t, uint32_t, double, std::string, another
+      struct bound with LOON_STRUCT or a std::vector of any of these (except
+      bool).
+    - When reading, dict entries whose key is not a member name are ignored,
+      members with no corresponding dict entry are left unchanged and a null
+      value leaves its member unchanged. If a value can not be stored in its
+      member a loon::reader::exception with id bound_value_mismatch is thrown.
+*/
+
+
+#include "loon_reader.h"
+#include "loon_writer.h"
+
+#include <string>
+#include <vector>
+#include <type_traits>
+#include <cstdint>
+
+
+namespace loon {
+namespace binding {
+
+
+class type_info;
+
+// describes one member of a bound struct; LOON_STRUCT creates these
+struct field {
+    const char * name;          // the member name, e.g. {x}
+    size_t name_len;
+    const char * quoted;        // the member name as a Loon dict key, e.g. {"x"}
+    size_t quoted_len;
+    const type_info & (*type)();  // the type of the member
+    void * (*member)(void * obj); // return the address of the member in the struct at 'obj'
+};
+
+
+// describes how a C++ type is read from and written to Loon
+class type_info {
+public:
+    enum kind_t { scalar, sequence, object };
+
+    typedef void write_fn(const type_info &, writer::base &, const void * obj);
+    typedef bool from_bool_fn(void * obj, bool);
+    typedef bool from_number_fn(void * obj, const char * utf8, size_t len, reader::num_type);
+    typedef bool from_string_fn(void * obj, const char * utf8, size_t len);
+    typedef void * append_fn(void * obj);
+
+    // a scalar is stored from a single Loon value; the from_XXXX functions
+    // return false if the given value can not be stored in the object at 'obj'
+    // (a null function pointer means no value of that Loon type may be stored)
+    type_info(write_fn *, from_bool_fn *, from_number_fn *, from_string_fn *);
+
+    // a sequence is stored from a Loon arry
+    type_info(write_fn *, append_fn *, const type_info & (*element)());
+
+    // an object is stored from a Loon dict
+    type_info(const field * fields, size_t num_fields);
+
+    kind_t kind() const { return kind_; }
+
+    // output the object at 'obj' to the given writer 'w'
+    void write(writer::base & w, const void * obj) const { write_(*this, w, obj); }
+
+    bool from_bool(void * obj, bool value) const
+    {
+        return from_bool_ && from_bool_(obj, value);
+    }
+
+    bool from_number(void * obj, const char * utf8, size_t len, reader::num_type ntype) const
+    {
+        return from_number_ && from_number_(obj, utf8, len, ntype);
+    }
+
+    bool from_string(void * obj, const char * utf8, size_t len) const
+    {
+        return from_string_ && from_string_(obj, utf8, len);
+    }
+
+    // sequence only: append a new element to the sequence at 'obj'; return its address
+    void * append(void * obj) const { return append_(obj); }
+    // sequence only: return the type of the sequence elements
+    const type_info & element() const { return element_(); }
+
+    // object only: return the members
+    const field * fields() const { return fields_; }
+    size_t num_fields() const { return num_fields_; }
+    // object only: return the member whose name is [utf8, utf8 + len), or 0 if none
+    const field * find(const char * utf8, size_t len) const;
+
+private:
+    kind_t kind_;
+    write_fn * write_;
+    from_bool_fn * from_bool_;
+    from_number_fn * from_number_;
+    from_string_fn * from_string_;
+    append_fn * append_;
+    const type_info & (*element_)();
+    const field * fields_;
+    size_t num_fields_;
+    std::vector<uint16_t> index_; // open addressed hash table: field index + 1, or 0 if empty slot
+
+    static write_fn write_object;
+};
+
+
+// type_of<T>::get() returns the type_info for T; types bound with
+// LOON_STRUCT are found through the loon_struct_type() function the
+// macro defines
+template <typename T, typename Enable = void>
+struct type_of {
+    static const type_info & get() { return loon_struct_type(static_cast<const T *>(0)); }
+};
+
+template <> struct type_of<bool>        { static const type_info & get(); };
+template <> struct type_of<int32_t>     { static const type_info & get(); };
+template <> struct type_of<uint32_t>    { static const type_info & get(); };
+template <> struct type_of<double>      { static const type_info & get(); };
+template <> struct type_of<std::string> { static const type_info & get(); };
+
+template <typename T>
+struct type_of<std::vector<T> > {
+    static_assert(!std::is_same<T, bool>::value, "std::vector<bool> is not supported");
+
+    static void write(const type_info &, writer::base & w, const void * obj)
+    {
+        const std::vector<T> & v = *static_cast<const std::vector<T> *>(obj);
+        const type_info & element = type_of<T>::get();
+        w.loon_arry_begin();
+        for (typename std::vector<T>::const_iterator i = v.begin(); i != v.end(); ++i)
+            element.write(w, &*i);
+        w.loon_arry_end();
+    }
+
+    static void * append(void * obj)
+    {
+        std::vector<T> & v = *static_cast<std::vector<T> *>(obj);
+        v.push_back(T());
+        return &v.back();
+    }
+
+    static const type_info & get()
+    {
+        static const type_info info(write, append, &type_of<T>::get);
+        return info;
+    }
+};
+
+
+// output the given bound 'obj' to the given writer 'w'
+template <typename T>
+void write_struct(writer::base & w, const T & obj)
+{
+    type_of<T>::get().write(w, &obj);
+}
+
+
+// a Loon reader that stores the Loon text it reads in a bound object
+class struct_reader : private loon::reader::base {
+public:
+    // all values read will be stored in the given 'obj', which must outlive this reader
+    template <typename T>
+    explicit struct_reader(T & obj)
+    : root_type_(&type_of<T>::get()), root_(&obj)
+    {
+    }
+
+    virtual ~struct_reader();
+
+    // ready the reader to read a new Loon text into the object given to the constructor
+    virtual void reset();
+
+    using base::process_chunk;
+    using base::current_line;
+
+private:
+    const type_info * root_type_;
+    void * root_;
+
+    // one frame for each open arry or dict; type is 0 while skipping an unknown entry
+    struct frame {
+        const type_info * type;
+        void * obj;
+        const type_info * value_type; // dict only: the member selected by the last key
+        void * value;
+    };
+    std::vector<frame> stack_;
+
+    const type_info * next_value(void *& obj);
+    void begin(type_info::kind_t);
+
+    virtual void loon_arry_begin();
+    virtual void loon_arry_end();
+    virtual void loon_dict_begin();
+    virtual void loon_dict_end();
+    virtual void loon_dict_key(const char * utf8, size_t len);
+    virtual void loon_null();
+    virtual void loon_bool(bool value);
+    virtual void loon_string(const char * utf8, size_t len);
+    virtual void loon_number(const char * utf8, size_t len, reader::num_type ntype);
+};
+
+
+// read the given Loon text [utf8, utf8 + len) into the given bound 'obj'
+template <typename T>
+void read_struct(const char * utf8, size_t len, T & obj)
+{
+    struct_reader r(obj);
+    r.process_chunk(utf8, len, /*is_last_chunk=*/true);
+}
+
+
+}} // end of namespace loon::binding
+
+
+
+// implementation detail of LOON_STRUCT: apply m(t, x) to each x in __VA_ARGS__
+#define LOON_STRUCT_EXPAND(x) x
+#define LOON_STRUCT_FE_1(m, t, x) m(t, x)
+#define LOON_STRUCT_FE_2(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_1(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_3(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_2(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_4(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_3(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_5(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_4(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_6(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_5(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_7(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_6(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_8(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_7(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_9(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_8(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_10(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_9(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_11(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_10(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_12(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_11(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_13(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_12(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_14(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_13(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_15(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_14(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_16(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_15(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_17(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_16(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_18(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_17(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_19(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_18(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_20(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_19(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_21(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_20(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_22(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_21(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_23(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_22(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_24(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_23(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_25(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_24(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_26(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_25(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_27(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_26(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_28(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_27(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_29(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_28(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_30(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_29(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_31(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_30(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_32(m, t, x, ...) m(t, x) LOON_STRUCT_EXPAND(LOON_STRUCT_FE_31(m, t, __VA_ARGS__))
+#define LOON_STRUCT_FE_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, name, ...) name
+#define LOON_STRUCT_FOR_EACH(m, t, ...) \
+    LOON_STRUCT_EXPAND(LOON_STRUCT_FE_SELECT(__VA_ARGS__, \
+        LOON_STRUCT_FE_32, LOON_STRUCT_FE_31, LOON_STRUCT_FE_30, LOON_STRUCT_FE_29, \
+        LOON_STRUCT_FE_28, LOON_STRUCT_FE_27, LOON_STRUCT_FE_26, LOON_STRUCT_FE_25, \
+        LOON_STRUCT_FE_24, LOON_STRUCT_FE_23, LOON_STRUCT_FE_22, LOON_STRUCT_FE_21, \
+        LOON_STRUCT_FE_20, LOON_STRUCT_FE_19, LOON_STRUCT_FE_18, LOON_STRUCT_FE_17, \
+        LOON_STRUCT_FE_16, LOON_STRUCT_FE_15, LOON_STRUCT_FE_14, LOON_STRUCT_FE_13, \
+        LOON_STRUCT_FE_12, LOON_STRUCT_FE_11, LOON_STRUCT_FE_10, LOON_STRUCT_FE_9, \
+        LOON_STRUCT_FE_8, LOON_STRUCT_FE_7, LOON_STRUCT_FE_6, LOON_STRUCT_FE_5, \
+        LOON_STRUCT_FE_4, LOON_STRUCT_FE_3, LOON_STRUCT_FE_2, LOON_STRUCT_FE_1)(m, t, __VA_ARGS__))
+
+#define LOON_STRUCT_FIELD(type, name)                                           \
+    { #name, sizeof(#name) - 1, "\"" #name "\"", sizeof(#name) + 1,             \
+      &::loon::binding::type_of<decltype(static_cast<type *>(0)->name)>::get,   \
+      [](void * obj) -> void * { return &static_cast<type *>(obj)->name; } },
+
+// bind the given members of the given struct 'type' to a Loon dict
+#define LOON_STRUCT(type, ...)                                                  \
+    inline const ::loon::binding::type_info & loon_struct_type(const type *)   \
+    {                                                                           \
+        static const ::loon::binding::field fields[] = {                        \
+            LOON_STRUCT_FOR_EACH(LOON_STRUCT_FIELD, type, __VA_ARGS__)          \
+        };                                                                      \
+        static const ::loon::binding::type_info info(                           \
+            fields, sizeof(fields) / sizeof(fields[0]));                        \
+        return info;                                                            \
+    }
+
+
+#endif
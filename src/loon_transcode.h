@@ -0,0 +1,145 @@
+#ifndef LOON_TRANSCODE_H_INCLUDED
+#define LOON_TRANSCODE_H_INCLUDED
+
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  Reformat Loon text, for example from pretty to compact, without building
+    the document in memory.
+
+    loon::transcoder connects the events from a loon::reader::base directly
+    to a Loon writer. Numbers are passed to the writer exactly as they appear
+    in the input text and, by default, so are strings: their escape sequences
+    are checked but not expanded and re-escaped. Comments are not copied.
+
+    The style of the output is the style of the writer, e.g.
+
+        loon::writer::basic<my_sink, loon::writer::compact> out;
+        loon::transcode(std::cin, out);
+*/
+
+
+#include "loon_reader.h"
+#include "loon_writer.h"
+
+#include <string>
+#include <vector>
+#include <istream>
+
+
+namespace loon {
+
+
+// Writer may be loon::writer::base or loon::writer::basic<>
+template <typename Writer>
+class transcoder : private reader::base {
+public:
+    // all Loon text given to process_chunk() will be written to 'out';
+    // if 'raw_strings' is false strings are unescaped and re-escaped by
+    // the writer, which normalises their escape sequences
+    explicit transcoder(Writer & out, bool raw_strings = true)
+    : out_(out), raw_strings_(raw_strings)
+    {
+        set_raw_strings(raw_strings);
+    }
+
+    using base::process_chunk;
+    using base::current_line;
+    using base::reset;
+
+private:
+    Writer & out_;
+    const bool raw_strings_;
+    std::string buf_; // scratch (is a member to minimise memory allocations)
+
+    // return the given raw string enclosed in double quotes
+    const std::string & quote(const char * utf8, size_t len)
+    {
+        buf_.assign(1, '"');
+        buf_.append(utf8, len);
+        buf_ += '"';
+        return buf_;
+    }
+
+    virtual void loon_arry_begin() { out_.loon_arry_begin(); }
+    virtual void loon_arry_end() { out_.loon_arry_end(); }
+    virtual void loon_dict_begin() { out_.loon_dict_begin(); }
+    virtual void loon_dict_end() { out_.loon_dict_end(); }
+    virtual void loon_null() { out_.loon_null(); }
+    virtual void loon_bool(bool value) { out_.loon_bool(value); }
+
+    virtual void loon_dict_key(const char * utf8, size_t len)
+    {
+        if (raw_strings_) {
+            const std::string & q(quote(utf8, len));
+            out_.loon_preformatted_key(q.c_str(), q.size());
+        }
+        else
+            out_.loon_dict_key(std::string(utf8, len));
+    }
+
+    virtual void loon_string(const char * utf8, size_t len)
+    {
+        if (raw_strings_) {
+            const std::string & q(quote(utf8, len));
+            out_.loon_preformatted_value(q.c_str(), q.size());
+        }
+        else
+            out_.loon_string(std::string(utf8, len));
+    }
+
+    virtual void loon_number(const char * utf8, size_t len, reader::num_type)
+    {
+        out_.loon_preformatted_value(utf8, len);
+    }
+};
+
+
+struct transcode_options {
+    size_t chunk_size;  // number of bytes read from the input at a time
+    bool raw_strings;   // see loon::transcoder
+
+    transcode_options() : chunk_size(64 * 1024), raw_strings(true) {}
+};
+
+// read all the Loon text from 'in' and write it to 'out'
+template <typename Writer>
+void transcode(std::istream & in, Writer & out, const transcode_options & options = transcode_options())
+{
+    transcoder<Writer> t(out, options.raw_strings);
+    std::vector<char> buf(options.chunk_size ? options.chunk_size : 1);
+    while (in) {
+        in.read(&buf[0], buf.size());
+        t.process_chunk(&buf[0], static_cast<size_t>(in.gcount()), /*is_last_chunk=*/false);
+    }
+    t.process_chunk(0, 0, /*is_last_chunk=*/true);
+}
+
+
+} // end of namespace loon
+#endif
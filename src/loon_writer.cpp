@@ -54,6 +54,20 @@ inline const char * char_ptr(const std::vector<uint8_t> & s)
     return s.empty() ? "" : reinterpret_cast<const char *>(&s[0]);
 }
 
+// throw the validation error 'id'
+void fail(error_id id)
+{
+    const char * msg = "Loon writer error.";
+    switch (id) {
+    case key_not_allowed:       msg = "Loon writer error: a dict key is not allowed here."; break;
+    case key_required:          msg = "Loon writer error: a dict key is required before the value."; break;
+    case missing_dict_value:    msg = "Loon writer error: the dict ended with a key that has no value."; break;
+    case unbalanced_end:        msg = "Loon writer error: there is no open list of that type to end."; break;
+    case extra_top_level_value: msg = "Loon writer error: a Loon text may contain just one top-level value."; break;
+    }
+    throw exception(id, msg);
+}
+
 // return true iff 'ch' is U+0000 .. U+001F or U+007F (ASCII control codes)
 inline bool is_ctrl(uint8_t ch)
 {
@@ -66,46 +80,6 @@ inline uint8_t hexchar(uint8_t c)
     return "0123456789ABCDEF"[c];
 }
 
-// copy 'utf8_in' to 'utf8_out' replacing control codes with their
-// respective loon escape representations
-void escape(std::vector<uint8_t> & utf8_out, const std::string & utf8_in)
-{
-    utf8_out.clear();
-    utf8_out.push_back('"');
-
-    if (!utf8_in.empty()) {
-        static_assert(CHAR_BIT == 8, "char is not 8 bits; code assumes it is");
-        const uint8_t * p = reinterpret_cast<const uint8_t *>(utf8_in.c_str());
-        const uint8_t * const end = p + utf8_in.size();
-        for (; p != end; ++p) {
-            switch (*p) {
-            // note: Loon does not require that {/} be escaped
-            case '\\':  utf8_out.push_back('\\');   utf8_out.push_back('\\');   break;
-            case '"':   utf8_out.push_back('\\');   utf8_out.push_back('\"');   break;
-            case '\b':  utf8_out.push_back('\\');   utf8_out.push_back('b');    break;
-            case '\f':  utf8_out.push_back('\\');   utf8_out.push_back('f');    break;
-            case '\n':  utf8_out.push_back('\\');   utf8_out.push_back('n');    break;
-            case '\r':  utf8_out.push_back('\\');   utf8_out.push_back('r');    break;
-            case '\t':  utf8_out.push_back('\\');   utf8_out.push_back('t');    break;
-            default:
-                if (is_ctrl(*p)) { // => \u00XX
-                    utf8_out.push_back('\\');
-                    utf8_out.push_back('u');
-                    utf8_out.push_back('0');
-                    utf8_out.push_back('0');
-                    utf8_out.push_back(hexchar(*p >> 4));
-                    utf8_out.push_back(hexchar(*p & 0x0F));
-                }
-                else
-                    utf8_out.push_back(*p);
-                break;
-            }
-        }
-    }
-
-    utf8_out.push_back('"');
-}
-
 // write 'n' to buffer that ENDS at 'p'; return pointer to first char of output
 template <typename scalar_type>
 char * unsigned_to_decimal(char * p, scalar_type n)
@@ -174,6 +148,68 @@ static const unsigned space_required = 0x00000001;
 
 
 
+// copy 'utf8_in' to 'utf8_out' replacing control codes with their
+// respective loon escape representations
+void detail::escape(std::vector<uint8_t> & utf8_out, const std::string & utf8_in)
+{
+    utf8_out.clear();
+    utf8_out.push_back('"');
+
+    if (!utf8_in.empty()) {
+        static_assert(CHAR_BIT == 8, "char is not 8 bits; code assumes it is");
+        const uint8_t * p = reinterpret_cast<const uint8_t *>(utf8_in.c_str());
+        const uint8_t * const end = p + utf8_in.size();
+        for (; p != end; ++p) {
+            switch (*p) {
+            // note: Loon does not require that {/} be escaped
+            case '\\':  utf8_out.push_back('\\');   utf8_out.push_back('\\');   break;
+            case '"':   utf8_out.push_back('\\');   utf8_out.push_back('\"');   break;
+            case '\b':  utf8_out.push_back('\\');   utf8_out.push_back('b');    break;
+            case '\f':  utf8_out.push_back('\\');   utf8_out.push_back('f');    break;
+            case '\n':  utf8_out.push_back('\\');   utf8_out.push_back('n');    break;
+            case '\r':  utf8_out.push_back('\\');   utf8_out.push_back('r');    break;
+            case '\t':  utf8_out.push_back('\\');   utf8_out.push_back('t');    break;
+            default:
+                if (is_ctrl(*p)) { // => \u00XX
+                    utf8_out.push_back('\\');
+                    utf8_out.push_back('u');
+                    utf8_out.push_back('0');
+                    utf8_out.push_back('0');
+                    utf8_out.push_back(hexchar(*p >> 4));
+                    utf8_out.push_back(hexchar(*p & 0x0F));
+                }
+                else
+                    utf8_out.push_back(*p);
+                break;
+            }
+        }
+    }
+
+    utf8_out.push_back('"');
+}
+
+char * detail::dec_u32(char * end, uint32_t n)
+{
+    return unsigned_to_decimal(end, n);
+}
+
+char * detail::dec_s32(char * end, int32_t n)
+{
+    return signed_to_decimal(end, n);
+}
+
+char * detail::hex_u32(char * end, uint32_t n)
+{
+    return unsigned_to_hexadecimal(end, n);
+}
+
+std::string detail::double_to_string(double n)
+{
+    return to_string(n);
+}
+
+
+
 
 ////////  ////////  //// //     //    ///    //////// //////// 
 //     // //     //  //  //     //   // //      //    //       
@@ -221,8 +257,68 @@ void base::write_indent(unsigned flags)
 void base::write(const char *, size_t) {}
 
 
+// validation: the writer state is the list nesting, whether each list is an
+// arry or a dict (one bit each), whether the innermost dict has a key waiting
+// for its value and whether the top-level value is complete
+
+void base::check_key()
+{
+    if (depth_ == 0 || !in_dict() || keyed_)
+        fail(key_not_allowed);
+    keyed_ = true;
+}
+
+void base::check_value()
+{
+    if (depth_ == 0) {
+        if (complete_)
+            fail(extra_top_level_value);
+        complete_ = true;
+    }
+    else if (in_dict()) {
+        if (!keyed_)
+            fail(key_required);
+        keyed_ = false;
+    }
+}
+
+void base::check_begin(bool dict)
+{
+    if (depth_ == 0) {
+        if (complete_)
+            fail(extra_top_level_value);
+    }
+    else if (in_dict()) {
+        if (!keyed_)
+            fail(key_required);
+        keyed_ = false;
+    }
+
+    if (depth_ / 64 == dicts_.size())
+        dicts_.push_back(0);
+    const uint64_t bit = uint64_t(1) << (depth_ % 64);
+    if (dict)
+        dicts_[depth_ / 64] |= bit;
+    else
+        dicts_[depth_ / 64] &= ~bit;
+    ++depth_;
+}
+
+void base::check_end(bool dict)
+{
+    if (depth_ == 0 || in_dict() != dict)
+        fail(unbalanced_end);
+    if (keyed_)
+        fail(missing_dict_value);
+    if (--depth_ == 0)
+        complete_ = true;
+}
+
+
 void base::loon_arry_begin()
 {
+    if (validate_)
+        check_begin(false);
     write_indent(space_required);
     write("(arry", 5);
     empty_list_ = true;
@@ -231,6 +327,8 @@ void base::loon_arry_begin()
 
 void base::loon_dict_begin()
 {
+    if (validate_)
+        check_begin(true);
     write_indent(space_required);
     write("(dict", 5);
     empty_list_ = true;
@@ -239,6 +337,8 @@ void base::loon_dict_begin()
 
 void base::loon_arry_end()
 {
+    if (validate_)
+        check_end(false);
     if (indent_)
         --indent_;
     if (!empty_list_)
@@ -249,6 +349,8 @@ void base::loon_arry_end()
 
 void base::loon_dict_end()
 {
+    if (validate_)
+        check_end(true);
     if (indent_)
         --indent_;
     if (!empty_list_)
@@ -259,15 +361,29 @@ void base::loon_dict_end()
 
 void base::loon_dict_key(const std::string & value)
 {
+    detail::escape(buf_, value);
+    loon_preformatted_key(char_ptr(buf_), buf_.size());
+}
+
+void base::loon_dict_key(const key & k)
+{
+    loon_preformatted_key(k.data(), k.size());
+}
+
+void base::loon_preformatted_key(const char * utf8, size_t len)
+{
+    if (validate_)
+        check_key();
     write_indent(space_required);
-    escape(buf_, value);
-    write(char_ptr(buf_), buf_.size());
+    write(utf8, len);
     empty_list_ = false;
     suppress_indent_ = true; // place value on same line as key
 }
 
 void base::loon_preformatted_value(const char * utf8, size_t len)
 {
+    if (validate_)
+        check_value();
     write_indent(space_required);
     write(utf8, len);
     empty_list_ = false;
@@ -321,7 +437,7 @@ void base::loon_double(double n)
 
 void base::loon_string(const std::string & value)
 {
-    escape(buf_, value);
+    detail::escape(buf_, value);
     loon_preformatted_value(char_ptr(buf_), buf_.size());
 }
 
@@ -334,6 +450,10 @@ void base::reset()
     suppress_indent_ = false;
     indent_ = 0;
     spaces_per_indent_ = 4;
+    validate_ = false;
+    keyed_ = false;
+    complete_ = false;
+    depth_ = 0;
 }
 
 base::base()
@@ -347,5 +467,17 @@ base::~base()
 
 
 
+key::key(const std::string & key_name)
+{
+    detail::escape(quoted_, key_name);
+}
+
+const char * key::data() const
+{
+    return char_ptr(quoted_);
+}
+
+
+
 
 }} // end of namespace loon::writer
@@ -33,12 +33,53 @@
 #include <vector>
 #include <algorithm>
 #include <cstdint>
+#include <stdexcept>
+#include <utility>
 
 
 namespace loon {
 namespace writer {
 
 
+// A Loon dict key that is quoted and escaped once, when it is constructed,
+// and may then be output any number of times with base::loon_dict_key().
+// Make one of these for each key your writer uses repeatedly, e.g.
+//    static const loon::writer::key name_key("name");
+class key {
+public:
+    explicit key(const std::string & key_name);
+
+    // the key in Loon format, e.g. {"name"}
+    const char * data() const;
+    size_t size() const { return quoted_.size(); }
+
+private:
+    std::vector<uint8_t> quoted_;
+};
+
+
+// The ways a validating writer (see base::set_validation()) can be misused.
+enum error_id {
+    key_not_allowed = 1,    // a dict key outside a dict, or straight after another key
+    key_required,           // a value in a dict where a key was required
+    missing_dict_value,     // the dict ended straight after a key
+    unbalanced_end,         // an arry or dict end with no open arry or dict to close
+    extra_top_level_value   // a second top-level value; a Loon text has just one
+};
+
+// thrown by a validating writer when the calls made to it would not
+// produce well formed Loon
+class exception : public std::logic_error {
+public:
+    exception(error_id id, const char * msg) : std::logic_error(msg), id_(id) {}
+
+    error_id id() const { return id_; }
+
+private:
+    error_id id_;
+};
+
+
 class base {
 public:
     base();
@@ -63,6 +104,12 @@ public:
     // Every entry in a Loon dict must have first a key, and then a value.
     // Call this function with the key name, which must be UTF-8 encoded.
     void loon_dict_key(const std::string & key_name);
+    // As above, but for a key that has already been quoted and escaped.
+    void loon_dict_key(const key & k);
+    // Call this function to output a pre-formatted dict key. The key must
+    // already be enclosed in double quotes and escaped; it is passed
+    // unchanged to the write() function.
+    void loon_preformatted_key(const char * utf8, size_t len);
 
     // Output the Loon value null.
     void loon_null();
@@ -100,6 +147,17 @@ public:
     // Set the string to be used when the writer needs to output a newline.
     std::string set_newline(std::string nl) { nl.swap(newline_); return nl; }
 
+    // Turn validation on or off. (Default is off.) A validating writer throws
+    // a loon::writer::exception, before writing anything, from a call that
+    // would make the output malformed: a key where a value is required, a
+    // value where a key is required, an end that doesn't match the open list
+    // or a second top-level value. Each check costs O(1).
+    bool set_validation(bool on) { std::swap(validate_, on); return on; }
+
+    // If validating, return true iff a whole top-level value has been
+    // written, i.e. the output is a complete Loon text.
+    bool complete() const { return complete_; }
+
 private:
     std::vector<uint8_t> buf_;  // scratch (is a member to minimise memory allocations)
     std::string newline_;       // the string output to move to the next line
@@ -110,7 +168,286 @@ private:
     int indent_;
     int spaces_per_indent_;
 
+    bool validate_;
+    bool keyed_;                // the innermost list is a dict with a key awaiting its value
+    bool complete_;             // the top-level value has been written
+    size_t depth_;              // the number of open lists
+    std::vector<uint64_t> dicts_; // bit i is set iff the list at depth i is a dict
+
     void write_indent(unsigned = 0);
+    bool in_dict() const { return ((dicts_[(depth_ - 1) / 64] >> ((depth_ - 1) % 64)) & 1) != 0; }
+    void check_key();
+    void check_value();
+    void check_begin(bool dict);
+    void check_end(bool dict);
+};
+
+
+
+
+// The styles of output for loon::writer::basic. For example,
+//    loon::writer::basic<my_sink, loon::writer::compact>
+//    loon::writer::basic<my_sink, loon::writer::pretty<2, loon::writer::crlf> >
+struct compact {};
+struct lf   { static const char * chars() { return "\n"; }    enum { size = 1 }; };
+struct crlf { static const char * chars() { return "\r\n"; }  enum { size = 2 }; };
+template <int SpacesPerIndent = 4, typename Newline = lf> struct pretty {};
+
+
+// ignore this namespace: it is a Loon writer implementation detail
+namespace detail {
+
+// set 'utf8_out' to the Loon string representing 'utf8_in', including the quotes
+void escape(std::vector<uint8_t> & utf8_out, const std::string & utf8_in);
+
+// these write the given 'n' to a buffer that ENDS at 'end' and return a pointer
+// to the first char of output; the buffer must be at least 11 chars long
+char * dec_u32(char * end, uint32_t n);
+char * dec_s32(char * end, int32_t n);
+char * hex_u32(char * end, uint32_t n);
+
+// return given 'n' in Loon double format
+std::string double_to_string(double n);
+
+// write 'n' spaces to 'sink'
+template <typename Sink>
+void write_spaces(Sink & sink, int n)
+{
+    static const char spaces[] = "                                ";
+    const int chunk = sizeof(spaces) - 1;
+    for (; n > chunk; n -= chunk)
+        sink.write(spaces, chunk);
+    sink.write(spaces, n);
+}
+
+
+// the layout decisions for each style of output; the functions are called
+// before a list, key or value is output (token), before a list is closed
+// (close) and after a list is opened (opened), a key (keyed) or a value
+// (valued) has been output
+
+template <typename Style> class layout;
+
+template <>
+class layout<compact> {
+public:
+    layout() { reset(); }
+    void reset() { need_space_ = false; }
+
+    template <typename Sink>
+    void token(Sink & sink)
+    {
+        if (need_space_)
+            sink.write(" ", 1);
+        need_space_ = true;
+    }
+
+    template <typename Sink>
+    void close(Sink &) {}
+
+    void opened() {}
+    void keyed() {}
+    void valued() {}
+
+private:
+    bool need_space_;
+};
+
+template <int SpacesPerIndent, typename Newline>
+class layout<pretty<SpacesPerIndent, Newline> > {
+public:
+    layout() { reset(); }
+
+    void reset()
+    {
+        need_newline_ = false;
+        empty_list_ = false;
+        suppress_indent_ = false;
+        indent_ = 0;
+    }
+
+    template <typename Sink>
+    void token(Sink & sink)
+    {
+        if (suppress_indent_) {
+            suppress_indent_ = false;
+            sink.write("  ", 2);
+        }
+        else if (need_newline_) {
+            sink.write(Newline::chars(), Newline::size);
+            write_spaces(sink, SpacesPerIndent * indent_);
+        }
+        need_newline_ = true;
+    }
+
+    template <typename Sink>
+    void close(Sink & sink)
+    {
+        if (indent_)
+            --indent_;
+        if (!empty_list_) {
+            if (suppress_indent_) {
+                suppress_indent_ = false;
+                sink.write("  ", 2);
+            }
+            need_newline_ = true;
+        }
+        empty_list_ = false;
+    }
+
+    void opened()
+    {
+        empty_list_ = true;
+        ++indent_;
+    }
+
+    void keyed()
+    {
+        empty_list_ = false;
+        suppress_indent_ = true; // place value on same line as key
+    }
+
+    void valued() { empty_list_ = false; }
+
+private:
+    bool need_newline_;
+    bool empty_list_;
+    bool suppress_indent_;
+    int indent_;
+};
+
+} // end of namespace detail
+
+
+
+
+// A Loon writer whose output style is fixed at compile time, so that, for
+// example, compact output is only a sequence of appends to the sink. The
+// output is the same as loon::writer::base gives when configured to the
+// same style.
+//
+// Sink is any type with a member function
+//    void write(const char * utf8, size_t len);
+// which will receive the Loon text. Style is compact or pretty<>.
+template <typename Sink, typename Style = compact>
+class basic {
+public:
+    explicit basic(const Sink & sink = Sink()) : sink_(sink) {}
+    explicit basic(Sink && sink) : sink_(std::move(sink)) {}
+
+    // the sink that receives the output of this writer
+    Sink & sink() { return sink_; }
+    const Sink & sink() const { return sink_; }
+
+    // Reset the writer to it's initial pristine state.
+    void reset() { layout_.reset(); }
+
+    // These functions behave exactly as their namesakes in loon::writer::base.
+
+    void loon_arry_begin()
+    {
+        layout_.token(sink_);
+        sink_.write("(arry", 5);
+        layout_.opened();
+    }
+
+    void loon_arry_end()
+    {
+        layout_.close(sink_);
+        sink_.write(")", 1);
+    }
+
+    void loon_dict_begin()
+    {
+        layout_.token(sink_);
+        sink_.write("(dict", 5);
+        layout_.opened();
+    }
+
+    void loon_dict_end()
+    {
+        layout_.close(sink_);
+        sink_.write(")", 1);
+    }
+
+    void loon_dict_key(const std::string & key_name)
+    {
+        detail::escape(buf_, key_name);
+        loon_preformatted_key(reinterpret_cast<const char *>(&buf_[0]), buf_.size());
+    }
+
+    void loon_dict_key(const key & k)
+    {
+        loon_preformatted_key(k.data(), k.size());
+    }
+
+    void loon_preformatted_key(const char * utf8, size_t len)
+    {
+        layout_.token(sink_);
+        sink_.write(utf8, len);
+        layout_.keyed();
+    }
+
+    void loon_null()
+    {
+        loon_preformatted_value("null", 4);
+    }
+
+    void loon_bool(bool value)
+    {
+        if (value)
+            loon_preformatted_value("true", 4);
+        else
+            loon_preformatted_value("false", 5);
+    }
+
+    void loon_dec_u32(uint32_t n)
+    {
+        char buf[11];
+        char * const end = buf + sizeof(buf);
+        const char * const p = detail::dec_u32(end, n);
+        loon_preformatted_value(p, end - p);
+    }
+
+    void loon_dec_s32(int32_t n)
+    {
+        char buf[11];
+        char * const end = buf + sizeof(buf);
+        const char * const p = detail::dec_s32(end, n);
+        loon_preformatted_value(p, end - p);
+    }
+
+    void loon_hex_u32(uint32_t n)
+    {
+        char buf[11];
+        char * const end = buf + sizeof(buf);
+        const char * const p = detail::hex_u32(end, n);
+        loon_preformatted_value(p, end - p);
+    }
+
+    void loon_double(double n)
+    {
+        const std::string s(detail::double_to_string(n));
+        loon_preformatted_value(s.c_str(), s.length());
+    }
+
+    void loon_string(const std::string & value)
+    {
+        detail::escape(buf_, value);
+        loon_preformatted_value(reinterpret_cast<const char *>(&buf_[0]), buf_.size());
+    }
+
+    void loon_preformatted_value(const char * utf8, size_t len)
+    {
+        layout_.token(sink_);
+        sink_.write(utf8, len);
+        layout_.valued();
+    }
+
+private:
+    Sink sink_;
+    detail::layout<Style> layout_;
+    std::vector<uint8_t> buf_;  // scratch (is a member to minimise memory allocations)
 };
 
 
@@ -0,0 +1,619 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+// loonbench: reader, writer, DOM and round-trip throughput of loon-cpp over
+// a generated corpus of differently shaped documents.
+//
+//   loonbench [-runs N] [-size BYTES] [-json]
+//
+// Each measurement is repeated N times (default 15) and reported as the
+// throughput at the 50th, 90th and 99th percentile of the run times, so
+// mbps_p99 is the slow tail. Results go to stdout as Loon (or JSON) with
+// one dict per measurement, for scripts that track results run over run;
+// progress goes to stderr.
+
+
+#include "loon_reader.h"
+#include "loon_writer.h"
+#include "loon_json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+
+//  //////// //     // //////// 
+//  //       //     // //       
+//  //       //     // //       
+//  //////   //     // //////   
+//  //        //   //  //       
+//  //         // //   //       
+//  ////////    ///    //////// 
+
+// the DOM timed by this benchmark: numbers are kept as their Loon text so
+// that a round trip reproduces them exactly
+struct node {
+    enum kind_t { k_null, k_bool, k_number, k_string, k_arry, k_dict };
+
+    kind_t kind;
+    bool boolean;
+    loon::reader::num_type ntype;
+    std::string text;               // number or string value
+    std::vector<std::string> keys;  // dict keys, one per item
+    std::vector<node> items;        // arry or dict values
+
+    explicit node(kind_t k = k_null)
+    : kind(k), boolean(false), ntype(loon::reader::num_dec_int) {}
+
+    static node make_number(const std::string & text, loon::reader::num_type ntype)
+    {
+        node n(k_number);
+        n.text = text;
+        n.ntype = ntype;
+        return n;
+    }
+
+    static node make_string(const std::string & text)
+    {
+        node n(k_string);
+        n.text = text;
+        return n;
+    }
+};
+
+
+// build a node tree from Loon text
+class dom_reader : private loon::reader::base {
+public:
+    using base::process_chunk;
+
+    // return the last top-level value read
+    node & root() { return root_; }
+
+    virtual void reset()
+    {
+        base::reset();
+        stack_.clear();
+        root_ = node();
+    }
+
+private:
+    std::vector<node> stack_;
+    node root_;
+
+    // append the given value to the open list, or make it the root
+    void add(node & n)
+    {
+        if (stack_.empty())
+            root_ = std::move(n);
+        else
+            stack_.back().items.push_back(std::move(n));
+    }
+
+    void list_end()
+    {
+        node n(std::move(stack_.back()));
+        stack_.pop_back();
+        add(n);
+    }
+
+    virtual void loon_arry_begin() { stack_.push_back(node(node::k_arry)); }
+    virtual void loon_dict_begin() { stack_.push_back(node(node::k_dict)); }
+    virtual void loon_arry_end() { list_end(); }
+    virtual void loon_dict_end() { list_end(); }
+
+    virtual void loon_dict_key(const char * utf8, size_t len)
+    {
+        stack_.back().keys.push_back(std::string(utf8, len));
+    }
+
+    virtual void loon_null()
+    {
+        node n;
+        add(n);
+    }
+
+    virtual void loon_bool(bool value)
+    {
+        node n(node::k_bool);
+        n.boolean = value;
+        add(n);
+    }
+
+    virtual void loon_string(const char * utf8, size_t len)
+    {
+        node n(node::k_string);
+        n.text.assign(utf8, len);
+        add(n);
+    }
+
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+    {
+        node n(node::k_number);
+        n.text.assign(utf8, len);
+        n.ntype = ntype;
+        add(n);
+    }
+};
+
+
+// output the given node tree to the given Loon (or JSON) writer
+template <typename Writer>
+void write_node(const node & n, Writer & w)
+{
+    switch (n.kind) {
+    case node::k_null:      w.loon_null();                                      break;
+    case node::k_bool:      w.loon_bool(n.boolean);                             break;
+    case node::k_number:    w.loon_preformatted_value(n.text.data(), n.text.size()); break;
+    case node::k_string:    w.loon_string(n.text);                              break;
+    case node::k_arry:
+        w.loon_arry_begin();
+        for (size_t i = 0; i < n.items.size(); ++i)
+            write_node(n.items[i], w);
+        w.loon_arry_end();
+        break;
+    case node::k_dict:
+        w.loon_dict_begin();
+        for (size_t i = 0; i < n.items.size(); ++i) {
+            w.loon_dict_key(n.keys[i]);
+            write_node(n.items[i], w);
+        }
+        w.loon_dict_end();
+        break;
+    }
+}
+
+
+// a Loon writer that appends its output to 'str'
+struct string_writer : public loon::writer::base {
+    std::string str;
+    virtual void reset() { base::reset(); str.clear(); }
+private:
+    virtual void write(const char * utf8, size_t len) { str.append(utf8, len); }
+};
+
+// a JSON writer that copies its output to std::cout
+struct cout_json_writer : public loon::json::writer {
+private:
+    virtual void write(const char * utf8, size_t len) { std::cout.write(utf8, len); }
+};
+
+// a Loon writer that copies its output to std::cout
+struct cout_writer : public loon::writer::base {
+private:
+    virtual void write(const char * utf8, size_t len) { std::cout.write(utf8, len); }
+};
+
+// a reader with nothing to do, to time the lexer and parser alone
+struct null_reader : private loon::reader::base {
+    using base::process_chunk;
+    using base::reset;
+private:
+    virtual void loon_arry_begin() {}
+    virtual void loon_arry_end() {}
+    virtual void loon_dict_begin() {}
+    virtual void loon_dict_end() {}
+    virtual void loon_dict_key(const char *, size_t) {}
+    virtual void loon_null() {}
+    virtual void loon_bool(bool) {}
+    virtual void loon_string(const char *, size_t) {}
+    virtual void loon_number(const char *, size_t, loon::reader::num_type) {}
+};
+
+
+
+
+//   //////   //////  ////////  ////////  //     //  //////  
+//  //    // //    // //     // //     // //     // //    // 
+//  //       //    // //     // //     // //     // //       
+//  //       //    // ////////  ////////  //     //  //////  
+//  //       //    // //   //   //        //     //       // 
+//  //    // //    // //    //  //        //     // //    // 
+//   //////   //////  //     // //         ///////   //////  
+
+// a small deterministic pseudo-random number generator, so that every run
+// of the benchmark reads the same corpus
+class prng {
+public:
+    prng() : x_(88172645463325252ULL) {}
+
+    // return a number in the range 0 .. n-1
+    unsigned next(unsigned n)
+    {
+        x_ ^= x_ << 13;
+        x_ ^= x_ >> 7;
+        x_ ^= x_ << 17;
+        return static_cast<unsigned>(x_ % n);
+    }
+
+private:
+    uint64_t x_;
+};
+
+std::string random_word(prng & rnd)
+{
+    static const char * const words[] = {
+        "loon", "rain", "Spain", "plain", "Wiltshire", "serialisation", "UTF-8",
+        "list", "value", "a", "the", "of", "bananas", "Hello, World!", "config",
+        "\xCE\xBB", "\xE2\x82\xAC\xE2\x82\xAC", "\xF0\x9F\x90\xA6"
+    };
+    return words[rnd.next(sizeof(words) / sizeof(words[0]))];
+}
+
+std::string random_sentence(prng & rnd, unsigned max_words)
+{
+    std::string s(random_word(rnd));
+    for (unsigned n = rnd.next(max_words); n; --n)
+        s += ' ' + random_word(rnd);
+    return s;
+}
+
+std::string random_number_text(prng & rnd, loon::reader::num_type & ntype)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    std::string s;
+    switch (rnd.next(4)) {
+    case 0: // small decimal integer
+        ntype = loon::reader::num_dec_int;
+        s = std::to_string(static_cast<int>(rnd.next(2000)) - 1000);
+        break;
+    case 1: // big decimal integer
+        ntype = loon::reader::num_dec_int;
+        s = std::to_string(rnd.next(0x7FFFFFFF)) + std::to_string(rnd.next(1000000000));
+        break;
+    case 2:
+        ntype = loon::reader::num_hex_int;
+        s = "0x";
+        for (unsigned n = 1 + rnd.next(16); n; --n)
+            s += digits[rnd.next(16)];
+        break;
+    default:
+        ntype = loon::reader::num_float;
+        s = std::to_string(rnd.next(100000)) + '.' + std::to_string(rnd.next(1000000));
+        if (rnd.next(2))
+            s += "e-" + std::to_string(rnd.next(300));
+        break;
+    }
+    return s;
+}
+
+node random_number(prng & rnd)
+{
+    loon::reader::num_type ntype;
+    const std::string s(random_number_text(rnd, ntype));
+    return node::make_number(s, ntype);
+}
+
+// a string with something to escape every few characters
+std::string random_escapes(prng & rnd)
+{
+    static const char * const pieces[] = {
+        "\n", "\t", "\"", "\\", "\x01", "\x1F", "\r\n", "\b", "\f", "\x7F", "ab", "xyz"
+    };
+    std::string s;
+    for (unsigned n = 4 + rnd.next(24); n; --n)
+        s += pieces[rnd.next(sizeof(pieces) / sizeof(pieces[0]))];
+    return s;
+}
+
+// return a document of the named shape of very roughly the given size in
+// bytes when written compactly
+node generate(const std::string & shape, size_t size)
+{
+    prng rnd;
+    node root(node::k_arry);
+
+    if (shape == "strings") {
+        // records of short and long text
+        for (size_t n = 0; n < size / 160; ++n) {
+            node rec(node::k_dict);
+            rec.keys.push_back("name");
+            rec.items.push_back(node::make_string(random_sentence(rnd, 3)));
+            rec.keys.push_back("description");
+            rec.items.push_back(node::make_string(random_sentence(rnd, 30)));
+            root.items.push_back(rec);
+        }
+    }
+    else if (shape == "numbers") {
+        // rows of integers, hex and floats
+        for (size_t n = 0; n < size / 120; ++n) {
+            node row(node::k_arry);
+            for (int i = 0; i < 8; ++i)
+                row.items.push_back(random_number(rnd));
+            root.items.push_back(row);
+        }
+    }
+    else if (shape == "nesting") {
+        // towers of lists 64 deep, alternating arry and dict
+        const int depth = 64;
+        for (size_t n = 0; n < size / (depth * 9); ++n) {
+            node tower;
+            for (int i = 0; i < depth; ++i) {
+                node list(i % 2 ? node::k_dict : node::k_arry);
+                if (list.kind == node::k_dict)
+                    list.keys.push_back("k");
+                list.items.push_back(std::move(tower));
+                tower = std::move(list);
+            }
+            root.items.push_back(tower);
+        }
+    }
+    else if (shape == "escapes") {
+        for (size_t n = 0; n < size / 30; ++n)
+            root.items.push_back(node::make_string(random_escapes(rnd)));
+    }
+    else if (shape == "wide_dict") {
+        // one dict with very many keys
+        root.kind = node::k_dict;
+        for (size_t n = 0; n < size / 24; ++n) {
+            root.keys.push_back("key_" + std::to_string(n));
+            switch (rnd.next(4)) {
+            case 0: root.items.push_back(node(node::k_null)); break;
+            case 1: root.items.push_back(node::make_string(random_word(rnd))); break;
+            default: root.items.push_back(random_number(rnd)); break;
+            }
+        }
+    }
+    else if (shape == "huge_array") {
+        // one arry of very many small atoms
+        for (size_t n = 0; n < size / 4; ++n) {
+            switch (rnd.next(4)) {
+            case 0: root.items.push_back(node(node::k_null)); break;
+            case 1: root.items.push_back(node(node::k_bool)); break;
+            default: root.items.push_back(node::make_number(std::to_string(rnd.next(1000)), loon::reader::num_dec_int)); break;
+            }
+        }
+    }
+
+    return root;
+}
+
+
+
+
+//  //////// //// ////////    //// ////    //  //////   
+//     //     //  //     //   //   //  //   // //    //  
+//     //     //  //     //   //   //  ///  // //        
+//     //     //  //     //   //   //  // // // //   //// 
+//     //     //  //     //   //   //  //  //// //    //  
+//     //     //  //     //   //   //  //   /// //    //  
+//     //    //// ////////   //// ////  //    //  //////   
+
+struct options {
+    int runs;
+    size_t size;
+    bool json;
+
+    options() : runs(15), size(1 << 20), json(false) {}
+};
+
+struct result {
+    std::string corpus;
+    std::string style;
+    std::string bench;
+    size_t chunk_size;          // 0 => whole text in one chunk
+    size_t bytes;
+    std::vector<double> seconds;
+};
+
+// return the time in seconds of the run at the given percentile of the
+// sorted 'seconds', by the nearest-rank method
+double percentile(const std::vector<double> & seconds, int pc)
+{
+    size_t rank = (seconds.size() * pc + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+    return seconds[rank - 1];
+}
+
+double mbps(size_t bytes, double seconds)
+{
+    return seconds > 0 ? bytes / seconds / (1024 * 1024) : 0;
+}
+
+// call f() 'runs' times and return the sorted time taken by each call
+template <typename F>
+std::vector<double> time_runs(int runs, F f)
+{
+    typedef std::chrono::steady_clock clock;
+    std::vector<double> seconds;
+    f(); // warm up
+    for (int i = 0; i < runs; ++i) {
+        const clock::time_point t1 = clock::now();
+        f();
+        const clock::time_point t2 = clock::now();
+        seconds.push_back(std::chrono::duration<double>(t2 - t1).count());
+    }
+    std::sort(seconds.begin(), seconds.end());
+    return seconds;
+}
+
+// give the given 'text' to the given reader in chunks of the given size
+template <typename Reader>
+void read_chunked(Reader & r, const std::string & text, size_t chunk_size)
+{
+    r.reset();
+    if (chunk_size == 0 || chunk_size >= text.size()) {
+        r.process_chunk(text.data(), text.size(), /*is_last_chunk=*/true);
+        return;
+    }
+    const char * p = text.data();
+    const char * const end = p + text.size();
+    while (end - p > static_cast<ptrdiff_t>(chunk_size)) {
+        r.process_chunk(p, chunk_size, /*is_last_chunk=*/false);
+        p += chunk_size;
+    }
+    r.process_chunk(p, end - p, /*is_last_chunk=*/true);
+}
+
+template <typename Writer>
+void report(Writer & w, const result & r)
+{
+    w.loon_dict_begin();
+    w.loon_dict_key("corpus");      w.loon_string(r.corpus);
+    w.loon_dict_key("style");       w.loon_string(r.style);
+    w.loon_dict_key("bench");       w.loon_string(r.bench);
+    w.loon_dict_key("chunk_size");  w.loon_dec_u32(static_cast<uint32_t>(r.chunk_size));
+    w.loon_dict_key("bytes");       w.loon_dec_u32(static_cast<uint32_t>(r.bytes));
+    w.loon_dict_key("runs");        w.loon_dec_u32(static_cast<uint32_t>(r.seconds.size()));
+    w.loon_dict_key("mbps_p50");    w.loon_double(mbps(r.bytes, percentile(r.seconds, 50)));
+    w.loon_dict_key("mbps_p90");    w.loon_double(mbps(r.bytes, percentile(r.seconds, 90)));
+    w.loon_dict_key("mbps_p99");    w.loon_double(mbps(r.bytes, percentile(r.seconds, 99)));
+    w.loon_dict_end();
+}
+
+template <typename Writer>
+void report(Writer & w, const std::vector<result> & results)
+{
+    w.loon_arry_begin();
+    for (size_t i = 0; i < results.size(); ++i)
+        report(w, results[i]);
+    w.loon_arry_end();
+}
+
+// run every benchmark over every corpus; return false if a round trip
+// didn't reproduce its input
+bool run(const options & opt, std::vector<result> & results)
+{
+    static const char * const shapes[] = {
+        "strings", "numbers", "nesting", "escapes", "wide_dict", "huge_array"
+    };
+    static const size_t chunk_sizes[] = { 0, 65536, 4096, 1024, 256, 64, 16, 4, 1 };
+    bool ok = true;
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); ++s) {
+        const node doc(generate(shapes[s], opt.size));
+
+        for (int pretty = 0; pretty < 2; ++pretty) {
+            string_writer w;
+            w.set_pretty(pretty != 0);
+            write_node(doc, w);
+            const std::string text(w.str);
+
+            result r;
+            r.corpus = shapes[s];
+            r.style = pretty ? "pretty" : "compact";
+            r.bytes = text.size();
+            std::cerr << "loonbench: " << r.corpus << ' ' << r.style
+                << ", " << r.bytes << " bytes\n";
+
+            // reader only, in chunks of each size
+            null_reader nr;
+            r.bench = "reader";
+            for (size_t c = 0; c < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++c) {
+                r.chunk_size = chunk_sizes[c];
+                r.seconds = time_runs(opt.runs, [&] { read_chunked(nr, text, r.chunk_size); });
+                results.push_back(r);
+            }
+            r.chunk_size = 0;
+
+            // read into the DOM
+            dom_reader dr;
+            r.bench = "dom";
+            r.seconds = time_runs(opt.runs, [&] { read_chunked(dr, text, 0); });
+            results.push_back(r);
+
+            // write the DOM
+            r.bench = "writer";
+            r.seconds = time_runs(opt.runs, [&] { w.reset(); w.set_pretty(pretty != 0); write_node(doc, w); });
+            results.push_back(r);
+
+            // read into the DOM and write it again
+            r.bench = "round_trip";
+            r.seconds = time_runs(opt.runs, [&] {
+                read_chunked(dr, text, 0);
+                w.reset();
+                w.set_pretty(pretty != 0);
+                write_node(dr.root(), w);
+            });
+            results.push_back(r);
+
+            if (w.str != text) {
+                std::cerr << "loonbench: " << r.corpus << ' ' << r.style << " round trip differs\n";
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+bool parse_options(int argc, char * argv[], options & opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "-json")
+            opt.json = true;
+        else if (arg == "-runs" && i + 1 < argc)
+            opt.runs = std::atoi(argv[++i]);
+        else if (arg == "-size" && i + 1 < argc)
+            opt.size = std::strtoul(argv[++i], 0, 10);
+        else
+            return false;
+    }
+    return opt.runs > 0 && opt.size > 0;
+}
+
+} // anonymous namespace
+
+
+
+int main(int argc, char * argv[])
+{
+    options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::cerr << "usage: loonbench [-runs N] [-size BYTES] [-json]\n";
+        return 2;
+    }
+
+    try {
+        std::vector<result> results;
+        const bool ok = run(opt, results);
+        if (opt.json) {
+            cout_json_writer w;
+            report(w, results);
+        }
+        else {
+            cout_writer w;
+            report(w, results);
+        }
+        std::cout << '\n';
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    catch (const std::exception & e) {
+        std::cerr << "loonbench: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+}
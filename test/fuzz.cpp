@@ -0,0 +1,806 @@
+/*  THIS IS FREE AND UNENCUMBERED SOFTWARE RELEASED INTO THE PUBLIC DOMAIN.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a compiled
+    binary, for any purpose, commercial or non-commercial, and by any
+    means.
+
+    In jurisdictions that recognize copyright laws, the author or authors
+    of this software dedicate any and all copyright interest in the
+    software to the public domain. We make this dedication for the benefit
+    of the public at large and to the detriment of our heirs and
+    successors. We intend this dedication to be an overt act of
+    relinquishment in perpetuity of all present and future rights to this
+    software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+    OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+    OTHER DEALINGS IN THE SOFTWARE.
+
+    Made by Anthony Hay in 2014 in Wiltshire, England.
+    See http://loonfile.info.
+*/
+
+
+/*  Fuzz targets for loon-cpp.
+
+    Each target checks one part of the library against a reference, so that
+    a fast path that reads differently from the byte at a time path is found
+    as surely as a crash:
+
+    fuzz_reader     - loon::reader::base, given the input in chunks of random
+                      sizes, must log exactly the same events, locations,
+                      errors and counts as the reference reader: fast paths
+                      off, one byte per chunk, and string escapes expanded by
+                      the simple unescape() below
+    fuzz_round_trip - a document made from the input, written by each kind of
+                      Loon writer, must read back as the same events
+    fuzz_dom        - Loon text read through loon::binary must give the same
+                      events as reading the text; random edits to a
+                      loon::incremental::document, some in lists well into
+                      the text, must give the same trees as parsing the
+                      edited text; and arbitrary bytes given to
+                      loon::binary::document must only ever throw a
+                      loon::reader::exception
+
+    With libFuzzer (clang) build this file once per target, e.g.
+
+        clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined
+            -DLOON_FUZZ_TARGET=fuzz_reader -I../../src ../../test/fuzz.cpp
+            ../../src/loon_*.cpp -o fuzz_reader
+
+    (see the fuzz_XXXX targets in build/clang/makefile). Without
+    LOON_FUZZ_TARGET this file builds a stand-alone program that runs every
+    target over the files named on its command line, or, given none, over
+    random mutations of a few sample texts.
+*/
+
+
+#include "loon_reader.h"
+#include "loon_writer.h"
+#include "loon_binary.h"
+#include "loon_incremental.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace loonfuzz {
+
+
+// a small pseudo-random number generator, seeded from the input so that a
+// failing input always fails the same way
+class prng {
+public:
+    explicit prng(uint64_t seed) : x_(seed ^ 88172645463325252ULL) { if (!x_) x_ = 1; }
+
+    // return a number in the range 0 .. n-1
+    unsigned next(unsigned n)
+    {
+        x_ ^= x_ << 13;
+        x_ ^= x_ >> 7;
+        x_ ^= x_ << 17;
+        return static_cast<unsigned>(x_ % n);
+    }
+
+private:
+    uint64_t x_;
+};
+
+uint64_t hash(const uint8_t * data, size_t size)
+{
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < size; ++i)
+        h = (h ^ data[i]) * 1099511628211ULL;
+    return h;
+}
+
+// the fuzzer's input as a source of values; zeros once it runs out
+class input {
+public:
+    input(const uint8_t * data, size_t size) : p_(data), end_(data + size) {}
+
+    bool empty() const { return p_ == end_; }
+
+    uint8_t byte() { return p_ == end_ ? 0 : *p_++; }
+
+    uint32_t u32()
+    {
+        uint32_t n = 0;
+        for (int i = 0; i < 4; ++i)
+            n = n << 8 | byte();
+        return n;
+    }
+
+    // return the next 'n' bytes, or what's left if there are fewer
+    std::string bytes(size_t n)
+    {
+        n = std::min(n, static_cast<size_t>(end_ - p_));
+        const std::string s(reinterpret_cast<const char *>(p_), n);
+        p_ += n;
+        return s;
+    }
+
+    std::string rest() { return bytes(end_ - p_); }
+
+private:
+    const uint8_t * p_;
+    const uint8_t * const end_;
+};
+
+// report two logs that should be the same but are not, and stop
+void check_same(const char * what, const std::string & expected, const std::string & got)
+{
+    if (got == expected)
+        return;
+    size_t i = 0;
+    while (i < expected.size() && i < got.size() && expected[i] == got[i])
+        ++i;
+    const size_t from = i > 40 ? i - 40 : 0;
+    std::cerr
+        << "loonfuzz: " << what << " differs at byte " << i << " of the log\n"
+        << "expected: ..." << expected.substr(from, 120) << "\n"
+        << "got:      ..." << got.substr(from, 120) << "\n";
+    std::abort();
+}
+
+void check(bool ok, const char * what)
+{
+    if (!ok) {
+        std::cerr << "loonfuzz: " << what << "\n";
+        std::abort();
+    }
+}
+
+// append 'n' in UTF-8 to 's'
+void append_utf8(std::string & s, uint32_t n)
+{
+    if (n < 0x80)
+        s += static_cast<char>(n);
+    else if (n < 0x800) {
+        s += static_cast<char>(0xC0 | n >> 6);
+        s += static_cast<char>(0x80 | (n & 0x3F));
+    }
+    else if (n < 0x10000) {
+        s += static_cast<char>(0xE0 | n >> 12);
+        s += static_cast<char>(0x80 | (n >> 6 & 0x3F));
+        s += static_cast<char>(0x80 | (n & 0x3F));
+    }
+    else {
+        s += static_cast<char>(0xF0 | n >> 18);
+        s += static_cast<char>(0x80 | (n >> 12 & 0x3F));
+        s += static_cast<char>(0x80 | (n >> 6 & 0x3F));
+        s += static_cast<char>(0x80 | (n & 0x3F));
+    }
+}
+
+// the reference for the reader's escape expansion: replace, one byte at a
+// time, each escape in 's' (which the reader has checked) with what it means
+std::string unescape(const std::string & s)
+{
+    std::string out;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] != '\\') {
+            out += s[i];
+            continue;
+        }
+        const char c = s[++i];
+        switch (c) {
+        case 'b':   out += '\b';    break;
+        case 'f':   out += '\f';    break;
+        case 'n':   out += '\n';    break;
+        case 'r':   out += '\r';    break;
+        case 't':   out += '\t';    break;
+        case 'u':
+            {
+                uint32_t x = std::strtoul(s.substr(i + 1, 4).c_str(), 0, 16);
+                i += 4;
+                if (x >= 0xD800 && x < 0xDC00) { // a surrogate pair
+                    const uint32_t y = std::strtoul(s.substr(i + 3, 4).c_str(), 0, 16);
+                    i += 6;
+                    x = 0x10000 + ((x - 0xD800) << 10) + (y - 0xDC00);
+                }
+                append_utf8(out, x);
+            }
+            break;
+        default:    out += c;       break; // \\ \" or \/
+        }
+    }
+    return out;
+}
+
+// append one event to 'log'
+void log_event(std::string & log, char event, const char * utf8 = 0, size_t len = 0)
+{
+    log += event;
+    if (utf8) {
+        log += std::to_string(len) + ':';
+        log.append(utf8, len);
+    }
+    log += ' ';
+}
+
+void log_number(std::string & log, const std::string & text, loon::reader::num_type ntype)
+{
+    log_event(log, static_cast<char>('n' + ntype), text.data(), text.size());
+}
+
+
+// a reader that logs every event, with its location, every error and what
+// the reader counted, so that two readers can be compared by their logs
+class logger : public loon::reader::base {
+public:
+    std::string log;
+    int errors;
+    int top_level_values;
+
+    // options: bits 0-1 recovery, 2-3 UTF-8 validation, 4 raw strings and
+    // 5 token locations; a 'reference' reader takes the byte at a time path
+    // and has its string escapes expanded by unescape()
+    logger(unsigned options, bool reference)
+    : errors(0), top_level_values(0), depth_(0), unescape_(false)
+    {
+        set_recovery(static_cast<recovery>(options % 3));
+        set_utf8_validation(static_cast<loon::reader::utf8_validation>((options >> 2) % 3));
+        set_token_locations((options & 0x20) != 0);
+        set_raw_strings((options & 0x10) != 0);
+        if (reference) {
+            set_fast_paths(false);
+            unescape_ = !set_raw_strings(true);
+        }
+    }
+
+    // read all of 'text' in chunks of the given sizes (the last is the rest)
+    void read(const std::string & text, const std::vector<size_t> & chunks)
+    {
+        try {
+            size_t at = 0;
+            for (size_t i = 0; i < chunks.size() && at + chunks[i] < text.size(); ++i) {
+                process_chunk(text.data() + at, chunks[i], false);
+                at += chunks[i];
+            }
+            process_chunk(text.data() + at, text.size() - at, true);
+
+            const loon::reader::statistics & s = stats();
+            log += "end " + std::to_string(current_offset()) + ':' + std::to_string(current_line())
+                + ':' + std::to_string(current_column())
+                + " bytes " + std::to_string(s.bytes)
+                + " lists " + std::to_string(s.lists)
+                + " strings " + std::to_string(s.strings)
+                + " escaped " + std::to_string(s.escaped_strings)
+                + " numbers " + std::to_string(s.numbers)
+                + " symbols " + std::to_string(s.symbols)
+                + " depth " + std::to_string(s.max_depth);
+        }
+        catch (const loon::reader::exception & e) {
+            log_error(e);
+        }
+    }
+
+    // read all of 'text' one byte at a time
+    void read(const std::string & text)
+    {
+        read(text, std::vector<size_t>(text.size(), 1));
+    }
+
+private:
+    int depth_;
+    bool unescape_;
+
+    void value()
+    {
+        if (depth_ == 0)
+            ++top_level_values;
+    }
+
+    void log_error(const loon::reader::exception & e)
+    {
+        ++errors;
+        log += '!' + std::to_string(e.id()) + '@' + std::to_string(e.offset())
+            + ':' + std::to_string(e.line()) + ':' + std::to_string(e.column()) + ' ';
+    }
+
+    void log_text(char event, const char * utf8, size_t len)
+    {
+        if (unescape_) {
+            const std::string s(unescape(std::string(utf8, len)));
+            log_event(log, event, s.data(), s.size());
+        }
+        else
+            log_event(log, event, utf8, len);
+    }
+
+    virtual void loon_error(const loon::reader::exception & e) { log_error(e); }
+
+    virtual void loon_token_location(const loon::reader::location & where)
+    {
+        log += '@' + std::to_string(where.offset) + ':' + std::to_string(where.line)
+            + ':' + std::to_string(where.column) + ' ';
+    }
+
+    virtual void loon_arry_begin() { value(); ++depth_; log_event(log, '['); }
+    virtual void loon_arry_end() { --depth_; log_event(log, ']'); }
+    virtual void loon_dict_begin() { value(); ++depth_; log_event(log, '{'); }
+    virtual void loon_dict_end() { --depth_; log_event(log, '}'); }
+    virtual void loon_dict_key(const char * utf8, size_t len) { log_text('k', utf8, len); }
+    virtual void loon_null() { value(); log_event(log, '0'); }
+    virtual void loon_bool(bool b) { value(); log_event(log, b ? 't' : 'f'); }
+    virtual void loon_string(const char * utf8, size_t len) { value(); log_text('s', utf8, len); }
+
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+    {
+        value();
+        log_number(log, std::string(utf8, len), ntype);
+    }
+};
+
+// return random chunk sizes for reading 'size' bytes: mostly small, as from
+// a network read, with the occasional large one
+std::vector<size_t> random_chunks(prng & rnd, size_t size)
+{
+    std::vector<size_t> chunks;
+    for (size_t total = 0; total < size; ) {
+        size_t n;
+        switch (rnd.next(4)) {
+        case 0:     n = 1;                      break;
+        case 1:     n = 1 + rnd.next(8);        break;
+        case 2:     n = 1 + rnd.next(80);       break;
+        default:    n = 1 + rnd.next(1000);     break;
+        }
+        chunks.push_back(n);
+        total += n;
+    }
+    return chunks;
+}
+
+
+
+
+////////  ////////    ///    ////////  ////////  //////// 
+//     // //         // //   //     // //       //     // 
+//     // //        //   //  //     // //       //     // 
+////////  //////   //     // //     // //////   ////////  
+//   //   //       ///////// //     // //       //   //   
+//    //  //       //     // //     // //       //    //  
+//     // //////// //     // ////////  //////// //     // 
+
+void fuzz_reader(const uint8_t * data, size_t size)
+{
+    input in(data, size);
+    const unsigned options = in.byte();
+    const std::string text(in.rest());
+
+    logger reference(options, true);
+    reference.read(text);
+
+    logger whole(options, false);
+    whole.read(text, std::vector<size_t>());
+    check_same("reading the whole text", reference.log, whole.log);
+
+    prng rnd(hash(data, size));
+    logger chunked(options, false);
+    chunked.read(text, random_chunks(rnd, text.size()));
+    check_same("reading the text in chunks", reference.log, chunked.log);
+}
+
+
+
+
+////////   ///////  //     // ////    //  ////////     //////// ////////  //// //////// 
+//     // //     // //     // //\\   //  //     //       //    //     //  //  //     //
+//     // //     // //     // // \\  //  //     //       //    //     //  //  //     //
+////////  //     // //     // //  \\ //  //     //       //    ////////   //  ////////  
+//   //   //     // //     // //   \\//  //     //       //    //   //    //  //        
+//    //  //     // //     // //    \//  //     //       //    //    //   //  //        
+//     //  ///////   ///////  //     //  ////////        //    //     // //// //        
+
+struct string_sink {
+    std::string str;
+    void write(const char * utf8, size_t len) { str.append(utf8, len); }
+};
+
+struct string_writer : public loon::writer::base {
+    std::string str;
+private:
+    virtual void write(const char * utf8, size_t len) { str.append(utf8, len); }
+};
+
+std::string text_of(const string_writer & w) { return w.str; }
+
+template <typename Style>
+std::string text_of(const loon::writer::basic<string_sink, Style> & w) { return w.sink().str; }
+
+// write a value made from the input to 'w' and log the events reading it
+// back should give
+template <typename Writer>
+void generate(input & in, Writer & w, std::string & log, int depth)
+{
+    const uint8_t op = in.byte();
+    switch (op % 8) {
+    case 0:
+        w.loon_null();
+        log_event(log, '0');
+        break;
+
+    case 1:
+        w.loon_bool((op & 0x80) != 0);
+        log_event(log, (op & 0x80) ? 't' : 'f');
+        break;
+
+    case 2:
+        {
+            const int32_t n = static_cast<int32_t>(in.u32());
+            w.loon_dec_s32(n);
+            log_number(log, std::to_string(n), loon::reader::num_dec_int);
+        }
+        break;
+
+    case 3:
+        {
+            const uint32_t n = in.u32();
+            w.loon_hex_u32(n);
+            char hex[16];
+            std::sprintf(hex, "0x%08X", n);
+            log_number(log, hex, loon::reader::num_hex_int);
+        }
+        break;
+
+    case 4:
+        {
+            const uint64_t bits = static_cast<uint64_t>(in.u32()) << 32 | in.u32();
+            double n;
+            std::memcpy(&n, &bits, sizeof(n));
+            if (!std::isfinite(n))
+                n = bits / 1024.0;
+            w.loon_double(n);
+            log_number(log, loon::writer::detail::double_to_string(n), loon::reader::num_float);
+        }
+        break;
+
+    case 5:
+        {
+            const std::string s(in.bytes(in.byte() % 32));
+            w.loon_string(s);
+            log_event(log, 's', s.data(), s.size());
+        }
+        break;
+
+    default:
+        {
+            const bool is_dict = op % 8 == 7;
+            const int n = depth < 32 ? in.byte() % 8 : 0;
+            if (is_dict) {
+                w.loon_dict_begin();
+                log_event(log, '{');
+            }
+            else {
+                w.loon_arry_begin();
+                log_event(log, '[');
+            }
+            for (int i = 0; i < n; ++i) {
+                if (is_dict) {
+                    const std::string key(in.bytes(in.byte() % 16));
+                    w.loon_dict_key(key);
+                    log_event(log, 'k', key.data(), key.size());
+                }
+                generate(in, w, log, depth + 1);
+            }
+            if (is_dict) {
+                w.loon_dict_end();
+                log_event(log, '}');
+            }
+            else {
+                w.loon_arry_end();
+                log_event(log, ']');
+            }
+        }
+        break;
+    }
+}
+
+template <typename Writer>
+void round_trip(input & in, Writer & w, uint64_t seed)
+{
+    std::string expected;
+    for (int values = 0; !in.empty() && values < 16; ++values)
+        generate(in, w, expected, 0);
+    const std::string text(text_of(w));
+
+    // (the expected log has no end; compare the logs up to there)
+    logger reference(0, true);
+    reference.read(text);
+    reference.log.erase(reference.log.rfind("end "));
+    check_same("reading what was written", expected, reference.log);
+
+    prng rnd(seed);
+    logger chunked(0, false);
+    chunked.read(text, random_chunks(rnd, text.size()));
+    chunked.log.erase(chunked.log.rfind("end "));
+    check_same("reading what was written in chunks", expected, chunked.log);
+}
+
+void fuzz_round_trip(const uint8_t * data, size_t size)
+{
+    input in(data, size);
+    const uint64_t seed = hash(data, size);
+    switch (in.byte() % 4) {
+    case 0:
+        {
+            string_writer w;
+            w.set_pretty(false);
+            round_trip(in, w, seed);
+        }
+        break;
+    case 1:
+        {
+            string_writer w;
+            round_trip(in, w, seed);
+        }
+        break;
+    case 2:
+        {
+            loon::writer::basic<string_sink, loon::writer::compact> w;
+            round_trip(in, w, seed);
+        }
+        break;
+    default:
+        {
+            loon::writer::basic<string_sink, loon::writer::pretty<2, loon::writer::crlf> > w;
+            round_trip(in, w, seed);
+        }
+        break;
+    }
+}
+
+
+
+
+////////   ///////  //     // 
+//     // //     // ///   /// 
+//     // //     // //// //// 
+//     // //     // // /// // 
+//     // //     // //     // 
+//     // //     // //     // 
+////////   ///////  //     // 
+
+// a binary reader that logs events as logger does
+class binary_logger : public loon::binary::reader {
+public:
+    std::string log;
+private:
+    virtual void loon_arry_begin() { log_event(log, '['); }
+    virtual void loon_arry_end() { log_event(log, ']'); }
+    virtual void loon_dict_begin() { log_event(log, '{'); }
+    virtual void loon_dict_end() { log_event(log, '}'); }
+    virtual void loon_dict_key(const char * utf8, size_t len) { log_event(log, 'k', utf8, len); }
+    virtual void loon_null() { log_event(log, '0'); }
+    virtual void loon_bool(bool b) { log_event(log, b ? 't' : 'f'); }
+    virtual void loon_string(const char * utf8, size_t len) { log_event(log, 's', utf8, len); }
+
+    virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type ntype)
+    {
+        log_number(log, std::string(utf8, len), ntype);
+    }
+};
+
+struct binary_string_writer : public loon::binary::writer {
+    std::string str;
+private:
+    virtual void write(const char * data, size_t len) { str.append(data, len); }
+};
+
+// return the whole of the given incremental tree as text
+std::string dump(const loon::incremental::node & n)
+{
+    std::string s(std::to_string(n.kind) + '/' + std::to_string(n.ntype)
+        + ' ' + std::to_string(n.begin) + '-' + std::to_string(n.end) + '+' + std::to_string(n.head)
+        + ' ' + std::to_string(n.value.size()) + ':' + n.value + " (");
+    for (size_t i = 0; i < n.children.size(); ++i)
+        s += dump(n.children[i]);
+    return s + ") ";
+}
+
+// return false if 'text' is not valid Loon
+bool parse(loon::incremental::document & doc, const std::string & text)
+{
+    try {
+        doc.parse(text);
+        return true;
+    }
+    catch (const loon::reader::exception &) {
+        return false;
+    }
+}
+
+void fuzz_dom(const uint8_t * data, size_t size)
+{
+    input in(data, size);
+    const uint8_t options = in.byte();
+
+    if (options & 1) {
+        // arbitrary bytes as a binary document: any fault must be reported
+        // as a loon::reader::exception
+        const std::string bytes(in.rest());
+        try {
+            loon::binary::document doc(bytes.data(), bytes.size());
+            binary_logger b;
+            b.process(doc);
+        }
+        catch (const loon::reader::exception &) {
+        }
+        return;
+    }
+
+    // sometimes put the text in nested lists well into the text, so that
+    // edits reach lists that don't begin at offset 0
+    prng rnd(hash(data, size));
+    const std::string text(rnd.next(2) ? in.rest()
+        : "1 (arry" + std::string(2 * rnd.next(64), ' ') + " 2 (arry " + in.rest() + " ) )");
+
+    // Loon text -> binary -> events is the same as reading the text
+    logger r(0, false);
+    r.read(text, std::vector<size_t>());
+    const bool valid = r.errors == 0;
+    if (valid && r.top_level_values == 1) {
+        binary_string_writer w;
+        loon::binary::from_text ft(w);
+        ft.process_chunk(text.data(), text.size(), true);
+        loon::binary::document doc(w.str.data(), w.str.size());
+        binary_logger b;
+        b.process(doc);
+        check_same("reading the text through loon::binary", r.log.substr(0, r.log.rfind("end ")), b.log);
+    }
+
+    // an edit gives the same tree as parsing the edited text
+    loon::incremental::document doc;
+    check(parse(doc, text) == valid, "loon::incremental disagrees with the reader");
+    if (!valid)
+        return;
+
+    // make a few edits in turn, each replacing a few bytes, often those just
+    // before a ')', with a few others from elsewhere in the text, or with a value
+    static const char * const values[] = { "", " ", "1", " 2.5", " \"x\"", " null", "(arry)", " (dict \"k\" 0x9)", ";.", "\\" };
+    for (unsigned edits = 1 + rnd.next(8); edits; --edits) {
+        const std::string & current(doc.text());
+        size_t at = rnd.next(static_cast<unsigned>(current.size() + 1));
+        size_t n = rnd.next(16);
+        std::vector<size_t> closes;
+        for (size_t i = current.find(')'); i != std::string::npos; i = current.find(')', i + 1))
+            closes.push_back(i);
+        if (!closes.empty() && rnd.next(2)) {
+            const size_t close = closes[rnd.next(static_cast<unsigned>(closes.size()))];
+            n = rnd.next(4);
+            at = close - std::min<size_t>(close, n + rnd.next(2));
+        }
+        n = std::min<size_t>(n, current.size() - at);
+        const size_t from = rnd.next(static_cast<unsigned>(current.size() + 1));
+        const std::string replacement(rnd.next(2)
+            ? std::string(current, from, rnd.next(16))
+            : std::string(values[rnd.next(sizeof(values) / sizeof(values[0]))]));
+        std::string edited(current);
+        edited.replace(at, n, replacement);
+        loon::incremental::document fresh;
+        const bool edited_valid = parse(fresh, edited);
+        bool edit_valid = true;
+        try {
+            doc.edit(at, n, replacement);
+        }
+        catch (const loon::reader::exception &) {
+            edit_valid = false;
+        }
+        check(edit_valid == edited_valid, "an edit disagrees with parsing the edited text");
+        check(doc.text() == edited, "an edit made the wrong text");
+        if (!edit_valid)
+            break;
+        check_same("the tree after an edit", dump(fresh.top()), dump(doc.top()));
+    }
+}
+
+
+} // end of namespace loonfuzz
+
+
+
+#ifdef LOON_FUZZ_TARGET
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    loonfuzz::LOON_FUZZ_TARGET(data, size);
+    return 0;
+}
+
+#else
+
+namespace {
+
+using namespace loonfuzz;
+
+void fuzz_all(const std::string & s)
+{
+    const uint8_t * data = reinterpret_cast<const uint8_t *>(s.data());
+    fuzz_reader(data, s.size());
+    fuzz_round_trip(data, s.size());
+    fuzz_dom(data, s.size());
+}
+
+// return 's' with a few random changes
+std::string mutate(prng & rnd, std::string s, const std::vector<std::string> & samples)
+{
+    for (unsigned n = 1 + rnd.next(4); n; --n) {
+        const size_t at = s.empty() ? 0 : rnd.next(static_cast<unsigned>(s.size()));
+        switch (rnd.next(5)) {
+        case 0: // change a byte
+            if (!s.empty())
+                s[at] = static_cast<char>(rnd.next(256));
+            break;
+        case 1: // insert one of the bytes Loon gives meaning to
+            {
+                static const char loon_bytes[] = "()\";\\\r\n\t 0x.e-+u";
+                s.insert(at, 1, loon_bytes[rnd.next(sizeof(loon_bytes) - 1)]);
+            }
+            break;
+        case 2: // delete a few bytes
+            s.erase(at, rnd.next(4));
+            break;
+        case 3: // splice in part of a sample
+            {
+                const std::string & t = samples[rnd.next(static_cast<unsigned>(samples.size()))];
+                const size_t from = rnd.next(static_cast<unsigned>(t.size()));
+                s.insert(at, t, from, rnd.next(32));
+            }
+            break;
+        default: // change the options byte
+            if (!s.empty())
+                s[0] = static_cast<char>(rnd.next(256));
+            break;
+        }
+    }
+    return s;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc > 1) {
+        // replay the given inputs, e.g. ones libFuzzer saved
+        for (int i = 1; i < argc; ++i) {
+            std::ifstream f(argv[i], std::ios::binary);
+            std::ostringstream ss;
+            ss << f.rdbuf();
+            fuzz_all(ss.str());
+        }
+        std::cout << "loonfuzz: " << argc - 1 << " inputs passed\n";
+        return EXIT_SUCCESS;
+    }
+
+    // each sample starts with the options byte
+    std::vector<std::string> samples;
+    samples.push_back(std::string(1, '\0') + "(dict \"k\\u0041\\n\" (arry 1 -2.5e3 0x1F true false null))");
+    samples.push_back(std::string(1, '\x25') + "\xEF\xBB\xBF; comment\r\n(arry \"\xC2\xA3\\uD83D\\uDE00\" +.5 tr\\\r\nue)");
+    samples.push_back(std::string(1, '\x2A') + "(arry (dict \"a\" 1 \"b\") 99a \"\\q\" (arry \x80\xFF ok)) (dict 0x)");
+    samples.push_back(std::string(1, '\x06') + "(dict \"server\" (dict \"host\" \"example.com\" \"port\" 8080) \"tags\" (arry \"a\" \"b\"))");
+    samples.push_back(std::string(9, '\x07') + "generated");
+
+    prng rnd(1);
+    const int iterations = 20000;
+    for (int i = 0; i < iterations; ++i) {
+        const std::string & sample = samples[rnd.next(static_cast<unsigned>(samples.size()))];
+        fuzz_all(mutate(rnd, sample, samples));
+    }
+    std::cout << "loonfuzz: " << iterations << " random inputs passed\n";
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -28,12 +28,29 @@
 
 #include "loon_reader.h"
 #include "loon_writer.h"
+#include "loon_struct.h"
+#include "loon_transcode.h"
+#include "loon_json.h"
+#include "loon_binary.h"
+#include "loon_index.h"
+#include "loon_incremental.h"
+#include "loon_sink.h"
+#include "loon_parallel.h"
+#include "loon_canonical.h"
+#include "loon_diff.h"
+#include "loon_persistent.h"
 
 #include "var.h" // a sample variant class used for testing, not part of loon itself
 
 #include <iostream>
 #include <ratio>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <type_traits>
 
 namespace {
 
@@ -1547,6 +1564,36 @@ void test_strings()
         const uint8_t t[] = { 0xF0, 0x9D, 0x84, 0x9E, 'A', 'B', 'C' };
         test("\"\\uD834\\uDD1eABC\"", var(std::string(t, t+sizeof(t))));
     }
+    {
+        // escape-heavy strings, as written by tools that escape all non-ASCII,
+        // with runs of ordinary characters of various lengths between escapes
+        std::string loon("\""), expected;
+        for (uint32_t n = 1; n < 0xD800; n += 97) {
+            const char * const hex = n & 1 ? "0123456789abcdef" : "0123456789ABCDEF";
+            loon += "\\u";
+            for (int shift = 12; shift >= 0; shift -= 4)
+                loon += hex[(n >> shift) & 0xF];
+            if (n < 0x80)
+                expected += static_cast<char>(n);
+            else if (n < 0x800) {
+                expected += static_cast<char>(0xC0 | (n >> 6));
+                expected += static_cast<char>(0x80 | (n & 0x3F));
+            }
+            else {
+                expected += static_cast<char>(0xE0 | (n >> 12));
+                expected += static_cast<char>(0x80 | ((n >> 6) & 0x3F));
+                expected += static_cast<char>(0x80 | (n & 0x3F));
+            }
+            const std::string run(n % 19, static_cast<char>('a' + n % 26));
+            loon += run;
+            expected += run;
+            if (n % 5 == 0) {
+                loon += "\\uD83D\\uDE00\\n";
+                expected += "\xF0\x9F\x98\x80\n";
+            }
+        }
+        test(loon + '"', var(expected));
+    }
 }
 
 
@@ -1997,28 +2044,1691 @@ void test_write_loon_hex_u32()
     struct writer : public loon::writer::base {
         std::string write_as_hex_u32(uint32_t n)
         {
-            reset();
-            str.clear();
-            loon_hex_u32(n);
-            return str;
+            reset();
+            str.clear();
+            loon_hex_u32(n);
+            return str;
+        }
+
+    private:
+        std::string str;
+        virtual void write(const char * utf8, size_t len)
+        {
+            str.append(utf8, len);
+        }
+    };
+
+    writer w;
+    TEST_EQUAL(w.write_as_hex_u32(0         ), "0x00000000");
+    TEST_EQUAL(w.write_as_hex_u32(1         ), "0x00000001");
+    TEST_EQUAL(w.write_as_hex_u32(0xABCDEF  ), "0x00ABCDEF");
+    TEST_EQUAL(w.write_as_hex_u32(0x12345678), "0x12345678");
+    TEST_EQUAL(w.write_as_hex_u32(0x87654321), "0x87654321");
+    TEST_EQUAL(w.write_as_hex_u32(0xABCDEF00), "0xABCDEF00");
+    TEST_EQUAL(w.write_as_hex_u32(0xFFFFFFFF), "0xFFFFFFFF");
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Test a pre-escaped loon::writer::key outputs the same as a std::string key.
+void test_write_loon_dict_key()
+{
+    struct writer : public loon::writer::base {
+        std::string str;
+    private:
+        virtual void write(const char * utf8, size_t len)
+        {
+            str.append(utf8, len);
+        }
+    };
+
+    const char * const names[] = { "", "name", "a \"quoted\" key", "tab\there", "back\\slash", 0 };
+    for (const char * const * name = names; *name; ++name) {
+        const loon::writer::key k(*name);
+        writer a, b;
+        for (int i = 0; i < 3; ++i) {
+            a.loon_dict_begin();
+            a.loon_dict_key(k);
+            a.loon_null();
+            a.loon_dict_end();
+
+            b.loon_dict_begin();
+            b.loon_dict_key(std::string(*name));
+            b.loon_null();
+            b.loon_dict_end();
+        }
+        TEST_EQUAL(a.str, b.str);
+    }
+
+    const loon::writer::key k("tab\there");
+    TEST_EQUAL(std::string(k.data(), k.size()), "\"tab\\there\"");
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// a loon::writer::basic sink that appends to a string
+struct string_sink {
+    std::string str;
+    void write(const char * utf8, size_t len) { str.append(utf8, len); }
+};
+
+// output given 'v' to given 'writer', which may be any type of Loon writer
+template <typename Writer>
+void write_var(const var & v, Writer & writer)
+{
+    switch (v.type()) {
+    case var::type_null:    writer.loon_null();                 break;
+    case var::type_bool:    writer.loon_bool(v.as_bool());      break;
+    case var::type_string:  writer.loon_string(v.as_string());  break;
+    case var::type_int:     writer.loon_dec_s32(v.as_int());    break;
+    case var::type_float:   writer.loon_double(v.as_float());   break;
+
+    case var::type_arry:
+        {
+            writer.loon_arry_begin();
+            const var::arry_t & a(v.as_arry_t());
+            for (var::arry_t::const_iterator i = a.begin(); i != a.end(); ++i)
+                write_var(*i, writer);
+            writer.loon_arry_end();
+        }
+        break;
+
+    case var::type_dict:
+        {
+            writer.loon_dict_begin();
+            const var::dict_t & d(v.as_dict_t());
+            for (var::dict_t::const_iterator i = d.begin(); i != d.end(); ++i) {
+                writer.loon_dict_key(i->first);
+                write_var(i->second, writer);
+            }
+            writer.loon_dict_end();
+        }
+        break;
+
+    default: // (should never happen)
+        throw std::runtime_error("unknown variant type");
+    }
+}
+
+// Test loon::writer::basic gives the same output as loon::writer::base
+// configured to the same style.
+void test_basic_writer()
+{
+    struct writer : public loon::writer::base {
+        std::string str;
+    private:
+        virtual void write(const char * utf8, size_t len)
+        {
+            str.append(utf8, len);
+        }
+    };
+
+    const char * const texts[] = {
+        "null",
+        "\"a\\tstring\"",
+        "(arry)",
+        "(dict)",
+        "(arry 1 2.5 0x10 true false null \"s\")",
+        "(dict \"k\" (arry) \"l\" (dict) \"m\" (arry (dict \"x\" 1) (arry 2 (arry 3))))",
+        "(arry (dict \"a\" (dict \"b\" (dict \"c\" (arry 1 2 3)))) (arry) (dict \"\" \"\"))",
+        0
+    };
+
+    for (const char * const * t = texts; *t; ++t) {
+        const var v(unserialise(*t));
+
+        writer compact_base;
+        compact_base.set_pretty(false);
+        write_var(v, compact_base);
+        loon::writer::basic<string_sink, loon::writer::compact> compact_basic;
+        write_var(v, compact_basic);
+        TEST_EQUAL(compact_basic.sink().str, compact_base.str);
+
+        writer pretty_base;
+        write_var(v, pretty_base);
+        loon::writer::basic<string_sink, loon::writer::pretty<> > pretty_basic;
+        write_var(v, pretty_basic);
+        TEST_EQUAL(pretty_basic.sink().str, pretty_base.str);
+
+        writer crlf_base;
+        crlf_base.set_spaces_per_indent(2);
+        crlf_base.set_newline("\r\n");
+        write_var(v, crlf_base);
+        loon::writer::basic<string_sink, loon::writer::pretty<2, loon::writer::crlf> > crlf_basic;
+        write_var(v, crlf_basic);
+        TEST_EQUAL(crlf_basic.sink().str, crlf_base.str);
+
+        // deep nesting needs more spaces than are written at once
+        writer deep_base;
+        deep_base.set_spaces_per_indent(40);
+        write_var(v, deep_base);
+        loon::writer::basic<string_sink, loon::writer::pretty<40> > deep_basic;
+        write_var(v, deep_basic);
+        TEST_EQUAL(deep_basic.sink().str, deep_base.str);
+    }
+
+    loon::writer::basic<string_sink> w;
+    w.loon_arry_begin();
+    w.loon_dec_u32(4294967295u);
+    w.loon_dec_s32(-2147483647 - 1);
+    w.loon_hex_u32(0xABCDEF);
+    w.loon_dict_begin();
+    w.loon_dict_key(loon::writer::key("k"));
+    w.loon_preformatted_value("1e9", 3);
+    w.loon_dict_end();
+    w.loon_arry_end();
+    TEST_EQUAL(w.sink().str, "(arry 4294967295 -2147483648 0x00ABCDEF (dict \"k\" 1e9))");
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// return everything in the given temporary file
+std::string file_contents(FILE * f)
+{
+    std::string s;
+    std::rewind(f);
+    char buf[4096];
+    for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0; )
+        s.append(buf, n);
+    return s;
+}
+
+// Test the ready-made writer sinks give the same text as a string.
+void test_writer_sinks()
+{
+    const var v(unserialise(
+        "(dict \"name\" \"loon\" \"list\" (arry 1 2.5 0x10 true false null)"
+        " \"long\" \"a string longer than the fd_sink buffer in the test below\")"));
+
+    std::string expected;
+    loon::writer::to<loon::writer::string_sink> s(expected);
+    write_var(v, s);
+    TEST_EQUAL(expected.substr(0, 5), "(dict");
+
+    std::string compact;
+    loon::writer::basic<loon::writer::string_sink> c((loon::writer::string_sink(compact)));
+    write_var(v, c);
+    TEST_EQUAL(&c.sink().str(), &compact);
+    std::string compact_base;
+    loon::writer::to<loon::writer::string_sink> cb(compact_base);
+    cb.set_pretty(false);
+    write_var(v, cb);
+    TEST_EQUAL(compact, compact_base);
+
+    {
+        FILE * f = std::tmpfile();
+        loon::writer::to<loon::writer::file_sink> w(f);
+        write_var(v, w);
+        w.sink().flush();
+        TEST_EQUAL(file_contents(f), expected);
+        std::fclose(f);
+    }
+
+    {
+        // a small buffer: the long string goes out with the buffer before it
+        FILE * f = std::tmpfile();
+        loon::writer::basic<loon::writer::fd_sink, loon::writer::pretty<> > w(loon::writer::fd_sink(fileno(f), 16));
+        write_var(v, w);
+        w.sink().flush();
+        TEST_EQUAL(file_contents(f), expected);
+        TEST_EQUAL(w.sink().syscalls() < 12, true);
+        w.sink().flush(); // (nothing to write)
+        TEST_EQUAL(w.sink().syscalls() < 12, true);
+        std::fclose(f);
+    }
+
+    {
+        // about 1 MB of small tokens in a few calls
+        FILE * f = std::tmpfile();
+        loon::writer::to<loon::writer::fd_sink> w(fileno(f));
+        w.set_pretty(false);
+        w.loon_arry_begin();
+        for (int i = 0; i < 100000; ++i)
+            w.loon_dec_s32(123456789);
+        w.loon_arry_end();
+        w.sink().flush();
+        const std::string text(file_contents(f));
+        TEST_EQUAL(text.size(), 1000006u);
+        TEST_EQUAL(text.substr(text.size() - 11), " 123456789)");
+        TEST_EQUAL(w.sink().syscalls() <= 16, true);
+        std::fclose(f);
+    }
+
+    {
+        // an fd_sink can't be copied, so its buffered text is written once
+        static_assert(!std::is_copy_constructible<loon::writer::fd_sink>::value, "fd_sink is copyable");
+        static_assert(!std::is_copy_assignable<loon::writer::fd_sink>::value, "fd_sink is copyable");
+        FILE * f = std::tmpfile();
+        {
+            loon::writer::fd_sink a(fileno(f));
+            a.write("(arry ", 6);
+            loon::writer::to<loon::writer::fd_sink> w(std::move(a));
+            w.loon_null();
+            loon::writer::fd_sink b(fileno(f));
+            b = std::move(w.sink());
+            b.write(")", 1);
+        } // (a, the to<>'s sink and b are all flushed here)
+        TEST_EQUAL(file_contents(f), "(arry null)");
+        std::fclose(f);
+    }
+
+    // a failed write throws
+    {
+        loon::writer::fd_sink bad(-1, 16);
+        bad.write("12345678", 8);
+        TEST_EXCEPTION(bad.flush(), std::system_error);
+        TEST_EXCEPTION(bad.write("a string too long to buffer", 27), std::system_error);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_writer_validation()
+{
+    // each call is one char: [ ] arry begin/end, { } dict begin/end, k key, v value
+    struct {
+        const char * calls;
+        int error;      // the error thrown by the last call, or 0 for none
+        bool complete;  // whether the output is then a complete Loon text
+    } tests[] = {
+        { "",                   0, false },
+        { "v",                  0, true },
+        { "[]",                 0, true },
+        { "{}",                 0, true },
+        { "[vv[v]{kv}]",        0, true },
+        { "{kvk[v{kvk[]}]}",    0, true },
+        { "[[[",                0, false },
+        { "{kv",                0, false },
+        { "vv",                 loon::writer::extra_top_level_value, true },
+        { "[]v",                loon::writer::extra_top_level_value, true },
+        { "{}[",                loon::writer::extra_top_level_value, true },
+        { "k",                  loon::writer::key_not_allowed, false },
+        { "[k",                 loon::writer::key_not_allowed, false },
+        { "{kk",                loon::writer::key_not_allowed, false },
+        { "{v",                 loon::writer::key_required, false },
+        { "{kvv",               loon::writer::key_required, false },
+        { "{[",                 loon::writer::key_required, false },
+        { "{k}",                loon::writer::missing_dict_value, false },
+        { "]",                  loon::writer::unbalanced_end, false },
+        { "[}",                 loon::writer::unbalanced_end, false },
+        { "{]",                 loon::writer::unbalanced_end, false },
+        { "[]]",                loon::writer::unbalanced_end, true },
+        { "{k[}",               loon::writer::unbalanced_end, false },
+    };
+
+    struct writer : public loon::writer::base {
+        std::string str;
+    private:
+        virtual void write(const char * utf8, size_t len) { str.append(utf8, len); }
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        writer w;
+        w.set_validation(true);
+        int error = 0;
+        std::string before_last;
+        try {
+            for (const char * p = tests[i].calls; *p; ++p) {
+                before_last = w.str;
+                switch (*p) {
+                case '[': w.loon_arry_begin(); break;
+                case ']': w.loon_arry_end(); break;
+                case '{': w.loon_dict_begin(); break;
+                case '}': w.loon_dict_end(); break;
+                case 'k': w.loon_dict_key("key"); break;
+                case 'v': w.loon_dec_u32(1); break;
+                }
+            }
+        }
+        catch (const loon::writer::exception & e) {
+            error = e.id();
+            TEST_EQUAL(w.str, before_last); // nothing was written by the bad call
+        }
+        TEST_EQUAL(error, tests[i].error);
+        TEST_EQUAL(w.complete(), tests[i].complete);
+        if (error != tests[i].error)
+            std::cout << "[writer validation of '" << tests[i].calls << "' gave error " << error << "]\n";
+    }
+
+    // deep nesting, past the 64 lists held in one word of the stack
+    writer deep;
+    deep.set_validation(true);
+    for (int i = 0; i < 200; ++i) {
+        if (i % 3 == 0)
+            deep.loon_arry_begin();
+        else {
+            deep.loon_dict_begin();
+            deep.loon_dict_key("k");
+        }
+    }
+    deep.loon_null();
+    for (int i = 199; i >= 0; --i) {
+        TEST_EXCEPTION(i % 3 == 0 ? deep.loon_dict_end() : deep.loon_arry_end(), loon::writer::exception);
+        if (i % 3 == 0)
+            deep.loon_arry_end();
+        else
+            deep.loon_dict_end();
+    }
+    TEST_EQUAL(deep.complete(), true);
+    TEST_EQUAL(unserialise(deep.str).type(), var::type_arry);
+
+    // validation is off by default, and after reset()
+    writer loose;
+    loose.loon_dict_key("key");
+    loose.loon_arry_end();
+    loose.set_validation(true);
+    loose.reset();
+    loose.loon_dict_key("key"); // (no exception)
+    TEST_EQUAL(loose.str.substr(0, 8), "\"key\"  )");
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Test loon::transcode() reformats Loon text without changing its meaning.
+void test_transcode()
+{
+    struct writer : public loon::writer::base {
+        std::string str;
+    private:
+        virtual void write(const char * utf8, size_t len)
+        {
+            str.append(utf8, len);
+        }
+    };
+
+    const std::string pretty_text =
+        "; a comment\n"
+        "(dict\n"
+        "    \"a\\u0041\"  (arry 1 +2 0x1f .5 1e9 true false null)\n"
+        "    \"b\"  \"tab\\tslash\\/\"\n"
+        "    \"c\"  (dict))";
+
+    // pretty to compact, raw strings and numbers are copied unchanged
+    {
+        std::istringstream in(pretty_text);
+        loon::writer::basic<string_sink, loon::writer::compact> out;
+        loon::transcode_options options;
+        options.chunk_size = 7;
+        loon::transcode(in, out, options);
+        TEST_EQUAL(out.sink().str,
+            "(dict \"a\\u0041\" (arry 1 +2 0x1f .5 1e9 true false null)"
+            " \"b\" \"tab\\tslash\\/\" \"c\" (dict))");
+    }
+
+    // with raw strings off the strings are normalised by the writer
+    {
+        std::istringstream in(pretty_text);
+        loon::writer::basic<string_sink, loon::writer::compact> out;
+        loon::transcode_options options;
+        options.raw_strings = false;
+        loon::transcode(in, out, options);
+        TEST_EQUAL(out.sink().str,
+            "(dict \"aA\" (arry 1 +2 0x1f .5 1e9 true false null)"
+            " \"b\" \"tab\\tslash/\" \"c\" (dict))");
+    }
+
+    // compact to pretty gives the same text as writing the document directly
+    {
+        const char * const texts[] = {
+            "(arry (dict \"a\" (dict \"b\" (dict \"c\" (arry 1 2 3)))) (arry) (dict \"\" \"\"))",
+            "(dict \"k\" (arry) \"l\" (dict) \"m\" (arry (dict \"x\" 1) (arry 2 (arry 3))))",
+            "\"just a string\"",
+            0
+        };
+        for (const char * const * t = texts; *t; ++t) {
+            writer expected;
+            write_var(unserialise(*t), expected);
+
+            writer out;
+            loon::transcoder<loon::writer::base> tc(out);
+            tc.process_chunk(*t, strlen(*t), /*is_last_chunk=*/true);
+            TEST_EQUAL(out.str, expected.str);
+        }
+    }
+
+    // bad escapes are still detected in raw strings
+    {
+        std::istringstream in("(arry \"\\q\")");
+        loon::writer::basic<string_sink> out;
+        bool got_exception = false;
+        try {
+            loon::transcode(in, out);
+        }
+        catch (const loon::reader::exception & e) {
+            got_exception = true;
+            TEST_EQUAL(e.id(), loon::reader::string_escape_unknown);
+        }
+        TEST_EQUAL(got_exception, true);
+    }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Test conversion between JSON and Loon (see loon_json.h).
+void test_json()
+{
+    struct json_writer : public loon::json::writer {
+        std::string str;
+    private:
+        virtual void write(const char * utf8, size_t len)
+        {
+            str.append(utf8, len);
+        }
+    };
+
+    struct {
+        // return the given 'loon' text as JSON
+        std::string to_json(const std::string & loon) const
+        {
+            json_writer out;
+            std::istringstream in(loon);
+            loon::json::convert_from_loon(in, out, 3);
+            return out.str;
+        }
+
+        // return the given 'json' text as compact Loon
+        std::string to_loon(const std::string & json) const
+        {
+            loon::writer::basic<string_sink> out;
+            std::istringstream in(json);
+            loon::json::convert_to_loon(in, out, 3);
+            return out.sink().str;
+        }
+    } convert;
+
+    TEST_EQUAL(convert.to_json("(arry)"), "[]");
+    TEST_EQUAL(convert.to_json("(dict)"), "{}");
+    TEST_EQUAL(convert.to_json("(arry 1 +2 -3 007 0x1F 0xFFFFFFFFFFFFFFFFFF .5 -.5 1. 1.e5 2E-3 true false null)"),
+        "[1,2,-3,7,31,4722366482869645213695,0.5,-0.5,1.0,1.0e5,2E-3,true,false,null]");
+    TEST_EQUAL(convert.to_json("(dict \"a\\u0041\\n\" (arry (dict) \"x\") \"b\" (dict \"c\" \"d\"))"),
+        "{\"a\\u0041\\n\":[{},\"x\"],\"b\":{\"c\":\"d\"}}");
+
+    TEST_EQUAL(convert.to_loon("[]"), "(arry)");
+    TEST_EQUAL(convert.to_loon(" { } "), "(dict)");
+    TEST_EQUAL(convert.to_loon("[1,-0,2.5e+3,true,false,null,\"s\\/\\u00e9\"]"),
+        "(arry 1 -0 2.5e+3 true false null \"s\\/\\u00e9\")");
+    TEST_EQUAL(convert.to_loon("{\"k\":[{\"a\":1},[]],\r\n\"del\x7F\":\"\"}"),
+        "(dict \"k\" (arry (dict \"a\" 1) (arry)) \"del\\u007F\" \"\")");
+    TEST_EQUAL(convert.to_loon("0"), "0");
+
+    // JSON -> Loon -> JSON is lossless for normalised JSON
+    const char json[] = "{\"list\":[{\"i_d\":2880293630,\"ratio\":3.14159,\"name\":\"Hello, World!\"}],\"ok\":true}";
+    TEST_EQUAL(convert.to_json(convert.to_loon(json)), json);
+
+    // the JSON writer API
+    json_writer w;
+    w.loon_dict_begin();
+    w.loon_dict_key("a\"b");
+    w.loon_arry_begin();
+    w.loon_dec_s32(-1);
+    w.loon_hex_u32(0xFF);
+    w.loon_double(0.5);
+    w.loon_string("tab\t");
+    w.loon_arry_end();
+    w.loon_dict_key("n");
+    w.loon_null();
+    w.loon_dict_end();
+    TEST_EQUAL(w.str, "{\"a\\\"b\":[-1,255,0.5,\"tab\\t\"],\"n\":null}");
+
+    // a JSON text holds one value; a Loon text may hold more
+    TEST_EXCEPTION(w.loon_null(), loon::writer::exception);
+    w.reset();
+    w.str.clear();
+    w.loon_dec_s32(1);
+    TEST_EXCEPTION(w.loon_arry_begin(), loon::writer::exception);
+    TEST_EQUAL(w.str, "1");
+    TEST_EXCEPTION(convert.to_json("1 2"), loon::writer::exception);
+    TEST_EXCEPTION(convert.to_json("(arry) (dict)"), loon::writer::exception);
+    TEST_EQUAL(convert.to_json("; comment\n(arry (arry) 1) ; comment"), "[[],1]");
+
+    // malformed JSON
+    const char * const bad[] = {
+        "", "[", "]", "[1,]", "[1 2]", "{\"a\" 1}", "{\"a\":}", "{1:2}", "[01]", "[1.]",
+        "[.5]", "[+1]", "[1e]", "[tru]", "[nul]", "\"unclosed", "[\"a\nb\"]", "1 2",
+        "{\"a\":1,}", "[1}", "{]", "[\"\\x\"]", 0
+    };
+    for (const char * const * t = bad; *t; ++t) {
+        bool got_exception = false;
+        try {
+            convert.to_loon(*t);
+        }
+        catch (const loon::reader::exception &) {
+            got_exception = true;
+        }
+        TEST_EQUAL(got_exception, true);
+        if (!got_exception)
+            std::cout << "[expected exception for JSON '" << *t << "']\n";
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_binary()
+{
+    struct binary_writer : public loon::binary::writer {
+        std::string str;
+    private:
+        virtual void write(const char * data, size_t len)
+        {
+            str.append(data, len);
+        }
+    };
+
+    struct {
+        // return the given 'loon' text as a binary Loon document
+        std::string to_binary(const std::string & loon) const
+        {
+            binary_writer out;
+            loon::binary::from_text in(out);
+            in.process_chunk(loon.data(), loon.size(), true);
+            return out.str;
+        }
+
+        // return the given binary Loon document as compact Loon text
+        std::string to_text(const std::string & bin) const
+        {
+            loon::writer::basic<string_sink> out;
+            loon::binary::to_text<loon::writer::basic<string_sink> > converter(out);
+            converter.process(loon::binary::document(bin.data(), bin.size()));
+            return out.sink().str;
+        }
+
+        // return the given 'loon' text as compact Loon text, via the text reader
+        std::string to_compact(const std::string & loon) const
+        {
+            loon::writer::basic<string_sink> out;
+            std::istringstream in(loon);
+            loon::transcode_options options;
+            options.raw_strings = false;
+            loon::transcode(in, out, options);
+            return out.sink().str;
+        }
+    } convert;
+
+    // text -> binary -> text gives the same result as text -> text
+    const char * const round_trip[] = {
+        "null", "true", "-1", "(arry)", "(dict)",
+        "(arry 0 -0 007 +3 -9223372036854775808 9223372036854775808 0x0 0x1f 0xABCDEF0123456789 "
+            "0x1ABCDEF0123456789 1.5 -.5e-3 true false null \"\" \"a\\u0041\\n\\t\")",
+        "(dict \"a\" (arry (dict) (dict \"a\" 1 \"b\" 2)) \"b\" (dict \"a\" \"again\") \"\" \"empty key\")",
+        "(arry (arry (arry (arry \"deep\"))) (arry))", 0
+    };
+    for (const char * const * t = round_trip; *t; ++t) {
+        const std::string expected(convert.to_compact(*t));
+        const std::string got(convert.to_text(convert.to_binary(*t)));
+        TEST_EQUAL(got, expected);
+        if (got != expected)
+            std::cout << "[binary round trip of '" << *t << "' gave '" << got << "']\n";
+    }
+
+    // a float is stored as a double when that doesn't change its text
+    TEST_EQUAL(convert.to_binary("1.5")[8], loon::binary::tag_f64);
+    TEST_EQUAL(convert.to_binary("1.50")[8], loon::binary::tag_number);
+    TEST_EQUAL(convert.to_binary("3.14159265")[8], loon::binary::tag_number);
+    TEST_EQUAL(convert.to_text(convert.to_binary("-2.5e-07")), "-2.5e-07");
+    const std::string quarter(convert.to_binary("0.25"));
+    TEST_EQUAL(loon::binary::document(quarter.data(), quarter.size()).root().as_double(), 0.25);
+
+    // a document holds one top-level value; the reader would accept more
+    TEST_EXCEPTION(convert.to_binary("1 2"), loon::writer::exception);
+
+    // the writer rejects calls that would not make a well formed document;
+    // each call is one char: [ ] arry begin/end, { } dict begin/end, k key, v value
+    const struct {
+        const char * calls;
+        int error; // the error thrown by the last call, or 0 for none
+    } misuse[] = {
+        { "[vv{kvkv}]",     0 },
+        { "vv",             loon::writer::extra_top_level_value },
+        { "[]{",            loon::writer::extra_top_level_value },
+        { "k",              loon::writer::key_not_allowed },
+        { "[k",             loon::writer::key_not_allowed },
+        { "{kk",            loon::writer::key_not_allowed },
+        { "{v",             loon::writer::key_required },
+        { "{kvv",           loon::writer::key_required }, // (the key is not reused)
+        { "{kv[",           loon::writer::key_required },
+        { "{k}",            loon::writer::missing_dict_value },
+        { "]",              loon::writer::unbalanced_end },
+        { "[}",             loon::writer::unbalanced_end },
+        { "{]",             loon::writer::unbalanced_end },
+    };
+    for (size_t i = 0; i < sizeof(misuse) / sizeof(misuse[0]); ++i) {
+        binary_writer m;
+        int error = 0;
+        std::string before_last;
+        try {
+            for (const char * p = misuse[i].calls; *p; ++p) {
+                before_last = m.str;
+                switch (*p) {
+                case '[': m.loon_arry_begin(); break;
+                case ']': m.loon_arry_end(); break;
+                case '{': m.loon_dict_begin(); break;
+                case '}': m.loon_dict_end(); break;
+                case 'k': m.loon_dict_key(std::string(1, static_cast<char>('a' + (p - misuse[i].calls)))); break;
+                case 'v': m.loon_dec_u32(1); break;
+                }
+            }
+        }
+        catch (const loon::writer::exception & e) {
+            error = e.id();
+            TEST_EQUAL(m.str, before_last); // nothing was written by the bad call
+        }
+        TEST_EQUAL(error, misuse[i].error);
+        if (error != misuse[i].error)
+            std::cout << "[binary writer misuse '" << misuse[i].calls << "' gave error " << error << "]\n";
+        if (error == 0)
+            TEST_EQUAL(convert.to_text(m.str), "(arry 1 1 (dict \"e\" 1 \"g\" 1))");
+    }
+
+    // the writer API, and navigating the document without reading it
+    binary_writer w;
+    w.loon_dict_begin();
+    w.loon_dict_key("name");
+    w.loon_string("Loon");
+    w.loon_dict_key("list");
+    w.loon_arry_begin();
+    w.loon_dec_s32(-7);
+    w.loon_dec_u32(4000000000u);
+    w.loon_hex_u32(0xBEEF);
+    w.loon_double(2.5);
+    w.loon_bool(true);
+    w.loon_null();
+    w.loon_arry_end();
+    w.loon_dict_key("name");
+    w.loon_string(std::string("a\0b", 3));
+    w.loon_dict_end();
+
+    const loon::binary::document doc(w.str.data(), w.str.size());
+    TEST_EQUAL(doc.num_keys(), 2);
+    const loon::binary::value root(doc.root());
+    TEST_EQUAL(root.type(), loon::binary::value::type_dict);
+    TEST_EQUAL(root.size(), 3);
+    const char * utf8;
+    size_t len;
+    root.key(2, utf8, len);
+    TEST_EQUAL(std::string(utf8, len), "name");
+    TEST_EQUAL(root.at(2).as_string(), std::string("a\0b", 3));
+    loon::binary::value list(root);
+    TEST_EQUAL(root.find("list", list), true);
+    TEST_EQUAL(root.find("nope", list), false);
+    TEST_EQUAL(list.type(), loon::binary::value::type_arry);
+    TEST_EQUAL(list.size(), 6);
+    TEST_EQUAL(list.at(0).as_double(), -7.0);
+    TEST_EQUAL(list.at(1).as_double(), 4000000000.0);
+    loon::reader::num_type ntype;
+    TEST_EQUAL(list.at(2).number_text(ntype), "0x0000BEEF");
+    TEST_EQUAL(ntype, loon::reader::num_hex_int);
+    TEST_EQUAL(list.at(3).as_double(), 2.5);
+    TEST_EQUAL(list.at(4).as_bool(), true);
+    TEST_EQUAL(list.at(5).type(), loon::binary::value::type_null);
+    TEST_EXCEPTION(list.at(6), loon::reader::exception);
+    TEST_EXCEPTION(list.at(0).as_string(), loon::reader::exception);
+    TEST_EQUAL(convert.to_text(w.str),
+        "(dict \"name\" \"Loon\" \"list\" (arry -7 4000000000 0x0000BEEF 2.5 true null) \"name\" \"a\\u0000b\")");
+
+    // a malformed document throws bad_binary, and never reads outside the data
+    for (size_t n = 0; n < w.str.size(); ++n) {
+        const std::string truncated(w.str.substr(0, n));
+        TEST_EXCEPTION(convert.to_text(truncated), loon::reader::exception);
+    }
+    for (size_t i = 8; i < w.str.size() - 8; ++i) {
+        std::string corrupt(w.str);
+        corrupt[i] = static_cast<char>(corrupt[i] ^ 0xA5);
+        try {
+            convert.to_text(corrupt); // (may or may not be detected)
+        }
+        catch (const loon::reader::exception & e) {
+            TEST_EQUAL(e.id(), loon::reader::bad_binary);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// the top-level list of a var, as loon::write_parallel() requires
+struct var_list {
+    std::vector<std::string> keys;  // empty for an arry
+    std::vector<var> values;
+    bool dict;
+    size_t throw_at;                // throw when writing this element
+
+    explicit var_list(const var & v)
+    : dict(v.type() == var::type_dict), throw_at(size_t(-1))
+    {
+        if (dict) {
+            const var::dict_t d(v.as_dict_t());
+            for (var::dict_t::const_iterator i = d.begin(); i != d.end(); ++i) {
+                keys.push_back(i->first);
+                values.push_back(i->second);
+            }
+        }
+        else
+            values = v.as_arry_t();
+    }
+
+    bool is_dict() const { return dict; }
+    size_t size() const { return values.size(); }
+
+    template <typename Writer>
+    void write(size_t i, Writer & w) const
+    {
+        if (i == throw_at)
+            throw std::runtime_error("write failed");
+        if (dict)
+            w.loon_dict_key(keys[i]);
+        write_var(values[i], w);
+    }
+};
+
+// return the Loon text of 'v' written in one piece by loon::writer::basic
+template <typename Style>
+std::string serial_text(const var & v)
+{
+    loon::writer::basic<string_sink, Style> w;
+    write_var(v, w);
+    return w.sink().str;
+}
+
+void test_write_parallel()
+{
+    // an arry of a few thousand varied elements, and a dict of them
+    var big(var::make_arry());
+    var big_dict(var::make_dict());
+    for (int i = 0; i < 3000; ++i) {
+        var element(var::make_arry());
+        switch (i % 5) {
+        case 0: element = var(i); break;
+        case 1: element = var("string " + std::to_string(i)); break;
+        case 2: break;
+        case 3: element = var::make_dict(); element["n"] = var(i); element["list"] = var::make_arry(); break;
+        default:
+            for (int j = 0; j < i % 7; ++j)
+                element.push_back(var(j * 0.5));
+            break;
+        }
+        big.push_back(element);
+        big_dict["key " + std::to_string(i)] = element;
+    }
+
+    var one(var::make_arry());
+    one.push_back(var("only"));
+    const var docs[] = { big, big_dict, var::make_arry(), var::make_dict(), one, big_dict["key 3"] };
+    typedef loon::writer::pretty<2, loon::writer::crlf> crlf_style;
+    const unsigned threads[] = { 0, 1, 2, 3, 8 };
+    for (size_t d = 0; d < sizeof(docs) / sizeof(docs[0]); ++d) {
+        const var_list list(docs[d]);
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+            string_sink compact, pretty, crlf;
+            loon::write_parallel(list, compact, threads[t]);
+            loon::write_parallel<loon::writer::pretty<> >(list, pretty, threads[t]);
+            loon::write_parallel<crlf_style>(list, crlf, threads[t]);
+            TEST_EQUAL(compact.str, serial_text<loon::writer::compact>(docs[d]));
+            TEST_EQUAL(pretty.str, serial_text<loon::writer::pretty<> >(docs[d]));
+            TEST_EQUAL(crlf.str, serial_text<crlf_style>(docs[d]));
+        }
+    }
+
+    // a binary document
+    {
+        struct binary_writer : public loon::binary::writer {
+            std::string str;
+        private:
+            virtual void write(const char * data, size_t len) { str.append(data, len); }
+        };
+        const std::string texts[] = { serial_text<loon::writer::compact>(big_dict), "-12.5" };
+        for (size_t i = 0; i < 2; ++i) {
+            binary_writer bin;
+            loon::binary::from_text in(bin);
+            in.process_chunk(texts[i].data(), texts[i].size(), true);
+            const loon::binary::document doc(bin.str.data(), bin.str.size());
+
+            string_sink expected, got;
+            loon::writer::basic<string_sink, loon::writer::pretty<> > w;
+            loon::binary::to_text<loon::writer::basic<string_sink, loon::writer::pretty<> > >(w).process(doc);
+            loon::write_parallel<loon::writer::pretty<> >(doc, got, 4);
+            TEST_EQUAL(got.str, w.sink().str);
+        }
+    }
+
+    // an exception thrown while formatting an element reaches the caller
+    var_list failing(big);
+    failing.throw_at = 2500;
+    string_sink out;
+    TEST_EXCEPTION(loon::write_parallel(failing, out, 4), std::runtime_error);
+    TEST_EXCEPTION(loon::write_parallel(failing, out, 1), std::runtime_error);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_canonical()
+{
+    // the streaming hash, against MurmurHash3 x64-128 reference values
+    {
+        const std::string fox("The quick brown fox jumps over the lazy dog");
+        std::string bytes;
+        for (int i = 0; i < 40; ++i)
+            bytes += static_cast<char>(i);
+        const struct {
+            std::string data;
+            uint64_t lo, hi;
+        } tests[] = {
+            { "",       0, 0 },
+            { "a",      0x85555565f6597889ULL, 0xe6b53a48510e895aULL },
+            { fox,      0xe34bbc7bbc071b6cULL, 0x7a433ca9c49a9347ULL },
+            { bytes,    0xc3a054d8418c8064ULL, 0xa001ca30974c12adULL },
+        };
+        for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+            loon::canonical::hash128 whole;
+            whole.update(tests[i].data.data(), tests[i].data.size());
+            TEST_EQUAL(whole.result().lo, tests[i].lo);
+            TEST_EQUAL(whole.result().hi, tests[i].hi);
+            for (size_t step = 1; step < 20; step += 6) {
+                loon::canonical::hash128 pieces;
+                for (size_t at = 0; at < tests[i].data.size(); at += step)
+                    pieces.update(tests[i].data.data() + at, std::min(step, tests[i].data.size() - at));
+                TEST_EQUAL(pieces.result() == whole.result(), true);
+            }
+        }
+    }
+
+    // numbers
+    {
+        const struct {
+            const char * text;
+            loon::reader::num_type ntype;
+            const char * expected;
+        } tests[] = {
+            { "0",          loon::reader::num_dec_int,  "0" },
+            { "-0",         loon::reader::num_dec_int,  "0" },
+            { "+007",       loon::reader::num_dec_int,  "7" },
+            { "-1200",      loon::reader::num_dec_int,  "-1200" },
+            { "0x1F",       loon::reader::num_hex_int,  "31" },
+            { "0x000",      loon::reader::num_hex_int,  "0" },
+            { "0xFFFFFFFFFFFFFFFF", loon::reader::num_hex_int, "18446744073709551615" },
+            { "0xFFFFFFFFFFFFFFFFFF", loon::reader::num_hex_int, "4.722366482869645213695e21" },
+            { "123456789012345678901234", loon::reader::num_dec_int, "1.23456789012345678901234e23" },
+            { "3.1e1",      loon::reader::num_float,    "31" },
+            { "1.0",        loon::reader::num_float,    "1" },
+            { "-.50",       loon::reader::num_float,    "-0.5" },
+            { "-5e-1",      loon::reader::num_float,    "-0.5" },
+            { "0.0e5",      loon::reader::num_float,    "0" },
+            { "12.5e-10",   loon::reader::num_float,    "1.25e-9" },
+            { "0.000001",   loon::reader::num_float,    "0.000001" },
+            { "1e-7",       loon::reader::num_float,    "1e-7" },
+            { "1e20",       loon::reader::num_float,    "100000000000000000000" },
+            { "1E+21",      loon::reader::num_float,    "1e21" },
+            { "314.159E-2", loon::reader::num_float,    "3.14159" },
+        };
+        for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+            const std::string got(loon::canonical::number(tests[i].text, std::strlen(tests[i].text), tests[i].ntype));
+            TEST_EQUAL(got, tests[i].expected);
+            if (got != tests[i].expected)
+                std::cout << "[canonical number of '" << tests[i].text << "' gave '" << got << "']\n";
+        }
+    }
+
+    struct local {
+        static std::string text(const std::string & loon)
+        {
+            return loon::canonical::canonical_text(loon.data(), loon.size());
+        }
+        static loon::canonical::digest hash(const std::string & loon)
+        {
+            return loon::canonical::hash_text(loon.data(), loon.size());
+        }
+    };
+
+    // texts with the same meaning have the same canonical text and hash
+    const char * const same[] = {
+        "(dict \"b\" (arry 1 2.0 0x3) \"a\" (dict \"y\" null \"x\" \"\\u0041\") \"c\" true)",
+        "; a comment\n(dict\n    \"a\" (dict \"x\" \"A\" \"y\" null)\n    \"c\" true\n    \"b\" (arry +1 2 3e0)\n)\n",
+        "(dict \"c\" true \"b\" (arry 1. 20e-1 0x0003) \"a\" (dict \"x\" \"\\u0041\" \"y\" null))",
+        0
+    };
+    const std::string expected("(dict \"a\" (dict \"x\" \"A\" \"y\" null) \"b\" (arry 1 2 3) \"c\" true)");
+    for (const char * const * t = same; *t; ++t) {
+        TEST_EQUAL(local::text(*t), expected);
+        TEST_EQUAL(local::hash(*t) == local::hash(expected), true);
+    }
+
+    const struct {
+        const char * text;
+        const char * expected;
+    } tests[] = {
+        { "  -0.0  ",                           "0" },
+        { "\"a\\tb\"",                          "\"a\\tb\"" },
+        { "(arry)",                             "(arry)" },
+        { "(arry 1E+21 12.5e-10 0x1F 1e-7)",    "(arry 1e21 1.25e-9 31 1e-7)" },
+        { "(dict)",                             "(dict)" },
+        { "(dict \"k\" 2 \"a\" 0 \"k\" 1)",     "(dict \"a\" 0 \"k\" 2 \"k\" 1)" },
+        { "(arry (dict) (dict \"z\" (arry (dict \"b\" 1 \"a\" 2))) 5)",
+                                                "(arry (dict) (dict \"z\" (arry (dict \"a\" 2 \"b\" 1))) 5)" },
+        { "(dict \"b\" (dict \"d\" 1 \"c\" (dict \"f\" 0 \"e\" 0)) \"a\" (arry))",
+                                                "(dict \"a\" (arry) \"b\" (dict \"c\" (dict \"e\" 0 \"f\" 0) \"d\" 1))" },
+    };
+    std::vector<loon::canonical::digest> hashes;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        const std::string got(local::text(tests[i].text));
+        TEST_EQUAL(got, tests[i].expected);
+        TEST_EQUAL(local::text(got), got); // (the canonical text is canonical)
+        TEST_EQUAL(local::hash(got) == local::hash(tests[i].text), true);
+        hashes.push_back(local::hash(tests[i].text));
+    }
+
+    // texts with different meanings have different hashes
+    const char * const different[] = {
+        "(arry 1 2)", "(arry 12)", "(arry \"1\" 2)", "(arry 2 1)", "(arry (arry 1) 2)", "(arry (arry 1 2))",
+        "(dict \"ab\" \"c\")", "(dict \"a\" \"bc\")", "(dict \"a\" (arry))", "(dict \"a\" (dict))",
+        "(dict \"k\" 1 \"k\" 2)", "(dict \"k\" 2 \"k\" 1)", "null", "true", "false", "\"\"", "1", "-1", 0
+    };
+    for (const char * const * t = different; *t; ++t)
+        hashes.push_back(local::hash(*t));
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        for (size_t j = i + 1; j < hashes.size(); ++j)
+            TEST_EQUAL(hashes[i] != hashes[j], true);
+    }
+
+    // a hasher or writer may be reused after reset()
+    loon::canonical::hasher h;
+    loon::canonical::from_text<loon::canonical::hasher> in(h);
+    in.process_chunk("(dict \"a\" (arry", 15, false);
+    h.reset();
+    in.reset();
+    in.process_chunk("(arry 1 2)", 10, true);
+    TEST_EQUAL(h.result() == local::hash("(arry 1 2)"), true);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_diff()
+{
+    struct local {
+        // check patch() turns 'a' into 'b' with the delta from diff(); return the delta
+        static std::string round_trip(const std::string & a, const std::string & b)
+        {
+            const std::string delta(loon::diff(a, b));
+            const std::string patched(loon::patch(a, delta));
+            const std::string expected(loon::canonical::canonical_text(b.data(), b.size()));
+            TEST_EQUAL(loon::canonical::canonical_text(patched.data(), patched.size()), expected);
+            if (loon::canonical::canonical_text(patched.data(), patched.size()) != expected)
+                std::cout << "[patch(" << a << ", " << delta << ") gave " << patched << "]\n";
+            return delta;
+        }
+    };
+
+    const struct {
+        const char * a;
+        const char * b;
+        const char * delta;
+    } tests[] = {
+        { "1", "1", "(arry)" },
+        { "(dict \"a\" 1 \"b\" (arry 2.0))", "; same\n(dict \"b\" (arry 2) \"a\" 0x1)", "(arry)" },
+        { "1", "\"one\"", "(arry (dict \"op\" \"set\" \"path\" (arry) \"value\" \"one\"))" },
+        { "(dict \"a\" 1 \"b\" 2)", "(dict \"a\" 1 \"b\" 3 \"c\" 4)",
+            "(arry (dict \"op\" \"set\" \"path\" (arry \"b\") \"value\" 3) (dict \"op\" \"set\" \"path\" (arry \"c\") \"value\" 4))" },
+        { "(dict \"a\" 1 \"b\" 2)", "(dict \"b\" 2)", "(arry (dict \"op\" \"remove\" \"path\" (arry \"a\")))" },
+        { "(arry 1 2 3)", "(arry 1 9 2 3)", "(arry (dict \"op\" \"insert\" \"path\" (arry 1) \"value\" 9))" },
+        { "(arry 1 2 3 4)", "(arry 1 4)",
+            "(arry (dict \"op\" \"remove\" \"path\" (arry 2)) (dict \"op\" \"remove\" \"path\" (arry 1)))" },
+        { "(arry 1 2 3)", "(arry 1 7 3)", "(arry (dict \"op\" \"set\" \"path\" (arry 1) \"value\" 7))" },
+        { "(dict \"s\" (arry (dict \"port\" 80 \"host\" \"a\") (dict \"port\" 81 \"host\" \"b\")))",
+          "(dict \"s\" (arry (dict \"port\" 80 \"host\" \"a\") (dict \"port\" 8081 \"host\" \"b\")))",
+            "(arry (dict \"op\" \"set\" \"path\" (arry \"s\" 1 \"port\") \"value\" 8081))" },
+        { "(dict \"k\" 1 \"k\" 2)", "(dict \"k\" 1 \"k\" 3)",
+            "(arry (dict \"op\" \"set\" \"path\" (arry) \"value\" (dict \"k\" 1 \"k\" 3)))" },
+        { "(dict \"a\" (arry))", "(dict \"a\" (dict))",
+            "(arry (dict \"op\" \"set\" \"path\" (arry \"a\") \"value\" (dict)))" },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        const std::string delta(local::round_trip(tests[i].a, tests[i].b));
+        TEST_EQUAL(delta, tests[i].delta);
+    }
+
+    // more changes, checked only by patching
+    const char * const pairs[] = {
+        "(arry)", "(arry 1 2 3)",
+        "(arry 1 2 3)", "(arry)",
+        "(arry 1 2 3)", "(arry 0 1 2 3 4)",
+        "(arry 1 2 3 4 5 6)", "(arry 6 5 4 3 2 1)",
+        "(arry (arry 1 2) (arry 3 4) 5)", "(arry (arry 1) (arry 9 3 4 4) 5 6)",
+        "(dict \"a\" (dict \"b\" (dict \"c\" (arry 1 2))))", "(dict \"a\" (dict \"b\" (dict \"c\" (arry 1 2 3) \"d\" null)) \"e\" true)",
+        "(dict \"x\" (arry (dict \"y\" 1) (dict \"y\" 2)))", "(dict \"x\" (arry (dict \"z\" 1) (dict \"y\" 2 \"w\" false)))",
+        "(dict \"\" \"empty\" \"a\\\"b\" \"quote\")", "(dict \"\" \"full\" \"a\\\"b\" \"quote\" \"tab\\t\" 1)",
+        0
+    };
+    for (const char * const * p = pairs; *p; p += 2)
+        local::round_trip(p[0], p[1]);
+
+    // a small change to a large value gives a small delta
+    std::string big_a("(dict"), big_b("(dict");
+    for (int i = 0; i < 2000; ++i) {
+        const std::string entry(" \"key" + std::to_string(i) + "\" (arry " + std::to_string(i) + " \"value\" (dict \"n\" 1))");
+        big_a += entry;
+        big_b += i == 1234 ? " \"key1234\" (arry 1234 \"value\" (dict \"n\" 2))" : entry;
+    }
+    big_a += ")";
+    big_b += ")";
+    TEST_EQUAL(local::round_trip(big_a, big_b),
+        "(arry (dict \"op\" \"set\" \"path\" (arry \"key1234\" 2 \"n\") \"value\" 2))");
+
+    // bad documents and deltas
+    TEST_EXCEPTION(loon::diff("", "1"), loon::reader::exception);
+    TEST_EXCEPTION(loon::diff("1 2", "1"), loon::reader::exception);
+    TEST_EXCEPTION(loon::diff("(arry", "1"), loon::reader::exception);
+    const char * const bad_deltas[] = {
+        "",
+        "1",
+        "(arry 1)",
+        "(arry (dict \"op\" \"set\"))",
+        "(arry (dict \"op\" \"set\" \"path\" (arry)))",
+        "(arry (dict \"op\" \"move\" \"path\" (arry \"a\")))",
+        "(arry (dict \"op\" \"remove\" \"path\" (arry)))",
+        "(arry (dict \"op\" \"remove\" \"path\" (arry \"nokey\")))",
+        "(arry (dict \"op\" \"remove\" \"path\" (arry \"a\" 2)))",
+        "(arry (dict \"op\" \"remove\" \"path\" (arry \"a\" -1)))",
+        "(arry (dict \"op\" \"remove\" \"path\" (arry \"a\" 0 0)))",
+        "(arry (dict \"op\" \"insert\" \"path\" (arry \"a\" 3) \"value\" 1))",
+        "(arry (dict \"op\" \"insert\" \"path\" (arry \"b\") \"value\" 1))",
+        "(arry (dict \"op\" \"set\" \"path\" (arry 0) \"value\" 1))",
+        "(arry (dict \"op\" \"set\" \"path\" (arry \"no\" \"such\") \"value\" 1))",
+        0
+    };
+    for (const char * const * d = bad_deltas; *d; ++d) {
+        bool thrown = false;
+        try {
+            loon::patch("(dict \"a\" (arry 1 2) \"b\" 3)", *d);
+        }
+        catch (const loon::reader::exception & e) {
+            thrown = true;
+            TEST_EQUAL(e.id(), loon::reader::bad_diff);
+        }
+        TEST_EQUAL(thrown, true);
+        if (!thrown)
+            std::cout << "[patch with bad delta '" << *d << "' didn't throw]\n";
+    }
+    TEST_EQUAL(loon::patch("(dict \"a\" (arry 1 2) \"b\" 3)",
+        "(arry (dict \"op\" \"insert\" \"path\" (arry \"a\" 2) \"value\" 3) (dict \"op\" \"remove\" \"path\" (arry \"b\")))"),
+        "(dict \"a\" (arry 1 2 3))");
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_persistent()
+{
+    typedef loon::persistent::value value;
+    typedef loon::persistent::path path;
+
+    struct local {
+        static std::string text(const value & v)
+        {
+            loon::writer::basic<string_sink> out;
+            loon::persistent::write(v, out);
+            return out.sink().str;
+        }
+        static path make_path(const char * a, const char * b = 0, const char * c = 0)
+        {
+            path p(1, a);
+            if (b)
+                p.push_back(b);
+            if (c)
+                p.push_back(c);
+            return p;
+        }
+    };
+
+    const std::string original(
+        "(dict \"name\" \"loon\" \"servers\" (arry (dict \"host\" \"a\" \"port\" 80) (dict \"host\" \"b\" \"port\" 81))"
+        " \"limits\" (dict \"cpu\" 2 \"mem\" 0x400) \"flags\" (arry true false null))");
+    const value v1(loon::persistent::read(original));
+    TEST_EQUAL(local::text(v1), original);
+    TEST_EQUAL(v1.type(), value::type_dict);
+    TEST_EQUAL(v1.size(), 4u);
+    TEST_EQUAL(v1.key(1), "servers");
+    TEST_EQUAL(v1.at(0).as_string(), "loon");
+    loon::reader::num_type ntype;
+    TEST_EQUAL(v1.at(2).at(1).number_text(ntype), "0x400");
+    TEST_EQUAL(ntype, loon::reader::num_hex_int);
+    TEST_EQUAL(v1.at(3).at(0).as_bool(), true);
+    TEST_EQUAL(v1.at(3).at(2).type(), value::type_null);
+    TEST_EXCEPTION(v1.at(4), std::out_of_range);
+    TEST_EXCEPTION(v1.as_string(), std::invalid_argument);
+    value found;
+    TEST_EQUAL(v1.find(local::make_path("servers", "1", "port"), found), true);
+    TEST_EQUAL(found.number_text(ntype), "81");
+    TEST_EQUAL(v1.find(local::make_path("servers", "2"), found), false);
+    TEST_EQUAL(v1.find(local::make_path("name", "x"), found), false);
+    TEST_EQUAL(v1.find(path(), found), true);
+    TEST_EQUAL(found.shares(v1), true);
+
+    // a change copies the path to it and shares everything else
+    const value v2(v1.set(local::make_path("servers", "1", "port"), value::make_number("8081", loon::reader::num_dec_int)));
+    TEST_EQUAL(local::text(v1), original);
+    TEST_EQUAL(local::text(v2),
+        "(dict \"name\" \"loon\" \"servers\" (arry (dict \"host\" \"a\" \"port\" 80) (dict \"host\" \"b\" \"port\" 8081))"
+        " \"limits\" (dict \"cpu\" 2 \"mem\" 0x400) \"flags\" (arry true false null))");
+    TEST_EQUAL(v2.shares(v1), false);
+    TEST_EQUAL(v2.at(0).shares(v1.at(0)), true);
+    TEST_EQUAL(v2.at(1).shares(v1.at(1)), false);
+    TEST_EQUAL(v2.at(1).at(0).shares(v1.at(1).at(0)), true);
+    TEST_EQUAL(v2.at(1).at(1).at(0).shares(v1.at(1).at(1).at(0)), true);
+    TEST_EQUAL(v2.at(2).shares(v1.at(2)), true);
+    TEST_EQUAL(v2.at(3).shares(v1.at(3)), true);
+
+    // adding, inserting and erasing
+    const value v3(v2.set(local::make_path("limits", "disk"), value::make_string("10G"))
+        .insert(local::make_path("flags", "0"), value::make_bool(false))
+        .insert(local::make_path("flags", "4"), value())
+        .erase(local::make_path("name"))
+        .erase(local::make_path("servers", "0")));
+    TEST_EQUAL(local::text(v3),
+        "(dict \"servers\" (arry (dict \"host\" \"b\" \"port\" 8081))"
+        " \"limits\" (dict \"cpu\" 2 \"mem\" 0x400 \"disk\" \"10G\") \"flags\" (arry false true false null null))");
+    TEST_EQUAL(local::text(v1), original);
+    TEST_EQUAL(v3.at(0).at(0).shares(v2.at(1).at(1)), true);
+    TEST_EQUAL(local::text(v3.set(path(), value::make_string("all"))), "\"all\"");
+
+    // paths that lead to nothing
+    const value one(value::make_number("1", loon::reader::num_dec_int));
+    TEST_EXCEPTION(v1.set(local::make_path("servers", "2"), one), std::out_of_range);
+    TEST_EXCEPTION(v1.set(local::make_path("servers", "x"), one), std::out_of_range);
+    TEST_EXCEPTION(v1.set(local::make_path("nope", "x"), one), std::out_of_range);
+    TEST_EXCEPTION(v1.set(local::make_path("name", "x"), one), std::out_of_range);
+    TEST_EXCEPTION(v1.insert(local::make_path("flags", "4"), one), std::out_of_range);
+    TEST_EXCEPTION(v1.insert(local::make_path("limits", "cpu"), one), std::out_of_range);
+    TEST_EXCEPTION(v1.erase(local::make_path("limits", "gpu")), std::out_of_range);
+    TEST_EXCEPTION(v1.erase(path()), std::out_of_range);
+    TEST_EXCEPTION(loon::persistent::read("1 2"), std::invalid_argument);
+
+    // made directly
+    std::vector<std::pair<std::string, value> > entries;
+    entries.push_back(std::make_pair(std::string("list"), value::make_arry(std::vector<value>(2, one))));
+    entries.push_back(std::make_pair(std::string("text"), value::make_string("a\"b")));
+    const value made(value::make_dict(entries));
+    TEST_EQUAL(local::text(made), "(dict \"list\" (arry 1 1) \"text\" \"a\\\"b\")");
+    TEST_EQUAL(made.at(0).at(0).shares(made.at(0).at(1)), true);
+
+    // versions read by several threads while another makes more versions
+    std::vector<value> versions(1, v1);
+    std::vector<std::string> expected(1, local::text(v1));
+    for (int i = 1; i < 50; ++i) {
+        versions.push_back(versions.back().set(local::make_path("limits", "cpu"),
+            value::make_number(std::to_string(i), loon::reader::num_dec_int)));
+        expected.push_back(local::text(versions.back()));
+    }
+    std::vector<int> mismatches(4, 0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.push_back(std::thread([&versions, &expected, &mismatches, t]() {
+            for (int round = 0; round < 20; ++round) {
+                for (size_t i = 0; i < versions.size(); ++i) {
+                    const value copy(versions[i]);
+                    if (local::text(copy) != expected[i])
+                        ++mismatches[t];
+                }
+            }
+        }));
+    }
+    value latest(versions.back());
+    for (int i = 0; i < 1000; ++i)
+        latest = latest.set(local::make_path("flags", "1"), value::make_bool(i % 2 != 0));
+    for (size_t t = 0; t < readers.size(); ++t)
+        readers[t].join();
+    for (size_t t = 0; t < mismatches.size(); ++t)
+        TEST_EQUAL(mismatches[t], 0);
+    TEST_EQUAL(local::text(latest.at(3)), "(arry true true null)");
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_key_interning()
+{
+    // a person reader written the usual way: switch on the key id
+    class person_reader : public loon::reader::base {
+    public:
+        enum { name, age, tags, num_keys };
+        std::string log; // e.g. "name=Ann ?colour=red", or "#3=red" for an id not handled
+
+        person_reader() : key_(-1)
+        {
+            TEST_EQUAL(intern_key("name"), name);
+            TEST_EQUAL(intern_key(std::string("age")), age);
+            TEST_EQUAL(intern_key("tags", 4), tags);
+        }
+
+        using base::intern_key;
+        using base::clear_interned_keys;
+        using base::set_raw_strings;
+
+        void read(const std::string & text)
+        {
+            log.clear();
+            key_ = -1;
+            unknown_.clear();
+            reset();
+            process_chunk(text.data(), text.size(), true);
+        }
+
+    private:
+        int key_;               // the id of the current key, or -1 if it wasn't registered
+        std::string unknown_;   // the current key if it wasn't registered
+
+        virtual void loon_arry_begin() {}
+        virtual void loon_arry_end() {}
+        virtual void loon_dict_begin() {}
+        virtual void loon_dict_end() {}
+        virtual void loon_dict_key_id(int id) { key_ = id; }
+        virtual void loon_dict_key(const char * utf8, size_t len)
+        {
+            key_ = -1;
+            unknown_.assign(utf8, len);
+        }
+        virtual void loon_null() {}
+        virtual void loon_bool(bool) {}
+        virtual void loon_string(const char * utf8, size_t len) { value(std::string(utf8, len)); }
+        virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type)
+        {
+            value(std::string(utf8, len));
+        }
+
+        void value(const std::string & v)
+        {
+            if (!log.empty())
+                log += ' ';
+            switch (key_) {
+            case name:  log += "name=" + v; break;
+            case age:   log += "age=" + v; break;
+            case tags:  log += "tags=" + v; break;
+            default:
+                log += key_ < 0 ? '?' + unknown_ : '#' + to_string(key_);
+                log += '=' + v;
+                break;
+            }
+        }
+    };
+
+    person_reader r;
+    r.read("(dict \"name\" \"Ann\" \"colour\" \"red\" \"age\" 42 \"tags\" (arry \"x\" \"y\"))");
+    TEST_EQUAL(r.log, "name=Ann ?colour=red age=42 tags=x tags=y");
+
+    // registering a key again returns the id it already has
+    TEST_EQUAL(r.intern_key("age"), person_reader::age);
+    TEST_EQUAL(r.intern_key("colour"), person_reader::num_keys);
+    r.read("(dict \"colour\" \"red\" \"\" 1)");
+    TEST_EQUAL(r.log, "#3=red ?=1");
+
+    // keys are matched after escapes are replaced, unless raw strings are on
+    r.read("(dict \"n\\u0061me\" \"Bob\" \"na\" 1 \"names\" 2)");
+    TEST_EQUAL(r.log, "name=Bob ?na=1 ?names=2");
+    r.set_raw_strings(true);
+    r.read("(dict \"n\\u0061me\" \"Bob\")");
+    TEST_EQUAL(r.log, "?n\\u0061me=Bob");
+    r.set_raw_strings(false);
+
+    // strings that are not dict keys are never looked up
+    r.read("(arry \"name\" (dict \"age\" \"name\"))");
+    TEST_EQUAL(r.log, "?=name age=name");
+
+    // the registered keys survive reset() but not clear_interned_keys()
+    r.clear_interned_keys();
+    r.read("(dict \"name\" \"Ann\")");
+    TEST_EQUAL(r.log, "?name=Ann");
+    TEST_EQUAL(r.intern_key(""), 0);
+    r.read("(dict \"\" 1 \"name\" 2)");
+    TEST_EQUAL(r.log, "name=1 ?name=2");
+
+    // a reader that doesn't override loon_dict_key_id() still sees every key
+    struct key_list : public loon::reader::base {
+        std::string keys;
+        using base::intern_key;
+        virtual void loon_arry_begin() {}
+        virtual void loon_arry_end() {}
+        virtual void loon_dict_begin() {}
+        virtual void loon_dict_end() {}
+        virtual void loon_dict_key(const char * utf8, size_t len)
+        {
+            keys.append(utf8, len);
+            keys += ';';
+        }
+        virtual void loon_null() {}
+        virtual void loon_bool(bool) {}
+        virtual void loon_string(const char *, size_t) {}
+        virtual void loon_number(const char *, size_t, loon::reader::num_type) {}
+    };
+
+    // many keys, so that the table grows, all found again
+    key_list k;
+    std::string text("(dict");
+    std::string expected;
+    for (int i = 0; i < 1000; ++i) {
+        const std::string key("key" + to_string(i));
+        TEST_EQUAL(k.intern_key(key), i);
+        text += " \"" + key + "\" null";
+        expected += key + ';';
+    }
+    text += " \"key1000\" null)";
+    expected += "key1000;";
+    for (int i = 0; i < 1000; i += 97)
+        TEST_EQUAL(k.intern_key("key" + to_string(i)), i);
+    k.process_chunk(text.data(), text.size(), true);
+    TEST_EQUAL(k.keys, expected);
+
+    // and the ids are delivered, not the bytes
+    struct id_list : public key_list {
+        std::vector<int> ids;
+        virtual void loon_dict_key_id(int id) { ids.push_back(id); }
+    } ids;
+    for (int i = 0; i < 1000; ++i)
+        ids.intern_key("key" + to_string(i));
+    ids.process_chunk(text.data(), text.size(), true);
+    TEST_EQUAL(ids.ids.size(), 1000u);
+    for (int i = 0; i < 1000; i += 97)
+        TEST_EQUAL(ids.ids[i], i);
+    TEST_EQUAL(ids.keys, "key1000;");
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_index()
+{
+    // a reader that collects what it reads as compact Loon text
+    struct collector : public loon::reader::base {
+        loon::writer::basic<string_sink> out;
+    private:
+        virtual void loon_arry_begin() { out.loon_arry_begin(); }
+        virtual void loon_arry_end() { out.loon_arry_end(); }
+        virtual void loon_dict_begin() { out.loon_dict_begin(); }
+        virtual void loon_dict_end() { out.loon_dict_end(); }
+        virtual void loon_dict_key(const char * utf8, size_t len) { out.loon_dict_key(std::string(utf8, len)); }
+        virtual void loon_null() { out.loon_null(); }
+        virtual void loon_bool(bool value) { out.loon_bool(value); }
+        virtual void loon_string(const char * utf8, size_t len) { out.loon_string(std::string(utf8, len)); }
+        virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type)
+        {
+            out.loon_preformatted_value(utf8, len);
+        }
+    };
+
+    const std::string text(
+        "; header\n"
+        "(arry\n"
+        "    1 \"two\" (dict \"a\" (arry 3))\n"
+        "    true 0x5 ; comment\n"
+        "    6.0 null\"s\"-7)\n");
+    const char * const elements[] = {
+        "1", "\"two\"", "(dict \"a\" (arry 3))", "true", "0x5", "6.0", "null", "\"s\"", "-7"
+    };
+
+    std::istringstream in(text);
+    const loon::index::arry_index index(loon::index::build_index(in, 2, 3));
+    TEST_EQUAL(index.every, 2);
+    TEST_EQUAL(index.size, 9);
+    TEST_EQUAL(index.entries.size(), 6);
+    TEST_EQUAL(index.entries[0].line, 2);
+    TEST_EQUAL(index.entries[3].element, 6);
+    TEST_EQUAL(index.entries[3].line, 5);
+    TEST_EQUAL(index.entries[5].element, 9);
+    TEST_EQUAL(index.entry_for(0), 0);
+    TEST_EQUAL(index.entry_for(5), 2);
+    TEST_EQUAL(index.entry_for(100), 5);
+
+    // the index does not depend on how the text is chunked
+    for (size_t chunk_size = 1; chunk_size < 8; ++chunk_size) {
+        std::istringstream in(text);
+        const loon::index::arry_index i(loon::index::build_index(in, 2, chunk_size));
+        TEST_EQUAL(i.entries.size(), index.entries.size());
+        for (size_t j = 0; j < i.entries.size() && j < index.entries.size(); ++j) {
+            TEST_EQUAL(i.entries[j].offset, index.entries[j].offset);
+            TEST_EQUAL(i.entries[j].line, index.entries[j].line);
+        }
+    }
+
+    // every slice reads exactly the elements it covers
+    for (size_t first = 0; first < index.entries.size(); ++first) {
+        for (size_t last = first; last < index.entries.size(); ++last) {
+            std::string expected;
+            for (uint64_t e = index.entries[first].element; e < index.entries[last].element; ++e)
+                expected += std::string(expected.empty() ? "" : " ") + elements[e];
+            collector c;
+            loon::index::read_slice(in, index, first, last, c, 4);
+            TEST_EQUAL(c.out.sink().str, expected);
+        }
+    }
+
+    // errors in a slice are reported with the line number in the whole text
+    {
+        std::istringstream good("(arry 1\n2\n3 44)");
+        const loon::index::arry_index i(loon::index::build_index(good, 1));
+        std::istringstream bad("(arry 1\n2\n3 4x)");
+        collector c;
+        int line = 0;
+        try {
+            loon::index::read_slice(bad, i, 3, 4, c);
+        }
+        catch (const loon::reader::exception & e) {
+            TEST_EQUAL(e.id(), loon::reader::bad_number);
+            line = e.line();
+        }
+        TEST_EQUAL(line, 3);
+    }
+
+    // the sidecar
+    struct string_writer : public loon::writer::base {
+        std::string str;
+    private:
+        virtual void write(const char * utf8, size_t len) { str.append(utf8, len); }
+    } w;
+    w.set_pretty(false);
+    loon::index::write_index(index, w);
+    std::istringstream sidecar(w.str);
+    const loon::index::arry_index read(loon::index::read_index(sidecar));
+    TEST_EQUAL(read.every, index.every);
+    TEST_EQUAL(read.size, index.size);
+    TEST_EQUAL(read.entries.size(), index.entries.size());
+    for (size_t j = 0; j < read.entries.size() && j < index.entries.size(); ++j) {
+        TEST_EQUAL(read.entries[j].element, index.entries[j].element);
+        TEST_EQUAL(read.entries[j].offset, index.entries[j].offset);
+        TEST_EQUAL(read.entries[j].line, index.entries[j].line);
+    }
+
+    // only a single top-level arry can be indexed
+    const char * const not_arry[] = { "", "(dict)", "1", "(arry) 1", "(arry) (arry)", 0 };
+    for (const char * const * t = not_arry; *t; ++t) {
+        std::istringstream in(*t);
+        TEST_EXCEPTION(loon::index::build_index(in, 1), loon::reader::exception);
+    }
+
+    // a sidecar that is not an index
+    const char * const bad_sidecar[] = {
+        "(dict \"every\" 0 \"size\" 0 \"entries\" (arry 0 1))",
+        "(dict \"every\" 1 \"size\" 1 \"entries\" (arry 0 1))",
+        "(dict \"every\" 1 \"size\" 0 \"entries\" (arry 0))",
+        "(dict \"every\" 1 \"size\" 1 \"entries\" (arry 5 1 4 1))",
+        "(dict \"every\" 1 \"size\" 0 \"entries\" (arry 0 1) \"x\" 1)",
+        "(arry)", 0
+    };
+    for (const char * const * t = bad_sidecar; *t; ++t) {
+        std::istringstream in(*t);
+        TEST_EXCEPTION(loon::index::read_index(in), loon::reader::exception);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// return true iff 'a' and 'b' are identical, extents included
+bool identical(const loon::incremental::node & a, const loon::incremental::node & b)
+{
+    if (a.kind != b.kind || a.value != b.value || a.begin != b.begin || a.end != b.end
+        || a.head != b.head || a.children.size() != b.children.size())
+        return false;
+    for (size_t i = 0; i < a.children.size(); ++i)
+        if (!identical(a.children[i], b.children[i]))
+            return false;
+    return true;
+}
+
+loon::incremental::path make_path(const char * a, const char * b = 0)
+{
+    loon::incremental::path p(1, a);
+    if (b)
+        p.push_back(b);
+    return p;
+}
+
+void test_incremental()
+{
+    typedef std::vector<loon::incremental::path> paths;
+
+    const std::string config(
+        "; settings\n"
+        "(dict\n"
+        "    \"name\" \"loon\"\n"
+        "    \"server\" (dict \"host\" \"example.com\" \"port\" 8080)\n"
+        "    \"list\" (arry 1 2 3))\n");
+
+    loon::incremental::document doc;
+    doc.parse(config);
+    TEST_EQUAL(doc.top().children.size(), 1);
+    TEST_EQUAL(doc.bytes_read(), config.size());
+
+    // return true iff 'doc' is what parsing its text from scratch gives
+    struct {
+        bool operator()(const loon::incremental::document & doc) const
+        {
+            loon::incremental::document fresh;
+            fresh.parse(doc.text());
+            return identical(doc.top(), fresh.top());
+        }
+    } up_to_date;
+
+    // change a value: only the slot of the value is read again
+    paths changed(doc.edit(config.find("8080"), 4, "9090"));
+    TEST_EQUAL(changed.size(), 1);
+    TEST_EQUAL(changed.size() == 1 && changed[0] == make_path("server", "port"), true);
+    TEST_EQUAL(doc.bytes_read(), std::string(" \"port\" 9090").size());
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // add a key
+    changed = doc.edit(doc.text().find("9090") + 4, 0, " \"tls\" true");
+    TEST_EQUAL(changed.size() == 1 && changed[0] == make_path("server", "tls"), true);
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // change an element of an arry
+    changed = doc.edit(doc.text().find("2 3"), 1, "20");
+    TEST_EQUAL(changed.size() == 1 && changed[0] == make_path("list"), true);
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // changes that make no difference
+    changed = doc.edit(doc.text().find("(arry"), 0, "; comment\n");
+    TEST_EQUAL(changed.empty(), true);
+    TEST_EQUAL(up_to_date(doc), true);
+    changed = doc.edit(doc.text().find("20"), 0, " ");
+    TEST_EQUAL(changed.empty(), true);
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // rename a key
+    changed = doc.edit(doc.text().find("host"), 4, "hostname");
+    TEST_EQUAL(changed.size() == 2 && changed[0] == make_path("server", "host")
+        && changed[1] == make_path("server", "hostname"), true);
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // an edit that changes where a list ends is read in its parent
+    changed = doc.edit(doc.text().find("\"tls\""), 0, ") \"x\" (arry");
+    TEST_EQUAL(changed.size() == 2 && changed[0] == make_path("server")
+        && changed[1] == make_path("x"), true);
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // an edit that makes the text invalid
+    TEST_EXCEPTION(doc.edit(0, 0, "\""), loon::reader::exception);
+    changed = doc.edit(0, 1, "");
+    TEST_EQUAL(changed.size() == 1 && changed[0].empty(), true);
+    TEST_EQUAL(up_to_date(doc), true);
+    TEST_EXCEPTION(doc.edit(doc.text().size() + 1, 0, ""), std::out_of_range);
+
+    // a BOM is only ignored at the start of the text
+    doc.parse("\xEF\xBB\xBF; comment\n");
+    TEST_EXCEPTION(doc.edit(0, 0, "1 "), loon::reader::exception);
+    doc.parse("\xEF\xBB\xBF; comment\n");
+    TEST_EXCEPTION(doc.edit(1, 0, "1"), loon::reader::exception);
+    doc.parse("\xEF\xBB\xBF(arry)");
+    TEST_EXCEPTION(doc.edit(0, 1, ""), loon::reader::exception);
+    doc.parse("(arry)");
+    changed = doc.edit(0, 0, "\xEF\xBB\xBF");
+    TEST_EQUAL(doc.top().children.size(), 1);
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // an edit reaching the space after the last element of a list that
+    // doesn't begin at offset 0
+    std::string nested("(arry");
+    for (int i = 0; i < 300; ++i)
+        nested += " 1";
+    nested += " (arry 3 ))";
+    doc.parse(nested);
+    TEST_EXCEPTION(doc.edit(nested.rfind("3 )"), 2, ";."), loon::reader::exception);
+    doc.parse(nested);
+    changed = doc.edit(nested.rfind("3 )"), 2, "4 5 ");
+    TEST_EQUAL(changed.size(), 1);
+    TEST_EQUAL(doc.bytes_read() < 10, true);
+    TEST_EQUAL(up_to_date(doc), true);
+    doc.parse("1 2 (arry 3 )");
+    TEST_EXCEPTION(doc.edit(10, 2, ";."), loon::reader::exception);
+    doc.parse("1 2 (arry 3 )");
+    changed = doc.edit(10, 2, "4 5 ");
+    TEST_EQUAL(doc.text(), "1 2 (arry 4 5 )");
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // an edit that makes or breaks a line splice moves where tokens end
+    doc.parse("1\\\n (arry 3)");
+    doc.edit(1, 1, "");
+    TEST_EQUAL(doc.top().children[1].begin, 1);
+    TEST_EQUAL(up_to_date(doc), true);
+    doc.parse("1 (arry 2\r\n 3)");
+    doc.edit(9, 0, "\\");
+    TEST_EQUAL(up_to_date(doc), true);
+    doc.edit(11, 0, "4");
+    TEST_EQUAL(up_to_date(doc), true);
+
+    // random edits always give the same result as parsing from scratch
+    // (in the config, and in the config nested in lists some way into the text)
+    const char alphabet[] = " ()\"a1;\\\nxyz";
+    const std::string nested_config("1 (arry 2 (arry " + config + " ) )");
+    doc.parse(config);
+    for (int n = 0; n < 3000; ++n) {
+        const size_t size = doc.text().size();
+        const size_t offset = rand() % (size + 1);
+        const size_t len = std::min<size_t>(rand() % 4, size - offset);
+        std::string replacement;
+        for (int k = rand() % 4; k; --k)
+            replacement += alphabet[rand() % (sizeof(alphabet) - 1)];
+
+        bool edit_failed = false;
+        try {
+            doc.edit(offset, len, replacement);
+        }
+        catch (const loon::reader::exception &) {
+            edit_failed = true;
         }
 
-    private:
-        std::string str;
-        virtual void write(const char * utf8, size_t len)
-        {
-            str.append(utf8, len);
+        loon::incremental::document fresh;
+        bool parse_failed = false;
+        try {
+            fresh.parse(doc.text());
+        }
+        catch (const loon::reader::exception &) {
+            parse_failed = true;
         }
-    };
 
-    writer w;
-    TEST_EQUAL(w.write_as_hex_u32(0         ), "0x00000000");
-    TEST_EQUAL(w.write_as_hex_u32(1         ), "0x00000001");
-    TEST_EQUAL(w.write_as_hex_u32(0xABCDEF  ), "0x00ABCDEF");
-    TEST_EQUAL(w.write_as_hex_u32(0x12345678), "0x12345678");
-    TEST_EQUAL(w.write_as_hex_u32(0x87654321), "0x87654321");
-    TEST_EQUAL(w.write_as_hex_u32(0xABCDEF00), "0xABCDEF00");
-    TEST_EQUAL(w.write_as_hex_u32(0xFFFFFFFF), "0xFFFFFFFF");
+        TEST_EQUAL(edit_failed, parse_failed);
+        if (!edit_failed && !parse_failed) {
+            TEST_EQUAL(identical(doc.top(), fresh.top()), true);
+        }
+        else if (rand() % 2)
+            doc.parse(rand() % 2 ? config : nested_config); // (otherwise the next edit reads everything)
+    }
 }
 
 
@@ -2075,6 +3785,8 @@ void test_syntax_errors()
         {"1x",                          1,  bad_number},
         {"1.x",                         1,  bad_number},
         {"9ed",                         1,  bad_number},
+        {"9e",                          1,  bad_number},
+        {"9e ",                         1,  bad_number},
         {"9e+",                         1,  bad_number},
         {"9e+x",                        1,  bad_number},
         {"9e9e",                        1,  bad_number},
@@ -2123,6 +3835,12 @@ void test_syntax_errors()
         {"(arry 1\nbarada)",            2,  unexpected_or_unknown_symbol},
         {"(arry 1 (nikto\n",            1,  missing_arry_or_dict_symbol},
         {"xyz",                         1,  unexpected_or_unknown_symbol},
+        {"(arry nul)",                  1,  unexpected_or_unknown_symbol},
+        {"(arry nullnull)",             1,  unexpected_or_unknown_symbol},
+        {"(arry truefalse)",            1,  unexpected_or_unknown_symbol},
+        {"(arry +null)",                1,  unexpected_or_unknown_symbol},
+        {"(true)",                      1,  missing_arry_or_dict_symbol},
+        {"(arryarry)",                  1,  missing_arry_or_dict_symbol},
 
         // UTF-8 BOM is {0xEF} {0xBB} {0xBF}; test sequences that almost
         // match the BOM are passed through and come out as unknown symbols
@@ -2138,6 +3856,30 @@ void test_syntax_errors()
     const char s1[] = {'"', '\0', '"' };
     expect_exception(std::string(s1, s1 + sizeof(s1)), unescaped_ctrl_char_in_string, 1);
 
+    // the messages give the symbol in error, however long it is
+    const char * const symbols[] = { "x", "nul", "nulls", "arrayed", "nullnull", "truefalse", "+.x", 0 };
+    for (const char * const * sym = symbols; *sym; ++sym) {
+        std::string message;
+        try {
+            unserialise(std::string("(arry ") + *sym + ')');
+        }
+        catch (const loon::reader::exception & e) {
+            message = e.what();
+        }
+        TEST_EQUAL(message.find(std::string("'") + *sym + '\''), message.find('\''));
+        TEST_EQUAL(message.empty(), false);
+    }
+    {
+        std::string message;
+        try {
+            unserialise("(false)");
+        }
+        catch (const loon::reader::exception & e) {
+            message = e.what();
+        }
+        TEST_EQUAL(message.find("near 'false'") != std::string::npos, true);
+    }
+
     // test the reader detects duplicate keys
     {
         bool got_exception = false;
@@ -2349,6 +4091,662 @@ void test_current_line()
     r.process_chunk(text, len, /*is_last_chunk=*/true);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+
+void test_token_location()
+{
+    // a reader that logs the location of every event
+    struct locator : public loon::reader::base {
+        std::string str;
+    private:
+        void log(char event)
+        {
+            const loon::reader::location & t = token_location();
+            str += event + std::to_string(t.offset) + ':' + std::to_string(t.line)
+                + ':' + std::to_string(t.column) + ' ';
+        }
+        virtual void loon_token_location(const loon::reader::location & where)
+        {
+            // the callback gives the same location as token_location()
+            const loon::reader::location & t = token_location();
+            str += where.offset == t.offset && where.line == t.line && where.column == t.column ? "" : "?";
+        }
+        virtual void loon_arry_begin() { log('['); }
+        virtual void loon_arry_end() { log(']'); }
+        virtual void loon_dict_begin() { log('{'); }
+        virtual void loon_dict_end() { log('}'); }
+        virtual void loon_dict_key(const char *, size_t) { log('k'); }
+        virtual void loon_null() { log('0'); }
+        virtual void loon_bool(bool) { log('b'); }
+        virtual void loon_string(const char *, size_t) { log('s'); }
+        virtual void loon_number(const char *, size_t, loon::reader::num_type) { log('n'); }
+    };
+
+    // lists are located at their '(', even if the symbol comes later
+    const std::string text(
+        "\xEF\xBB\xBF(arry 1\r\n"             // line 1 (the BOM is not in column 1)
+        "\t( dict \"k\\u0041\" null)\n"       // line 2
+        "  \"\xC2\xA3\" tr\\\nue 0x1F)\n"     // lines 3 and 4 (spliced); a two-byte character
+        "-7");
+    const std::string expected(
+        "[3:1:1 n9:1:7 "
+        "{13:2:2 k20:2:9 030:2:19 }34:2:23 "
+        "s38:3:3 b43:3:8 n50:4:4 ]54:4:8 "
+        "n56:5:1 ");
+
+    locator r;
+    r.set_token_locations(true);
+    r.process_chunk(text.data(), text.size(), true);
+    TEST_EQUAL(r.str, expected);
+    TEST_EQUAL(r.current_offset(), text.size());
+    TEST_EQUAL(r.current_column(), 3);
+
+    // the same locations are reported when the text is given a byte at a time
+    locator b;
+    for (size_t i = 0; i < text.size(); ++i)
+        b.process_chunk(text.data() + i, 1, i + 1 == text.size());
+    TEST_EQUAL(b.str, expected);
+
+    // and in small chunks of any size, splitting the {\}{LF} and {CR}{LF}
+    for (size_t len = 2; len <= 9; ++len) {
+        locator c;
+        for (size_t i = 0; i < text.size(); i += len) {
+            const size_t n = std::min(len, text.size() - i);
+            c.process_chunk(text.data() + i, n, i + n == text.size());
+        }
+        TEST_EQUAL(c.str, expected);
+        TEST_EQUAL(c.current_column(), 3);
+    }
+
+    // and when resumed from a checkpoint
+    for (size_t at = 0; at <= text.size(); ++at) {
+        locator first;
+        first.process_chunk(text.data(), at, false);
+        TEST_EQUAL(first.current_offset(), at);
+        locator second;
+        second.restore(first.checkpoint());
+        TEST_EQUAL(second.current_column(), first.current_column());
+        second.process_chunk(text.data() + at, text.size() - at, true);
+        TEST_EQUAL(first.str + second.str, expected);
+    }
+
+    // a slice starting part way along a line
+    locator s;
+    s.reset_at(100, 7, 5);
+    s.process_chunk("null\n(arry)", 11, true);
+    TEST_EQUAL(s.str, "0100:7:5 [105:8:1 ]110:8:6 ");
+
+    // exceptions carry the location of the token in error
+    struct test_case {
+        const char * text;
+        loon::reader::error_id id;
+        uint64_t offset;
+        int line;
+        int column;
+    };
+    const test_case tests[] = {
+        { "(arry 1\n  12x3)",           loon::reader::bad_number,                   10, 2, 3 },
+        { "(dict\r\n\"a\" 1 2 true)",   loon::reader::dict_key_is_not_string,       13, 2, 7 },
+        { "(arry\n\n  \"a\\q\")",       loon::reader::string_escape_unknown,        9, 3, 3 },
+        { "(arry (foo))",               loon::reader::missing_arry_or_dict_symbol,  7, 1, 8 },
+        { "(dict \"a\"\n   )",          loon::reader::missing_dict_value,           13, 2, 4 },
+        { "(arry\n (arry 1)",           loon::reader::unclosed_list,                15, 2, 10 },
+        { 0, loon::reader::no_error, 0, 0, 0 }
+    };
+    for (const test_case * t = tests; t->text; ++t) {
+        locator r;
+        bool got_exception = false;
+        try {
+            r.process_chunk(t->text, strlen(t->text), true);
+        }
+        catch (const loon::reader::exception & e) {
+            got_exception = true;
+            TEST_EQUAL(e.id(), t->id);
+            TEST_EQUAL(e.offset(), t->offset);
+            TEST_EQUAL(e.line(), t->line);
+            TEST_EQUAL(e.column(), t->column);
+        }
+        TEST_EQUAL(got_exception, true);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_utf8_validation()
+{
+    // a reader that collects the errors it finds
+    struct checker : public loon::reader::base {
+        std::vector<uint64_t> errors; // offsets of invalid_utf8 errors
+        int strings;
+        checker() : strings(0) {}
+
+        // return the offset of the first invalid_utf8 error reading 'text', or -1
+        static int first_error(const std::string & text, loon::reader::utf8_validation v)
+        {
+            checker r;
+            r.set_utf8_validation(v);
+            try {
+                r.process_chunk(text.data(), text.size(), true);
+            }
+            catch (const loon::reader::exception & e) {
+                TEST_EQUAL(e.id(), loon::reader::invalid_utf8);
+                TEST_EQUAL(e.column(), static_cast<int>(e.offset()) + 1);
+                return static_cast<int>(e.offset());
+            }
+            return -1;
+        }
+    private:
+        virtual void loon_arry_begin() {}
+        virtual void loon_arry_end() {}
+        virtual void loon_dict_begin() {}
+        virtual void loon_dict_end() {}
+        virtual void loon_dict_key(const char *, size_t) {}
+        virtual void loon_null() {}
+        virtual void loon_bool(bool) {}
+        virtual void loon_string(const char *, size_t) { ++strings; }
+        virtual void loon_number(const char *, size_t, loon::reader::num_type) {}
+        virtual void loon_error(const loon::reader::exception & e)
+        {
+            if (e.id() == loon::reader::invalid_utf8)
+                errors.push_back(e.offset());
+        }
+    };
+
+    // valid UTF-8, split at every possible point
+    const std::string valid(
+        "(arry \"plain ASCII that is long enough to be read a word at a time\" "
+        "\"\xC2\xA3 \xE2\x82\xAC \xEF\xBF\xBF \xF0\x9F\x98\x80 \xF4\x8F\xBF\xBF \xE0\xA0\x80 \xED\x9F\xBF\" "
+        "; \xE6\x97\xA5\xE6\x9C\xAC\n"
+        "\"\\u00A3\")");
+    for (size_t at = 0; at <= valid.size(); ++at) {
+        checker r;
+        r.set_utf8_validation(loon::reader::utf8_all);
+        r.process_chunk(valid.data(), at, false);
+        r.process_chunk(valid.data() + at, valid.size() - at, true);
+        TEST_EQUAL(r.strings, 3);
+    }
+
+    struct test_case {
+        const char * bytes;
+        int at;     // offset of the invalid byte within 'bytes'
+    };
+    const test_case tests[] = {
+        { "\x80", 0 },                  // a continuation byte with no lead byte
+        { "\xC0\xAF", 0 },              // an overlong '/'
+        { "\xE0\x80\x80", 1 },          // an overlong U+0000
+        { "\xED\xA0\x80", 1 },          // the UTF-16 surrogate U+D800
+        { "\xF4\x90\x80\x80", 1 },      // U+110000
+        { "\xF5\x80\x80\x80", 0 },
+        { "\xFF", 0 },
+        { "\xE2\x82", 2 },              // cut short (by the closing quote)
+        { "abcdefgh\xF0\x9F\x98", 11 },
+        { 0, 0 }
+    };
+    for (const test_case * t = tests; t->bytes; ++t) {
+        const std::string in_string("(arry \"" + std::string(t->bytes) + "\" 1)");
+        TEST_EQUAL(checker::first_error(in_string, loon::reader::utf8_all), 7 + t->at);
+        TEST_EQUAL(checker::first_error(in_string, loon::reader::utf8_strings), 6);
+        TEST_EQUAL(checker::first_error(in_string, loon::reader::utf8_unchecked), -1);
+
+        const std::string in_comment("(arry ;" + std::string(t->bytes) + "\n1)");
+        TEST_EQUAL(checker::first_error(in_comment, loon::reader::utf8_all), 7 + t->at);
+        TEST_EQUAL(checker::first_error(in_comment, loon::reader::utf8_strings), -1);
+
+        // the same, with the text given a byte at a time
+        checker r;
+        r.set_utf8_validation(loon::reader::utf8_all);
+        r.set_recovery(loon::reader::base::skip_list);
+        for (size_t i = 0; i < in_string.size(); ++i)
+            r.process_chunk(in_string.data() + i, 1, false);
+        r.process_chunk(0, 0, true);
+        TEST_EQUAL(r.errors.empty(), false);
+        TEST_EQUAL(r.errors.empty() ? 0 : r.errors[0], static_cast<uint64_t>(7 + t->at));
+    }
+
+    // the text ends part way through a sequence
+    TEST_EQUAL(checker::first_error("1 ;\xF0\x9F", loon::reader::utf8_all), 5);
+
+    // every invalid byte is reported when recovering from errors
+    const std::string text("\"\x80\" ;\xC0\xAF\n\"ok\" \xFF");
+    checker r;
+    r.set_utf8_validation(loon::reader::utf8_all);
+    r.set_recovery(loon::reader::base::skip_record);
+    r.process_chunk(text.data(), text.size(), true);
+    TEST_EQUAL(r.errors.size(), 4);
+    TEST_EQUAL(r.errors.size() == 4 && r.errors[0] == 1 && r.errors[1] == 5
+        && r.errors[2] == 6 && r.errors[3] == 13, true);
+    TEST_EQUAL(r.strings, 2);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_reader_statistics()
+{
+    struct counter : public loon::reader::base {
+        virtual void loon_arry_begin() {}
+        virtual void loon_arry_end() {}
+        virtual void loon_dict_begin() {}
+        virtual void loon_dict_end() {}
+        virtual void loon_dict_key(const char *, size_t) {}
+        virtual void loon_null() {}
+        virtual void loon_bool(bool) {}
+        virtual void loon_string(const char *, size_t) {}
+        virtual void loon_number(const char *, size_t, loon::reader::num_type) {}
+    };
+
+    const std::string text("(arry 1 \"a\\nb\" (dict \"k\" true) null \"plain\" -2.5) ; the end");
+    counter r;
+    r.process_chunk(text.data(), 10, false);
+    r.process_chunk(text.data() + 10, text.size() - 10, true);
+    const loon::reader::statistics & s = r.stats();
+    TEST_EQUAL(s.bytes, text.size());
+    TEST_EQUAL(s.chunks, 2);
+    TEST_EQUAL(s.lists, 2);
+    TEST_EQUAL(s.strings, 3);
+    TEST_EQUAL(s.escaped_strings, 1);
+    TEST_EQUAL(s.numbers, 2);
+    TEST_EQUAL(s.symbols, 4); // arry dict true null
+    TEST_EQUAL(s.split_tokens, 1); // "a\nb" was split
+    TEST_EQUAL(s.max_depth, 2);
+
+    // every chunk boundary within a token is counted (a symbol or number
+    // isn't complete until the byte after it is seen)
+    const std::string small("(arry 12 \"ab\")");
+    counter b;
+    for (size_t i = 0; i < small.size(); ++i)
+        b.process_chunk(small.data() + i, 1, false);
+    b.process_chunk(0, 0, true);
+    TEST_EQUAL(b.stats().chunks, small.size() + 1);
+    TEST_EQUAL(b.stats().split_tokens, 4 + 2 + 3);
+
+    // a long string makes the reader grow its token buffer
+    const std::string big("\"" + std::string(100000, 'x') + "\"");
+    b.process_chunk(big.data(), big.size(), true);
+    TEST_EQUAL(b.stats().buffer_growths > 0, true);
+
+    // the counts start again after a reset
+    b.reset();
+    TEST_EQUAL(b.stats().bytes, 0);
+    TEST_EQUAL(b.stats().strings, 0);
+    TEST_EQUAL(b.stats().max_depth, 0);
+
+    // per-state timing is only sampled if compiled in
+    uint64_t samples = 0;
+    r.reset();
+    for (int i = 0; i < 100; ++i)
+        r.process_chunk(big.data(), big.size(), false);
+    for (int i = 0; i < loon::reader::statistics::num_states; ++i)
+        samples += r.stats().state_samples[i];
+#if LOON_READER_STATE_SAMPLING
+    TEST_EQUAL(samples, 100 * big.size() / loon::reader::statistics::state_sample_interval);
+#else
+    TEST_EQUAL(samples, 0);
+#endif
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_checkpoint()
+{
+    // a reader that logs every event it receives
+    struct event_log : public loon::reader::base {
+        std::string str;
+    private:
+        virtual void loon_arry_begin() { str += "[ "; }
+        virtual void loon_arry_end() { str += "] "; }
+        virtual void loon_dict_begin() { str += "{ "; }
+        virtual void loon_dict_end() { str += "} "; }
+        virtual void loon_dict_key(const char * utf8, size_t len) { str += "k:" + std::string(utf8, len) + ' '; }
+        virtual void loon_null() { str += "null "; }
+        virtual void loon_bool(bool value) { str += value ? "true " : "false "; }
+        virtual void loon_string(const char * utf8, size_t len) { str += "s:" + std::string(utf8, len) + ' '; }
+        virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type)
+        {
+            str += "n:" + std::string(utf8, len) + ' ';
+        }
+    };
+
+    const std::string text(
+        "\xEF\xBB\xBF; a checkpoint may be taken anywhere\r\n"
+        "(dict \"a\\\"b\\u0041\" (arry 12.5e-3 0x1F +7 -\\\n8 true null)\r\n"
+        "      \"ctrl\\t\" (dict) \"\" (arry (arry \"x\")))\n"
+        "\"second\" 3");
+
+    event_log whole;
+    whole.process_chunk(text.data(), text.size(), true);
+
+    // stop at every byte, checkpoint, and continue in a new reader
+    for (size_t at = 0; at <= text.size(); ++at) {
+        event_log first;
+        first.process_chunk(text.data(), at, false);
+        const std::string saved(first.checkpoint());
+        TEST_EQUAL(first.current_offset(), at);
+
+        event_log second;
+        second.restore(saved);
+        TEST_EQUAL(second.current_offset(), at);
+        TEST_EQUAL(second.current_line(), first.current_line());
+        second.process_chunk(text.data() + at, text.size() - at, true);
+        TEST_EQUAL(first.str + second.str, whole.str);
+        TEST_EQUAL(second.current_line(), whole.current_line());
+        TEST_EQUAL(second.checkpoint(), whole.checkpoint());
+    }
+
+    // errors after a restore are the same as without one
+    event_log r;
+    r.process_chunk("(arry 1 (dict", 13, false);
+    event_log s;
+    s.restore(r.checkpoint());
+    TEST_EXCEPTION(s.process_chunk(" 2)", 3, true), loon::reader::exception);
+
+    const char * const bad[] = {
+        "", "(arry)", "1", "(arry \"loon reader checkpoint\" 3 0 1 0 0 0 0 0 0 0 1 0 1 1 0 1 1 0 \"\" \"\")",
+        "(arry \"loon reader checkpoint\" 4 0 0 0 0 0 0 0 0 0 1 0 1 1 0 1 1 0 \"\" \"\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 99 0 0 0 0 0 0 1 0 1 1 0 1 1 0 \"\" \"\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 0 0 0 1 0 0 0 1 0 1 1 0 1 1 0 \"\" \"\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 0 0 0 1 0 0 0 1 0 1 1 0 1 1 0 \"\" \"x\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 0 0 0 0 0 0 0 1 0 1 1 0 1 1 0 \"\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 0 0 0 1 1 1 0 1 0 1 1 0 1 1 0 \"\" \"\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 0 0 0 1 0 1 2 1 0 1 1 0 1 1 0 \"\" \"a\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 0 0 0 0 0 0 0 2 0 1 1 0 1 1 0 \"\" \"\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 0 0 0 0 0 0 0 1 0 0 1 0 1 1 0 \"\" \"\")",
+        "(arry \"loon reader checkpoint\" 4 0 1 0 0 0 0 0 0 0 1 0 1 1 0 1 1 8 \"\" \"\")",
+        0
+    };
+    for (const char * const * t = bad; *t; ++t)
+        TEST_EXCEPTION(r.restore(*t), loon::reader::exception);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void test_recovery()
+{
+    // a reader that logs every event it receives, including errors
+    struct event_log : public loon::reader::base {
+        std::string str;
+        int depth;
+        event_log() : depth(0) {}
+    private:
+        virtual void loon_arry_begin() { str += "[ "; ++depth; }
+        virtual void loon_arry_end() { str += "] "; --depth; }
+        virtual void loon_dict_begin() { str += "{ "; ++depth; }
+        virtual void loon_dict_end() { str += "} "; --depth; }
+        virtual void loon_dict_key(const char * utf8, size_t len) { str += "k:" + std::string(utf8, len) + ' '; }
+        virtual void loon_null() { str += "null "; }
+        virtual void loon_bool(bool value) { str += value ? "true " : "false "; }
+        virtual void loon_string(const char * utf8, size_t len) { str += "s:" + std::string(utf8, len) + ' '; }
+        virtual void loon_number(const char * utf8, size_t len, loon::reader::num_type)
+        {
+            str += "n:" + std::string(utf8, len) + ' ';
+        }
+        virtual void loon_error(const loon::reader::exception & e)
+        {
+            str += "E" + std::to_string(e.id()) + '@' + std::to_string(e.line()) + ' ';
+        }
+    };
+
+    struct test_case {
+        const char * text;
+        const char * skip_list;     // events in skip_list mode
+        const char * skip_record;   // events in skip_record mode
+    };
+    const test_case tests[] = {
+        // no errors
+        { "(arry 1 (dict \"a\" true))",
+          "[ n:1 { k:a true } ] ",
+          "[ n:1 { k:a true } ] " },
+        // bad number in a nested arry
+        { "(arry 1 (arry 2x 3) 4)\n5",
+          "[ n:1 [ E100@1 ] n:4 ] n:5 ",
+          "[ n:1 [ E100@1 ] ] n:5 " },
+        // bad number immediately followed by ')'
+        { "(arry 0x)(arry 6)",
+          "[ E103@1 ] [ n:6 ] ",
+          "[ E103@1 ] [ n:6 ] " },
+        // a list without arry or dict symbol, and an empty list
+        { "(arry (foo 1) () 2)",
+          "[ E104@1 E104@1 n:2 ] ",
+          "[ E104@1 ] " },
+        // unknown symbol and a dict key that is not a string
+        { "(arry maybe 1)\n(dict 1 2 \"k\" 3)",
+          "[ E110@1 ] { E102@2 } ",
+          "[ E110@1 ] { E102@2 } " },
+        // a symbol too long to be a keyword
+        { "(arry 1 very_long_symbol 2)\n3",
+          "[ n:1 E110@1 ] n:3 ",
+          "[ n:1 E110@1 ] n:3 " },
+        // a dict key with no value
+        { "(dict \"a\" 1 \"b\")\n(arry 7)",
+          "{ k:a n:1 k:b E105@1 } [ n:7 ] ",
+          "{ k:a n:1 k:b E105@1 } [ n:7 ] " },
+        // errors at the top level just skip the offending token
+        { "1 ) oops \"s\\q\" 2",
+          "n:1 E106@1 E110@1 E112@1 n:2 ",
+          "n:1 E106@1 E110@1 E112@1 n:2 " },
+        // lists left open at the end of the text are closed
+        { "(arry 1 (dict \"a\" (arry\n2",
+          "[ n:1 { k:a [ n:2 E107@2 ] } ] ",
+          "[ n:1 { k:a [ n:2 E107@2 ] } ] " },
+        // errors inside lists that are already being skipped are not reported
+        { "(arry (arry 9z (arry 1y) 2w) 3)",
+          "[ [ E100@1 ] n:3 ] ",
+          "[ [ E100@1 ] ] " },
+        { 0, 0, 0 }
+    };
+
+    for (const test_case * t = tests; t->text; ++t) {
+        const size_t len = strlen(t->text);
+        const loon::reader::base::recovery modes[] = {
+            loon::reader::base::skip_list, loon::reader::base::skip_record
+        };
+        for (int m = 0; m < 2; ++m) {
+            const std::string expected(m == 0 ? t->skip_list : t->skip_record);
+
+            event_log r;
+            TEST_EQUAL(r.set_recovery(modes[m]), loon::reader::base::no_recovery);
+            r.process_chunk(t->text, len, true);
+            TEST_EQUAL(r.str, expected);
+            TEST_EQUAL(r.depth, 0);
+
+            // the same events when read one byte at a time
+            event_log b;
+            b.set_recovery(modes[m]);
+            for (size_t i = 0; i < len; ++i)
+                b.process_chunk(t->text + i, 1, false);
+            b.process_chunk(t->text + len, 0, true);
+            TEST_EQUAL(b.str, expected);
+
+            // and when resumed from a checkpoint taken at any byte
+            for (size_t at = 0; at <= len; ++at) {
+                event_log first;
+                first.set_recovery(modes[m]);
+                first.process_chunk(t->text, at, false);
+                event_log second;
+                second.set_recovery(modes[m]);
+                second.restore(first.checkpoint());
+                second.process_chunk(t->text + at, len - at, true);
+                TEST_EQUAL(first.str + second.str, expected);
+            }
+
+            // the mode survives reset()
+            r.reset();
+            TEST_EQUAL(r.set_recovery(loon::reader::base::no_recovery), modes[m]);
+        }
+
+        // without recovery any error is thrown as before
+        event_log r;
+        if (std::string(t->skip_list).find('E') == std::string::npos)
+            r.process_chunk(t->text, len, true);
+        else
+            TEST_EXCEPTION(r.process_chunk(t->text, len, true), loon::reader::exception);
+    }
+
+    // a reader that doesn't override loon_error() still gets the exception
+    struct quiet : public loon::reader::base {
+        virtual void loon_arry_begin() {}
+        virtual void loon_arry_end() {}
+        virtual void loon_dict_begin() {}
+        virtual void loon_dict_end() {}
+        virtual void loon_dict_key(const char *, size_t) {}
+        virtual void loon_null() {}
+        virtual void loon_bool(bool) {}
+        virtual void loon_string(const char *, size_t) {}
+        virtual void loon_number(const char *, size_t, loon::reader::num_type) {}
+    };
+    quiet q;
+    q.set_recovery(loon::reader::base::skip_record);
+    TEST_EXCEPTION(q.process_chunk("(arry 1x)", 9, true), loon::reader::exception);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// structs bound to Loon dicts with LOON_STRUCT (see loon_struct.h)
+struct bound_point {
+    int32_t x;
+    int32_t y;
+};
+LOON_STRUCT(bound_point, x, y)
+
+struct bound_shape {
+    std::string name;
+    bool visible;
+    uint32_t colour;
+    double scale;
+    bound_point origin;
+    std::vector<bound_point> points;
+    std::vector<std::string> tags;
+};
+LOON_STRUCT(bound_shape, name, visible, colour, scale, origin, points, tags)
+
+bool operator==(const bound_point & lhs, const bound_point & rhs)
+{
+    return lhs.x == rhs.x && lhs.y == rhs.y;
+}
+
+bool operator==(const bound_shape & lhs, const bound_shape & rhs)
+{
+    return lhs.name == rhs.name && lhs.visible == rhs.visible
+        && lhs.colour == rhs.colour && lhs.scale == rhs.scale
+        && lhs.origin == rhs.origin && lhs.points == rhs.points
+        && lhs.tags == rhs.tags;
+}
+
+// Test LOON_STRUCT bound structs may be written and read.
+void test_struct_binding()
+{
+    struct writer : public loon::writer::base {
+        std::string str;
+    private:
+        virtual void write(const char * utf8, size_t len)
+        {
+            str.append(utf8, len);
+        }
+    };
+
+    bound_shape a;
+    a.name = "tri\"angle";
+    a.visible = true;
+    a.colour = 0xFF8000;
+    a.scale = 1.5;
+    a.origin.x = -1;
+    a.origin.y = 2;
+    for (int i = 0; i < 3; ++i) {
+        bound_point p = { i, i * 10 };
+        a.points.push_back(p);
+    }
+    a.tags.push_back("red");
+    a.tags.push_back("");
+
+    writer w;
+    w.set_pretty(false);
+    loon::binding::write_struct(w, a);
+    const std::string expected =
+        "(dict \"name\" \"tri\\\"angle\" \"visible\" true \"colour\" 16744448"
+        " \"scale\" 1.5 \"origin\" (dict \"x\" -1 \"y\" 2)"
+        " \"points\" (arry (dict \"x\" 0 \"y\" 0) (dict \"x\" 1 \"y\" 10) (dict \"x\" 2 \"y\" 20))"
+        " \"tags\" (arry \"red\" \"\"))";
+    TEST_EQUAL(w.str, expected);
+
+    // read it back in one chunk, and byte at a time
+    bound_shape b = bound_shape();
+    loon::binding::read_struct(w.str.c_str(), w.str.size(), b);
+    TEST_EQUAL(b, a);
+
+    bound_shape c = bound_shape();
+    loon::binding::struct_reader r(c);
+    for (size_t i = 0; i < w.str.size(); ++i)
+        r.process_chunk(&w.str[i], 1, /*is_last_chunk=*/false);
+    r.process_chunk(0, 0, /*is_last_chunk=*/true);
+    TEST_EQUAL(c, a);
+
+    // unknown keys (and their values) are ignored, absent members and
+    // nulls leave the member unchanged, hex and signed numbers are accepted
+    {
+        const char text[] =
+            "(dict \"extra\" (dict \"x\" \"not a number\" \"y\" (arry 1 2))"
+            " \"x\" 0x10 \"y\" +3 \"z\" null)";
+        bound_point p = { 7, 8 };
+        loon::binding::read_struct(text, sizeof(text) - 1, p);
+        TEST_EQUAL(p.x, 16);
+        TEST_EQUAL(p.y, 3);
+
+        const char text2[] = "(dict \"y\" null)";
+        loon::binding::read_struct(text2, sizeof(text2) - 1, p);
+        TEST_EQUAL(p.x, 16);
+        TEST_EQUAL(p.y, 3);
+    }
+
+    // a double member takes hex numbers of any width
+    {
+        const char text[] = "(dict \"scale\" 0x100000000)";
+        bound_shape s = bound_shape();
+        loon::binding::read_struct(text, sizeof(text) - 1, s);
+        TEST_EQUAL(s.scale, 4294967296.0);
+
+        const char text2[] = "(dict \"scale\" 0xFfFFFFFFFFFFF)";
+        loon::binding::read_struct(text2, sizeof(text2) - 1, s);
+        TEST_EQUAL(s.scale, 4503599627370495.0);
+    }
+
+    // values that can't be stored in their members
+    {
+        const char * const tests[] = {
+            "(dict \"x\" \"1\")",
+            "(dict \"x\" 1.0)",
+            "(dict \"x\" 2147483648)",
+            "(dict \"x\" (arry))",
+            "(arry)",
+            "(dict \"x\" true)",
+            0
+        };
+        for (const char * const * t = tests; *t; ++t) {
+            bool got_exception = false;
+            try {
+                bound_point p;
+                loon::binding::read_struct(*t, strlen(*t), p);
+            }
+            catch (const loon::reader::exception & e) {
+                got_exception = true;
+                TEST_EQUAL(e.id(), loon::reader::bound_value_mismatch);
+            }
+            TEST_EQUAL(got_exception, true);
+        }
+
+        bool got_exception = false;
+        try {
+            const char text[] = "(dict \"colour\" -1)";
+            bound_shape s;
+            loon::binding::read_struct(text, sizeof(text) - 1, s);
+        }
+        catch (const loon::reader::exception & e) {
+            got_exception = true;
+            TEST_EQUAL(e.id(), loon::reader::bound_value_mismatch);
+        }
+        TEST_EQUAL(got_exception, true);
+    }
+}
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -2546,256 +4944,6 @@ void fuzztest()
 /////////////////////////////////////////////////////////////////////////////
 
 
-void performancetest()
-{
-    // reader performance
-
-/*  {
-      "location":"http://google.com/flatbuffers/",
-      "initialized":true,
-      "fruit":"Bananas",
-      "list":[
-        {
-          "sibling":{
-            "parent":{
-              "i_d":0xABADCAFE,
-              "count":10000,
-              "prefix":64,
-              "length":1000000
-            },
-            "time":123456,
-            "ratio":3.14159,
-            "size":10000
-          },
-          "name":"Hello, World!",
-          "rating":3.1415432432445543543,
-          "postfix":33
-        },{
-          "sibling":{
-            "parent":{
-              "i_d":0xABADCAFE,
-              "count":10001,
-              "prefix":65,
-              "length":1000001
-            },
-            "time":123457,
-            "ratio":4.14159,
-            "size":10001
-          },
-          "name":"Hello, World!",
-          "rating":4.1415432432445543543,
-          "postfix":34
-        },{
-          "sibling":{
-            "parent":{
-              "i_d":0xABADCAFE,
-              "count":10002,
-              "prefix":66,
-              "length":1000002
-            },
-            "time":123458,
-            "ratio":5.14159,
-            "size":10002
-          },
-          "name":"Hello, World!",
-          "rating":5.1415432432445543543,
-          "postfix":35
-        }
-      ]
-    }
-    -- https://medium.com/@icex33/10-thousand-times-faster-swift-737b1accd973#.5puhwhc0v */
-
-    const char text[] =
-        "(dict\n"
-        "  \"location\" \"http://google.com/flatbuffers/\"\n"
-        "  \"initialized\" true\n"
-        "  \"fruit\" \"Bananas\"\n"
-        "  \"list\" (arry\n"
-        "    (dict\n"
-        "      \"sibling\" (dict\n"
-        "        \"parent\" (dict\n"
-        "          \"i_d\" 0xABADCAFE\n"
-        "          \"count\" 10000\n"
-        "          \"prefix\" 64\n"
-        "          \"length\" 1000000\n"
-        "        )\n"
-        "        \"time\" 123456\n"
-        "        \"ratio\" 3.14159\n"
-        "        \"size\" 10000\n"
-        "      )\n"
-        "      \"name\" \"Hello, World!\"\n"
-        "      \"rating\" 3.1415432432445543543\n"
-        "      \"postfix\" 33\n"
-        "    ) (dict\n"
-        "      \"sibling\" (dict\n"
-        "        \"parent\" (dict\n"
-        "          \"i_d\" 0xABADCAFE\n"
-        "          \"count\" 10001\n"
-        "          \"prefix\" 65\n"
-        "          \"length\" 1000001\n"
-        "        )\n"
-        "        \"time\" 123457\n"
-        "        \"ratio\" 4.14159\n"
-        "        \"size\" 10001\n"
-        "      )\n"
-        "      \"name\" \"Hello, World!\"\n"
-        "      \"rating\" 4.1415432432445543543\n"
-        "      \"postfix\" 34\n"
-        "    ) (dict\n"
-        "      \"sibling\" (dict\n"
-        "        \"parent\" (dict\n"
-        "          \"i_d\" 0xABADCAFE\n"
-        "          \"count\" 10002\n"
-        "          \"prefix\" 66\n"
-        "          \"length\" 1000002\n"
-        "        )\n"
-        "        \"time\" 123458\n"
-        "        \"ratio\" 5.14159\n"
-        "        \"size\" 10002\n"
-        "      )\n"
-        "      \"name\" \"Hello, World!\"\n"
-        "      \"rating\" 5.1415432432445543543\n"
-        "      \"postfix\" 35\n"
-        "    )\n"
-        "  )\n"
-        ")\n";
-
-    const size_t text_len = sizeof(text) - 1;
-
-
-    struct reader : private loon::reader::base  {
-        using base::process_chunk;
-        using base::reset;
-    private:
-        virtual void loon_null() {}
-        virtual void loon_arry_begin() {}
-        virtual void loon_arry_end() {}
-        virtual void loon_dict_begin() {}
-        virtual void loon_dict_end() {}
-        virtual void loon_bool(bool) {}
-        virtual void loon_string(const char *, size_t) {}
-        virtual void loon_dict_key(const char *, size_t) {}
-        virtual void loon_number(const char *, size_t, loon::reader::num_type) {}
-    };
-
-    using namespace std::chrono;
-    const high_resolution_clock::time_point t1 = high_resolution_clock::now();
-
-    const int num_reads = 10000;
-    reader r;
-    for (int i = 0; i < num_reads; ++i) {
-        r.reset();
-        r.process_chunk(text, text_len, /*is_last_chunk=*/true);
-    }
-
-    const high_resolution_clock::time_point t2 = high_resolution_clock::now();
-    const double reading_seconds = duration_cast<duration<double>>(t2 - t1).count();
-
-
-
-    // writer performance
-
-    struct writer : public loon::writer::base {
-        size_t total_length;
-        writer() : total_length(0) {}
-
-    private:
-        virtual void write(const char * /*utf8*/, size_t len)
-        {
-            //std::cout << std::string(utf8, len);
-            total_length += len;
-        }
-    };
-
-    const int num_writes = 10000;
-    writer w;
-    for (int i = 0; i < num_writes; ++i) {
-        w.loon_dict_begin();
-          w.loon_dict_key("location"); w.loon_string("http://google.com/flatbuffers/");
-          w.loon_dict_key("initialized"); w.loon_bool(true);
-          w.loon_dict_key("fruit"); w.loon_string("Bananas");
-          w.loon_dict_key("list");
-          w.loon_arry_begin();
-
-            w.loon_dict_begin();
-              w.loon_dict_key("sibling");
-              w.loon_dict_begin();
-                w.loon_dict_key("parent");
-                w.loon_dict_begin();
-                  w.loon_dict_key("i_d"); w.loon_hex_u32(0xABADCAFE);
-                  w.loon_dict_key("count"); w.loon_dec_u32(10000);
-                  w.loon_dict_key("prefix"); w.loon_dec_u32(64);
-                  w.loon_dict_key("length"); w.loon_dec_u32(1000000);
-                w.loon_dict_end();
-                w.loon_dict_key("time"); w.loon_dec_u32(123456);
-                w.loon_dict_key("ratio"); w.loon_double(3.14159);
-                w.loon_dict_key("size"); w.loon_dec_u32(10000);
-              w.loon_dict_end();
-              w.loon_dict_key("name"); w.loon_string("Hello, World!");
-              w.loon_dict_key("rating"); w.loon_preformatted_value("3.1415432432445543543", 21);
-              w.loon_dict_key("postfix"); w.loon_dec_u32(33);
-            w.loon_dict_end();
-
-            w.loon_dict_begin();
-              w.loon_dict_key("sibling");
-              w.loon_dict_begin();
-                w.loon_dict_key("parent");
-                w.loon_dict_begin();
-                  w.loon_dict_key("i_d"); w.loon_hex_u32(0xABADCAFE);
-                  w.loon_dict_key("count"); w.loon_dec_u32(10001);
-                  w.loon_dict_key("prefix"); w.loon_dec_u32(65);
-                  w.loon_dict_key("length"); w.loon_dec_u32(1000001);
-                w.loon_dict_end();
-                w.loon_dict_key("time"); w.loon_dec_u32(123457);
-                w.loon_dict_key("ratio"); w.loon_double(4.14159);
-                w.loon_dict_key("size"); w.loon_dec_u32(10001);
-              w.loon_dict_end();
-              w.loon_dict_key("name"); w.loon_string("Hello, World!");
-              w.loon_dict_key("rating"); w.loon_preformatted_value("4.1415432432445543543", 21);
-              w.loon_dict_key("postfix"); w.loon_dec_u32(34);
-            w.loon_dict_end();
-
-            w.loon_dict_begin();
-              w.loon_dict_key("sibling");
-              w.loon_dict_begin();
-                w.loon_dict_key("parent");
-                w.loon_dict_begin();
-                  w.loon_dict_key("i_d"); w.loon_hex_u32(0xABADCAFE);
-                  w.loon_dict_key("count"); w.loon_dec_u32(10002);
-                  w.loon_dict_key("prefix"); w.loon_dec_u32(66);
-                  w.loon_dict_key("length"); w.loon_dec_u32(1000002);
-                w.loon_dict_end();
-                w.loon_dict_key("time"); w.loon_dec_u32(123458);
-                w.loon_dict_key("ratio"); w.loon_double(5.14159);
-                w.loon_dict_key("size"); w.loon_dec_u32(10002);
-              w.loon_dict_end();
-              w.loon_dict_key("name"); w.loon_string("Hello, World!");
-              w.loon_dict_key("rating"); w.loon_preformatted_value("5.1415432432445543543", 21);
-              w.loon_dict_key("postfix"); w.loon_dec_u32(35);
-            w.loon_dict_end();
-
-          w.loon_arry_end();
-        w.loon_dict_end();
-    }
-
-    const high_resolution_clock::time_point t3 = high_resolution_clock::now();
-    const double writing_seconds = duration_cast<duration<double>>(t3 - t2).count();
-
-
-    if (reading_seconds > 0.0001 && writing_seconds > 0.0001) {
-        const int reading_mb_s = static_cast<int>(text_len * num_reads / (reading_seconds * 1024 * 1024));
-        const int writing_mb_s = static_cast<int>(w.total_length / (writing_seconds * 1024 * 1024));
-        std::cout << "reading ";
-        if (reading_mb_s) std::cout << reading_mb_s; else std::cout << "<1";
-        std::cout << " MB/s, writing ";
-        if (writing_mb_s) std::cout << writing_mb_s; else std::cout << "<1";
-        std::cout << " MB/s\n";
-    }
-}
-
-/////////////////////////////////////////////////////////////////////////////
-
-
 
 // how deep can we go?
 void depthtest()
@@ -2858,14 +5006,33 @@ void test()
     test_strings();
     test_numbers();
     test_write_loon_hex_u32();
+    test_write_loon_dict_key();
+    test_basic_writer();
+    test_writer_sinks();
+    test_writer_validation();
+    test_transcode();
+    test_json();
+    test_binary();
+    test_write_parallel();
+    test_canonical();
+    test_diff();
+    test_persistent();
+    test_key_interning();
+    test_index();
+    test_incremental();
     test_syntax_errors();
     test_reset();
     test_adhoc_valid();
     test_current_line();
+    test_token_location();
+    test_utf8_validation();
+    test_reader_statistics();
+    test_checkpoint();
+    test_recovery();
+    test_struct_binding();
     soaktest();
     fuzztest();
     depthtest();
-    performancetest();
 }
 
 }